@@ -0,0 +1,151 @@
+/*
+ * Single-file container for recovered data
+ */
+#define _GNU_SOURCE
+#include "archive.h"
+#include "lfs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+#define ARCHIVE_RECORD 512
+
+static bool archive_write(archive_t *a, const void *data, size_t size) {
+    const uint8_t *p = data;
+    while (size) {
+        ssize_t n = write(a->fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+        a->pos += n;
+    }
+    return true;
+}
+
+// Copies in the kernel, returns the number of bytes it managed so the
+// caller can finish the rest from memory
+static size_t archive_copy(archive_t *a, int64_t src_off, size_t size) {
+    size_t done = 0;
+#ifdef __linux__
+    loff_t in = src_off;
+    while (done < size) {
+        ssize_t n = copy_file_range(a->src, &in, a->fd, NULL, size - done, 0);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+
+    // older kernels refuse copies between different filesystems
+    off_t off = src_off + done;
+    while (done < size) {
+        ssize_t n = sendfile(a->fd, a->src, &off, size - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+#else
+    (void)src_off;
+#endif
+    a->pos += done;
+    return done;
+}
+
+static void archive_octal(char *field, size_t len, uint64_t value) {
+    // len-1 digits and a terminating NUL
+    field[len - 1] = '\0';
+    for (size_t i = len - 1; i > 0; i--) {
+        field[i - 1] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+int archive_open(archive_t *a, const char *path, int src, uint64_t base) {
+    memset(a, 0, sizeof(*a));
+    a->src = src;
+    a->base = base;
+    a->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (a->fd < 0) {
+        return LFS_ERR_IO;
+    }
+    return 0;
+}
+
+int archive_add(archive_t *a, const char *name,
+        const void *data, size_t size, int64_t src_off) {
+    if (a->failed) {
+        return LFS_ERR_IO;
+    }
+    if (strlen(name) >= 100) {
+        return LFS_ERR_NAMETOOLONG;
+    }
+
+    uint8_t header[ARCHIVE_RECORD];
+    memset(header, 0, sizeof(header));
+    memcpy(&header[0], name, strlen(name));
+    archive_octal((char *)&header[100], 8, 0644);
+    archive_octal((char *)&header[108], 8, 0);
+    archive_octal((char *)&header[116], 8, 0);
+    archive_octal((char *)&header[124], 12, size);
+    archive_octal((char *)&header[136], 12, (uint64_t)time(NULL));
+    header[156] = '0';
+    memcpy(&header[257], "ustar", 6);
+    memcpy(&header[263], "00", 2);
+
+    // the checksum is computed with its own field as spaces
+    memset(&header[148], ' ', 8);
+    uint32_t sum = 0;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        sum += header[i];
+    }
+    archive_octal((char *)&header[148], 7, sum);
+    header[155] = ' ';
+
+    if (!archive_write(a, header, sizeof(header))) {
+        a->failed = true;
+        return LFS_ERR_IO;
+    }
+
+    size_t done = 0;
+    if (a->src >= 0 && src_off >= 0) {
+        done = archive_copy(a, a->base + src_off, size);
+    }
+    if (!archive_write(a, (const uint8_t *)data + done, size - done)) {
+        a->failed = true;
+        return LFS_ERR_IO;
+    }
+
+    static const uint8_t zeros[ARCHIVE_RECORD];
+    size_t pad = (ARCHIVE_RECORD - size % ARCHIVE_RECORD) % ARCHIVE_RECORD;
+    if (!archive_write(a, zeros, pad)) {
+        a->failed = true;
+        return LFS_ERR_IO;
+    }
+    return 0;
+}
+
+int archive_close(archive_t *a) {
+    // two empty records end the archive
+    static const uint8_t zeros[2*ARCHIVE_RECORD];
+    int err = a->failed ? LFS_ERR_IO : 0;
+    if (!err && !archive_write(a, zeros, sizeof(zeros))) {
+        err = LFS_ERR_IO;
+    }
+    if (close(a->fd) != 0) {
+        err = LFS_ERR_IO;
+    }
+    a->fd = -1;
+    return err;
+}
@@ -0,0 +1,41 @@
+/*
+ * Single-file container for recovered data
+ *
+ * Members are written as a POSIX ustar archive, so the result can be
+ * listed and unpacked with any tar. Creating one host file per recovered
+ * block costs more than the copy itself once there are thousands of them,
+ * a single append-only archive avoids that.
+ *
+ * Members that are an unmodified range of the image are copied from the
+ * image file descriptor with copy_file_range (or sendfile) where the
+ * platform has it, without passing through our buffers.
+ */
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct archive {
+    int fd;                 // the archive
+    int src;                // the image, -1 to always write from memory
+    uint64_t base;          // where offset 0 of the image is in src
+    uint64_t pos;           // bytes written so far
+    bool failed;
+} archive_t;
+
+// Creates or truncates path. src may be -1, base is non-zero when the
+// image is a partition further into the file, e.g. with --offset.
+int archive_open(archive_t *a, const char *path, int src, uint64_t base);
+
+// Appends a member. If src_off is non-negative and the archive has a
+// source, size bytes are copied from the image at src_off, counted from
+// base, data is only used when the kernel can't do the copy.
+int archive_add(archive_t *a, const char *name,
+        const void *data, size_t size, int64_t src_off);
+
+// Writes the end-of-archive marker and closes the file
+int archive_close(archive_t *a);
+
+#endif
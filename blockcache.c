@@ -0,0 +1,426 @@
+/*
+ * Persistent cache of per-block analysis results
+ */
+#include "blockcache.h"
+#include "lfs_util.h"
+#include "hash64.h"
+#include "parallel.h"
+#include "sidecar.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCKCACHE_GRAIN 64
+#define BLOCKCACHE_HEADER 24
+#define BLOCKCACHE_RECORD 24
+#define BLOCKCACHE_TREE_HEADER 16
+#define BLOCKCACHE_TREE_USAGE 0x1
+#define BLOCKCACHE_TREE_LISTING 0x2
+// bumped whenever a cached fact would now be computed differently, the
+// content classes changed in version 2
+#define BLOCKCACHE_VERSION 3
+
+struct blockcache_record {
+    uint64_t hash;
+    blockcache_facts_t facts;
+};
+
+// The tree as read from the sidecar, adopted once the image key is known
+struct blockcache_tree {
+    uint64_t key;
+    uint32_t flags;
+    uint32_t block_count;
+    uint8_t *usage;
+    blockcache_entry_t *listing;
+    size_t listing_count;
+};
+
+struct blockcache_job {
+    blockcache_t *c;
+    const uint8_t *image;
+    const struct blockcache_record *records;
+    size_t count;
+    lfs_size_t hits;
+};
+
+static void blockcache_free_listing(blockcache_entry_t *listing,
+        size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(listing[i].path);
+    }
+    free(listing);
+}
+
+// Reads the optional tree after the records, leaves t zeroed if there is
+// none or it is damaged
+static void blockcache_read_tree(FILE *f, struct blockcache_tree *t) {
+    memset(t, 0, sizeof(*t));
+    uint8_t header[BLOCKCACHE_TREE_HEADER];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+        return;
+    }
+    t->key = sidecar_get64(&header[0]);
+    t->flags = sidecar_get32(&header[8]);
+    t->block_count = sidecar_get32(&header[12]);
+
+    if (t->flags & BLOCKCACHE_TREE_USAGE) {
+        size_t bytes = ((size_t)t->block_count + 7) / 8;
+        t->usage = malloc(bytes ? bytes : 1);
+        if (!t->usage || fread(t->usage, 1, bytes, f) != bytes) {
+            goto damaged;
+        }
+    }
+
+    if (t->flags & BLOCKCACHE_TREE_LISTING) {
+        uint8_t buf[7];
+        if (fread(buf, 1, 4, f) != 4) {
+            goto damaged;
+        }
+        size_t count = sidecar_get32(buf);
+        t->listing = calloc(count ? count : 1, sizeof(blockcache_entry_t));
+        if (!t->listing) {
+            goto damaged;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (fread(buf, 1, 7, f) != 7) {
+                goto damaged;
+            }
+            blockcache_entry_t *e = &t->listing[i];
+            e->kind = buf[0];
+            e->size = sidecar_get32(&buf[1]);
+            size_t len = sidecar_get16(&buf[5]);
+            e->path = malloc(len + 1);
+            t->listing_count = i + 1;
+            if (!e->path || fread(e->path, 1, len, f) != len) {
+                goto damaged;
+            }
+            e->path[len] = '\0';
+        }
+    }
+    return;
+
+damaged:
+    free(t->usage);
+    blockcache_free_listing(t->listing, t->listing_count);
+    memset(t, 0, sizeof(*t));
+}
+
+static int blockcache_cmp(const void *a, const void *b) {
+    const struct blockcache_record *ra = a;
+    const struct blockcache_record *rb = b;
+    return (ra->hash > rb->hash) - (ra->hash < rb->hash);
+}
+
+// Records of the sidecar, sorted by hash as they were saved
+static struct blockcache_record *blockcache_read(const char *path,
+        lfs_size_t block_size, size_t *count, struct blockcache_tree *tree) {
+    *count = 0;
+    memset(tree, 0, sizeof(*tree));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    uint8_t header[BLOCKCACHE_HEADER];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+            memcmp(header, "LFSBC1\0\0", 8) != 0 ||
+            sidecar_get32(&header[8]) != BLOCKCACHE_VERSION ||
+            sidecar_get32(&header[12]) != block_size) {
+        fclose(f);
+        return NULL;
+    }
+
+    size_t n = sidecar_get64(&header[16]);
+    struct blockcache_record *records = malloc(
+            (n + 1) * sizeof(struct blockcache_record));
+    if (!records) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t buf[BLOCKCACHE_RECORD];
+    for (size_t i = 0; i < n; i++) {
+        if (fread(buf, 1, sizeof(buf), f) != sizeof(buf)) {
+            free(records);
+            fclose(f);
+            return NULL;
+        }
+
+        struct blockcache_record *r = &records[i];
+        r->hash = sidecar_get64(&buf[0]);
+        r->facts.flags = buf[8];
+        r->facts.stop = buf[9];
+        r->facts.cls = buf[10];
+        r->facts.stop_off = sidecar_get32(&buf[12]);
+        uint32_t bits = sidecar_get32(&buf[16]);
+        memcpy(&r->facts.entropy, &bits, sizeof(bits));
+        bits = sidecar_get32(&buf[20]);
+        memcpy(&r->facts.printable, &bits, sizeof(bits));
+    }
+
+    blockcache_read_tree(f, tree);
+    fclose(f);
+    *count = n;
+    return records;
+}
+
+static void blockcache_lookup_range(void *data, size_t begin, size_t end) {
+    struct blockcache_job *job = data;
+    blockcache_t *c = job->c;
+    lfs_size_t hits = 0;
+
+    for (size_t i = begin; i < end; i++) {
+        c->hash[i] = hash64(&job->image[i * c->block_size], c->block_size, 0);
+
+        struct blockcache_record key = {.hash = c->hash[i]};
+        const struct blockcache_record *r = job->count ? bsearch(&key,
+                job->records, job->count, sizeof(key), blockcache_cmp) : NULL;
+        if (r) {
+            c->facts[i] = r->facts;
+            c->loaded[i] = r->facts.flags;
+            hits += 1;
+        }
+    }
+
+    __atomic_fetch_add(&job->hits, hits, __ATOMIC_RELAXED);
+}
+
+int blockcache_open(blockcache_t *c, const char *image_path,
+        const uint8_t *image, lfs_size_t block_size, lfs_size_t block_count) {
+    memset(c, 0, sizeof(*c));
+    c->block_size = block_size;
+    c->block_count = block_count;
+    snprintf(c->path, sizeof(c->path), "%s.lfscache", image_path);
+
+    c->hash = malloc(block_count * sizeof(uint64_t));
+    c->facts = calloc(block_count, sizeof(blockcache_facts_t));
+    c->loaded = calloc(block_count, sizeof(uint8_t));
+    if (!c->hash || !c->facts || !c->loaded) {
+        blockcache_free(c);
+        return LFS_ERR_NOMEM;
+    }
+
+    struct blockcache_job job = {c, image, NULL, 0, 0};
+    struct blockcache_tree tree;
+    job.records = blockcache_read(c->path, block_size, &job.count, &tree);
+    parallel_for(block_count, BLOCKCACHE_GRAIN, blockcache_lookup_range, &job);
+    c->hits = job.hits;
+    free((void *)job.records);
+
+    // chained over the block hashes in order, so any change to any block,
+    // or blocks trading places, gives another key
+    uint64_t key = block_count;
+    for (lfs_size_t i = 0; i < block_count; i++) {
+        uint8_t le[8];
+        sidecar_put64(le, c->hash[i]);
+        key = hash64(le, sizeof(le), key);
+    }
+    c->image_key = key;
+
+    if (tree.key == key && tree.block_count == block_count) {
+        if (tree.usage) {
+            c->usage = malloc(block_count);
+            for (lfs_size_t i = 0; c->usage && i < block_count; i++) {
+                c->usage[i] = (tree.usage[i / 8] >> (i % 8)) & 1;
+            }
+        }
+        if (tree.flags & BLOCKCACHE_TREE_LISTING) {
+            c->listing = tree.listing;
+            c->listing_count = tree.listing_count;
+            c->listing_capacity = tree.listing_count;
+            c->listing_known = true;
+            tree.listing = NULL;
+            tree.listing_count = 0;
+        }
+    }
+    free(tree.usage);
+    blockcache_free_listing(tree.listing, tree.listing_count);
+    return 0;
+}
+
+int blockcache_put_usage(blockcache_t *c, const bool *usage) {
+    if (!c->usage) {
+        c->usage = malloc(c->block_count);
+        if (!c->usage) {
+            return LFS_ERR_NOMEM;
+        }
+    }
+    for (lfs_size_t i = 0; i < c->block_count; i++) {
+        c->usage[i] = usage[i];
+    }
+    c->tree_dirty = true;
+    return 0;
+}
+
+int blockcache_put_entry(blockcache_t *c, int kind, lfs_size_t size,
+        const char *path) {
+    if (c->listing_count == c->listing_capacity) {
+        size_t capacity = c->listing_capacity ? 2*c->listing_capacity : 64;
+        blockcache_entry_t *listing = realloc(c->listing,
+                capacity * sizeof(blockcache_entry_t));
+        if (!listing) {
+            return LFS_ERR_NOMEM;
+        }
+        c->listing = listing;
+        c->listing_capacity = capacity;
+    }
+
+    size_t len = strlen(path);
+    if (len > UINT16_MAX) {
+        return LFS_ERR_NAMETOOLONG;
+    }
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        return LFS_ERR_NOMEM;
+    }
+    memcpy(copy, path, len + 1);
+    c->listing[c->listing_count++] = (blockcache_entry_t){kind, size, copy};
+    return 0;
+}
+
+void blockcache_listing_done(blockcache_t *c) {
+    c->listing_known = true;
+    c->tree_dirty = true;
+}
+
+void blockcache_drop_listing(blockcache_t *c) {
+    blockcache_free_listing(c->listing, c->listing_count);
+    c->listing = NULL;
+    c->listing_count = 0;
+    c->listing_capacity = 0;
+    c->listing_known = false;
+}
+
+static void blockcache_write_tree(const blockcache_t *c, FILE *f) {
+    uint32_t flags = (c->usage ? BLOCKCACHE_TREE_USAGE : 0) |
+            (c->listing_known ? BLOCKCACHE_TREE_LISTING : 0);
+    if (!flags) {
+        return;
+    }
+
+    uint8_t header[BLOCKCACHE_TREE_HEADER];
+    sidecar_put64(&header[0], c->image_key);
+    sidecar_put32(&header[8], flags);
+    sidecar_put32(&header[12], c->block_count);
+    fwrite(header, 1, sizeof(header), f);
+
+    if (c->usage) {
+        for (lfs_size_t i = 0; i < c->block_count; i += 8) {
+            uint8_t bits = 0;
+            for (lfs_size_t j = i; j < i + 8 && j < c->block_count; j++) {
+                bits |= (c->usage[j] ? 1 : 0) << (j - i);
+            }
+            fputc(bits, f);
+        }
+    }
+
+    if (c->listing_known) {
+        uint8_t buf[7];
+        sidecar_put32(buf, c->listing_count);
+        fwrite(buf, 1, 4, f);
+        for (size_t i = 0; i < c->listing_count; i++) {
+            const blockcache_entry_t *e = &c->listing[i];
+            size_t len = strlen(e->path);
+            buf[0] = e->kind;
+            sidecar_put32(&buf[1], e->size);
+            sidecar_put16(&buf[5], len);
+            fwrite(buf, 1, 7, f);
+            fwrite(e->path, 1, len, f);
+        }
+    }
+}
+
+int blockcache_save(const blockcache_t *c) {
+    bool dirty = false;
+    size_t n = 0;
+    for (lfs_size_t i = 0; i < c->block_count; i++) {
+        dirty |= (c->facts[i].flags != c->loaded[i]);
+        n += (c->facts[i].flags != 0);
+    }
+    if (!dirty && !c->tree_dirty) {
+        return 0;
+    }
+
+    struct blockcache_record *records = malloc(
+            (n + 1) * sizeof(struct blockcache_record));
+    if (!records) {
+        return LFS_ERR_NOMEM;
+    }
+    n = 0;
+    for (lfs_size_t i = 0; i < c->block_count; i++) {
+        if (c->facts[i].flags) {
+            records[n++] = (struct blockcache_record){c->hash[i], c->facts[i]};
+        }
+    }
+    qsort(records, n, sizeof(struct blockcache_record), blockcache_cmp);
+
+    // identical blocks have identical facts, only what each copy
+    // learned may differ
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique && records[unique-1].hash == records[i].hash) {
+            struct blockcache_record *u = &records[unique-1];
+            const blockcache_facts_t *f = &records[i].facts;
+            if (f->flags & BLOCKCACHE_SCANNED) {
+                u->facts.stop = f->stop;
+                u->facts.stop_off = f->stop_off;
+            }
+            if (f->flags & BLOCKCACHE_ENTROPY) {
+                u->facts.entropy = f->entropy;
+            }
+            if (f->flags & BLOCKCACHE_CLASS) {
+                u->facts.cls = f->cls;
+                u->facts.printable = f->printable;
+            }
+            u->facts.flags |= f->flags;
+        } else {
+            records[unique++] = records[i];
+        }
+    }
+
+    sidecar_file_t out;
+    if (sidecar_create(&out, c->path) != 0) {
+        free(records);
+        return LFS_ERR_IO;
+    }
+    FILE *f = out.f;
+
+    uint8_t header[BLOCKCACHE_HEADER];
+    memcpy(&header[0], "LFSBC1\0\0", 8);
+    sidecar_put32(&header[8], BLOCKCACHE_VERSION);
+    sidecar_put32(&header[12], c->block_size);
+    sidecar_put64(&header[16], unique);
+    fwrite(header, 1, sizeof(header), f);
+
+    for (size_t i = 0; i < unique; i++) {
+        const struct blockcache_record *r = &records[i];
+        uint8_t buf[BLOCKCACHE_RECORD] = {0};
+        uint32_t bits;
+        memcpy(&bits, &r->facts.entropy, sizeof(bits));
+        sidecar_put64(&buf[0], r->hash);
+        buf[8] = r->facts.flags;
+        buf[9] = r->facts.stop;
+        buf[10] = r->facts.cls;
+        sidecar_put32(&buf[12], r->facts.stop_off);
+        sidecar_put32(&buf[16], bits);
+        memcpy(&bits, &r->facts.printable, sizeof(bits));
+        sidecar_put32(&buf[20], bits);
+        fwrite(buf, 1, sizeof(buf), f);
+    }
+    free(records);
+    blockcache_write_tree(c, f);
+    return sidecar_commit(&out);
+}
+
+void blockcache_free(blockcache_t *c) {
+    free(c->hash);
+    free(c->facts);
+    free(c->loaded);
+    free(c->usage);
+    blockcache_free_listing(c->listing, c->listing_count);
+    memset(c, 0, sizeof(*c));
+}
+
+void blockcache_print_summary(const blockcache_t *c, FILE *out) {
+    fprintf(out, "Analysis cache: %lu of %lu blocks already known from %s\n",
+            (unsigned long)c->hits, (unsigned long)c->block_count, c->path);
+}
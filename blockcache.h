@@ -0,0 +1,130 @@
+/*
+ * Persistent cache of per-block analysis results
+ *
+ * Whether a block holds a metadata log, where its log stops, whether it
+ * is erased, its entropy and its content class only depend on the
+ * block's bytes, so they are kept keyed by the block's hash64 alone. A
+ * rerun on the same image, or on a re-acquisition where most blocks are
+ * unchanged, or moved, only analyzes blocks whose content the cache
+ * hasn't seen.
+ *
+ * What a mount learns depends on every block: the directory listing and
+ * which blocks the mounted tree reads. Those are kept for the whole
+ * image, keyed by a hash64 of all block hashes, and reused only when
+ * every block is unchanged, so a rerun doesn't mount or read any file.
+ * Anything else that depends on more than one block (salvaged pairs,
+ * the block map) is rebuilt from the per-block facts each run, which
+ * only parses the metadata blocks.
+ *
+ * The cache lives in a sidecar next to the image, all integers
+ * little-endian:
+ *
+ *   8 bytes  magic "LFSBC1\0\0"
+ *   4 bytes  format version, currently 3, older caches are ignored
+ *   4 bytes  block size
+ *   8 bytes  number of records
+ *   24 bytes per record, sorted by hash:
+ *            8 bytes hash64 of the block
+ *            1 byte  flags (enum blockcache_flags)
+ *            1 byte  enum ondisk_stop of the log scan
+ *            1 byte  enum classify_class
+ *            1 byte  reserved, 0
+ *            4 bytes offset the log scan stopped at
+ *            4 bytes entropy, IEEE 754 single
+ *            4 bytes printable fraction, IEEE 754 single
+ *
+ * optionally followed by the tree of the mounted image:
+ *
+ *   8 bytes  image key, hash64 of the block hashes in order
+ *   4 bytes  flags, 1 usage follows, 2 listing follows
+ *   4 bytes  block count
+ *   (block count + 7) / 8 bytes of usage, one bit per block, LSB first
+ *   4 bytes  number of listing entries, then per entry:
+ *            1 byte  enum blockcache_entry_kind
+ *            4 bytes file size
+ *            2 bytes path length, then the path without a NUL
+ */
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include "lfs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum blockcache_flags {
+    BLOCKCACHE_SCANNED  = 0x01,     // stop, stop_off and LOG are known
+    BLOCKCACHE_LOG      = 0x02,     // at least one valid metadata commit
+    BLOCKCACHE_BLANK    = 0x04,     // ERASED is known
+    BLOCKCACHE_ERASED   = 0x08,     // every byte is 0xFF
+    BLOCKCACHE_ENTROPY  = 0x10,     // entropy is known
+    BLOCKCACHE_CLASS    = 0x20,     // cls and printable are known
+};
+
+typedef struct blockcache_facts {
+    uint8_t flags;
+    uint8_t stop;
+    uint8_t cls;
+    lfs_off_t stop_off;
+    float entropy;
+    float printable;
+} blockcache_facts_t;
+
+// Listing of a mounted tree in walk order, a directory is opened, then
+// its files and subdirectories follow, each subdirectory opened in turn
+enum blockcache_entry_kind {
+    BLOCKCACHE_DIR_OPEN = 0,
+    BLOCKCACHE_FILE,
+    BLOCKCACHE_SUBDIR,
+};
+
+typedef struct blockcache_entry {
+    uint8_t kind;
+    lfs_size_t size;
+    char *path;
+} blockcache_entry_t;
+
+typedef struct blockcache {
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+    char path[1024];
+
+    // per block of the image, filled in as the analysis learns them
+    uint64_t *hash;
+    blockcache_facts_t *facts;
+    uint8_t *loaded;        // flags as they came from the sidecar
+    lfs_size_t hits;        // blocks the sidecar knew something about
+
+    // whole-image results, NULL or false unless known for this image
+    uint64_t image_key;
+    uint8_t *usage;         // per block, 1 if the mounted tree reads it
+    blockcache_entry_t *listing;
+    size_t listing_count;
+    size_t listing_capacity;
+    bool listing_known;
+    bool tree_dirty;        // learned this run
+} blockcache_t;
+
+// Hashes every block in parallel and looks it up in the sidecar of
+// image_path, a missing or unusable sidecar just means nothing is known
+int blockcache_open(blockcache_t *c, const char *image_path,
+        const uint8_t *image, lfs_size_t block_size, lfs_size_t block_count);
+
+// Records which blocks the mounted tree reads
+int blockcache_put_usage(blockcache_t *c, const bool *usage);
+
+// Appends to the listing as a walk goes, and marks it known once the
+// walk got through every directory. A walk that fails part way discards
+// it with blockcache_drop_listing.
+int blockcache_put_entry(blockcache_t *c, int kind, lfs_size_t size,
+        const char *path);
+void blockcache_listing_done(blockcache_t *c);
+void blockcache_drop_listing(blockcache_t *c);
+
+// Writes the sidecar back if this run learned anything
+int blockcache_save(const blockcache_t *c);
+void blockcache_free(blockcache_t *c);
+
+void blockcache_print_summary(const blockcache_t *c, FILE *out);
+
+#endif
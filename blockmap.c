@@ -0,0 +1,332 @@
+/*
+ * Per-block facts for a whole image
+ */
+#include "blockmap.h"
+#include "blockcache.h"
+#include "classify.h"
+#include "ondisk.h"
+#include "hash64.h"
+#include "parallel.h"
+#include "sidecar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCKMAP_GRAIN 64
+#define BLOCKMAP_ALIGN 64
+#define BLOCKMAP_COLUMNS 9
+
+struct blockmap_job {
+    blockmap_t *m;
+    const uint8_t *image;
+    blockcache_t *cache;
+};
+
+static bool blockmap_erased(const uint8_t *data, lfs_size_t size) {
+    uint8_t all = 0xFF;
+    for (lfs_size_t i = 0; i < size; i++) {
+        all &= data[i];
+    }
+    return all == 0xFF;
+}
+
+static void blockmap_scan_range(void *data, size_t begin, size_t end) {
+    struct blockmap_job *job = data;
+    blockmap_t *m = job->m;
+
+    for (size_t i = begin; i < end; i++) {
+        const uint8_t *block = &job->image[i * m->block_size];
+        bool erased;
+        if (!job->cache) {
+            m->hash[i] = hash64(block, m->block_size, 0);
+            erased = blockmap_erased(block, m->block_size);
+        } else {
+            // the cache already hashed every block, and may know the rest
+            blockcache_facts_t *facts = &job->cache->facts[i];
+            m->hash[i] = job->cache->hash[i];
+            if (!(facts->flags & BLOCKCACHE_BLANK)) {
+                facts->flags |= BLOCKCACHE_BLANK |
+                        (blockmap_erased(block, m->block_size) ?
+                            BLOCKCACHE_ERASED : 0);
+            }
+            erased = facts->flags & BLOCKCACHE_ERASED;
+        }
+
+        if (erased) {
+            m->state[i] = BLOCKMAP_ERASED;
+        } else {
+            m->state[i] = BLOCKMAP_DEAD;
+            m->role[i] = BLOCKMAP_DATA;
+        }
+    }
+}
+
+// Dictionary of owner paths, open addressed on the path's hash
+struct blockmap_intern {
+    blockmap_t *m;
+    uint32_t *slots;        // owner index + 1, 0 is empty
+    size_t mask;
+    bool failed;
+};
+
+static uint32_t blockmap_intern(struct blockmap_intern *in, const char *path) {
+    blockmap_t *m = in->m;
+    size_t len = strlen(path);
+    size_t i = hash64(path, len, 0) & in->mask;
+
+    while (in->slots[i]) {
+        if (strcmp(m->owners[in->slots[i] - 1], path) == 0) {
+            return in->slots[i] - 1;
+        }
+        i = (i + 1) & in->mask;
+    }
+
+    // sized for one owner per block, only a badly corrupt image with
+    // many files sharing blocks gets near that
+    if (m->owner_count + 1 > in->mask / 2) {
+        return BLOCKMAP_NO_OWNER;
+    }
+
+    if (m->owner_count == m->owner_capacity) {
+        uint32_t capacity = m->owner_capacity ? 2*m->owner_capacity : 64;
+        char **owners = realloc(m->owners, capacity * sizeof(char *));
+        if (!owners) {
+            in->failed = true;
+            return BLOCKMAP_NO_OWNER;
+        }
+        m->owners = owners;
+        m->owner_capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if (!copy) {
+        in->failed = true;
+        return BLOCKMAP_NO_OWNER;
+    }
+    m->owners[m->owner_count] = copy;
+    in->slots[i] = ++m->owner_count;
+    return m->owner_count - 1;
+}
+
+struct blockmap_files {
+    salvage_t *s;
+    struct blockmap_intern *in;
+    uint32_t owner;
+};
+
+static int blockmap_mark_ctz(void *data, lfs_block_t block, lfs_off_t index) {
+    (void)index;
+    struct blockmap_files *f = data;
+    blockmap_t *m = f->in->m;
+
+    // a corrupt chain may run into metadata, keep the stronger claim
+    if (m->role[block] != BLOCKMAP_METADATA) {
+        m->role[block] = BLOCKMAP_FILE;
+        m->state[block] = BLOCKMAP_LIVE;
+        m->owner[block] = f->owner;
+    }
+    return 0;
+}
+
+static void blockmap_collect_file(void *data, const salvage_info_t *info) {
+    struct blockmap_files *f = data;
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (!info->entry || !ondisk_entry_ctz(info->entry, &head, &size)) {
+        return;
+    }
+
+    f->owner = blockmap_intern(f->in, info->path);
+    ondisk_ctz_walk(f->s->image, f->s->block_size, f->s->block_count,
+            head, size, blockmap_mark_ctz, f);
+}
+
+int blockmap_build(blockmap_t *m, salvage_t *s) {
+    memset(m, 0, sizeof(*m));
+    m->block_size = s->block_size;
+    m->block_count = s->block_count;
+
+    size_t n = s->block_count;
+    m->state = calloc(n, sizeof(uint8_t));
+    m->role = calloc(n, sizeof(uint8_t));
+    m->owner = malloc(n * sizeof(uint32_t));
+    m->entropy = calloc(n, sizeof(float));
+    m->cls = calloc(n, sizeof(uint8_t));
+    m->revision = calloc(n, sizeof(uint32_t));
+    m->hash = calloc(n, sizeof(uint64_t));
+
+    struct blockmap_intern in = {.m = m};
+    size_t slots = 1;
+    while (slots < 2*n + 2) {
+        slots <<= 1;
+    }
+    in.slots = calloc(slots, sizeof(uint32_t));
+    in.mask = slots - 1;
+
+    char **dirs = salvage_dir_paths(s);
+    if (!m->state || !m->role || !m->owner || !m->entropy || !m->cls ||
+            !m->revision || !m->hash || !in.slots || !dirs) {
+        free(in.slots);
+        salvage_free_paths(s, dirs);
+        blockmap_free(m);
+        return LFS_ERR_NOMEM;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        m->owner[i] = BLOCKMAP_NO_OWNER;
+    }
+
+    struct blockmap_job job = {m, s->image, s->cache};
+    parallel_for(n, BLOCKMAP_GRAIN, blockmap_scan_range, &job);
+    classify_image(s->image, m->block_size, n, s->cache, m->cls,
+            m->entropy, NULL);
+
+    for (lfs_block_t i = 0; i < n; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_NONE) {
+            continue;
+        }
+
+        m->role[i] = BLOCKMAP_METADATA;
+        m->revision[i] = b->rev;
+        if (dirs[i]) {
+            m->state[i] = BLOCKMAP_LIVE;
+            m->owner[i] = blockmap_intern(&in, dirs[i]);
+        }
+    }
+
+    struct blockmap_files f = {s, &in, BLOCKMAP_NO_OWNER};
+    salvage_walk(s, blockmap_collect_file, &f);
+
+    free(in.slots);
+    salvage_free_paths(s, dirs);
+    if (in.failed) {
+        blockmap_free(m);
+        return LFS_ERR_NOMEM;
+    }
+    return 0;
+}
+
+void blockmap_free(blockmap_t *m) {
+    free(m->state);
+    free(m->role);
+    free(m->owner);
+    free(m->entropy);
+    free(m->cls);
+    free(m->revision);
+    free(m->hash);
+    for (uint32_t i = 0; i < m->owner_count; i++) {
+        free(m->owners[i]);
+    }
+    free(m->owners);
+    memset(m, 0, sizeof(*m));
+}
+
+const char *blockmap_state_name(int state) {
+    static const char *const names[] = {
+        [BLOCKMAP_ERASED] = "erased",
+        [BLOCKMAP_LIVE] = "live",
+        [BLOCKMAP_DEAD] = "dead",
+    };
+    return names[state];
+}
+
+const char *blockmap_role_name(int role) {
+    static const char *const names[] = {
+        [BLOCKMAP_NONE] = "none",
+        [BLOCKMAP_METADATA] = "metadata",
+        [BLOCKMAP_FILE] = "file",
+        [BLOCKMAP_DATA] = "data",
+    };
+    return names[role];
+}
+
+struct blockmap_column {
+    const char *name;
+    uint32_t type;
+    const void *data;
+    uint64_t count;
+    size_t width;
+};
+
+static size_t blockmap_align(size_t off) {
+    return (off + BLOCKMAP_ALIGN-1) & ~(size_t)(BLOCKMAP_ALIGN-1);
+}
+
+int blockmap_export(const blockmap_t *m, const char *path) {
+    // the columns are written straight from memory
+    const uint16_t probe = 1;
+    if (*(const uint8_t *)&probe != 1) {
+        return LFS_ERR_INVAL;
+    }
+
+    uint32_t *offsets = malloc((m->owner_count + 1) * sizeof(uint32_t));
+    if (!offsets) {
+        return LFS_ERR_NOMEM;
+    }
+    offsets[0] = 0;
+    for (uint32_t i = 0; i < m->owner_count; i++) {
+        offsets[i+1] = offsets[i] + strlen(m->owners[i]);
+    }
+
+    struct blockmap_column columns[BLOCKMAP_COLUMNS] = {
+        {"state",         BLOCKMAP_U8,    m->state,    m->block_count, 1},
+        {"role",          BLOCKMAP_U8,    m->role,     m->block_count, 1},
+        {"owner",         BLOCKMAP_U32,   m->owner,    m->block_count, 4},
+        {"entropy",       BLOCKMAP_F32,   m->entropy,  m->block_count, 4},
+        {"class",         BLOCKMAP_U8,    m->cls,      m->block_count, 1},
+        {"revision",      BLOCKMAP_U32,   m->revision, m->block_count, 4},
+        {"hash",          BLOCKMAP_U64,   m->hash,     m->block_count, 8},
+        {"owner_offsets", BLOCKMAP_U32,   offsets,     m->owner_count + 1, 4},
+        // owner_data is written from the strings themselves
+        {"owner_data",    BLOCKMAP_BYTES, NULL,        offsets[m->owner_count], 1},
+    };
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        free(offsets);
+        return LFS_ERR_IO;
+    }
+
+    uint8_t header[32 + 40*BLOCKMAP_COLUMNS];
+    memset(header, 0, sizeof(header));
+    memcpy(&header[0], "LFSCOL1\0", 8);
+    sidecar_put32(&header[8], 1);
+    sidecar_put32(&header[12], BLOCKMAP_COLUMNS);
+    sidecar_put64(&header[16], m->block_count);
+    sidecar_put32(&header[24], m->block_size);
+
+    size_t off = blockmap_align(sizeof(header));
+    for (int i = 0; i < BLOCKMAP_COLUMNS; i++) {
+        uint8_t *d = &header[32 + 40*i];
+        strncpy((char *)d, columns[i].name, 16);
+        sidecar_put32(&d[16], columns[i].type);
+        sidecar_put64(&d[24], off);
+        sidecar_put64(&d[32], columns[i].count);
+        off = blockmap_align(off + columns[i].count * columns[i].width);
+    }
+
+    static const uint8_t zeros[BLOCKMAP_ALIGN];
+    size_t pos = fwrite(header, 1, sizeof(header), f);
+    for (int i = 0; i < BLOCKMAP_COLUMNS; i++) {
+        size_t start = blockmap_align(pos);
+        pos += fwrite(zeros, 1, start - pos, f);
+
+        if (columns[i].data) {
+            pos += fwrite(columns[i].data, columns[i].width,
+                    columns[i].count, f) * columns[i].width;
+        } else {
+            for (uint32_t j = 0; j < m->owner_count; j++) {
+                pos += fwrite(m->owners[j], 1, offsets[j+1] - offsets[j], f);
+            }
+        }
+    }
+
+    free(offsets);
+    int err = ferror(f) ? LFS_ERR_IO : 0;
+    if (fclose(f) != 0) {
+        err = LFS_ERR_IO;
+    }
+    return err;
+}
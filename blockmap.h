@@ -0,0 +1,87 @@
+/*
+ * Per-block facts for a whole image
+ *
+ * One array per attribute (structure of arrays), so a column can be handed
+ * to fwrite, or scanned, without touching the others. Content statistics
+ * and classes are computed in parallel, ownership comes from the salvage
+ * scan so it doesn't depend on the image mounting. If that scan used a
+ * block cache, the statistics come from it where it knows them.
+ *
+ * Columnar export format (all integers little-endian):
+ *
+ *   header      8 bytes  magic "LFSCOL1\0"
+ *               4 bytes  format version, currently 1
+ *               4 bytes  number of columns
+ *               8 bytes  number of rows (blocks)
+ *               4 bytes  block size
+ *               4 bytes  reserved, 0
+ *   directory   40 bytes per column:
+ *               16 bytes name, NUL padded
+ *               4 bytes  element type (enum blockmap_coltype)
+ *               4 bytes  reserved, 0
+ *               8 bytes  file offset of the data, a multiple of 64
+ *               8 bytes  number of elements
+ *   data        each column's elements back to back, native width
+ *
+ * The owner column indexes a string dictionary stored in two more
+ * columns: owner_offsets (owners+1 u32) and owner_data (bytes), owner i
+ * spanning [owner_offsets[i], owner_offsets[i+1]) of owner_data.
+ */
+#ifndef BLOCKMAP_H
+#define BLOCKMAP_H
+
+#include "lfs.h"
+#include "salvage.h"
+#include <stdint.h>
+#include <stddef.h>
+
+enum blockmap_state {
+    BLOCKMAP_ERASED = 0,    // every byte is 0xFF
+    BLOCKMAP_LIVE,          // reachable from the directory tree
+    BLOCKMAP_DEAD,          // programmed but not reachable
+};
+
+enum blockmap_role {
+    BLOCKMAP_NONE = 0,      // erased
+    BLOCKMAP_METADATA,      // holds a valid metadata log
+    BLOCKMAP_FILE,          // part of a file's CTZ skip-list
+    BLOCKMAP_DATA,          // programmed, nothing claims it
+};
+
+enum blockmap_coltype {
+    BLOCKMAP_U8 = 1,
+    BLOCKMAP_U32 = 2,
+    BLOCKMAP_U64 = 3,
+    BLOCKMAP_F32 = 4,
+    BLOCKMAP_BYTES = 5,
+};
+
+#define BLOCKMAP_NO_OWNER 0xffffffff
+
+typedef struct blockmap {
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+
+    uint8_t *state;         // enum blockmap_state
+    uint8_t *role;          // enum blockmap_role
+    uint32_t *owner;        // index into owners, BLOCKMAP_NO_OWNER if none
+    float *entropy;         // of the programmed bytes, bits per byte, 0 to 8
+    uint8_t *cls;           // enum classify_class
+    uint32_t *revision;     // metadata revision count, 0 for other roles
+    uint64_t *hash;         // hash64 of the whole block
+
+    char **owners;          // directory or file paths
+    uint32_t owner_count;
+    uint32_t owner_capacity;
+} blockmap_t;
+
+int blockmap_build(blockmap_t *m, salvage_t *s);
+void blockmap_free(blockmap_t *m);
+
+const char *blockmap_state_name(int state);
+const char *blockmap_role_name(int role);
+
+// Writes the columnar export described above
+int blockmap_export(const blockmap_t *m, const char *path);
+
+#endif
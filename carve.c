@@ -0,0 +1,810 @@
+/*
+ * Signature-based carving of unreferenced data
+ */
+#include "carve.h"
+#include "lfs.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define CARVE_CHUNK (64*1024)
+#define CARVE_GRAIN 1
+#define CARVE_MEASURE_GRAIN 16
+#define CARVE_MIN_JSON 16
+#define CARVE_MIN_PROTOBUF 16
+#define CARVE_MIN_PROTOBUF_FIELDS 4
+#define CARVE_MAX_ELF ((uint64_t)1 << 32)
+
+// Size of the object starting at data, 0 if it isn't one after all.
+// limit is what is left of the region.
+typedef size_t (*carve_measure_fn)(const uint8_t *data, size_t limit,
+        bool *complete);
+
+enum carve_anchor {
+    CARVE_ANYWHERE,
+    CARVE_AFTER_FILL,       // where data starts after erased or zero fill
+    CARVE_TEXT_START,       // where a run of text starts
+};
+
+struct carve_sig {
+    const char *type;
+    const char *ext;
+    const uint8_t *magic;
+    size_t magic_len;
+    int anchor;
+    carve_measure_fn measure;
+};
+
+struct carve_candidate {
+    size_t offset;
+    size_t limit;
+    int sig;
+    size_t size;
+    size_t extent;          // size as measured, before anything cut it
+    bool complete;
+};
+
+struct carve_chunk {
+    size_t region;
+    size_t begin;           // offsets into buf
+    size_t end;
+};
+
+struct carve_job {
+    const uint8_t *buf;
+    const carve_region_t *regions;
+    const struct carve_chunk *chunks;
+    struct carve_candidate *candidates;
+    size_t count;
+    size_t capacity;
+    bool nomem;
+    pthread_mutex_t lock;
+};
+
+static uint32_t carve_be16(const uint8_t *p) {
+    return ((uint32_t)p[0] << 8) | p[1];
+}
+
+static uint32_t carve_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint64_t carve_word(const uint8_t *p, int size, bool big) {
+    uint64_t v = 0;
+    for (int i = 0; i < size; i++) {
+        v |= (uint64_t)p[big ? size-1-i : i] << (8*i);
+    }
+    return v;
+}
+
+// SOI, then marker segments up to the scan, entropy-coded data up to the
+// next real marker, and so on until EOI
+static size_t carve_jpeg(const uint8_t *data, size_t limit, bool *complete) {
+    size_t off = 2;
+    bool scan = false;
+    while (off + 2 <= limit) {
+        if (data[off] != 0xff) {
+            return 0;
+        }
+        // any number of fill bytes may precede a marker
+        while (off + 1 < limit && data[off+1] == 0xff) {
+            off++;
+        }
+        if (off + 2 > limit) {
+            break;
+        }
+        uint8_t marker = data[off+1];
+        off += 2;
+
+        if (marker == 0xd9) {
+            *complete = true;
+            return off;
+        }
+        if ((marker >= 0xd0 && marker <= 0xd7) || marker == 0x01) {
+            continue;
+        }
+        if (marker == 0x00 || off + 2 > limit) {
+            break;
+        }
+
+        uint32_t len = carve_be16(&data[off]);
+        if (len < 2) {
+            return 0;
+        }
+        off += len;
+        if (marker != 0xda) {
+            continue;
+        }
+
+        // entropy-coded data only has stuffed 0xff00 and restart markers
+        scan = true;
+        while (off + 1 < limit && !(data[off] == 0xff && data[off+1] != 0x00 &&
+                !(data[off+1] >= 0xd0 && data[off+1] <= 0xd7))) {
+            off++;
+        }
+    }
+
+    // a truncated image is still worth having once pixels started
+    *complete = false;
+    return scan ? limit : 0;
+}
+
+// The signature, then length, type, data and crc per chunk until IEND
+static size_t carve_png(const uint8_t *data, size_t limit, bool *complete) {
+    size_t off = 8;
+    bool first = true;
+    while (off + 12 <= limit) {
+        uint32_t len = carve_be32(&data[off]);
+        const uint8_t *type = &data[off+4];
+        for (int i = 0; i < 4; i++) {
+            uint8_t c = type[i] & ~0x20;
+            if (c < 'A' || c > 'Z') {
+                return 0;
+            }
+        }
+        if (first && memcmp(type, "IHDR", 4) != 0) {
+            return 0;
+        }
+        first = false;
+
+        if (len > limit - off - 12) {
+            break;
+        }
+        off += 12 + len;
+        if (memcmp(type, "IEND", 4) == 0) {
+            *complete = true;
+            return off;
+        }
+    }
+
+    *complete = false;
+    return first ? 0 : limit;
+}
+
+// The file ends with whichever of the section and program header tables
+// lies last, sections themselves come before the section headers
+static size_t carve_elf(const uint8_t *data, size_t limit, bool *complete) {
+    if (limit < 52 || (data[4] != 1 && data[4] != 2) ||
+            (data[5] != 1 && data[5] != 2) || data[6] != 1) {
+        return 0;
+    }
+    bool wide = (data[4] == 2);
+    bool big = (data[5] == 2);
+    size_t ehsize = wide ? 64 : 52;
+    if (limit < ehsize) {
+        return 0;
+    }
+
+    // e_entry, e_phoff and e_shoff are words, e_flags and the rest aren't
+    int w = wide ? 8 : 4;
+    uint64_t phoff = carve_word(&data[24 + w], w, big);
+    uint64_t shoff = carve_word(&data[24 + 2*w], w, big);
+    const uint8_t *tail = &data[24 + 3*w + 4];
+    if (carve_word(&tail[0], 2, big) != ehsize ||
+            phoff > CARVE_MAX_ELF || shoff > CARVE_MAX_ELF) {
+        return 0;
+    }
+    uint64_t phentsize = carve_word(&tail[2], 2, big);
+    uint64_t phnum = carve_word(&tail[4], 2, big);
+    uint64_t shentsize = carve_word(&tail[6], 2, big);
+    uint64_t shnum = carve_word(&tail[8], 2, big);
+
+    uint64_t size = ehsize;
+    if (phnum && phoff + phentsize*phnum > size) {
+        size = phoff + phentsize*phnum;
+    }
+    if (shnum && shoff + shentsize*shnum > size) {
+        size = shoff + shentsize*shnum;
+    }
+
+    *complete = (size <= limit);
+    return (size <= limit) ? size : limit;
+}
+
+// Deflate has no length field and gzip no end marker, so the stream is
+// decoded to find where it ends. Nothing is written out: literals and
+// matches are only counted, which also checks every distance against
+// what came before it. This follows the RFC 1951 reference decoder.
+struct carve_inflate {
+    const uint8_t *data;
+    size_t limit;
+    size_t pos;             // bytes taken into bitbuf so far
+    uint32_t bitbuf;
+    int bitcnt;
+    bool over;              // ran past the end of the region
+    uint64_t out;           // bytes the stream decodes to
+};
+
+struct carve_huffman {
+    uint16_t count[16];     // codes of each length
+    uint16_t symbol[288];   // symbols ordered by code
+};
+
+static uint32_t carve_bits(struct carve_inflate *s, int need) {
+    while (s->bitcnt < need) {
+        if (s->pos >= s->limit) {
+            s->over = true;
+            return 0;
+        }
+        s->bitbuf |= (uint32_t)s->data[s->pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+    uint32_t v = s->bitbuf & ((1u << need) - 1);
+    s->bitbuf >>= need;
+    s->bitcnt -= need;
+    return v;
+}
+
+static int carve_decode(struct carve_inflate *s, const struct carve_huffman *h) {
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= carve_bits(s, 1);
+        if (s->over) {
+            return -1;
+        }
+        int count = h->count[len];
+        if (code - count < first) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Canonical code from code lengths, false if it is over-subscribed
+static bool carve_huffman_build(struct carve_huffman *h,
+        const uint8_t *length, int n) {
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) {
+        h->count[length[i]]++;
+    }
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    uint16_t offs[16];
+    offs[1] = 0;
+    for (int len = 1; len < 15; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for (int i = 0; i < n; i++) {
+        if (length[i]) {
+            h->symbol[offs[length[i]]++] = i;
+        }
+    }
+    return true;
+}
+
+static bool carve_codes(struct carve_inflate *s,
+        const struct carve_huffman *lencode,
+        const struct carve_huffman *distcode) {
+    static const uint16_t lbase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lext[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t dbase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577};
+    static const uint8_t dext[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    while (true) {
+        int sym = carve_decode(s, lencode);
+        if (sym < 0) {
+            return false;
+        }
+        if (sym < 256) {
+            s->out += 1;
+            continue;
+        }
+        if (sym == 256) {
+            return true;
+        }
+
+        sym -= 257;
+        if (sym >= 29) {
+            return false;
+        }
+        uint32_t len = lbase[sym] + carve_bits(s, lext[sym]);
+        int dsym = carve_decode(s, distcode);
+        if (dsym < 0 || dsym >= 30) {
+            return false;
+        }
+        uint32_t dist = dbase[dsym] + carve_bits(s, dext[dsym]);
+        if (s->over || dist > s->out) {
+            return false;
+        }
+        s->out += len;
+    }
+}
+
+static bool carve_stored(struct carve_inflate *s) {
+    // stored blocks start on a byte boundary
+    s->bitbuf = 0;
+    s->bitcnt = 0;
+    if (s->limit - s->pos < 4) {
+        s->over = true;
+        return false;
+    }
+    uint32_t len = s->data[s->pos] | ((uint32_t)s->data[s->pos+1] << 8);
+    uint32_t nlen = s->data[s->pos+2] | ((uint32_t)s->data[s->pos+3] << 8);
+    if (len != (~nlen & 0xffff)) {
+        return false;
+    }
+    s->pos += 4;
+    if (s->limit - s->pos < len) {
+        s->over = true;
+        return false;
+    }
+    s->pos += len;
+    s->out += len;
+    return true;
+}
+
+static bool carve_fixed(struct carve_inflate *s) {
+    struct carve_huffman lencode, distcode;
+    uint8_t length[288];
+    for (int i = 0; i < 288; i++) {
+        length[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+    }
+    carve_huffman_build(&lencode, length, 288);
+    memset(length, 5, 30);
+    carve_huffman_build(&distcode, length, 30);
+    return carve_codes(s, &lencode, &distcode);
+}
+
+static bool carve_dynamic(struct carve_inflate *s) {
+    static const uint8_t order[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    int nlen = carve_bits(s, 5) + 257;
+    int ndist = carve_bits(s, 5) + 1;
+    int ncode = carve_bits(s, 4) + 4;
+    if (s->over || nlen > 286 || ndist > 30) {
+        return false;
+    }
+
+    uint8_t length[320] = {0};
+    for (int i = 0; i < ncode; i++) {
+        length[order[i]] = carve_bits(s, 3);
+    }
+    struct carve_huffman lencode, distcode;
+    if (s->over || !carve_huffman_build(&lencode, length, 19)) {
+        return false;
+    }
+
+    for (int i = 0; i < nlen + ndist; ) {
+        int sym = carve_decode(s, &lencode);
+        if (sym < 0) {
+            return false;
+        }
+        if (sym < 16) {
+            length[i++] = sym;
+            continue;
+        }
+
+        uint8_t prev = 0;
+        int repeat;
+        if (sym == 16) {
+            if (i == 0) {
+                return false;
+            }
+            prev = length[i - 1];
+            repeat = 3 + carve_bits(s, 2);
+        } else if (sym == 17) {
+            repeat = 3 + carve_bits(s, 3);
+        } else {
+            repeat = 11 + carve_bits(s, 7);
+        }
+        if (s->over || i + repeat > nlen + ndist) {
+            return false;
+        }
+        while (repeat--) {
+            length[i++] = prev;
+        }
+    }
+
+    // a block without an end-of-block code could never finish
+    if (length[256] == 0 ||
+            !carve_huffman_build(&lencode, length, nlen) ||
+            !carve_huffman_build(&distcode, &length[nlen], ndist)) {
+        return false;
+    }
+    return carve_codes(s, &lencode, &distcode);
+}
+
+// Header, deflate blocks up to the last one, then the crc and the
+// length of the decoded data. The object ends where the stream does, and
+// is only incomplete when the stream runs off the end of the region.
+static size_t carve_gzip(const uint8_t *data, size_t limit, bool *complete) {
+    if (limit < 18 || (data[3] & 0xe0) || (data[9] > 13 && data[9] != 255)) {
+        return 0;
+    }
+
+    uint8_t flags = data[3];
+    size_t off = 10;
+    if (flags & 0x04) {
+        off += 2 + (data[off] | ((size_t)data[off+1] << 8));
+    }
+    for (int field = 0x08; field <= 0x10; field <<= 1) {
+        if (flags & field) {
+            while (off < limit && data[off]) {
+                off++;
+            }
+            off++;
+        }
+    }
+    if (flags & 0x02) {
+        off += 2;
+    }
+
+    struct carve_inflate s = {.data = data, .limit = limit, .pos = off};
+    bool last = false;
+    bool ok = off < limit;
+    while (ok && !last) {
+        last = carve_bits(&s, 1);
+        switch (carve_bits(&s, 2)) {
+            case 0: ok = carve_stored(&s); break;
+            case 1: ok = carve_fixed(&s); break;
+            case 2: ok = carve_dynamic(&s); break;
+            default: ok = false; break;
+        }
+        ok = ok && !s.over;
+    }
+
+    if (ok && s.pos + 8 <= limit) {
+        *complete = (carve_be32(&data[s.pos + 4]) ==
+                __builtin_bswap32((uint32_t)s.out));
+        return s.pos + 8;
+    }
+    if (!s.over) {
+        // a damaged stream, or no deflate data at all
+        return (s.pos > off + 1) ? s.pos : 0;
+    }
+
+    // cut off by the end of the region, keep what there is less any
+    // erased tail
+    size_t size = limit;
+    while (size > 10 && data[size-1] == 0xff) {
+        size--;
+    }
+    *complete = false;
+    return size;
+}
+
+// The header has the page size and, since 3.7.0, the page count
+static size_t carve_sqlite(const uint8_t *data, size_t limit, bool *complete) {
+    if (limit < 100) {
+        return 0;
+    }
+    uint32_t page = carve_be16(&data[16]);
+    if (page == 1) {
+        page = 65536;
+    }
+    uint32_t pages = carve_be32(&data[28]);
+    if (page < 512 || (page & (page - 1)) || pages == 0) {
+        return 0;
+    }
+
+    size_t size = (size_t)page * pages;
+    *complete = (size <= limit);
+    return (size <= limit) ? size : limit;
+}
+
+static bool carve_text(uint8_t c) {
+    return (c >= 0x20 && c < 0x7f) || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Balanced braces and brackets outside of strings, all of it text
+static size_t carve_json(const uint8_t *data, size_t limit, bool *complete) {
+    int depth = 0;
+    bool string = false;
+    for (size_t off = 0; off < limit; off++) {
+        uint8_t c = data[off];
+        if (!carve_text(c) && c < 0x80) {
+            return 0;
+        }
+        if (string) {
+            if (c == '\\') {
+                off++;
+            } else if (c == '"') {
+                string = false;
+            }
+            continue;
+        }
+
+        if (c == '"') {
+            string = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                *complete = true;
+                return (off + 1 >= CARVE_MIN_JSON) ? off + 1 : 0;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool carve_varint(const uint8_t *data, size_t limit, size_t *off,
+        uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64 && *off < limit; shift += 7) {
+        uint8_t c = data[(*off)++];
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Protocol buffers carry no magic, a run of well-formed fields ending in
+// erased or zero fill is as close as it gets
+static size_t carve_protobuf(const uint8_t *data, size_t limit,
+        bool *complete) {
+    size_t off = 0;
+    int fields = 0;
+    while (off < limit && data[off] != 0xff && data[off] != 0x00) {
+        uint64_t key, v;
+        if (!carve_varint(data, limit, &off, &key) || (key >> 3) == 0 ||
+                (key >> 3) > 0x1fffffff) {
+            return 0;
+        }
+
+        switch (key & 7) {
+            case 0:
+                if (!carve_varint(data, limit, &off, &v)) {
+                    return 0;
+                }
+                break;
+            case 1:
+                off += 8;
+                break;
+            case 2:
+                if (!carve_varint(data, limit, &off, &v) || v > limit - off) {
+                    return 0;
+                }
+                off += v;
+                break;
+            case 5:
+                off += 4;
+                break;
+            default:
+                return 0;
+        }
+        if (off > limit) {
+            return 0;
+        }
+        fields += 1;
+    }
+
+    if (fields < CARVE_MIN_PROTOBUF_FIELDS || off < CARVE_MIN_PROTOBUF) {
+        return 0;
+    }
+    *complete = (off < limit);
+    return off;
+}
+
+static const struct carve_sig carve_sigs[] = {
+    {"jpeg",     "jpg",    (const uint8_t *)"\xff\xd8\xff", 3,
+            CARVE_ANYWHERE, carve_jpeg},
+    {"png",      "png",    (const uint8_t *)"\x89PNG\r\n\x1a\n", 8,
+            CARVE_ANYWHERE, carve_png},
+    {"elf",      "elf",    (const uint8_t *)"\x7f" "ELF", 4,
+            CARVE_ANYWHERE, carve_elf},
+    {"gzip",     "gz",     (const uint8_t *)"\x1f\x8b\x08", 3,
+            CARVE_ANYWHERE, carve_gzip},
+    {"sqlite",   "sqlite", (const uint8_t *)"SQLite format 3", 16,
+            CARVE_ANYWHERE, carve_sqlite},
+    // or every object nested in one would be carved again
+    {"json",     "json",   (const uint8_t *)"{", 1,
+            CARVE_TEXT_START, carve_json},
+    {"protobuf", "pb",     NULL, 0,
+            CARVE_AFTER_FILL, carve_protobuf},
+};
+
+#define CARVE_SIGS (sizeof(carve_sigs) / sizeof(carve_sigs[0]))
+
+// Signatures by their first byte, so the scan costs one lookup a byte
+static uint32_t carve_first[256];
+static uint32_t carve_after_fill;
+static uint32_t carve_text_start;
+static pthread_once_t carve_once = PTHREAD_ONCE_INIT;
+
+static void carve_init(void) {
+    for (size_t i = 0; i < CARVE_SIGS; i++) {
+        const struct carve_sig *sig = &carve_sigs[i];
+        if (sig->anchor == CARVE_AFTER_FILL) {
+            carve_after_fill |= 1u << i;
+        } else {
+            carve_first[sig->magic[0]] |= 1u << i;
+        }
+        if (sig->anchor == CARVE_TEXT_START) {
+            carve_text_start |= 1u << i;
+        }
+    }
+}
+
+static void carve_push(struct carve_job *job, size_t offset, size_t limit,
+        int sig) {
+    pthread_mutex_lock(&job->lock);
+    if (job->count == job->capacity) {
+        size_t capacity = job->capacity ? 2*job->capacity : 64;
+        struct carve_candidate *ncandidates = realloc(job->candidates,
+                capacity * sizeof(struct carve_candidate));
+        if (!ncandidates) {
+            job->nomem = true;
+            pthread_mutex_unlock(&job->lock);
+            return;
+        }
+        job->candidates = ncandidates;
+        job->capacity = capacity;
+    }
+    job->candidates[job->count++] = (struct carve_candidate){
+        .offset = offset, .limit = limit, .sig = sig,
+    };
+    pthread_mutex_unlock(&job->lock);
+}
+
+static void carve_find_range(void *data, size_t begin, size_t end) {
+    struct carve_job *job = data;
+    const uint8_t *buf = job->buf;
+
+    for (size_t i = begin; i < end; i++) {
+        const struct carve_chunk *chunk = &job->chunks[i];
+        const carve_region_t *r = &job->regions[chunk->region];
+        size_t region_end = r->offset + r->size;
+
+        for (size_t off = chunk->begin; off < chunk->end; off++) {
+            uint32_t sigs = carve_first[buf[off]];
+            bool start = (off == r->offset);
+            if (buf[off] != 0xff && buf[off] != 0x00 && (start ||
+                    buf[off-1] == 0xff || buf[off-1] == 0x00)) {
+                sigs |= carve_after_fill;
+            }
+            if (!start && carve_text(buf[off-1])) {
+                sigs &= ~carve_text_start;
+            }
+
+            while (sigs) {
+                int s = __builtin_ctz(sigs);
+                sigs &= sigs - 1;
+                const struct carve_sig *sig = &carve_sigs[s];
+                if (sig->magic_len <= region_end - off && (!sig->magic_len ||
+                        memcmp(&buf[off], sig->magic, sig->magic_len) == 0)) {
+                    carve_push(job, off, region_end - off, s);
+                }
+            }
+        }
+    }
+}
+
+static void carve_measure_range(void *data, size_t begin, size_t end) {
+    struct carve_job *job = data;
+    for (size_t i = begin; i < end; i++) {
+        struct carve_candidate *c = &job->candidates[i];
+        c->complete = false;
+        c->size = carve_sigs[c->sig].measure(&job->buf[c->offset],
+                c->limit, &c->complete);
+        c->extent = c->size;
+    }
+}
+
+static int carve_cmp(const void *a, const void *b) {
+    const struct carve_candidate *ca = a;
+    const struct carve_candidate *cb = b;
+    if (ca->offset != cb->offset) {
+        return (ca->offset > cb->offset) - (ca->offset < cb->offset);
+    }
+    return ca->sig - cb->sig;
+}
+
+int carve_scan(const uint8_t *buf, const carve_region_t *regions,
+        size_t count, carve_cb cb, void *data) {
+    pthread_once(&carve_once, carve_init);
+
+    // regions are cut into chunks so one large run still spreads out
+    size_t nchunks = 0;
+    for (size_t i = 0; i < count; i++) {
+        nchunks += (regions[i].size + CARVE_CHUNK - 1) / CARVE_CHUNK;
+    }
+    struct carve_chunk *chunks = malloc((nchunks + 1) *
+            sizeof(struct carve_chunk));
+    if (!chunks) {
+        return LFS_ERR_NOMEM;
+    }
+    nchunks = 0;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t off = 0; off < regions[i].size; off += CARVE_CHUNK) {
+            size_t end = off + CARVE_CHUNK;
+            if (end > regions[i].size) {
+                end = regions[i].size;
+            }
+            chunks[nchunks++] = (struct carve_chunk){
+                i, regions[i].offset + off, regions[i].offset + end,
+            };
+        }
+    }
+
+    struct carve_job job = {
+        .buf = buf,
+        .regions = regions,
+        .chunks = chunks,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+    };
+    parallel_for(nchunks, CARVE_GRAIN, carve_find_range, &job);
+    parallel_for(job.count, CARVE_MEASURE_GRAIN, carve_measure_range, &job);
+    free(chunks);
+    if (job.nomem) {
+        free(job.candidates);
+        return LFS_ERR_NOMEM;
+    }
+
+    if (job.count) {
+        qsort(job.candidates, job.count, sizeof(struct carve_candidate),
+                carve_cmp);
+    }
+
+    // an object with no recorded end stops where the next object that
+    // has one starts. Only a magic makes that trustworthy, zero padding
+    // or a brace inside a file would cut it short otherwise.
+    size_t next = SIZE_MAX;
+    for (size_t i = job.count; i-- > 0;) {
+        struct carve_candidate *c = &job.candidates[i];
+        if (!c->complete && c->size && c->offset + c->size > next) {
+            c->size = next - c->offset;
+        }
+        if (c->complete && c->size &&
+                carve_sigs[c->sig].anchor == CARVE_ANYWHERE) {
+            next = c->offset;
+        }
+    }
+
+    // earliest first, whatever starts inside an object is part of it,
+    // and heuristic hits anywhere the object measured itself to reach
+    size_t end = 0;
+    size_t reach = 0;
+    for (size_t i = 0; i < job.count; i++) {
+        const struct carve_candidate *c = &job.candidates[i];
+        if (!c->size || c->offset < end || (c->offset < reach &&
+                carve_sigs[c->sig].anchor != CARVE_ANYWHERE)) {
+            continue;
+        }
+
+        const struct carve_sig *sig = &carve_sigs[c->sig];
+        carve_object_t object = {
+            .type = sig->type,
+            .ext = sig->ext,
+            .offset = c->offset,
+            .size = c->size,
+            .complete = c->complete,
+        };
+        cb(data, &object);
+        end = c->offset + c->size;
+        if (c->offset + c->extent > reach) {
+            reach = c->offset + c->extent;
+        }
+    }
+
+    free(job.candidates);
+    return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Signature-based carving of unreferenced data
+ *
+ * Regions (runs of adjacent orphaned blocks, slack ranges) are scanned
+ * once, in parallel, for the leading bytes of every signature in a table.
+ * Each hit is then measured by walking the format's own structure (JPEG
+ * segments, PNG chunks, ELF and SQLite headers, JSON nesting, protobuf
+ * fields) as far as the region goes, so an object runs on across the
+ * blocks of its region but never past it. gzip records no length, its
+ * deflate stream is decoded to find where it ends.
+ */
+#ifndef CARVE_H
+#define CARVE_H
+
+#include "lfs.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct carve_region {
+    size_t offset;          // into buf
+    size_t size;
+} carve_region_t;
+
+typedef struct carve_object {
+    const char *type;       // "jpeg", "png", ...
+    const char *ext;        // file name extension for the carved copy
+    size_t offset;          // into buf
+    size_t size;
+    bool complete;          // the format's end was found inside the region
+} carve_object_t;
+
+typedef void (*carve_cb)(void *data, const carve_object_t *object);
+
+// Carves every region of buf and calls cb for each object in order.
+// Objects never overlap, one found inside another isn't reported.
+// Returns 0 or LFS_ERR_NOMEM.
+int carve_scan(const uint8_t *buf, const carve_region_t *regions,
+        size_t count, carve_cb cb, void *data);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Content classes of blocks
+ */
+#include "classify.h"
+#include "ondisk.h"
+#include "parallel.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define CLASSIFY_GRAIN 64
+#define CLASSIFY_WIDTH 64
+#define CLASSIFY_ROWS 32
+
+// fewer programmed bytes than this, a stray bit flip or an interrupted
+// program, say nothing about what a block held
+#define CLASSIFY_MIN_PROGRAMMED 16
+
+// 1 for bytes that count as text, the same set hexdump_printable takes
+static const uint8_t classify_text[256] = {
+    0,0,0,0,0,0,0,0, 0,0,1,0,0,1,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,0,
+};
+
+static const char classify_cells[CLASSIFY_COUNT] = {
+    [CLASSIFY_ERASED] = '.',
+    [CLASSIFY_METADATA] = 'M',
+    [CLASSIFY_TEXT] = 'T',
+    [CLASSIFY_COMPRESSED] = 'X',
+    [CLASSIFY_BINARY] = 'B',
+};
+
+// Most blocks of a sparsely used image are erased, they are told apart
+// 16 bytes at a time before any histogram is taken
+static bool classify_all_erased(const uint8_t *data, lfs_size_t size) {
+    lfs_size_t i = 0;
+#ifdef __SSE2__
+    __m128i all = _mm_set1_epi8((char)0xff);
+    for (; i + 64 <= size; i += 64) {
+        __m128i x = _mm_and_si128(
+                _mm_and_si128(
+                    _mm_loadu_si128((const __m128i *)&data[i]),
+                    _mm_loadu_si128((const __m128i *)&data[i+16])),
+                _mm_and_si128(
+                    _mm_loadu_si128((const __m128i *)&data[i+32]),
+                    _mm_loadu_si128((const __m128i *)&data[i+48])));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, all)) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+    uint8_t all8 = 0xff;
+    for (; i < size; i++) {
+        all8 &= data[i];
+    }
+    return all8 == 0xff;
+}
+
+static double classify_entropy(const uint32_t *hist, int first, int last,
+        uint32_t total) {
+    double entropy = 0;
+    for (int b = first; b <= last; b++) {
+        if (hist[b]) {
+            double p = (double)hist[b] / total;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
+
+int classify_block(const uint8_t *data, lfs_size_t size, bool metadata,
+        classify_stats_t *stats) {
+    if (classify_all_erased(data, size)) {
+        *stats = (classify_stats_t){0, 0, 1};
+        return CLASSIFY_ERASED;
+    }
+
+    // four interleaved histograms avoid stalling on repeated bytes
+    uint32_t hist4[4][256];
+    memset(hist4, 0, sizeof(hist4));
+
+    lfs_size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        hist4[0][data[i+0]]++;
+        hist4[1][data[i+1]]++;
+        hist4[2][data[i+2]]++;
+        hist4[3][data[i+3]]++;
+    }
+    for (; i < size; i++) {
+        hist4[0][data[i]]++;
+    }
+
+    uint32_t hist[256];
+    uint32_t text = 0;
+    for (int b = 0; b < 256; b++) {
+        hist[b] = hist4[0][b] + hist4[1][b] + hist4[2][b] + hist4[3][b];
+        text += classify_text[b] ? hist[b] : 0;
+    }
+
+    // the class, entropy and printable all come from the programmed
+    // bytes, however much of the block is still erased
+    uint32_t programmed = size - hist[0xff];
+    double content = classify_entropy(hist, 0, 254, programmed);
+    stats->entropy = (float)content;
+    stats->printable = (float)text / programmed;
+    stats->erased = (float)hist[0xff] / size;
+
+    if (metadata) {
+        return CLASSIFY_METADATA;
+    }
+    if (programmed < CLASSIFY_MIN_PROGRAMMED) {
+        return CLASSIFY_ERASED;
+    }
+    if (20*text >= 19*programmed) {
+        return CLASSIFY_TEXT;
+    }
+
+    // a short run can't reach 8 bits however random it is, the bound is
+    // taken from the number of bytes there are
+    double ceiling = log2(programmed);
+    if (content >= 0.9 * ((ceiling < 8) ? ceiling : 8)) {
+        return CLASSIFY_COMPRESSED;
+    }
+    return CLASSIFY_BINARY;
+}
+
+struct classify_job {
+    const uint8_t *image;
+    lfs_size_t block_size;
+    blockcache_t *cache;
+    uint8_t *classes;
+    float *entropy;
+    float *printable;
+};
+
+static void classify_range(void *data, size_t begin, size_t end) {
+    struct classify_job *job = data;
+
+    for (size_t i = begin; i < end; i++) {
+        const uint8_t *block = &job->image[i * job->block_size];
+        blockcache_facts_t *facts = job->cache ? &job->cache->facts[i] : NULL;
+        if (facts && (facts->flags & BLOCKCACHE_CLASS) &&
+                (facts->flags & BLOCKCACHE_ENTROPY)) {
+            job->classes[i] = facts->cls;
+            if (job->entropy) {
+                job->entropy[i] = facts->entropy;
+            }
+            if (job->printable) {
+                job->printable[i] = facts->printable;
+            }
+            continue;
+        }
+
+        bool metadata;
+        if (facts && (facts->flags & BLOCKCACHE_SCANNED)) {
+            metadata = facts->flags & BLOCKCACHE_LOG;
+        } else {
+            ondisk_cursor_t cur;
+            ondisk_commit_t commit;
+            ondisk_cursor_init(&cur, block, job->block_size);
+            metadata = ondisk_next_commit(&cur, &commit);
+        }
+
+        classify_stats_t stats;
+        job->classes[i] = classify_block(block, job->block_size, metadata,
+                &stats);
+        if (job->entropy) {
+            job->entropy[i] = stats.entropy;
+        }
+        if (job->printable) {
+            job->printable[i] = stats.printable;
+        }
+        if (facts) {
+            facts->cls = job->classes[i];
+            facts->entropy = stats.entropy;
+            facts->printable = stats.printable;
+            facts->flags |= BLOCKCACHE_CLASS | BLOCKCACHE_ENTROPY;
+        }
+    }
+}
+
+int classify_image(const uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, blockcache_t *cache,
+        uint8_t *classes, float *entropy, float *printable) {
+    struct classify_job job = {
+        image, block_size, cache, classes, entropy, printable
+    };
+    parallel_for(block_count, CLASSIFY_GRAIN, classify_range, &job);
+    return 0;
+}
+
+const char *classify_name(int cls) {
+    static const char *const names[] = {
+        [CLASSIFY_ERASED] = "erased",
+        [CLASSIFY_METADATA] = "metadata",
+        [CLASSIFY_TEXT] = "text",
+        [CLASSIFY_COMPRESSED] = "compressed",
+        [CLASSIFY_BINARY] = "binary",
+    };
+    return names[cls];
+}
+
+void classify_print_heatmap(const uint8_t *classes, lfs_size_t count,
+        FILE *out) {
+    lfs_size_t totals[CLASSIFY_COUNT] = {0};
+    for (lfs_size_t i = 0; i < count; i++) {
+        totals[classes[i]]++;
+    }
+
+    fprintf(out, "Block Classes:\n");
+    for (int c = 0; c < CLASSIFY_COUNT; c++) {
+        fprintf(out, "  %c %s: %lu", classify_cells[c], classify_name(c),
+                (unsigned long)totals[c]);
+    }
+    fprintf(out, "\n");
+
+    // large images are folded so the map stays a screen high, a cell
+    // shows the most common class of its blocks that isn't erased
+    lfs_size_t per = 1;
+    while ((uint64_t)per * CLASSIFY_WIDTH * CLASSIFY_ROWS < count) {
+        per *= 2;
+    }
+    if (per > 1) {
+        fprintf(out, "  (one cell per %lu blocks)\n", (unsigned long)per);
+    }
+
+    char row[CLASSIFY_WIDTH + 1];
+    for (lfs_size_t start = 0; start < count;
+            start += per * CLASSIFY_WIDTH) {
+        int n = 0;
+        for (lfs_size_t cell = start;
+                cell < count && n < CLASSIFY_WIDTH; cell += per) {
+            lfs_size_t seen[CLASSIFY_COUNT] = {0};
+            lfs_size_t last = (count - cell < per) ? count : cell + per;
+            for (lfs_size_t i = cell; i < last; i++) {
+                seen[classes[i]]++;
+            }
+
+            int best = CLASSIFY_ERASED;
+            for (int c = CLASSIFY_ERASED + 1; c < CLASSIFY_COUNT; c++) {
+                if (seen[c] > (best == CLASSIFY_ERASED ? 0 : seen[best])) {
+                    best = c;
+                }
+            }
+            row[n++] = classify_cells[best];
+        }
+        row[n] = '\0';
+        fprintf(out, "  %8lu  %s\n", (unsigned long)start, row);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Content classes of blocks
+ *
+ * A block's byte histogram says a lot about what it held: erased flash
+ * is all 0xFF, text is almost all printable ASCII, compressed or
+ * encrypted data spreads evenly over all 256 values, and everything else
+ * (structured binary, executables, databases) lies in between. Counts
+ * are taken over the programmed bytes only, so the erased tail of a
+ * file's last block doesn't hide what the block starts with. Blocks that
+ * hold a valid metadata log are told apart from the others first.
+ */
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include "lfs.h"
+#include "blockcache.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum classify_class {
+    CLASSIFY_ERASED = 0,    // too few programmed bytes to tell anything
+    CLASSIFY_METADATA,      // holds a valid metadata log
+    CLASSIFY_TEXT,          // programmed bytes are printable ASCII
+    CLASSIFY_COMPRESSED,    // near maximum entropy, compressed or encrypted
+    CLASSIFY_BINARY,        // anything else
+    CLASSIFY_COUNT,
+};
+
+typedef struct classify_stats {
+    float entropy;          // Shannon entropy of the programmed bytes, 0 to 8
+    float printable;        // fraction of the programmed bytes that are text
+    float erased;           // fraction of the bytes that are 0xFF,
+                            // the rest is what the class is taken from
+} classify_stats_t;
+
+// Histogram statistics of one block, and its class from them
+int classify_block(const uint8_t *data, lfs_size_t size, bool metadata,
+        classify_stats_t *stats);
+
+// Classifies every block of an image in parallel. The cache, if any,
+// supplies and learns both classes and metadata scans, entropy and
+// printable may be NULL.
+int classify_image(const uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, blockcache_t *cache,
+        uint8_t *classes, float *entropy, float *printable);
+
+const char *classify_name(int cls);
+
+// Class counts and a map of the image, one character per block or per
+// group of blocks on large images
+void classify_print_heatmap(const uint8_t *classes, lfs_size_t count,
+        FILE *out);
+
+#endif
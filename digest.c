@@ -0,0 +1,255 @@
+/*
+ * Selectable cryptographic digests for acquisition hashes
+ */
+#include "digest.h"
+#include <string.h>
+
+static inline uint32_t digest_rotl(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t digest_le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t digest_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static void md5_blocks(uint32_t state[5], const uint8_t *data, size_t blocks) {
+    for (; blocks; blocks--, data += 64) {
+        uint32_t m[16];
+        for (int i = 0; i < 16; i++) {
+            m[i] = digest_le32(&data[4*i]);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        for (int i = 0; i < 64; i++) {
+            uint32_t f;
+            int g;
+            if (i < 16) {
+                f = (b & c) | (~b & d);
+                g = i;
+            } else if (i < 32) {
+                f = (d & b) | (~d & c);
+                g = (5*i + 1) & 15;
+            } else if (i < 48) {
+                f = b ^ c ^ d;
+                g = (3*i + 5) & 15;
+            } else {
+                f = c ^ (b | ~d);
+                g = (7*i) & 15;
+            }
+
+            uint32_t t = d;
+            d = c;
+            c = b;
+            b = b + digest_rotl(a + f + md5_k[i] + m[g], md5_r[i]);
+            a = t;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    }
+}
+
+static void sha1_blocks(uint32_t state[5], const uint8_t *data, size_t blocks) {
+    for (; blocks; blocks--, data += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = digest_be32(&data[4*i]);
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = digest_rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2];
+        uint32_t d = state[3], e = state[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+
+            uint32_t t = digest_rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = digest_rotl(b, 30);
+            b = a;
+            a = t;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c;
+        state[3] += d; state[4] += e;
+    }
+}
+
+int digest_parse(const char *name) {
+    if (strcmp(name, "md5") == 0) {
+        return DIGEST_MD5;
+    } else if (strcmp(name, "sha1") == 0) {
+        return DIGEST_SHA1;
+    } else if (strcmp(name, "sha256") == 0) {
+        return DIGEST_SHA256;
+    }
+    return DIGEST_NONE;
+}
+
+const char *digest_name(int algo) {
+    switch (algo) {
+        case DIGEST_MD5:    return "MD5";
+        case DIGEST_SHA1:   return "SHA-1";
+        case DIGEST_SHA256: return "SHA-256";
+        default:            return "none";
+    }
+}
+
+size_t digest_size(int algo) {
+    switch (algo) {
+        case DIGEST_MD5:    return 16;
+        case DIGEST_SHA1:   return 20;
+        case DIGEST_SHA256: return SHA256_DIGEST_SIZE;
+        default:            return 0;
+    }
+}
+
+void digest_init(digest_t *d, int algo) {
+    static const uint32_t md5_iv[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0,
+    };
+    static const uint32_t sha1_iv[5] = {
+        0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+    };
+
+    memset(d, 0, sizeof(*d));
+    d->algo = algo;
+    if (algo == DIGEST_SHA256) {
+        sha256_init(&d->u.sha256);
+    } else {
+        memcpy(d->u.md.state, (algo == DIGEST_MD5) ? md5_iv : sha1_iv,
+                sizeof(d->u.md.state));
+    }
+}
+
+static void digest_blocks(digest_t *d, const uint8_t *data, size_t blocks) {
+    if (d->algo == DIGEST_MD5) {
+        md5_blocks(d->u.md.state, data, blocks);
+    } else {
+        sha1_blocks(d->u.md.state, data, blocks);
+    }
+}
+
+void digest_update(digest_t *d, const void *data, size_t size) {
+    if (d->algo == DIGEST_SHA256) {
+        sha256_update(&d->u.sha256, data, size);
+        return;
+    }
+
+    const uint8_t *p = data;
+    d->u.md.length += size;
+
+    if (d->u.md.buf_len) {
+        size_t n = 64 - d->u.md.buf_len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(&d->u.md.buf[d->u.md.buf_len], p, n);
+        d->u.md.buf_len += n;
+        p += n;
+        size -= n;
+        if (d->u.md.buf_len < 64) {
+            return;
+        }
+        digest_blocks(d, d->u.md.buf, 1);
+        d->u.md.buf_len = 0;
+    }
+
+    if (size >= 64) {
+        digest_blocks(d, p, size / 64);
+        p += size & ~(size_t)63;
+        size &= 63;
+    }
+
+    memcpy(d->u.md.buf, p, size);
+    d->u.md.buf_len = size;
+}
+
+void digest_final(digest_t *d, uint8_t *out) {
+    if (d->algo == DIGEST_SHA256) {
+        sha256_final(&d->u.sha256, out);
+        return;
+    }
+
+    uint64_t bits = d->u.md.length * 8;
+    uint8_t *buf = d->u.md.buf;
+    size_t len = d->u.md.buf_len;
+
+    buf[len++] = 0x80;
+    if (len > 56) {
+        memset(&buf[len], 0, 64 - len);
+        digest_blocks(d, buf, 1);
+        len = 0;
+    }
+    memset(&buf[len], 0, 56 - len);
+
+    // MD5 is little-endian throughout, SHA-1 big-endian
+    bool le = (d->algo == DIGEST_MD5);
+    for (int i = 0; i < 8; i++) {
+        buf[56 + i] = le ? bits >> (8*i) : bits >> (56 - 8*i);
+    }
+    digest_blocks(d, buf, 1);
+
+    int words = le ? 4 : 5;
+    for (int i = 0; i < words; i++) {
+        uint32_t v = d->u.md.state[i];
+        for (int j = 0; j < 4; j++) {
+            out[4*i + j] = le ? v >> (8*j) : v >> (24 - 8*j);
+        }
+    }
+}
+
+void digest_hex(const uint8_t *digest, size_t size, char *out) {
+    static const char digits[16] = "0123456789abcdef";
+    for (size_t i = 0; i < size; i++) {
+        out[2*i] = digits[digest[i] >> 4];
+        out[2*i+1] = digits[digest[i] & 0xf];
+    }
+    out[2*size] = '\0';
+}
@@ -0,0 +1,48 @@
+/*
+ * Selectable cryptographic digests for acquisition hashes
+ *
+ * MD5 and SHA-1 are only here because acquisition records still ask for
+ * them, SHA-256 comes from sha256.c.
+ */
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include "sha256.h"
+#include <stdint.h>
+#include <stddef.h>
+
+enum digest_algo {
+    DIGEST_NONE = 0,
+    DIGEST_MD5,
+    DIGEST_SHA1,
+    DIGEST_SHA256,
+};
+
+#define DIGEST_MAX_SIZE 32
+
+typedef struct digest {
+    int algo;
+    union {
+        struct {
+            uint32_t state[5];
+            uint64_t length;
+            uint8_t buf[64];
+            size_t buf_len;
+        } md;               // MD5 and SHA-1 share the Merkle-Damgard framing
+        sha256_t sha256;
+    } u;
+} digest_t;
+
+// DIGEST_NONE for an unknown name
+int digest_parse(const char *name);
+const char *digest_name(int algo);
+size_t digest_size(int algo);
+
+void digest_init(digest_t *d, int algo);
+void digest_update(digest_t *d, const void *data, size_t size);
+void digest_final(digest_t *d, uint8_t *out);
+
+// Lowercase hex of a digest_size(algo) digest, out holds 2*size+1
+void digest_hex(const uint8_t *digest, size_t size, char *out);
+
+#endif
@@ -0,0 +1,376 @@
+/*
+ * Single-bit error correction of metadata commits
+ */
+#include "ecc.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "parallel.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ECC_GRAIN 16
+#define ECC_MAX_ROUNDS 4
+#define ECC_MAX_FIXES_PER_BLOCK 8
+
+// lfs_crc is the reflected CRC-32 without a final xor
+#define ECC_POLY 0xedb88320
+
+// Open addressed map from syndrome to bit distance from the end of a commit
+typedef struct ecc_table {
+    uint32_t *syndromes;
+    uint32_t *distances;
+    size_t mask;
+    uint32_t max_bits;
+} ecc_table_t;
+
+struct ecc_job {
+    const ecc_table_t *table;
+    uint8_t *image;
+    lfs_size_t block_size;
+    lfs_block_t *blocks;
+    ecc_report_t *report;
+    pthread_mutex_t lock;
+    size_t fixed;
+};
+
+static inline size_t ecc_hash(uint32_t syndrome, size_t mask) {
+    return ((size_t)syndrome * 0x9e3779b1u) & mask;
+}
+
+static int ecc_table_build(ecc_table_t *t, lfs_size_t block_size) {
+    // a commit, including the revision count, never spans more than a block
+    t->max_bits = 8 * block_size;
+
+    size_t size = 1;
+    while (size < 2 * (size_t)t->max_bits) {
+        size <<= 1;
+    }
+    t->mask = size - 1;
+    t->syndromes = calloc(size, sizeof(uint32_t));
+    t->distances = malloc(size * sizeof(uint32_t));
+    if (!t->syndromes || !t->distances) {
+        free(t->syndromes);
+        free(t->distances);
+        return LFS_ERR_NOMEM;
+    }
+
+    // a bit flipped k steps before the end of the message changes the
+    // final crc by the bit-at-position-0 pattern shifted through k steps,
+    // single-bit syndromes are never zero so zero marks an empty slot
+    uint32_t s = 1;
+    for (uint32_t k = 1; k <= t->max_bits; k++) {
+        s = (s >> 1) ^ ((s & 1) ? ECC_POLY : 0);
+
+        size_t i = ecc_hash(s, t->mask);
+        while (t->syndromes[i]) {
+            i = (i + 1) & t->mask;
+        }
+        t->syndromes[i] = s;
+        t->distances[i] = k;
+    }
+
+    return 0;
+}
+
+static void ecc_table_free(ecc_table_t *t) {
+    free(t->syndromes);
+    free(t->distances);
+}
+
+static bool ecc_table_lookup(const ecc_table_t *t, uint32_t syndrome,
+        uint32_t *distance) {
+    size_t i = ecc_hash(syndrome, t->mask);
+    while (t->syndromes[i]) {
+        if (t->syndromes[i] == syndrome) {
+            *distance = t->distances[i];
+            return true;
+        }
+        i = (i + 1) & t->mask;
+    }
+    return false;
+}
+
+static uint32_t ecc_commits(const uint8_t *block, lfs_size_t block_size,
+        ondisk_cursor_t *cur) {
+    ondisk_commit_t commit;
+    ondisk_cursor_init(cur, block, block_size);
+    while (ondisk_next_commit(cur, &commit)) {
+    }
+    return cur->commits;
+}
+
+// A log that stops between commits is only really finished if nothing was
+// programmed after it, otherwise the next tag's valid bit may have flipped
+static bool ecc_log_finished(const uint8_t *block, lfs_size_t block_size,
+        const ondisk_cursor_t *cur) {
+    if (cur->stop != ONDISK_STOP_ERASED) {
+        return false;
+    }
+
+    for (lfs_off_t off = cur->stop_off; off < block_size; off++) {
+        if (block[off] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Flips one bit and keeps it only if more commits validate afterwards
+static bool ecc_try_flip(uint8_t *block, lfs_size_t block_size,
+        uint32_t commits, lfs_off_t off, uint8_t bit, ecc_fix_t *fix) {
+    if (off >= block_size) {
+        return false;
+    }
+
+    uint8_t before = block[off];
+    block[off] ^= 1U << bit;
+
+    ondisk_cursor_t cur;
+    if (ecc_commits(block, block_size, &cur) > commits) {
+        fix->off = off;
+        fix->bit = bit;
+        fix->before = before;
+        fix->after = block[off];
+        fix->commit = commits;
+        return true;
+    }
+
+    block[off] = before;
+    return false;
+}
+
+// O(1) path, the walk reached the crc tag so the commit's extent is known
+static bool ecc_fix_syndrome(const ecc_table_t *t, uint8_t *block,
+        lfs_size_t block_size, const ondisk_cursor_t *cur, ecc_fix_t *fix) {
+    if (cur->stop != ONDISK_STOP_BADCRC) {
+        return false;
+    }
+
+    // the first commit's crc also covers the revision count at offset 0
+    lfs_off_t start = (cur->commits == 0) ? 0 : cur->off;
+    lfs_off_t end = cur->stop_off + sizeof(lfs_tag_t);
+    if (end + sizeof(uint32_t) > block_size) {
+        return false;
+    }
+
+    uint32_t crc = lfs_crc(0xffffffff, &block[start], end - start);
+    uint32_t syndrome = crc ^ ondisk_le32(&block[end]);
+
+    // a single differing bit means the stored crc itself took the hit
+    if (lfs_popc(syndrome) == 1) {
+        uint32_t b = lfs_ctz(syndrome);
+        return ecc_try_flip(block, block_size, cur->commits,
+                end + b/8, b%8, fix);
+    }
+
+    uint32_t distance;
+    uint32_t bits = 8 * (end - start);
+    if (!ecc_table_lookup(t, syndrome, &distance) || distance > bits) {
+        return false;
+    }
+
+    uint32_t i = bits - distance;
+    return ecc_try_flip(block, block_size, cur->commits,
+            start + i/8, i%8, fix);
+}
+
+// A flip in a tag's size or valid bit derails the walk before it reaches
+// the crc, so the commit's length is unknown and the syndrome can't be
+// used. Only the tag words parsed so far can be the culprit, try those.
+static bool ecc_fix_tags(uint8_t *block, lfs_size_t block_size,
+        const ondisk_cursor_t *cur, ecc_fix_t *fix) {
+    lfs_off_t off = cur->off;
+    lfs_tag_t ptag = cur->ptag;
+
+    while (off <= cur->stop_off && off + sizeof(lfs_tag_t) <= block_size) {
+        lfs_tag_t tag = ondisk_be32(&block[off]) ^ ptag;
+
+        for (int b = 0; b < 32; b++) {
+            // tags are stored big-endian
+            if (ecc_try_flip(block, block_size, cur->commits,
+                    off + 3 - b/8, b%8, fix)) {
+                return true;
+            }
+        }
+
+        if (!ondisk_tag_isvalid(tag)) {
+            break;
+        }
+        ptag = tag;
+        off += ondisk_tag_dsize(tag);
+    }
+
+    return false;
+}
+
+static void ecc_fix_range(void *data, size_t begin, size_t end) {
+    struct ecc_job *job = data;
+
+    for (size_t i = begin; i < end; i++) {
+        lfs_block_t block = job->blocks[i];
+        uint8_t *bdata = &job->image[(size_t)block * job->block_size];
+        ecc_fix_t fixes[ECC_MAX_FIXES_PER_BLOCK];
+        size_t count = 0;
+        bool uncorrectable = false;
+
+        // each fix only repairs one commit, keep going while later
+        // commits fail for the same reason
+        while (count < ECC_MAX_FIXES_PER_BLOCK) {
+            ondisk_cursor_t cur;
+            ecc_commits(bdata, job->block_size, &cur);
+            if (ecc_log_finished(bdata, job->block_size, &cur)) {
+                break;
+            }
+
+            ecc_fix_t *fix = &fixes[count];
+            if (ecc_fix_syndrome(job->table, bdata, job->block_size,
+                        &cur, fix) ||
+                    ecc_fix_tags(bdata, job->block_size, &cur, fix)) {
+                fix->block = block;
+                count++;
+            } else {
+                // leftovers past a clean end are usually an interrupted
+                // prog, not a bit error
+                uncorrectable = (cur.stop != ONDISK_STOP_ERASED);
+                break;
+            }
+        }
+
+        if (count == 0 && !uncorrectable) {
+            continue;
+        }
+
+        pthread_mutex_lock(&job->lock);
+        ecc_report_t *r = job->report;
+        if (r->count + count > r->capacity) {
+            size_t capacity = lfs_max(2*r->capacity, r->count + count);
+            ecc_fix_t *nfixes = realloc(r->fixes,
+                    capacity * sizeof(ecc_fix_t));
+            if (nfixes) {
+                r->fixes = nfixes;
+                r->capacity = capacity;
+            }
+        }
+        // the block is already corrected, the report must not pretend
+        // it wasn't
+        if (r->count + count <= r->capacity) {
+            memcpy(&r->fixes[r->count], fixes, count * sizeof(ecc_fix_t));
+            r->count += count;
+        } else {
+            r->nomem = true;
+        }
+        r->uncorrectable += uncorrectable;
+        job->fixed += count;
+        pthread_mutex_unlock(&job->lock);
+    }
+}
+
+static int ecc_fix_cmp(const void *a, const void *b) {
+    const ecc_fix_t *fa = a;
+    const ecc_fix_t *fb = b;
+    if (fa->block != fb->block) {
+        return (fa->block < fb->block) ? -1 : 1;
+    }
+    return (fa->off > fb->off) - (fa->off < fb->off);
+}
+
+int ecc_correct_image(uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, ecc_report_t *report) {
+    memset(report, 0, sizeof(*report));
+
+    ecc_table_t table;
+    int err = ecc_table_build(&table, block_size);
+    if (err) {
+        return err;
+    }
+
+    lfs_block_t *blocks = malloc(block_count * sizeof(lfs_block_t));
+    bool *done = calloc(block_count, sizeof(bool));
+    if (!blocks || !done) {
+        err = LFS_ERR_NOMEM;
+        goto cleanup;
+    }
+
+    struct ecc_job job = {
+        .table = &table,
+        .image = image,
+        .block_size = block_size,
+        .blocks = blocks,
+        .report = report,
+    };
+    pthread_mutex_init(&job.lock, NULL);
+
+    // only blocks that look like metadata are touched, a repaired
+    // directory may reference pairs we didn't know about, so rescan until
+    // nothing new turns up
+    for (int round = 0; round < ECC_MAX_ROUNDS; round++) {
+        salvage_t s;
+        err = salvage_scan(&s, image, block_size, block_count);
+        if (err) {
+            salvage_free(&s);
+            break;
+        }
+
+        size_t count = 0;
+        for (lfs_block_t i = 0; i < block_count; i++) {
+            const salvage_block_t *b = &s.blocks[i];
+            if (done[i] || b->stop == ONDISK_STOP_NONE ||
+                    (b->state == SALVAGE_NONE && !b->referenced)) {
+                continue;
+            }
+
+            ondisk_cursor_t cur = {
+                .stop = b->stop,
+                .stop_off = b->stop_off,
+            };
+            if (!ecc_log_finished(&image[(size_t)i * block_size],
+                    block_size, &cur)) {
+                blocks[count++] = i;
+                done[i] = true;
+            }
+        }
+        salvage_free(&s);
+
+        job.fixed = 0;
+        parallel_for(count, ECC_GRAIN, ecc_fix_range, &job);
+        if (job.fixed == 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_destroy(&job.lock);
+    if (report->count) {
+        qsort(report->fixes, report->count, sizeof(ecc_fix_t), ecc_fix_cmp);
+    }
+    if (report->nomem) {
+        err = LFS_ERR_NOMEM;
+    }
+
+cleanup:
+    free(blocks);
+    free(done);
+    ecc_table_free(&table);
+    return err;
+}
+
+void ecc_report_free(ecc_report_t *report) {
+    free(report->fixes);
+    memset(report, 0, sizeof(*report));
+}
+
+void ecc_print_report(const ecc_report_t *report, lfs_size_t block_size,
+        FILE *out) {
+    fprintf(out, "Bit error correction:\n");
+    for (size_t i = 0; i < report->count; i++) {
+        const ecc_fix_t *f = &report->fixes[i];
+        fprintf(out, "  [0x%08lx] block %lu +0x%04lx bit %u: "
+                "0x%02X -> 0x%02X (commit %lu)\n",
+                (unsigned long)((size_t)f->block * block_size + f->off),
+                (unsigned long)f->block, (unsigned long)f->off,
+                f->bit, f->before, f->after, (unsigned long)f->commit);
+    }
+    fprintf(out, "  Corrected bits: %lu\n", (unsigned long)report->count);
+    fprintf(out, "  Uncorrectable commits: %lu\n",
+            (unsigned long)report->uncorrectable);
+}
@@ -0,0 +1,48 @@
+/*
+ * Single-bit error correction of metadata commits
+ *
+ * CRC-32 is linear, so a commit that fails its crc check because of one
+ * flipped bit leaves a syndrome (computed crc xor stored crc) that depends
+ * only on how far the bit is from the end of the commit. A table from
+ * syndrome to distance, built once per block size, locates the bit in O(1).
+ *
+ * Corrections are applied to the in-memory copy of the image only, so
+ * lfs_mount and every later pass see the repaired metadata.
+ */
+#ifndef ECC_H
+#define ECC_H
+
+#include "lfs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct ecc_fix {
+    lfs_block_t block;
+    lfs_off_t off;          // byte offset within the block
+    uint8_t bit;            // bit number within the byte, 0 is the lsb
+    uint8_t before;
+    uint8_t after;
+    uint32_t commit;        // index of the commit that now validates
+} ecc_fix_t;
+
+typedef struct ecc_report {
+    ecc_fix_t *fixes;
+    size_t count;
+    size_t capacity;
+    size_t uncorrectable;   // failing commits no single bit flip explains
+    bool nomem;             // some fixes were applied but aren't listed
+} ecc_report_t;
+
+// Finds and repairs single-bit errors in every metadata block of image.
+// Returns 0 or a negative LFS_ERR code, the report must be freed with
+// ecc_report_free. On LFS_ERR_NOMEM the image may still have been
+// corrected, without the report saying where.
+int ecc_correct_image(uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, ecc_report_t *report);
+void ecc_report_free(ecc_report_t *report);
+void ecc_print_report(const ecc_report_t *report, lfs_size_t block_size,
+        FILE *out);
+
+#endif
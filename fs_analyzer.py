@@ -1,18 +1,49 @@
 from littlefs import LittleFS
 import subprocess
 import platform
+import sys
+
+# Turns optional switches into tool arguments, e.g. salvage=True -> --salvage
+def tool_flags(flags):
+    args = []
+    for name, value in flags.items():
+        if value is True:
+            args.append("--" + name.replace("_", "-"))
+        elif isinstance(value, list):
+            for item in value:
+                args += ["--" + name.replace("_", "-"), str(item)]
+        elif value not in (None, False):
+            args += ["--" + name.replace("_", "-"), str(value)]
+    return args
+
+# JSON Lines records stream straight to our stdout so consumers can start
+# before the tool finishes, banners would break the format
+def stream_jsonl(args, tool):
+    try:
+        subprocess.run(args, check=True)
+    except FileNotFoundError:
+        print(f"[!] '{tool}' binary not found.", file=sys.stderr)
+    except subprocess.CalledProcessError:
+        print(f"[!] '{tool}' failed.", file=sys.stderr)
+
+def list_files(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    # Use correct executable name depending on platform
+    list_tool = "littlefs_list.exe" if platform.system() == "Windows" else "./littlefs_list"
+
+    if flags.get("format") == "jsonl":
+        args = [list_tool, image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+        return stream_jsonl(args + tool_flags(flags), "littlefs_list")
 
-def list_files(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16):
     print("");
     print(f"Listing files in: {image_path}")
     print("")
 
-    # Use correct executable name depending on platform
-    list_tool = "littlefs_list.exe" if platform.system() == "Windows" else "./littlefs_list"
+    args = [list_tool, image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
 
     try:
         result = subprocess.run(
-            [list_tool, image_path, str(block_size), str(block_count), str(read_size), str(prog_size)],
+            args,
             capture_output=True,
             text=True,
             check=True
@@ -25,21 +56,29 @@ def list_files(image_path, block_size=4096, block_count=16, read_size=16, prog_s
         print(f"[!] Error running 'littlefs_list': {e.stderr}")
         
 
-def print_structures(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, dump_blocks=None):
-    print(f"Printing data-structure information from: {image_path}")
+def print_structures(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, dump_blocks=None, **flags):
+    jsonl = flags.get("format") == "jsonl"
+    if not jsonl:
+        print(f"Printing data-structure information from: {image_path}")
     
     if dump_blocks is None:
         dump_blocks = 8
 
     # Do not try to dump more blocks than exist
-    if dump_blocks > block_count:
+    if dump_blocks > block_count and not jsonl:
         print(f"[!] The filesystem has only {block_count} blocks, but you requested {dump_blocks}.")
         print(f"    Proceeding to dump {block_count} blocks instead.")
         dump_blocks = block_count
 
+    args = ["./littlefs_struct", image_path, str(block_size), str(block_count), str(read_size), str(prog_size), str(dump_blocks)]
+    args += tool_flags(flags)
+
+    if jsonl:
+        return stream_jsonl(args, "littlefs_struct")
+
     try:
         result = subprocess.run(
-            ["./littlefs_struct", image_path, str(block_size), str(block_count), str(read_size), str(prog_size), str(dump_blocks)],
+            args,
             capture_output=True,
             text=True,
             check=True
@@ -52,12 +91,18 @@ def print_structures(image_path, block_size=4096, block_count=16, read_size=16,
         print(f"[!] Error: {e.stderr}")
 
 
-def recover_deleted(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16):
+def recover_deleted(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    args = ["./littlefs_recover", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_recover")
+
     print(f"Recovering deleted data from: {image_path}")
 
     try:
         result = subprocess.run(
-            ["./littlefs_recover", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)],
+            args,
             capture_output=True,
             text=True,
             check=True
@@ -69,3 +114,159 @@ def recover_deleted(image_path, block_size=4096, block_count=16, read_size=16, p
     except FileNotFoundError:
         print("[!] 'littlefs_recover' tool is missing or not compiled.")
 
+
+def verify_image(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    print(f"Verifying filesystem integrity of: {image_path}")
+    print("")
+
+    args = ["./littlefs_verify", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_verify' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error verifying image: {e.stderr}")
+
+
+def extract_files(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, out="extracted", **flags):
+    print(f"Extracting files from: {image_path} to {out}")
+    print("")
+
+    args = ["./littlefs_extract", image_path, str(block_size), str(block_count), str(read_size), str(prog_size), "--out", out]
+    args += tool_flags(flags)
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_extract' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(e.stdout)
+        print(f"[!] Error extracting files: {e.stderr}")
+
+
+def hash_files(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    args = ["./littlefs_hash", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_hash")
+
+    print(f"Hashing every file in: {image_path}")
+    print("")
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_hash' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error hashing files: {e.stderr}")
+
+
+def find_partitions(image_path, **flags):
+    args = ["./littlefs_partitions", image_path]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_partitions")
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_partitions' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error scanning for partitions: {e.stderr}")
+
+
+def index_image(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    args = ["./littlefs_index", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_index")
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_index' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error indexing image: {e.stderr}")
+
+
+def diff_images(image_path, other_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    args = ["./littlefs_diff", image_path, other_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_diff")
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_diff' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error comparing images: {e.stderr}")
+
+def search_image(image_path, block_size=4096, block_count=16, read_size=16, prog_size=16, **flags):
+    args = ["./littlefs_search", image_path, str(block_size), str(block_count), str(read_size), str(prog_size)]
+    args += tool_flags(flags)
+
+    if flags.get("format") == "jsonl":
+        return stream_jsonl(args, "littlefs_search")
+
+    try:
+        result = subprocess.run(
+            args,
+            capture_output=True,
+            text=True,
+            check=True
+        )
+        print(result.stdout)
+
+    except FileNotFoundError:
+        print("[!] 'littlefs_search' binary not found.")
+    except subprocess.CalledProcessError as e:
+        print(f"[!] Error searching image: {e.stderr}")
@@ -0,0 +1,169 @@
+/*
+ * Similarity hashing of blocks and carved objects
+ */
+#include "fuzzy.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZY_GRAIN 16
+#define FUZZY_WINDOW 8
+#define FUZZY_BANDS (FUZZY_SLOTS / FUZZY_BAND)
+
+// splitmix64's finalizer, every input bit reaches every output bit
+static uint64_t fuzzy_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+void fuzzy_hash(const uint8_t *data, size_t size, fuzzy_sig_t *sig) {
+    uint32_t filled = 0;
+    memset(sig, 0, sizeof(*sig));
+
+    for (size_t i = 0; i + FUZZY_WINDOW <= size; i++) {
+        uint64_t w;
+        memcpy(&w, &data[i], sizeof(w));
+        if (w == UINT64_MAX) {
+            continue;
+        }
+
+        // the top bits pick the slot, the low word competes in it
+        uint64_t h = fuzzy_mix(w);
+        unsigned k = h >> (64 - 5);
+        uint32_t v = (uint32_t)h;
+        if (!(filled & (1u << k)) || v < sig->slot[k]) {
+            sig->slot[k] = v;
+            filled |= 1u << k;
+        }
+        sig->windows += 1;
+    }
+
+    if (!filled) {
+        sig->windows = 0;
+        return;
+    }
+
+    // a small fragment leaves slots empty, they borrow from the next
+    // filled slot so two fragments with the same windows still agree
+    for (unsigned k = 0; k < FUZZY_SLOTS; k++) {
+        if (filled & (1u << k)) {
+            continue;
+        }
+        unsigned d = 1;
+        while (!(filled & (1u << ((k + d) % FUZZY_SLOTS)))) {
+            d++;
+        }
+        sig->slot[k] = sig->slot[(k + d) % FUZZY_SLOTS] + d*0x9e3779b9u;
+    }
+}
+
+struct fuzzy_job {
+    const fuzzy_range_t *ranges;
+    fuzzy_sig_t *sigs;
+};
+
+static void fuzzy_hash_range(void *data, size_t begin, size_t end) {
+    struct fuzzy_job *job = data;
+    for (size_t i = begin; i < end; i++) {
+        fuzzy_hash(job->ranges[i].data, job->ranges[i].size, &job->sigs[i]);
+    }
+}
+
+void fuzzy_hash_ranges(const fuzzy_range_t *ranges, size_t count,
+        fuzzy_sig_t *sigs) {
+    struct fuzzy_job job = {ranges, sigs};
+    parallel_for(count, FUZZY_GRAIN, fuzzy_hash_range, &job);
+}
+
+unsigned fuzzy_similarity(const fuzzy_sig_t *a, const fuzzy_sig_t *b) {
+    if (!a->windows || !b->windows) {
+        return 0;
+    }
+
+    unsigned same = 0;
+    for (unsigned k = 0; k < FUZZY_SLOTS; k++) {
+        same += (a->slot[k] == b->slot[k]);
+    }
+    return same * 100 / FUZZY_SLOTS;
+}
+
+struct fuzzy_bucket {
+    uint64_t key;
+    size_t index;
+};
+
+static int fuzzy_bucket_cmp(const void *a, const void *b) {
+    const struct fuzzy_bucket *ba = a;
+    const struct fuzzy_bucket *bb = b;
+    if (ba->key != bb->key) {
+        return (ba->key > bb->key) - (ba->key < bb->key);
+    }
+    return (ba->index > bb->index) - (ba->index < bb->index);
+}
+
+static size_t fuzzy_find(size_t *rep, size_t i) {
+    while (rep[i] != i) {
+        rep[i] = rep[rep[i]];
+        i = rep[i];
+    }
+    return i;
+}
+
+int fuzzy_cluster(const fuzzy_sig_t *sigs, size_t count, unsigned threshold,
+        size_t *rep) {
+    for (size_t i = 0; i < count; i++) {
+        rep[i] = i;
+    }
+
+    struct fuzzy_bucket *buckets = malloc(
+            (count + 1) * sizeof(struct fuzzy_bucket));
+    if (!buckets) {
+        return LFS_ERR_NOMEM;
+    }
+
+    for (unsigned band = 0; band < FUZZY_BANDS; band++) {
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!sigs[i].windows) {
+                continue;
+            }
+            uint64_t key = band;
+            for (unsigned k = 0; k < FUZZY_BAND; k++) {
+                key = fuzzy_mix(key ^ sigs[i].slot[band*FUZZY_BAND + k]);
+            }
+            buckets[n++] = (struct fuzzy_bucket){key, i};
+        }
+        qsort(buckets, n, sizeof(struct fuzzy_bucket), fuzzy_bucket_cmp);
+
+        // each member of a bucket is only compared with its first, so a
+        // bucket of identical blocks costs one comparison per block
+        for (size_t i = 0; i < n;) {
+            size_t j = i + 1;
+            for (; j < n && buckets[j].key == buckets[i].key; j++) {
+                size_t a = fuzzy_find(rep, buckets[i].index);
+                size_t b = fuzzy_find(rep, buckets[j].index);
+                if (a == b || fuzzy_similarity(&sigs[buckets[i].index],
+                        &sigs[buckets[j].index]) < threshold) {
+                    continue;
+                }
+                // the lower index stays the root, so it represents
+                if (a < b) {
+                    rep[b] = a;
+                } else {
+                    rep[a] = b;
+                }
+            }
+            i = j;
+        }
+    }
+    free(buckets);
+
+    for (size_t i = 0; i < count; i++) {
+        rep[i] = fuzzy_find(rep, i);
+    }
+    return 0;
+}
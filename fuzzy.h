@@ -0,0 +1,52 @@
+/*
+ * Similarity hashing of blocks and carved objects
+ *
+ * A fragment is reduced to the set of 8-byte windows it contains, and
+ * fragments sharing most of their windows are near copies: blocks of
+ * the same log file, a file rewritten in place, the same picture saved
+ * twice. The set is summarized by one-permutation MinHash, the smallest
+ * window hash in each of FUZZY_SLOTS slices of the hash space, so the
+ * fraction of slots two fingerprints agree on estimates how much of
+ * their content they share. Windows of erased fill are left out.
+ *
+ * Unlike ssdeep or TLSH digests, which are compared by an edit or
+ * bucket distance, fingerprints can be split into bands: fragments that
+ * agree on every slot of any band meet in the same bucket, so clustering
+ * only ever compares fragments that are likely similar.
+ */
+#ifndef FUZZY_H
+#define FUZZY_H
+
+#include "lfs.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define FUZZY_SLOTS 32
+#define FUZZY_BAND 2            // slots per band
+
+typedef struct fuzzy_sig {
+    uint32_t slot[FUZZY_SLOTS];
+    uint32_t windows;           // windows hashed, 0 leaves nothing to compare
+} fuzzy_sig_t;
+
+typedef struct fuzzy_range {
+    const uint8_t *data;
+    size_t size;
+} fuzzy_range_t;
+
+void fuzzy_hash(const uint8_t *data, size_t size, fuzzy_sig_t *sig);
+
+// Fingerprints every range in parallel
+void fuzzy_hash_ranges(const fuzzy_range_t *ranges, size_t count,
+        fuzzy_sig_t *sigs);
+
+// Percentage of slots that agree, 0 if either side has no windows
+unsigned fuzzy_similarity(const fuzzy_sig_t *a, const fuzzy_sig_t *b);
+
+// Groups fingerprints at least threshold percent similar to another one
+// of the group. rep[i] is the lowest index in i's group, i itself if it
+// is alone. Returns 0 or LFS_ERR_NOMEM.
+int fuzzy_cluster(const fuzzy_sig_t *sigs, size_t count, unsigned threshold,
+        size_t *rep);
+
+#endif
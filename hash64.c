@@ -0,0 +1,97 @@
+/*
+ * 64-bit non-cryptographic content hash
+ */
+#include "hash64.h"
+#include <string.h>
+
+#define HASH64_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH64_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH64_PRIME3 0x165667B19E3779F9ULL
+#define HASH64_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH64_PRIME5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t hash64_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash64_read64(const uint8_t *p) {
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+           ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+           ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+           ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+static inline uint32_t hash64_read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t hash64_round(uint64_t acc, uint64_t input) {
+    acc += input * HASH64_PRIME2;
+    acc = hash64_rotl(acc, 31);
+    return acc * HASH64_PRIME1;
+}
+
+static inline uint64_t hash64_merge(uint64_t acc, uint64_t val) {
+    acc ^= hash64_round(0, val);
+    return acc * HASH64_PRIME1 + HASH64_PRIME4;
+}
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        // four independent lanes keep the multipliers busy
+        uint64_t v1 = seed + HASH64_PRIME1 + HASH64_PRIME2;
+        uint64_t v2 = seed + HASH64_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH64_PRIME1;
+
+        const uint8_t *limit = end - 32;
+        do {
+            v1 = hash64_round(v1, hash64_read64(p));
+            v2 = hash64_round(v2, hash64_read64(p + 8));
+            v3 = hash64_round(v3, hash64_read64(p + 16));
+            v4 = hash64_round(v4, hash64_read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = hash64_rotl(v1, 1) + hash64_rotl(v2, 7) +
+            hash64_rotl(v3, 12) + hash64_rotl(v4, 18);
+        h = hash64_merge(h, v1);
+        h = hash64_merge(h, v2);
+        h = hash64_merge(h, v3);
+        h = hash64_merge(h, v4);
+    } else {
+        h = seed + HASH64_PRIME5;
+    }
+
+    h += (uint64_t)size;
+
+    while (p + 8 <= end) {
+        h ^= hash64_round(0, hash64_read64(p));
+        h = hash64_rotl(h, 27) * HASH64_PRIME1 + HASH64_PRIME4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h ^= (uint64_t)hash64_read32(p) * HASH64_PRIME1;
+        h = hash64_rotl(h, 23) * HASH64_PRIME2 + HASH64_PRIME3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h ^= (*p) * HASH64_PRIME5;
+        h = hash64_rotl(h, 11) * HASH64_PRIME1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= HASH64_PRIME2;
+    h ^= h >> 29;
+    h *= HASH64_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
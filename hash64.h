@@ -0,0 +1,16 @@
+/*
+ * 64-bit non-cryptographic content hash
+ *
+ * This is XXH64, so digests match other xxHash implementations and can be
+ * joined against tables produced elsewhere. Inputs are read as
+ * little-endian words.
+ */
+#ifndef HASH64_H
+#define HASH64_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint64_t hash64(const void *data, size_t size, uint64_t seed);
+
+#endif
@@ -0,0 +1,371 @@
+/*
+ * Sets of known digests
+ */
+#include "hashset.h"
+#include "digest.h"
+#include "parallel.h"
+#include "sidecar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHSET_HEADER 48
+#define HASHSET_GRAIN 16
+#define HASHSET_BLOOM_BITS 16
+#define HASHSET_PROBES 4
+
+// qsort has no context argument, so one comparator per digest size
+static int hashset_cmp16(const void *a, const void *b) {
+    return memcmp(a, b, 16);
+}
+
+static int hashset_cmp20(const void *a, const void *b) {
+    return memcmp(a, b, 20);
+}
+
+static int hashset_cmp32(const void *a, const void *b) {
+    return memcmp(a, b, 32);
+}
+
+static int hashset_algo_of(size_t size) {
+    switch (size) {
+        case 16: return DIGEST_MD5;
+        case 20: return DIGEST_SHA1;
+        case 32: return DIGEST_SHA256;
+        default: return DIGEST_NONE;
+    }
+}
+
+static int hashset_hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c |= 0x20;
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// Reads the digests of a text list, unsorted
+static int hashset_parse(hashset_t *set, FILE *f) {
+    size_t capacity = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), f)) {
+        // the digest may be quoted, as in CSV exports
+        const char *p = line;
+        while (*p == ' ' || *p == '\t' || *p == '"') {
+            p++;
+        }
+        size_t len = 0;
+        while (hashset_hex(p[len]) >= 0) {
+            len++;
+        }
+        // comments, headers and blank lines have no digest up front
+        int algo = hashset_algo_of(len / 2);
+        if (len % 2 || algo == DIGEST_NONE) {
+            continue;
+        }
+        if (set->algo == DIGEST_NONE) {
+            set->algo = algo;
+            set->size = len / 2;
+        } else if (algo != set->algo) {
+            return LFS_ERR_INVAL;
+        }
+
+        if (set->count == capacity) {
+            capacity = capacity ? 2*capacity : 4096;
+            uint8_t *digests = realloc(set->digests, capacity * set->size);
+            if (!digests) {
+                return LFS_ERR_NOMEM;
+            }
+            set->digests = digests;
+        }
+        uint8_t *d = &set->digests[set->count++ * set->size];
+        for (size_t i = 0; i < set->size; i++) {
+            d[i] = (hashset_hex(p[2*i]) << 4) | hashset_hex(p[2*i+1]);
+        }
+    }
+    return ferror(f) ? LFS_ERR_IO : 0;
+}
+
+static void hashset_sort(hashset_t *set) {
+    qsort(set->digests, set->count, set->size,
+            (set->size == 16) ? hashset_cmp16 :
+            (set->size == 20) ? hashset_cmp20 : hashset_cmp32);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        const uint8_t *d = &set->digests[i * set->size];
+        if (unique && memcmp(&set->digests[(unique-1) * set->size],
+                d, set->size) == 0) {
+            continue;
+        }
+        memmove(&set->digests[unique++ * set->size], d, set->size);
+    }
+    set->count = unique;
+}
+
+// Digests of the binary form, if f is one, with the stamp it was made from
+static int hashset_read(hashset_t *set, FILE *f, sidecar_stamp_t *stamp) {
+    uint8_t header[HASHSET_HEADER];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+            memcmp(header, "LFSSET1\0", 8) != 0 ||
+            sidecar_get32(&header[8]) != 1) {
+        return LFS_ERR_NOENT;
+    }
+
+    int algo = sidecar_get32(&header[12]);
+    size_t count = sidecar_get64(&header[16]);
+    sidecar_get_stamp(&header[24], stamp);
+    if (algo != DIGEST_MD5 && algo != DIGEST_SHA1 && algo != DIGEST_SHA256) {
+        return LFS_ERR_NOENT;
+    }
+
+    size_t size = digest_size(algo);
+    uint8_t *digests = malloc(count * size + 1);
+    if (!digests) {
+        return LFS_ERR_NOMEM;
+    }
+    if (fread(digests, size, count, f) != count) {
+        free(digests);
+        return LFS_ERR_NOENT;
+    }
+
+    set->algo = algo;
+    set->size = size;
+    set->digests = digests;
+    set->count = count;
+    return 0;
+}
+
+static int hashset_write(const hashset_t *set, const char *path,
+        const sidecar_stamp_t *stamp) {
+    sidecar_file_t out;
+    if (sidecar_create(&out, path) != 0) {
+        return LFS_ERR_IO;
+    }
+
+    uint8_t header[HASHSET_HEADER];
+    memcpy(&header[0], "LFSSET1\0", 8);
+    sidecar_put32(&header[8], 1);
+    sidecar_put32(&header[12], set->algo);
+    sidecar_put64(&header[16], set->count);
+    sidecar_put_stamp(&header[24], stamp);
+    fwrite(header, 1, sizeof(header), out.f);
+    fwrite(set->digests, set->size, set->count, out.f);
+    return sidecar_commit(&out);
+}
+
+static void hashset_probes(const hashset_t *set, const uint8_t *digest,
+        uint64_t probes[HASHSET_PROBES]) {
+    // digests are already uniform, their bytes serve as the hashes
+    for (int k = 0; k < HASHSET_PROBES; k++) {
+        uint32_t v;
+        memcpy(&v, &digest[4*k], sizeof(v));
+        probes[k] = v & set->bloom_mask;
+    }
+}
+
+static int hashset_bloom(hashset_t *set) {
+    uint64_t bits = 64;
+    while (bits < (uint64_t)set->count * HASHSET_BLOOM_BITS) {
+        bits <<= 1;
+    }
+    // probes are 32 bits wide
+    if (bits > ((uint64_t)1 << 32)) {
+        bits = (uint64_t)1 << 32;
+    }
+    set->bloom = calloc(bits / 64, sizeof(uint64_t));
+    if (!set->bloom) {
+        return LFS_ERR_NOMEM;
+    }
+    set->bloom_mask = bits - 1;
+
+    for (size_t i = 0; i < set->count; i++) {
+        uint64_t probes[HASHSET_PROBES];
+        hashset_probes(set, &set->digests[i * set->size], probes);
+        for (int k = 0; k < HASHSET_PROBES; k++) {
+            set->bloom[probes[k] / 64] |= (uint64_t)1 << (probes[k] % 64);
+        }
+    }
+    return 0;
+}
+
+int hashset_load(hashset_t *set, const char *path, int kind) {
+    memset(set, 0, sizeof(*set));
+    set->path = path;
+    set->kind = kind;
+
+    sidecar_stamp_t now;
+    int err = sidecar_stamp(&now, path);
+    if (err) {
+        return err;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return LFS_ERR_NOENT;
+    }
+
+    // a binary set is used as is, a list through its converted copy
+    sidecar_stamp_t made;
+    err = hashset_read(set, f, &made);
+    if (err == LFS_ERR_NOENT) {
+        char sidecar[1040];
+        snprintf(sidecar, sizeof(sidecar), "%s.lfsset", path);
+        FILE *g = fopen(sidecar, "rb");
+        if (g) {
+            err = hashset_read(set, g, &made);
+            fclose(g);
+            if (!err && !sidecar_stamp_equal(&made, &now)) {
+                free(set->digests);
+                set->digests = NULL;
+                err = LFS_ERR_NOENT;
+            }
+        }
+
+        if (err == LFS_ERR_NOENT) {
+            set->algo = DIGEST_NONE;
+            set->count = 0;
+            rewind(f);
+            err = hashset_parse(set, f);
+            if (!err && !set->count) {
+                err = LFS_ERR_INVAL;
+            }
+            if (!err) {
+                hashset_sort(set);
+                // a read-only location just means parsing again next time
+                hashset_write(set, sidecar, &now);
+            }
+        }
+    }
+    fclose(f);
+
+    if (!err) {
+        err = hashset_bloom(set);
+    }
+    if (err) {
+        hashset_free(set);
+    }
+    return err;
+}
+
+void hashset_free(hashset_t *set) {
+    free(set->digests);
+    free(set->bloom);
+    set->digests = NULL;
+    set->bloom = NULL;
+    set->count = 0;
+}
+
+int hashset_append(hashset_t **sets, size_t *count, const char *path,
+        int kind) {
+    hashset_t *nsets = realloc(*sets, (*count + 1) * sizeof(hashset_t));
+    if (!nsets) {
+        return LFS_ERR_NOMEM;
+    }
+    *sets = nsets;
+
+    int err = hashset_load(&nsets[*count], path, kind);
+    if (!err) {
+        *count += 1;
+    }
+    return err;
+}
+
+void hashset_free_all(hashset_t *sets, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        hashset_free(&sets[i]);
+    }
+    free(sets);
+}
+
+const char *hashset_error(int err) {
+    switch (err) {
+        case LFS_ERR_NOENT: return "not found";
+        case LFS_ERR_INVAL: return "no digests, or digests of mixed lengths";
+        case LFS_ERR_NOMEM: return "out of memory";
+        default:            return "read error";
+    }
+}
+
+bool hashset_contains(const hashset_t *set, const uint8_t *digest) {
+    uint64_t probes[HASHSET_PROBES];
+    hashset_probes(set, digest, probes);
+    for (int k = 0; k < HASHSET_PROBES; k++) {
+        if (!(set->bloom[probes[k] / 64] & ((uint64_t)1 << (probes[k] % 64)))) {
+            return false;
+        }
+    }
+
+    size_t lo = 0, hi = set->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = memcmp(&set->digests[mid * set->size], digest, set->size);
+        if (cmp == 0) {
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+struct hashset_job {
+    const hashset_t *sets;
+    size_t set_count;
+    const hashset_range_t *ranges;
+    int *match;
+    bool used[DIGEST_SHA256 + 1];
+};
+
+static int hashset_first(const struct hashset_job *job, int kind,
+        uint8_t digests[][DIGEST_MAX_SIZE]) {
+    for (size_t s = 0; s < job->set_count; s++) {
+        const hashset_t *set = &job->sets[s];
+        if (set->kind == kind && hashset_contains(set, digests[set->algo])) {
+            return s;
+        }
+    }
+    return HASHSET_NONE;
+}
+
+static void hashset_match_range(void *data, size_t begin, size_t end) {
+    struct hashset_job *job = data;
+
+    for (size_t i = begin; i < end; i++) {
+        const hashset_range_t *r = &job->ranges[i];
+        job->match[i] = HASHSET_NONE;
+        if (!r->data) {
+            continue;
+        }
+
+        uint8_t digests[DIGEST_SHA256 + 1][DIGEST_MAX_SIZE];
+        for (int algo = DIGEST_MD5; algo <= DIGEST_SHA256; algo++) {
+            if (job->used[algo]) {
+                digest_t d;
+                digest_init(&d, algo);
+                digest_update(&d, r->data, r->size);
+                digest_final(&d, digests[algo]);
+            }
+        }
+
+        job->match[i] = hashset_first(job, HASHSET_BAD, digests);
+        if (job->match[i] == HASHSET_NONE) {
+            job->match[i] = hashset_first(job, HASHSET_GOOD, digests);
+        }
+    }
+}
+
+void hashset_match(const hashset_t *sets, size_t set_count,
+        const hashset_range_t *ranges, size_t count, int *match) {
+    struct hashset_job job = {sets, set_count, ranges, match, {false}};
+    for (size_t s = 0; s < set_count; s++) {
+        job.used[sets[s].algo] = true;
+    }
+    parallel_for(count, HASHSET_GRAIN, hashset_match_range, &job);
+}
+
+const char *hashset_kind_name(int kind) {
+    return (kind == HASHSET_BAD) ? "bad" : "good";
+}
@@ -0,0 +1,81 @@
+/*
+ * Sets of known digests
+ *
+ * A hash set lists the digests of content that is already known: stock
+ * firmware and configuration that needn't be reviewed again, or
+ * malicious content to look out for. It is read from a text list, one
+ * hex MD5, SHA-1 or SHA-256 digest per line with anything after the
+ * digest ignored (the output of md5sum or sha256sum will do), or from
+ * the sorted binary form lists are converted to. That form is kept next
+ * to a list as <list>.lfsset and reused while the list's size and mtime
+ * match, so a list of millions of digests is only parsed once. All
+ * integers are little-endian:
+ *
+ *   8 bytes  magic "LFSSET1\0"
+ *   4 bytes  format version, currently 1
+ *   4 bytes  enum digest_algo
+ *   8 bytes  number of digests
+ *   8 bytes  list file size, 0 for a standalone set
+ *   8 bytes  list mtime, seconds
+ *   8 bytes  list mtime, nanoseconds
+ *   digests  ascending and unique, digest_size bytes each
+ *
+ * Lookups first test a Bloom filter built on load, 16 bits and 4 probes
+ * per digest taken straight from the digest's bytes, so content that is
+ * in no set, nearly all of it, never pays for a binary search.
+ */
+#ifndef HASHSET_H
+#define HASHSET_H
+
+#include "lfs.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+enum hashset_kind {
+    HASHSET_GOOD = 0,       // known good, left out of recovery
+    HASHSET_BAD,            // known bad, reported wherever it is found
+};
+
+#define HASHSET_NONE (-1)
+
+typedef struct hashset {
+    const char *path;
+    int kind;               // enum hashset_kind
+    int algo;               // enum digest_algo
+    size_t size;            // digest size
+    uint8_t *digests;
+    size_t count;
+    uint64_t *bloom;
+    uint64_t bloom_mask;    // bits - 1
+} hashset_t;
+
+typedef struct hashset_range {
+    const uint8_t *data;    // NULL is never matched
+    size_t size;
+} hashset_range_t;
+
+// Returns LFS_ERR_NOENT for a missing list, LFS_ERR_INVAL for a list
+// with no digests or digests of different lengths
+int hashset_load(hashset_t *set, const char *path, int kind);
+void hashset_free(hashset_t *set);
+
+// Loads a set onto the end of a growing array of sets
+int hashset_append(hashset_t **sets, size_t *count, const char *path,
+        int kind);
+void hashset_free_all(hashset_t *sets, size_t count);
+
+// Why a set failed to load, for messages
+const char *hashset_error(int err);
+
+bool hashset_contains(const hashset_t *set, const uint8_t *digest);
+
+// For every range, the index of the first set its digest is in, known
+// bad sets tried before known good ones, or HASHSET_NONE. Each digest
+// algorithm the sets use is run once per range, ranges in parallel.
+void hashset_match(const hashset_t *sets, size_t set_count,
+        const hashset_range_t *ranges, size_t count, int *match);
+
+const char *hashset_kind_name(int kind);
+
+#endif
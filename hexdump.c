@@ -0,0 +1,162 @@
+/*
+ * Buffered hex/ASCII dump formatter
+ */
+#include "hexdump.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HEXDUMP_BUFFER_SIZE (256*1024)
+#define HEXDUMP_LINE_MAX 96
+
+static const char hexdump_digits[16] = "0123456789ABCDEF";
+
+// 1 for bytes that count as text: printable ASCII, '\n' and '\r'
+static const uint8_t hexdump_text[256] = {
+    0,0,0,0,0,0,0,0, 0,0,1,0,0,1,0,0, 0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,
+    1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,0,
+};
+
+// The ASCII column, '.' for anything that isn't printable
+static char hexdump_ascii(uint8_t c) {
+    return (c >= 0x20 && c < 0x7f) ? (char)c : '.';
+}
+
+bool hexdump_init(hexdump_t *h, FILE *out, bool collapse) {
+    memset(h, 0, sizeof(*h));
+    h->out = out;
+    h->collapse = collapse;
+    h->buf = malloc(HEXDUMP_BUFFER_SIZE);
+    if (!h->buf) {
+        return false;
+    }
+    h->capacity = HEXDUMP_BUFFER_SIZE;
+    return true;
+}
+
+void hexdump_free(hexdump_t *h) {
+    hexdump_flush(h);
+    free(h->buf);
+    memset(h, 0, sizeof(*h));
+}
+
+void hexdump_flush(hexdump_t *h) {
+    if (h->len) {
+        fwrite(h->buf, 1, h->len, h->out);
+        h->len = 0;
+    }
+}
+
+static char *hexdump_reserve(hexdump_t *h, size_t size) {
+    if (h->len + size > h->capacity) {
+        hexdump_flush(h);
+    }
+    return &h->buf[h->len];
+}
+
+static char *hexdump_offset(char *p, size_t off) {
+    int digits = (off > 0xffffffff) ? 16 : 8;
+    for (int i = digits - 1; i >= 0; i--) {
+        p[i] = hexdump_digits[off & 0xf];
+        off >>= 4;
+    }
+    return p + digits;
+}
+
+static bool hexdump_erased(const uint8_t *data, size_t size) {
+    uint8_t all = 0xFF;
+    for (size_t i = 0; i < size; i++) {
+        all &= data[i];
+    }
+    return all == 0xFF;
+}
+
+void hexdump_lines(hexdump_t *h, const uint8_t *data, size_t size,
+        size_t base) {
+    h->collapsed = false;
+
+    for (size_t off = 0; off < size; off += 16) {
+        size_t n = (size - off < 16) ? size - off : 16;
+        const uint8_t *line = &data[off];
+
+        if (h->collapse && n == 16 && hexdump_erased(line, n)) {
+            // keep the first erased line so the run has a visible start
+            if (h->collapsed) {
+                continue;
+            }
+            if (off > 0 && hexdump_erased(line - 16, 16)) {
+                char *p = hexdump_reserve(h, 2);
+                p[0] = '*';
+                p[1] = '\n';
+                h->len += 2;
+                h->collapsed = true;
+                continue;
+            }
+        } else {
+            h->collapsed = false;
+        }
+
+        // 00000000  XX XX XX XX XX XX XX XX  XX XX XX XX XX XX XX XX  |................|
+        char *start = hexdump_reserve(h, HEXDUMP_LINE_MAX);
+        char *p = hexdump_offset(start, base + off);
+        *p++ = ' ';
+        for (size_t i = 0; i < 16; i++) {
+            if (i % 8 == 0) {
+                *p++ = ' ';
+            }
+            if (i < n) {
+                *p++ = hexdump_digits[line[i] >> 4];
+                *p++ = hexdump_digits[line[i] & 0xf];
+            } else {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+            *p++ = ' ';
+        }
+        *p++ = ' ';
+        *p++ = '|';
+        for (size_t i = 0; i < n; i++) {
+            *p++ = hexdump_ascii(line[i]);
+        }
+        *p++ = '|';
+        *p++ = '\n';
+        h->len += p - start;
+    }
+
+    // a trailing run would otherwise hide where the dump ends
+    if (h->collapsed) {
+        char *start = hexdump_reserve(h, 18);
+        char *p = hexdump_offset(start, base + size);
+        *p++ = '\n';
+        h->len += p - start;
+        h->collapsed = false;
+    }
+}
+
+void hexdump_bytes(hexdump_t *h, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        char *p = hexdump_reserve(h, 3);
+        p[0] = hexdump_digits[data[i] >> 4];
+        p[1] = hexdump_digits[data[i] & 0xf];
+        p[2] = ' ';
+        h->len += 3;
+    }
+}
+
+bool hexdump_printable(const uint8_t *data, size_t size) {
+    // branch once per chunk so the inner loop stays straight-line
+    size_t off = 0;
+    while (off < size) {
+        size_t n = (size - off < 64) ? size - off : 64;
+        uint8_t ok = 1;
+        for (size_t i = 0; i < n; i++) {
+            ok &= hexdump_text[data[off + i]];
+        }
+        if (!ok) {
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
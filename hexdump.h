@@ -0,0 +1,42 @@
+/*
+ * Buffered hex/ASCII dump formatter
+ *
+ * Lines are formatted with lookup tables into one large buffer and written
+ * out with a few big fwrite calls, instead of a printf per byte. Output
+ * goes through the same FILE as the caller's printf calls, so the two
+ * interleave correctly as long as hexdump_flush is called before switching.
+ */
+#ifndef HEXDUMP_H
+#define HEXDUMP_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct hexdump {
+    FILE *out;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    bool collapse;          // print runs of all-0xFF lines as a single "*"
+    bool collapsed;         // currently inside such a run
+} hexdump_t;
+
+// Returns false if the buffer can't be allocated
+bool hexdump_init(hexdump_t *h, FILE *out, bool collapse);
+// Flushes and releases the buffer
+void hexdump_free(hexdump_t *h);
+void hexdump_flush(hexdump_t *h);
+
+// Offset/hex/ASCII lines, 16 bytes each, offsets counted from base
+void hexdump_lines(hexdump_t *h, const uint8_t *data, size_t size,
+        size_t base);
+
+// Space separated hex bytes on the current line, without a newline
+void hexdump_bytes(hexdump_t *h, const uint8_t *data, size_t size);
+
+// True if every byte is printable ASCII, a newline or a carriage return
+bool hexdump_printable(const uint8_t *data, size_t size);
+
+#endif
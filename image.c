@@ -0,0 +1,219 @@
+/*
+ * Loading an image file into memory
+ */
+#include "image.h"
+#include "lfs.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// large enough that the hasher wakes up rarely, small enough that it
+// starts early
+#define IMAGE_CHUNK (4*1024*1024)
+
+// The reader publishes how far the buffer is filled, the hasher follows
+struct image_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const uint8_t *buf;
+    size_t loaded;
+    bool done;
+
+    digest_t d;
+};
+
+static void *image_hasher(void *arg) {
+    struct image_pipe *p = arg;
+    size_t hashed = 0;
+
+    while (true) {
+        pthread_mutex_lock(&p->lock);
+        while (p->loaded == hashed && !p->done) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        size_t loaded = p->loaded;
+        bool done = p->done;
+        pthread_mutex_unlock(&p->lock);
+
+        // bytes below loaded are never written again, no lock needed
+        digest_update(&p->d, &p->buf[hashed], loaded - hashed);
+        hashed = loaded;
+        if (done) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void image_publish(struct image_pipe *p, size_t loaded, bool done) {
+    pthread_mutex_lock(&p->lock);
+    p->loaded = loaded;
+    p->done = done;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// Hashes up to len bytes of f that aren't kept, returns how many there were
+static uint64_t image_hash_skip(FILE *f, digest_t *d, uint64_t len) {
+    uint8_t *scratch = malloc(IMAGE_CHUNK);
+    if (!scratch) {
+        return 0;
+    }
+
+    uint64_t done = 0;
+    while (done < len) {
+        size_t want = (len - done > IMAGE_CHUNK) ? IMAGE_CHUNK : len - done;
+        size_t n = fread(scratch, 1, want, f);
+        digest_update(d, scratch, n);
+        done += n;
+        if (n < want) {
+            break;
+        }
+    }
+    free(scratch);
+    return done;
+}
+
+int image_load(uint8_t **image, const char *path, size_t size,
+        int algo, image_digest_t *digest) {
+    return image_load_at(image, path, 0, size, algo, digest);
+}
+
+int image_load_at(uint8_t **image, const char *path, uint64_t offset,
+        size_t size, int algo, image_digest_t *digest) {
+    memset(digest, 0, sizeof(*digest));
+    digest->algo = algo;
+    *image = NULL;
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return LFS_ERR_IO;
+    }
+
+    // the hash covers the whole file, so all of it is read. At offset 0
+    // the rest of the file lands in the buffer too, otherwise the bytes
+    // before and after the view only pass through the hash.
+    size_t file_size = size;
+    uint64_t tail = 0;
+    struct stat st;
+    if (algo != DIGEST_NONE && fstat(fileno(f), &st) == 0) {
+        if (offset == 0 && (size_t)st.st_size > size) {
+            file_size = st.st_size;
+        } else if ((uint64_t)st.st_size > offset + size) {
+            tail = st.st_size - offset - size;
+        }
+    }
+
+    uint8_t *buf = malloc(file_size ? file_size : 1);
+    if (!buf) {
+        fclose(f);
+        return LFS_ERR_NOMEM;
+    }
+
+    struct image_pipe p = {.buf = buf};
+    if (algo != DIGEST_NONE) {
+        digest_init(&p.d, algo);
+        pthread_mutex_init(&p.lock, NULL);
+        pthread_cond_init(&p.cond, NULL);
+    }
+
+    // the bytes before the view are hashed before the hasher starts on it
+    uint64_t skipped = 0;
+    if (offset && algo != DIGEST_NONE) {
+        skipped = image_hash_skip(f, &p.d, offset);
+    } else if (offset && fseeko(f, offset, SEEK_SET) != 0) {
+        fclose(f);
+        free(buf);
+        return LFS_ERR_IO;
+    }
+
+    pthread_t hasher;
+    bool threaded = false;
+    if (algo != DIGEST_NONE) {
+        threaded = (pthread_create(&hasher, NULL, image_hasher, &p) == 0);
+    }
+
+    size_t loaded = 0;
+    while (loaded < file_size) {
+        size_t want = file_size - loaded;
+        if (want > IMAGE_CHUNK) {
+            want = IMAGE_CHUNK;
+        }
+        size_t n = fread(&buf[loaded], 1, want, f);
+        loaded += n;
+        if (n < want) {
+            break;
+        }
+        if (threaded) {
+            image_publish(&p, loaded, false);
+        }
+    }
+
+    // only what was actually in the file is hashed
+    if (threaded) {
+        image_publish(&p, loaded, true);
+        pthread_join(hasher, NULL);
+    } else if (algo != DIGEST_NONE) {
+        digest_update(&p.d, buf, loaded);
+    }
+    if (tail) {
+        skipped += image_hash_skip(f, &p.d, tail);
+    }
+    int err = ferror(f) ? LFS_ERR_IO : 0;
+    fclose(f);
+
+    if (algo != DIGEST_NONE) {
+        uint8_t out[DIGEST_MAX_SIZE];
+        digest_final(&p.d, out);
+        digest_hex(out, digest_size(algo), digest->hex);
+        digest->size = skipped + loaded;
+        pthread_mutex_destroy(&p.lock);
+        pthread_cond_destroy(&p.cond);
+    }
+
+    if (err) {
+        free(buf);
+        return err;
+    }
+
+    if (loaded < size) {
+        memset(&buf[loaded], 0xFF, size - loaded);
+    }
+    *image = buf;
+    return 0;
+}
+
+void image_view_name(const char *path, uint64_t offset, char *out,
+        size_t len) {
+    if (offset) {
+        snprintf(out, len, "%s@0x%llx", path, (unsigned long long)offset);
+    } else {
+        snprintf(out, len, "%s", path);
+    }
+}
+
+void image_print_digest(const image_digest_t *digest, const char *path,
+        FILE *out) {
+    if (digest->algo == DIGEST_NONE) {
+        return;
+    }
+    fprintf(out, "Image %s: %s (%s, %llu bytes)\n\n", digest_name(digest->algo),
+            digest->hex, path, (unsigned long long)digest->size);
+}
+
+void image_json_digest(const image_digest_t *digest, const char *path,
+        jsonl_t *j) {
+    if (digest->algo == DIGEST_NONE) {
+        return;
+    }
+    jsonl_begin(j, "image");
+    jsonl_str(j, "path", path);
+    jsonl_uint(j, "size", digest->size);
+    jsonl_str(j, "algorithm", digest_name(digest->algo));
+    jsonl_str(j, "digest", digest->hex);
+    jsonl_end(j);
+}
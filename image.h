@@ -0,0 +1,49 @@
+/*
+ * Loading an image file into memory
+ *
+ * Every tool analyzes the image from one in-memory copy. When an
+ * acquisition hash is asked for, a second thread hashes the file as the
+ * reads land in that copy, so the hash costs no extra pass over the file.
+ * The hash covers the whole file, even past block_size*block_count.
+ *
+ * A littlefs partition inside a larger dump is analyzed in place by
+ * loading only its bytes, from its offset in the file, so every tool sees
+ * a view that starts at the partition's block 0.
+ */
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "digest.h"
+#include "jsonl.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct image_digest {
+    int algo;               // DIGEST_NONE if no hash was asked for
+    uint64_t size;          // bytes hashed, the size of the file
+    char hex[2*DIGEST_MAX_SIZE + 1];
+} image_digest_t;
+
+// Reads path into a new buffer of at least size bytes, anything the file
+// doesn't cover reads as erased (0xFF). Returns 0, LFS_ERR_IO if the file
+// can't be opened or read, or LFS_ERR_NOMEM.
+int image_load(uint8_t **image, const char *path, size_t size,
+        int algo, image_digest_t *digest);
+
+// Like image_load, for the size bytes at offset in the file
+int image_load_at(uint8_t **image, const char *path, uint64_t offset,
+        size_t size, int algo, image_digest_t *digest);
+
+// Name of a view for messages and sidecar files, path itself at offset 0,
+// "path@0x<offset>" otherwise
+void image_view_name(const char *path, uint64_t offset, char *out,
+        size_t len);
+
+// Report the hash, nothing is printed if none was asked for
+void image_print_digest(const image_digest_t *digest, const char *path,
+        FILE *out);
+void image_json_digest(const image_digest_t *digest, const char *path,
+        jsonl_t *j);
+
+#endif
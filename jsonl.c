@@ -0,0 +1,175 @@
+/*
+ * Streaming JSON Lines writer
+ */
+#include "jsonl.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSONL_BUFFER_SIZE (256*1024)
+// records are passed on once this much is pending
+#define JSONL_FLUSH_SIZE (64*1024)
+
+static const char jsonl_digits[16] = "0123456789abcdef";
+
+bool jsonl_init(jsonl_t *j, FILE *out) {
+    memset(j, 0, sizeof(*j));
+    j->out = out;
+    j->buf = malloc(JSONL_BUFFER_SIZE);
+    if (!j->buf) {
+        return false;
+    }
+    j->capacity = JSONL_BUFFER_SIZE;
+    return true;
+}
+
+void jsonl_free(jsonl_t *j) {
+    jsonl_flush(j);
+    free(j->buf);
+    memset(j, 0, sizeof(*j));
+}
+
+void jsonl_flush(jsonl_t *j) {
+    if (j->len) {
+        fwrite(j->buf, 1, j->len, j->out);
+        j->len = 0;
+    }
+    fflush(j->out);
+}
+
+static void jsonl_write(jsonl_t *j, const char *data, size_t size) {
+    if (j->len + size > j->capacity) {
+        fwrite(j->buf, 1, j->len, j->out);
+        j->len = 0;
+        if (size > j->capacity) {
+            fwrite(data, 1, size, j->out);
+            return;
+        }
+    }
+    memcpy(&j->buf[j->len], data, size);
+    j->len += size;
+}
+
+static void jsonl_quote(jsonl_t *j, const uint8_t *s, size_t size) {
+    jsonl_write(j, "\"", 1);
+
+    // copy runs of plain characters in one go
+    size_t run = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint8_t c = s[i];
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            continue;
+        }
+
+        jsonl_write(j, (const char *)&s[run], i - run);
+        run = i + 1;
+
+        char esc[6] = {'\\', 'u', '0', '0',
+                jsonl_digits[c >> 4], jsonl_digits[c & 0xf]};
+        switch (c) {
+            case '"':  jsonl_write(j, "\\\"", 2); break;
+            case '\\': jsonl_write(j, "\\\\", 2); break;
+            case '\n': jsonl_write(j, "\\n", 2); break;
+            case '\r': jsonl_write(j, "\\r", 2); break;
+            case '\t': jsonl_write(j, "\\t", 2); break;
+            // raw bytes aren't necessarily utf-8, keep them as code points
+            default:   jsonl_write(j, esc, sizeof(esc)); break;
+        }
+    }
+    jsonl_write(j, (const char *)&s[run], size - run);
+
+    jsonl_write(j, "\"", 1);
+}
+
+static void jsonl_key(jsonl_t *j, const char *key) {
+    if (!j->first) {
+        jsonl_write(j, ",", 1);
+    }
+    j->first = false;
+    jsonl_quote(j, (const uint8_t *)key, strlen(key));
+    jsonl_write(j, ":", 1);
+}
+
+void jsonl_begin(jsonl_t *j, const char *kind) {
+    jsonl_write(j, "{", 1);
+    j->first = true;
+    jsonl_str(j, "record", kind);
+}
+
+void jsonl_end(jsonl_t *j) {
+    jsonl_write(j, "}\n", 2);
+    if (j->len >= JSONL_FLUSH_SIZE) {
+        jsonl_flush(j);
+    }
+}
+
+void jsonl_str(jsonl_t *j, const char *key, const char *value) {
+    if (!value) {
+        jsonl_null(j, key);
+        return;
+    }
+    jsonl_strn(j, key, value, strlen(value));
+}
+
+void jsonl_strn(jsonl_t *j, const char *key, const void *value, size_t size) {
+    jsonl_key(j, key);
+    jsonl_quote(j, value, size);
+}
+
+void jsonl_uint(jsonl_t *j, const char *key, uint64_t value) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    jsonl_key(j, key);
+    jsonl_write(j, &digits[sizeof(digits) - n], n);
+}
+
+void jsonl_int(jsonl_t *j, const char *key, int64_t value) {
+    if (value >= 0) {
+        jsonl_uint(j, key, (uint64_t)value);
+        return;
+    }
+
+    char digits[21];
+    uint64_t v = -(uint64_t)value;
+    size_t n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    digits[sizeof(digits) - ++n] = '-';
+
+    jsonl_key(j, key);
+    jsonl_write(j, &digits[sizeof(digits) - n], n);
+}
+
+void jsonl_real(jsonl_t *j, const char *key, double value) {
+    if (!isfinite(value)) {
+        jsonl_null(j, key);
+        return;
+    }
+
+    char digits[32];
+    int n = snprintf(digits, sizeof(digits), "%.4f", value);
+    jsonl_key(j, key);
+    jsonl_write(j, digits, n);
+}
+
+void jsonl_bool(jsonl_t *j, const char *key, bool value) {
+    jsonl_key(j, key);
+    if (value) {
+        jsonl_write(j, "true", 4);
+    } else {
+        jsonl_write(j, "false", 5);
+    }
+}
+
+void jsonl_null(jsonl_t *j, const char *key) {
+    jsonl_key(j, key);
+    jsonl_write(j, "null", 4);
+}
@@ -0,0 +1,44 @@
+/*
+ * Streaming JSON Lines writer
+ *
+ * Each record is one JSON object on its own line, formatted into a large
+ * buffer and handed to the output FILE in big writes. The buffer is passed
+ * on whenever it fills and at every jsonl_flush, so consumers see records
+ * while the image is still being analyzed.
+ */
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct jsonl {
+    FILE *out;
+    char *buf;
+    size_t len;
+    size_t capacity;
+    bool first;             // no field written yet in the current record
+} jsonl_t;
+
+bool jsonl_init(jsonl_t *j, FILE *out);
+// Flushes and releases the buffer
+void jsonl_free(jsonl_t *j);
+void jsonl_flush(jsonl_t *j);
+
+// Starts a record, its first field is "record": kind
+void jsonl_begin(jsonl_t *j, const char *kind);
+void jsonl_end(jsonl_t *j);
+
+void jsonl_str(jsonl_t *j, const char *key, const char *value);
+// Arbitrary bytes, anything outside printable ASCII is escaped
+void jsonl_strn(jsonl_t *j, const char *key, const void *value, size_t size);
+void jsonl_uint(jsonl_t *j, const char *key, uint64_t value);
+void jsonl_int(jsonl_t *j, const char *key, int64_t value);
+// Four decimals, null if not finite
+void jsonl_real(jsonl_t *j, const char *key, double value);
+void jsonl_bool(jsonl_t *j, const char *key, bool value);
+void jsonl_null(jsonl_t *j, const char *key);
+
+#endif
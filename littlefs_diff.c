@@ -0,0 +1,868 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "parallel.h"
+#include "ecc.h"
+#include "image.h"
+#include "sha256.h"
+#include "jsonl.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define DIFF_GRAIN 4
+
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// A file or directory of one image, filled in by the tree walk
+struct fs_entry {
+    char *path;
+    uint16_t type;          // LFS_TYPE_REG or LFS_TYPE_DIR
+    lfs_size_t size;
+    bool ctz;
+    lfs_block_t head;       // CTZ files
+    const uint8_t *inline_data;
+    bool has_pair;
+    lfs_block_t pair[2];    // directories, lower block first
+
+    bool matched;
+    bool hashed;
+    int err;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+};
+
+// One of the two images, loaded and scanned on its own thread
+struct fs_side {
+    const char *path;
+    int image_hash;
+    bool ecc;
+
+    uint8_t *image;
+    image_digest_t digest;
+    ecc_report_t report;
+    bool ecc_ran;
+    salvage_t s;
+    bool scanned;
+    int err;
+
+    struct fs_entry *entries;
+    size_t count;
+    size_t capacity;
+};
+
+enum change_kind {
+    CHANGE_ADDED,
+    CHANGE_DELETED,
+    CHANGE_RENAMED,
+    CHANGE_GROWN,
+    CHANGE_TRUNCATED,
+    CHANGE_REWRITTEN,
+    CHANGE_UNREADABLE,      // a CTZ chain is corrupt, the content is unknown
+};
+
+static const char *change_names[] = {
+    "added", "deleted", "renamed", "grown", "truncated", "rewritten",
+    "unreadable",
+};
+
+struct change {
+    int kind;
+    const struct fs_entry *old;     // NULL if added
+    const struct fs_entry *new;     // NULL if deleted
+};
+
+struct changes {
+    struct change *list;
+    size_t count;
+    size_t capacity;
+};
+
+// A file whose path matched but whose CTZ head or size didn't, the
+// content decides how it changed
+struct compare_job {
+    const struct fs_side *a;
+    const struct fs_side *b;
+    struct fs_entry *old;
+    struct fs_entry *new;
+    int kind;               // -1 if the content turned out equal
+};
+
+// Contiguous spans of a file's data straight out of the image
+struct file_view {
+    const uint8_t *image;
+    const struct fs_entry *e;
+    lfs_block_t *blocks;
+    lfs_off_t count;
+};
+
+static void collect_entry(void *data, const salvage_info_t *info) {
+    struct fs_side *side = data;
+    const ondisk_entry_t *e = info->entry;
+    if (!e && info->type != LFS_TYPE_DIR) {
+        return;
+    }
+
+    if (side->count == side->capacity) {
+        size_t capacity = side->capacity ? 2*side->capacity : 64;
+        struct fs_entry *nentries = realloc(side->entries,
+                capacity * sizeof(struct fs_entry));
+        if (!nentries) {
+            fprintf(stderr, "[!] Out of memory, skipping %s\n", info->path);
+            return;
+        }
+        side->entries = nentries;
+        side->capacity = capacity;
+    }
+
+    struct fs_entry *entry = &side->entries[side->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->path = strdup(info->path);
+    if (!entry->path) {
+        fprintf(stderr, "[!] Out of memory, skipping %s\n", info->path);
+        return;
+    }
+    entry->type = info->type;
+    side->count += 1;
+
+    if (!e) {
+        return;
+    }
+    if (info->type == LFS_TYPE_DIR) {
+        lfs_block_t pair[2];
+        if (ondisk_entry_dirpair(e, pair)) {
+            entry->has_pair = true;
+            entry->pair[0] = lfs_min(pair[0], pair[1]);
+            entry->pair[1] = lfs_max(pair[0], pair[1]);
+        }
+    } else if (ondisk_entry_ctz(e, &entry->head, &entry->size)) {
+        entry->ctz = true;
+    } else if (e->struct_type == LFS_TYPE_INLINESTRUCT) {
+        entry->size = e->struct_size;
+        entry->inline_data = e->struct_data;
+    }
+}
+
+// Loads, corrects and scans one image, both sides run at the same time
+static void *load_side(void *arg) {
+    struct fs_side *side = arg;
+    size_t image_size = (size_t)block_size * block_count;
+
+    side->err = image_load_at(&side->image, side->path, image_offset,
+            image_size, side->image_hash, &side->digest);
+    if (side->err) {
+        return NULL;
+    }
+
+    if (side->ecc) {
+        side->ecc_ran = (ecc_correct_image(side->image, block_size,
+                block_count, &side->report) == 0);
+    }
+
+    side->err = salvage_scan(&side->s, side->image, block_size, block_count);
+    side->scanned = true;
+    if (side->err) {
+        return NULL;
+    }
+
+    salvage_walk(&side->s, collect_entry, side);
+    return NULL;
+}
+
+static void free_side(struct fs_side *side) {
+    for (size_t i = 0; i < side->count; i++) {
+        free(side->entries[i].path);
+    }
+    free(side->entries);
+    if (side->ecc_ran) {
+        ecc_report_free(&side->report);
+    }
+    if (side->scanned) {
+        salvage_free(&side->s);
+    }
+    free(side->image);
+}
+
+static int record_block(void *data, lfs_block_t block, lfs_off_t index) {
+    struct file_view *view = data;
+    view->blocks[index] = block;
+    return 0;
+}
+
+static int view_open(struct file_view *view, const uint8_t *image,
+        const struct fs_entry *e) {
+    memset(view, 0, sizeof(*view));
+    view->image = image;
+    view->e = e;
+    if (!e->ctz || !e->size) {
+        return 0;
+    }
+
+    lfs_off_t last = e->size - 1;
+    view->count = ondisk_ctz_index(block_size, &last) + 1;
+    view->blocks = malloc(view->count * sizeof(lfs_block_t));
+    if (!view->blocks) {
+        return LFS_ERR_NOMEM;
+    }
+
+    int err = ondisk_ctz_walk(image, block_size, block_count,
+            e->head, e->size, record_block, view);
+    if (err) {
+        free(view->blocks);
+        view->blocks = NULL;
+    }
+    return err;
+}
+
+static void view_close(struct file_view *view) {
+    free(view->blocks);
+}
+
+// Data at file offset pos, and how much of it is contiguous in the image
+static const uint8_t *view_span(const struct file_view *view, lfs_off_t pos,
+        lfs_size_t *len) {
+    if (!view->e->ctz) {
+        *len = view->e->size - pos;
+        return &view->e->inline_data[pos];
+    }
+
+    // off comes back past the block's skip-list pointers
+    lfs_off_t off = pos;
+    lfs_off_t i = ondisk_ctz_index(block_size, &off);
+    *len = lfs_min(block_size - off, view->e->size - pos);
+    return &view->image[(size_t)view->blocks[i] * block_size + off];
+}
+
+// Compares the first size bytes of two files without copying either
+static bool view_equal(const struct file_view *a, const struct file_view *b,
+        lfs_size_t size) {
+    lfs_off_t pos = 0;
+    while (pos < size) {
+        lfs_size_t alen, blen;
+        const uint8_t *ap = view_span(a, pos, &alen);
+        const uint8_t *bp = view_span(b, pos, &blen);
+        lfs_size_t n = lfs_min(lfs_min(alen, blen), size - pos);
+        if (memcmp(ap, bp, n) != 0) {
+            return false;
+        }
+        pos += n;
+    }
+    return true;
+}
+
+static void compare_range(void *data, size_t begin, size_t end) {
+    struct compare_job *jobs = data;
+
+    for (size_t i = begin; i < end; i++) {
+        struct compare_job *job = &jobs[i];
+        struct file_view a, b;
+        int erra = view_open(&a, job->a->image, job->old);
+        int errb = view_open(&b, job->b->image, job->new);
+        if (erra || errb) {
+            job->kind = CHANGE_UNREADABLE;
+        } else {
+            lfs_size_t common = lfs_min(job->old->size, job->new->size);
+            if (!view_equal(&a, &b, common)) {
+                job->kind = CHANGE_REWRITTEN;
+            } else if (job->new->size > job->old->size) {
+                job->kind = CHANGE_GROWN;
+            } else if (job->new->size < job->old->size) {
+                job->kind = CHANGE_TRUNCATED;
+            } else {
+                // same bytes in different blocks, littlefs rewrote it
+                // without changing anything
+                job->kind = -1;
+            }
+        }
+        view_close(&a);
+        view_close(&b);
+    }
+}
+
+// Content digests of the files left over for rename matching
+struct hash_job {
+    const struct fs_side *side;
+    struct fs_entry **entries;
+};
+
+static void hash_range(void *data, size_t begin, size_t end) {
+    struct hash_job *job = data;
+
+    for (size_t i = begin; i < end; i++) {
+        struct fs_entry *e = job->entries[i];
+        struct file_view view;
+        e->err = view_open(&view, job->side->image, e);
+        if (e->err) {
+            continue;
+        }
+
+        sha256_t ctx;
+        sha256_init(&ctx);
+        lfs_off_t pos = 0;
+        while (pos < e->size) {
+            lfs_size_t n;
+            const uint8_t *p = view_span(&view, pos, &n);
+            sha256_update(&ctx, p, n);
+            pos += n;
+        }
+        sha256_final(&ctx, e->digest);
+        e->hashed = true;
+        view_close(&view);
+    }
+}
+
+static void add_change(struct changes *changes, int kind,
+        const struct fs_entry *old, const struct fs_entry *new) {
+    if (changes->count == changes->capacity) {
+        size_t capacity = changes->capacity ? 2*changes->capacity : 64;
+        struct change *nlist = realloc(changes->list,
+                capacity * sizeof(struct change));
+        if (!nlist) {
+            fprintf(stderr, "[!] Out of memory, dropping a change to %s\n",
+                    (new ? new : old)->path);
+            return;
+        }
+        changes->list = nlist;
+        changes->capacity = capacity;
+    }
+    changes->list[changes->count++] = (struct change){kind, old, new};
+}
+
+static int compare_path(const void *a, const void *b) {
+    const struct fs_entry *ea = *(const struct fs_entry *const *)a;
+    const struct fs_entry *eb = *(const struct fs_entry *const *)b;
+    return strcmp(ea->path, eb->path);
+}
+
+static int compare_pair(const void *a, const void *b) {
+    const struct fs_entry *ea = *(const struct fs_entry *const *)a;
+    const struct fs_entry *eb = *(const struct fs_entry *const *)b;
+    if (ea->pair[0] != eb->pair[0]) {
+        return (ea->pair[0] < eb->pair[0]) ? -1 : 1;
+    }
+    if (ea->pair[1] != eb->pair[1]) {
+        return (ea->pair[1] < eb->pair[1]) ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_ctz(const void *a, const void *b) {
+    const struct fs_entry *ea = *(const struct fs_entry *const *)a;
+    const struct fs_entry *eb = *(const struct fs_entry *const *)b;
+    if (ea->head != eb->head) {
+        return (ea->head < eb->head) ? -1 : 1;
+    }
+    if (ea->size != eb->size) {
+        return (ea->size < eb->size) ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_size(const void *a, const void *b) {
+    const struct fs_entry *ea = *(const struct fs_entry *const *)a;
+    const struct fs_entry *eb = *(const struct fs_entry *const *)b;
+    if (ea->size != eb->size) {
+        return (ea->size < eb->size) ? -1 : 1;
+    }
+    return 0;
+}
+
+static int compare_content(const void *a, const void *b) {
+    const struct fs_entry *ea = *(const struct fs_entry *const *)a;
+    const struct fs_entry *eb = *(const struct fs_entry *const *)b;
+    if (ea->size != eb->size) {
+        return (ea->size < eb->size) ? -1 : 1;
+    }
+    return memcmp(ea->digest, eb->digest, SHA256_DIGEST_SIZE);
+}
+
+static int compare_change(const void *a, const void *b) {
+    const struct change *ca = a;
+    const struct change *cb = b;
+    const struct fs_entry *ea = ca->new ? ca->new : ca->old;
+    const struct fs_entry *eb = cb->new ? cb->new : cb->old;
+    return strcmp(ea->path, eb->path);
+}
+
+// Finds an unmatched entry in a sorted index, the first of equal ones
+static struct fs_entry *find_unmatched(struct fs_entry **index, size_t count,
+        struct fs_entry *key, int (*cmp)(const void *, const void *)) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmp(&index[mid], &key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = lo; i < count && cmp(&index[i], &key) == 0; i++) {
+        if (!index[i]->matched) {
+            return index[i];
+        }
+    }
+    return NULL;
+}
+
+static struct fs_entry **sorted_index(struct fs_side *side,
+        bool (*keep)(const struct fs_entry *), size_t *count,
+        int (*cmp)(const void *, const void *)) {
+    struct fs_entry **index = malloc((side->count + 1) * sizeof(*index));
+    if (!index) {
+        *count = 0;
+        return NULL;
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < side->count; i++) {
+        if (keep(&side->entries[i])) {
+            index[n++] = &side->entries[i];
+        }
+    }
+    qsort(index, n, sizeof(*index), cmp);
+    *count = n;
+    return index;
+}
+
+static bool is_any(const struct fs_entry *e) {
+    (void)e;
+    return true;
+}
+
+static bool is_paired_dir(const struct fs_entry *e) {
+    return e->type == LFS_TYPE_DIR && e->has_pair;
+}
+
+static bool is_unmatched_ctz(const struct fs_entry *e) {
+    return !e->matched && e->type == LFS_TYPE_REG && e->ctz;
+}
+
+static bool is_unmatched_file(const struct fs_entry *e) {
+    return !e->matched && e->type == LFS_TYPE_REG;
+}
+
+// Directory renames, a path in the old image is looked up under the
+// new name of its closest renamed parent
+struct dir_rename {
+    const char *from;
+    size_t from_len;
+    const char *to;
+};
+
+struct dir_renames {
+    struct dir_rename *list;
+    size_t count;
+};
+
+static void map_path(const struct dir_renames *renames, const char *path,
+        char *out, size_t len) {
+    const struct dir_rename *best = NULL;
+    for (size_t i = 0; i < renames->count; i++) {
+        const struct dir_rename *r = &renames->list[i];
+        if (strncmp(path, r->from, r->from_len) == 0 &&
+                path[r->from_len] == '/' &&
+                (!best || r->from_len > best->from_len)) {
+            best = r;
+        }
+    }
+
+    if (best) {
+        snprintf(out, len, "%s%s", best->to, &path[best->from_len]);
+    } else {
+        snprintf(out, len, "%s", path);
+    }
+}
+
+struct diff_stats {
+    unsigned long unchanged;
+    unsigned long compared;
+    unsigned long hashed;
+};
+
+static void diff_trees(struct fs_side *a, struct fs_side *b,
+        struct changes *changes, struct diff_stats *stats) {
+    // directories that kept their metadata pair but not their path were
+    // renamed, parents come before children in walk order so every
+    // path is mapped through its parents' renames first
+    size_t npairs;
+    struct fs_entry **pairs = sorted_index(b, is_paired_dir, &npairs,
+            compare_pair);
+    struct dir_renames renames = {
+        malloc((a->count + 1) * sizeof(struct dir_rename)), 0,
+    };
+    char mapped[512];
+
+    for (size_t i = 0; pairs && renames.list && i < a->count; i++) {
+        struct fs_entry *old = &a->entries[i];
+        if (!is_paired_dir(old)) {
+            continue;
+        }
+        struct fs_entry *new = find_unmatched(pairs, npairs, old,
+                compare_pair);
+        if (!new) {
+            continue;
+        }
+
+        old->matched = true;
+        new->matched = true;
+        map_path(&renames, old->path, mapped, sizeof(mapped));
+        if (strcmp(mapped, new->path) != 0) {
+            renames.list[renames.count++] = (struct dir_rename){
+                old->path, strlen(old->path), new->path,
+            };
+            add_change(changes, CHANGE_RENAMED, old, new);
+        } else {
+            stats->unchanged += 1;
+        }
+    }
+    free(pairs);
+
+    // then by path, a file whose CTZ head and size are unchanged is
+    // unchanged, its data is never read
+    size_t npaths;
+    struct fs_entry **paths = sorted_index(b, is_any, &npaths, compare_path);
+    struct compare_job *jobs = malloc((a->count + 1) * sizeof(*jobs));
+    size_t njobs = 0;
+
+    for (size_t i = 0; paths && jobs && i < a->count; i++) {
+        struct fs_entry *old = &a->entries[i];
+        if (old->matched) {
+            continue;
+        }
+
+        struct fs_entry key;
+        map_path(&renames, old->path, mapped, sizeof(mapped));
+        key.path = mapped;
+        struct fs_entry *new = find_unmatched(paths, npaths, &key,
+                compare_path);
+        if (!new || new->type != old->type) {
+            continue;
+        }
+
+        old->matched = true;
+        new->matched = true;
+        if (old->type == LFS_TYPE_DIR) {
+            stats->unchanged += 1;
+        } else if (old->ctz && new->ctz && old->head == new->head &&
+                old->size == new->size) {
+            stats->unchanged += 1;
+        } else if (!old->ctz && !new->ctz && old->size == new->size &&
+                (!old->size || memcmp(old->inline_data, new->inline_data,
+                    old->size) == 0)) {
+            stats->unchanged += 1;
+        } else {
+            jobs[njobs++] = (struct compare_job){a, b, old, new, 0};
+        }
+    }
+    free(paths);
+
+    parallel_for(njobs, DIFF_GRAIN, compare_range, jobs);
+    stats->compared += njobs;
+    for (size_t i = 0; i < njobs; i++) {
+        if (jobs[i].kind < 0) {
+            stats->unchanged += 1;
+        } else {
+            add_change(changes, jobs[i].kind, jobs[i].old, jobs[i].new);
+        }
+    }
+    free(jobs);
+
+    // files that moved keep their CTZ head and size
+    size_t nctz;
+    struct fs_entry **ctz = sorted_index(b, is_unmatched_ctz, &nctz,
+            compare_ctz);
+    for (size_t i = 0; ctz && i < a->count; i++) {
+        struct fs_entry *old = &a->entries[i];
+        if (!is_unmatched_ctz(old)) {
+            continue;
+        }
+        struct fs_entry *new = find_unmatched(ctz, nctz, old, compare_ctz);
+        if (new) {
+            old->matched = true;
+            new->matched = true;
+            add_change(changes, CHANGE_RENAMED, old, new);
+        }
+    }
+    free(ctz);
+
+    // files that were copied to a new name and the old one deleted, or
+    // inline files, only match by content, and only sizes present on
+    // both sides are worth hashing
+    size_t nolds, nnews;
+    struct fs_entry **olds = sorted_index(a, is_unmatched_file, &nolds,
+            compare_size);
+    struct fs_entry **news = sorted_index(b, is_unmatched_file, &nnews,
+            compare_size);
+    if (olds && news) {
+        struct fs_entry **hash_a = olds;
+        struct fs_entry **hash_b = news;
+        size_t nhash_a = 0, nhash_b = 0;
+        size_t i = 0, j = 0;
+        while (i < nolds && j < nnews) {
+            if (olds[i]->size < news[j]->size) {
+                i++;
+            } else if (olds[i]->size > news[j]->size) {
+                j++;
+            } else {
+                // every file of this size on both sides, kept in place
+                lfs_size_t size = olds[i]->size;
+                while (i < nolds && olds[i]->size == size) {
+                    hash_a[nhash_a++] = olds[i++];
+                }
+                while (j < nnews && news[j]->size == size) {
+                    hash_b[nhash_b++] = news[j++];
+                }
+            }
+        }
+
+        struct hash_job ja = {a, hash_a};
+        struct hash_job jb = {b, hash_b};
+        parallel_for(nhash_a, DIFF_GRAIN, hash_range, &ja);
+        parallel_for(nhash_b, DIFF_GRAIN, hash_range, &jb);
+        stats->hashed += nhash_a + nhash_b;
+
+        size_t nhashed = 0;
+        for (size_t j = 0; j < nhash_b; j++) {
+            if (hash_b[j]->hashed) {
+                hash_b[nhashed++] = hash_b[j];
+            }
+        }
+        qsort(hash_b, nhashed, sizeof(*hash_b), compare_content);
+        for (size_t i = 0; i < nhash_a; i++) {
+            struct fs_entry *old = hash_a[i];
+            if (!old->hashed) {
+                continue;
+            }
+            struct fs_entry *new = find_unmatched(hash_b, nhashed, old,
+                    compare_content);
+            if (new) {
+                old->matched = true;
+                new->matched = true;
+                add_change(changes, CHANGE_RENAMED, old, new);
+            }
+        }
+    }
+    free(olds);
+    free(news);
+
+    // whatever is left only exists on one side, the contents of a renamed
+    // directory were already mapped above
+    for (size_t i = 0; i < a->count; i++) {
+        if (!a->entries[i].matched) {
+            add_change(changes, CHANGE_DELETED, &a->entries[i], NULL);
+        }
+    }
+    for (size_t i = 0; i < b->count; i++) {
+        if (!b->entries[i].matched) {
+            add_change(changes, CHANGE_ADDED, NULL, &b->entries[i]);
+        }
+    }
+    free(renames.list);
+
+    if (changes->count) {
+        qsort(changes->list, changes->count, sizeof(struct change),
+                compare_change);
+    }
+}
+
+void print_changes(const struct changes *changes,
+        const struct diff_stats *stats) {
+    unsigned long counts[CHANGE_UNREADABLE + 1] = {0};
+
+    for (size_t i = 0; i < changes->count; i++) {
+        const struct change *c = &changes->list[i];
+        const struct fs_entry *e = c->new ? c->new : c->old;
+        bool dir = (e->type == LFS_TYPE_DIR);
+        counts[c->kind] += 1;
+
+        if (jsonl) {
+            jsonl_begin(&json, "change");
+            jsonl_str(&json, "kind", change_names[c->kind]);
+            jsonl_str(&json, "type", dir ? "dir" : "file");
+            jsonl_str(&json, "path", e->path);
+            if (c->kind == CHANGE_RENAMED) {
+                jsonl_str(&json, "old_path", c->old->path);
+            }
+            if (!dir && c->old) {
+                jsonl_uint(&json, "old_size", c->old->size);
+            }
+            if (!dir && c->new) {
+                jsonl_uint(&json, "size", c->new->size);
+            }
+            jsonl_end(&json);
+            continue;
+        }
+
+        printf("  %-10s  %s%s", change_names[c->kind], e->path,
+                dir ? "/" : "");
+        if (c->kind == CHANGE_RENAMED) {
+            printf("  (from %s%s)", c->old->path, dir ? "/" : "");
+        } else if (dir) {
+            // nothing more to say about a directory
+        } else if (c->old && c->new) {
+            printf("  (%lu -> %lu bytes)", (unsigned long)c->old->size,
+                    (unsigned long)c->new->size);
+        } else {
+            printf("  (%lu bytes)", (unsigned long)e->size);
+        }
+        printf("\n");
+    }
+
+    if (!changes->count && !jsonl) {
+        printf("  no changes\n");
+    }
+
+    fprintf(text_out, "\n");
+    for (int k = 0; k <= CHANGE_UNREADABLE; k++) {
+        if (counts[k]) {
+            fprintf(text_out, "%lu %s, ", counts[k], change_names[k]);
+        }
+    }
+    fprintf(text_out, "%lu unchanged\n", stats->unchanged);
+    fprintf(text_out, "%lu files compared and %lu hashed by content\n",
+            stats->compared, stats->hashed);
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc < 5) {
+        fprintf(stderr, "Usage: %s <old_image> <new_image> [block_size] [block_count] [read_size] [prog_size] [--ecc] [--format text|jsonl] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+
+    struct fs_side sides[2];
+    memset(sides, 0, sizeof(sides));
+    sides[0].path = argv[1];
+    sides[1].path = argv[2];
+    if (argc >= 4) {
+        block_size = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        block_count = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        read_size = atoi(argv[5]);
+    }
+    if (argc >= 7) {
+        prog_size = atoi(argv[6]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        return 1;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        return 1;
+    }
+
+    // both trees are rebuilt from a scan of their metadata at the same
+    // time, neither image needs to mount
+    pthread_t thread;
+    for (int i = 0; i < 2; i++) {
+        sides[i].image_hash = image_hash;
+        sides[i].ecc = ecc;
+    }
+    bool threaded = (pthread_create(&thread, NULL, load_side, &sides[1]) == 0);
+    load_side(&sides[0]);
+    if (threaded) {
+        pthread_join(thread, NULL);
+    } else {
+        load_side(&sides[1]);
+    }
+
+    int ret = 0;
+    for (int i = 0; i < 2; i++) {
+        if (sides[i].err) {
+            if (!sides[i].scanned) {
+                fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                        (sides[i].err == LFS_ERR_NOMEM) ? "load" : "open",
+                        sides[i].path);
+            } else {
+                fprintf(stderr, "[!] Failed to scan image: %s\n",
+                        sides[i].path);
+            }
+            ret = 1;
+        }
+    }
+    if (ret) {
+        goto done;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (jsonl) {
+            image_json_digest(&sides[i].digest, sides[i].path, &json);
+        } else {
+            image_print_digest(&sides[i].digest, sides[i].path, stdout);
+        }
+        if (sides[i].ecc_ran) {
+            fprintf(text_out, "%s:\n", sides[i].path);
+            ecc_print_report(&sides[i].report, block_size, text_out);
+            fprintf(text_out, "\n");
+        }
+    }
+
+    struct changes changes = {0};
+    struct diff_stats stats = {0};
+    diff_trees(&sides[0], &sides[1], &changes, &stats);
+
+    if (!jsonl) {
+        printf("Changes from %s to %s:\n", sides[0].path, sides[1].path);
+    }
+    print_changes(&changes, &stats);
+    free(changes.list);
+
+done:
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    free_side(&sides[0]);
+    free_side(&sides[1]);
+    return ret;
+}
@@ -0,0 +1,575 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "ecc.h"
+#include "image.h"
+#include "parallel.h"
+#include "store.h"
+#include "nand.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define CACHE_SIZE 512
+#define LOOKAHEAD_SIZE 16
+// files per worker mount, each chunk of files gets its own lfs_t
+#define EXTRACT_GRAIN 16
+#define MAX_PATTERNS 64
+
+uint8_t *image = NULL;
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+const char *out_dir = "extracted";
+const char *includes[MAX_PATTERNS];
+int include_count = 0;
+const char *excludes[MAX_PATTERNS];
+int exclude_count = 0;
+
+// with --store, files go into a content-addressed store shared with
+// other runs instead of a tree under out_dir
+const char *store_root = NULL;
+store_t store;
+
+// with --nand, the image is a raw dump with spare bytes after every page
+nand_t nand;
+nand_t *flash = NULL;
+
+// the image is only ever read, so any number of mounts can share it
+int user_read(const struct lfs_config *c, lfs_block_t block,
+              lfs_off_t off, void *buffer, lfs_size_t size) {
+    if (flash) {
+        nand_read(flash, (uint64_t)block * c->block_size + off, buffer, size);
+        return 0;
+    }
+    memcpy(buffer, &image[(size_t)block * c->block_size + off], size);
+    return 0;
+}
+
+int user_prog(const struct lfs_config *c, lfs_block_t block,
+              lfs_off_t off, const void *buffer, lfs_size_t size) {
+    return LFS_ERR_IO;
+}
+
+int user_erase(const struct lfs_config *c, lfs_block_t block) {
+    return LFS_ERR_IO;
+}
+
+int user_sync(const struct lfs_config *c) {
+    return 0;
+}
+
+struct extract_file {
+    char path[512];
+    lfs_size_t size;
+    lfs_size_t written;
+    int err;                // 0, or a negative lfs error, or errno
+    bool host_err;
+};
+
+struct extract_list {
+    struct extract_file *files;
+    size_t count;
+    size_t capacity;
+    unsigned long dirs;
+    unsigned long unsafe;
+    const struct lfs_config *cfg;
+};
+
+// Patterns without a '/' match the name alone, like "*.log", others the
+// whole path from the root, like "/logs/*"
+static bool match_any(const char **patterns, int count,
+        const char *path, const char *name) {
+    for (int i = 0; i < count; i++) {
+        const char *subject = strchr(patterns[i], '/') ? path : name;
+        if (fnmatch(patterns[i], subject, 0) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// mkdir -p below out_dir, path is a littlefs path
+static int make_dirs(const char *path) {
+    char host[1024];
+    int n = snprintf(host, sizeof(host), "%s%s", out_dir, path);
+    if (n < 0 || n >= (int)sizeof(host)) {
+        return ENAMETOOLONG;
+    }
+
+    for (char *p = &host[strlen(out_dir) + 1]; ; p++) {
+        if (*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            if (mkdir(host, 0755) != 0 && errno != EEXIST) {
+                return errno;
+            }
+            *p = c;
+            if (!c) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+// Names come from the image and are never trusted on the host. A name
+// must be a single plain path component, and must lead back to the entry
+// it was read from, which a name cut short by a NUL byte doesn't.
+static bool name_safe(lfs_t *lfs, const char *full_path,
+        const struct lfs_info *info) {
+    if (info->name[0] == '\0' || strcmp(info->name, ".") == 0 ||
+            strcmp(info->name, "..") == 0 || strchr(info->name, '/')) {
+        return false;
+    }
+
+    struct lfs_info check;
+    return lfs_stat(lfs, full_path, &check) == 0 &&
+            check.type == info->type &&
+            (info->type != LFS_TYPE_REG || check.size == info->size) &&
+            strcmp(check.name, info->name) == 0;
+}
+
+static void report_unsafe(const char *path, const char *name) {
+    char escaped[4 * LFS_NAME_MAX + 1];
+    size_t n = 0;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        if (*p < 0x20 || *p >= 0x7f || *p == '\\' || *p == '"') {
+            n += snprintf(&escaped[n], sizeof(escaped) - n, "\\x%02x", *p);
+        } else {
+            escaped[n++] = *p;
+        }
+    }
+    escaped[n] = '\0';
+    fprintf(stderr, "[!] Skipping entry with unsafe name in %s: \"%s\"\n",
+            path, escaped);
+}
+
+static void add_file(struct extract_list *list, const char *path,
+        lfs_size_t size) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? 2*list->capacity : 64;
+        struct extract_file *files = realloc(list->files,
+                capacity * sizeof(struct extract_file));
+        if (!files) {
+            fprintf(stderr, "[!] Out of memory, skipping %s\n", path);
+            return;
+        }
+        list->files = files;
+        list->capacity = capacity;
+    }
+
+    struct extract_file *file = &list->files[list->count++];
+    memset(file, 0, sizeof(*file));
+    snprintf(file->path, sizeof(file->path), "%s", path);
+    file->size = size;
+}
+
+// Walks the tree on one mount, creating directories as it goes. Only
+// metadata is read here, file contents are left to the workers.
+void collect_directory(lfs_t *lfs, const char *path,
+        struct extract_list *list) {
+    struct lfs_info info;
+    lfs_dir_t dir;
+
+    if (lfs_dir_open(lfs, &dir, path) < 0) {
+        fprintf(stderr, "[!] Failed to open directory: %s\n", path);
+        return;
+    }
+
+    // littlefs itself returns "." and ".." first, any later ones are
+    // entries in the image
+    for (int pos = 0; lfs_dir_read(lfs, &dir, &info) > 0; pos++) {
+        if (pos < 2) continue;
+
+        char full_path[512];
+        // the root is "/", don't double the separator below it
+        snprintf(full_path, sizeof(full_path), "%s/%s",
+                (strcmp(path, "/") == 0) ? "" : path, info.name);
+
+        if (!name_safe(lfs, full_path, &info)) {
+            report_unsafe(path, info.name);
+            list->unsafe += 1;
+            continue;
+        }
+
+        if (match_any(excludes, exclude_count, full_path, info.name)) {
+            continue;
+        }
+
+        if (info.type == LFS_TYPE_DIR) {
+            // with include patterns only parents of matches are created
+            if (include_count == 0 && !store_root) {
+                int err = make_dirs(full_path);
+                if (err) {
+                    fprintf(stderr, "[!] Failed to create %s%s: %s\n",
+                            out_dir, full_path, strerror(err));
+                    continue;
+                }
+                list->dirs += 1;
+            }
+            collect_directory(lfs, full_path, list);
+        } else if (info.type == LFS_TYPE_REG) {
+            if (include_count == 0 ||
+                    match_any(includes, include_count, full_path, info.name)) {
+                add_file(list, full_path, info.size);
+            }
+        }
+    }
+
+    lfs_dir_close(lfs, &dir);
+}
+
+static void extract_one(lfs_t *lfs, struct extract_file *file,
+        uint8_t *buffer) {
+    char host[1024];
+    snprintf(host, sizeof(host), "%s%s", out_dir, file->path);
+
+    lfs_file_t lf;
+    int err = lfs_file_open(lfs, &lf, file->path, LFS_O_RDONLY);
+    if (err) {
+        file->err = err;
+        return;
+    }
+
+    store_writer_t w;
+    int fd = -1;
+    if (store_root) {
+        if (store_begin(&store, &w) != 0) {
+            file->err = EIO;
+            file->host_err = true;
+            lfs_file_close(lfs, &lf);
+            return;
+        }
+    } else {
+        fd = open(host, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            file->err = errno;
+            file->host_err = true;
+            lfs_file_close(lfs, &lf);
+            return;
+        }
+    }
+
+    // whole-block reads go straight from the image into buffer,
+    // bypassing the littlefs cache
+    while (true) {
+        lfs_ssize_t n = lfs_file_read(lfs, &lf, buffer, block_size);
+        if (n <= 0) {
+            file->err = n;
+            break;
+        }
+
+        // hashed on the way through, the object is named when complete
+        if (store_root) {
+            if (store_write(&w, buffer, n) != 0) {
+                file->err = EIO;
+                file->host_err = true;
+                break;
+            }
+            file->written += n;
+            continue;
+        }
+
+        for (lfs_ssize_t done = 0; done < n; ) {
+            ssize_t w = write(fd, &buffer[done], n - done);
+            if (w < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                file->err = errno;
+                file->host_err = true;
+                break;
+            }
+            done += w;
+            file->written += w;
+        }
+        if (file->err) {
+            break;
+        }
+    }
+
+    if (store_root) {
+        char object[1200];
+        if (file->err) {
+            store_abort(&w);
+        } else if (store_commit(&w, file->path, object, sizeof(object)) != 0) {
+            file->err = EIO;
+            file->host_err = true;
+        }
+    } else if (close(fd) != 0 && !file->err) {
+        file->err = errno;
+        file->host_err = true;
+    }
+    lfs_file_close(lfs, &lf);
+}
+
+static void extract_range(void *data, size_t begin, size_t end) {
+    struct extract_list *list = data;
+
+    // lfs_t isn't thread-safe, every chunk mounts its own
+    lfs_t lfs;
+    uint8_t *buffer = malloc(block_size);
+    int err = buffer ? lfs_mount(&lfs, list->cfg) : LFS_ERR_NOMEM;
+    if (err) {
+        for (size_t i = begin; i < end; i++) {
+            if (!list->files[i].err) {
+                list->files[i].err = err;
+            }
+        }
+        free(buffer);
+        return;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        // already failed creating its parent
+        if (!list->files[i].err) {
+            extract_one(&lfs, &list->files[i], buffer);
+        }
+    }
+
+    lfs_unmount(&lfs);
+    free(buffer);
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    const char *nand_spec = NULL;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_dir = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_root = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--nand") == 0 && i + 1 < argc) {
+            nand_spec = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--include") == 0 && i + 1 < argc) {
+            if (include_count < MAX_PATTERNS) {
+                includes[include_count++] = argv[i + 1];
+            }
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--exclude") == 0 && i + 1 < argc) {
+            if (exclude_count < MAX_PATTERNS) {
+                excludes[exclude_count++] = argv[i + 1];
+            }
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--out DIR] [--store DIR] [--include GLOB]... [--exclude GLOB]... [--ecc] [--nand PAGE+SPARE] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+
+    const char *image_path = argv[1];
+    if (argc >= 3) {
+        block_size = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        block_count = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        read_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        prog_size = atoi(argv[5]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        return 1;
+    }
+
+    // ECC works on runs of whole blocks, only a mount can go through the
+    // spare areas
+    size_t page_size = 0;
+    size_t spare_size = 0;
+    if (nand_spec) {
+        if (nand_parse(nand_spec, &page_size, &spare_size) != 0 ||
+                block_size % page_size != 0) {
+            fprintf(stderr, "[!] Invalid NAND geometry: %s (PAGE+SPARE, block size a multiple of PAGE)\n", nand_spec);
+            return 1;
+        }
+        if (ecc) {
+            fprintf(stderr, "[!] --nand can't be used with --ecc\n");
+            return 1;
+        }
+    }
+
+    size_t image_size = (size_t)block_size * block_count;
+    if (nand_spec) {
+        image_size = nand_raw_size(image_size, page_size, spare_size);
+    }
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+        return 1;
+    }
+    image_print_digest(&digest, image_path, stdout);
+    if (nand_spec) {
+        nand_init(&nand, image, image_size, page_size, spare_size);
+        flash = &nand;
+    }
+
+    if (ecc) {
+        ecc_report_t report;
+        if (ecc_correct_image(image, block_size, block_count, &report) == 0) {
+            ecc_print_report(&report, block_size, stdout);
+            printf("\n");
+        }
+        ecc_report_free(&report);
+    }
+
+    struct lfs_config cfg = {
+        .read  = user_read,
+        .prog  = user_prog,
+        .erase = user_erase,
+        .sync  = user_sync,
+
+        .read_size = read_size,
+        .prog_size = prog_size,
+        .block_size = block_size,
+        .block_count = block_count,
+        .cache_size = CACHE_SIZE,
+        .lookahead_size = LOOKAHEAD_SIZE,
+        .block_cycles = -1
+    };
+
+    lfs_t lfs;
+    if (lfs_mount(&lfs, &cfg) != 0) {
+        fprintf(stderr, "[!] Failed to mount filesystem\n");
+        free(image);
+        return 1;
+    }
+
+    if (store_root) {
+        char view[1024];
+        image_view_name(image_path, image_offset, view, sizeof(view));
+        if (store_open(&store, store_root, view, image, image_size,
+                "extract") != 0) {
+            fprintf(stderr, "[!] Failed to open store: %s\n", store_root);
+            lfs_unmount(&lfs);
+            free(image);
+            return 1;
+        }
+    } else if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "[!] Failed to create %s: %s\n", out_dir, strerror(errno));
+        lfs_unmount(&lfs);
+        free(image);
+        return 1;
+    }
+
+    struct extract_list list = {.cfg = &cfg};
+    collect_directory(&lfs, "/", &list);
+    lfs_unmount(&lfs);
+
+    // parents are created up front so the workers never race on them
+    if (include_count && !store_root) {
+        for (size_t i = 0; i < list.count; i++) {
+            char *slash = strrchr(list.files[i].path, '/');
+            if (slash == list.files[i].path) {
+                continue;
+            }
+            *slash = '\0';
+            int err = make_dirs(list.files[i].path);
+            *slash = '/';
+            if (err) {
+                list.files[i].err = err;
+                list.files[i].host_err = true;
+            }
+        }
+    }
+
+    parallel_for(list.count, EXTRACT_GRAIN, extract_range, &list);
+
+    unsigned long extracted = 0;
+    unsigned long failed = 0;
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < list.count; i++) {
+        const struct extract_file *file = &list.files[i];
+        if (file->err && file->host_err) {
+            fprintf(stderr, "[!] Failed to extract %s: %s\n", file->path,
+                    strerror(file->err));
+            failed += 1;
+            continue;
+        } else if (file->err) {
+            fprintf(stderr, "[!] Failed to extract %s: littlefs error %d\n",
+                    file->path, file->err);
+            failed += 1;
+            continue;
+        }
+        printf("  %s (%lu bytes)\n", file->path, (unsigned long)file->written);
+        extracted += 1;
+        bytes += file->written;
+    }
+
+    if (list.unsafe) {
+        fprintf(stderr, "[!] Skipped %lu entries whose names could leave %s\n",
+                list.unsafe, store_root ? "the store" : out_dir);
+    }
+
+    printf("\nExtracted %lu files (%llu bytes)", extracted, bytes);
+    if (store_root) {
+        printf("\n");
+        store_print_summary(&store, stdout);
+        if (store_close(&store) != 0) {
+            fprintf(stderr, "[!] Failed to write %s\n", store.refs_path);
+        }
+    } else {
+        if (include_count == 0) {
+            printf(" and %lu directories", list.dirs);
+        }
+        printf(" to %s\n", out_dir);
+    }
+    if (failed) {
+        printf("%lu files could not be extracted\n", failed);
+    }
+
+    free(list.files);
+    free(image);
+    return failed ? 1 : 0;
+}
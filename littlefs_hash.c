@@ -0,0 +1,368 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "parallel.h"
+#include "ecc.h"
+#include "image.h"
+#include "sha256.h"
+#include "digest.h"
+#include "hashset.h"
+#include "jsonl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define HASH_GRAIN 4
+
+uint8_t *image = NULL;
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// with --known-good and --known-bad, every file is looked up in hash sets,
+// hashed with each algorithm the sets use besides SHA-256
+hashset_t *hashsets = NULL;
+size_t hashset_count = 0;
+bool digest_used[DIGEST_SHA256 + 1];
+
+// One file to hash, filled in by the tree walk
+struct hash_job {
+    char path[512];
+    lfs_size_t size;
+    bool ctz;
+    lfs_block_t head;           // CTZ files
+    const uint8_t *inline_data; // inline files
+
+    int err;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int known;                  // matching hash set or HASHSET_NONE
+};
+
+struct hash_jobs {
+    struct hash_job *jobs;
+    size_t count;
+    size_t capacity;
+};
+
+// CTZ blocks in file order, the walk hands them out last first
+struct hash_chain {
+    lfs_block_t *blocks;
+};
+
+static void collect_file(void *data, const salvage_info_t *info) {
+    struct hash_jobs *jobs = data;
+    const ondisk_entry_t *e = info->entry;
+    if (!e || info->type != LFS_TYPE_REG) {
+        return;
+    }
+
+    if (jobs->count == jobs->capacity) {
+        size_t capacity = jobs->capacity ? 2*jobs->capacity : 64;
+        struct hash_job *njobs = realloc(jobs->jobs,
+                capacity * sizeof(struct hash_job));
+        if (!njobs) {
+            fprintf(stderr, "[!] Out of memory, skipping %s\n", info->path);
+            return;
+        }
+        jobs->jobs = njobs;
+        jobs->capacity = capacity;
+    }
+
+    struct hash_job *job = &jobs->jobs[jobs->count++];
+    memset(job, 0, sizeof(*job));
+    snprintf(job->path, sizeof(job->path), "%s", info->path);
+    if (ondisk_entry_ctz(e, &job->head, &job->size)) {
+        job->ctz = true;
+    } else if (e->struct_type == LFS_TYPE_INLINESTRUCT) {
+        job->size = e->struct_size;
+        job->inline_data = e->struct_data;
+    }
+}
+
+static int record_block(void *data, lfs_block_t block, lfs_off_t index) {
+    struct hash_chain *chain = data;
+    chain->blocks[index] = block;
+    return 0;
+}
+
+static void hash_update(digest_t *ctx, const void *data, size_t size) {
+    for (int algo = DIGEST_MD5; algo <= DIGEST_SHA256; algo++) {
+        if (digest_used[algo]) {
+            digest_update(&ctx[algo], data, size);
+        }
+    }
+}
+
+static int hash_ctz(struct hash_job *job, digest_t *ctx) {
+    lfs_off_t last = job->size - 1;
+    lfs_off_t count = ondisk_ctz_index(block_size, &last) + 1;
+
+    struct hash_chain chain = {malloc(count * sizeof(lfs_block_t))};
+    if (!chain.blocks) {
+        return LFS_ERR_NOMEM;
+    }
+
+    int err = ondisk_ctz_walk(image, block_size, block_count,
+            job->head, job->size, record_block, &chain);
+    if (err) {
+        free(chain.blocks);
+        return err;
+    }
+
+    // hashed in place, the data never leaves the image buffer
+    lfs_size_t left = job->size;
+    for (lfs_off_t i = 0; i < count && left; i++) {
+        lfs_off_t skip = ondisk_ctz_skip(i);
+        lfs_size_t n = lfs_min(left, block_size - skip);
+        hash_update(ctx, &image[(size_t)chain.blocks[i] * block_size + skip], n);
+        left -= n;
+    }
+
+    free(chain.blocks);
+    return 0;
+}
+
+static void hash_range(void *data, size_t begin, size_t end) {
+    struct hash_jobs *jobs = data;
+
+    for (size_t i = begin; i < end; i++) {
+        struct hash_job *job = &jobs->jobs[i];
+        digest_t ctx[DIGEST_SHA256 + 1];
+        for (int algo = DIGEST_MD5; algo <= DIGEST_SHA256; algo++) {
+            if (digest_used[algo]) {
+                digest_init(&ctx[algo], algo);
+            }
+        }
+
+        if (job->ctz && job->size) {
+            job->err = hash_ctz(job, ctx);
+        } else if (job->inline_data) {
+            hash_update(ctx, job->inline_data, job->size);
+        }
+
+        job->known = HASHSET_NONE;
+        if (job->err) {
+            continue;
+        }
+        uint8_t digests[DIGEST_SHA256 + 1][DIGEST_MAX_SIZE];
+        for (int algo = DIGEST_MD5; algo <= DIGEST_SHA256; algo++) {
+            if (digest_used[algo]) {
+                digest_final(&ctx[algo], digests[algo]);
+            }
+        }
+        memcpy(job->digest, digests[DIGEST_SHA256], SHA256_DIGEST_SIZE);
+
+        // known bad wins over known good
+        for (int kind = HASHSET_BAD; kind >= HASHSET_GOOD; kind--) {
+            for (size_t s = 0; s < hashset_count; s++) {
+                if (job->known == HASHSET_NONE && hashsets[s].kind == kind &&
+                        hashset_contains(&hashsets[s],
+                            digests[hashsets[s].algo])) {
+                    job->known = s;
+                }
+            }
+        }
+    }
+}
+
+void print_manifest(const struct hash_jobs *jobs) {
+    unsigned long failed = 0;
+    unsigned long long bytes = 0;
+    unsigned long known[2] = {0, 0};
+
+    if (!jsonl) {
+        printf("SHA-256 manifest (%s):\n",
+                sha256_accelerated() ? "SHA extensions" : "portable");
+    }
+
+    for (size_t i = 0; i < jobs->count; i++) {
+        const struct hash_job *job = &jobs->jobs[i];
+        char hex[2*SHA256_DIGEST_SIZE + 1];
+        if (!job->err) {
+            sha256_hex(job->digest, hex);
+            bytes += job->size;
+        } else {
+            failed += 1;
+        }
+
+        if (jsonl) {
+            jsonl_begin(&json, "file");
+            jsonl_str(&json, "path", job->path);
+            jsonl_uint(&json, "size", job->size);
+            jsonl_str(&json, "sha256", job->err ? NULL : hex);
+            if (job->known != HASHSET_NONE) {
+                jsonl_str(&json, "known",
+                        hashset_kind_name(hashsets[job->known].kind));
+                jsonl_str(&json, "set", hashsets[job->known].path);
+            }
+            jsonl_end(&json);
+        } else if (job->err) {
+            printf("%-64s  %10lu  %s\n", "(corrupt CTZ chain)",
+                    (unsigned long)job->size, job->path);
+        } else if (job->known != HASHSET_NONE) {
+            printf("%s  %10lu  %s  [known %s]\n", hex,
+                    (unsigned long)job->size, job->path,
+                    hashset_kind_name(hashsets[job->known].kind));
+        } else {
+            printf("%s  %10lu  %s\n", hex, (unsigned long)job->size, job->path);
+        }
+        if (job->known != HASHSET_NONE) {
+            known[hashsets[job->known].kind] += 1;
+        }
+    }
+
+    fprintf(text_out, "\nHashed %lu files (%llu bytes)\n",
+            (unsigned long)(jobs->count - failed), bytes);
+    if (failed) {
+        fprintf(text_out, "%lu files could not be hashed\n", failed);
+    }
+    if (hashset_count) {
+        fprintf(text_out, "%lu files known bad, %lu known good\n",
+                known[HASHSET_BAD], known[HASHSET_GOOD]);
+    }
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if ((strcmp(argv[i], "--known-good") == 0 ||
+                strcmp(argv[i], "--known-bad") == 0) && i + 1 < argc) {
+            int kind = (strcmp(argv[i], "--known-good") == 0) ?
+                    HASHSET_GOOD : HASHSET_BAD;
+            int err = hashset_append(&hashsets, &hashset_count, argv[++i],
+                    kind);
+            if (err) {
+                fprintf(stderr, "[!] Failed to load hash set %s: %s\n",
+                        argv[i], hashset_error(err));
+                hashset_free_all(hashsets, hashset_count);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    digest_used[DIGEST_SHA256] = true;
+    for (size_t s = 0; s < hashset_count; s++) {
+        digest_used[hashsets[s].algo] = true;
+    }
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--ecc] [--known-good FILE] [--known-bad FILE] [--format text|jsonl] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+
+    const char *image_path = argv[1];
+    if (argc >= 3) {
+        block_size = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        block_count = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        read_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        prog_size = atoi(argv[5]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        return 1;
+    }
+
+    size_t image_size = (size_t)block_size * block_count;
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+        return 1;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        free(image);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
+
+    if (ecc) {
+        ecc_report_t report;
+        if (ecc_correct_image(image, block_size, block_count, &report) == 0) {
+            ecc_print_report(&report, block_size, text_out);
+            fprintf(text_out, "\n");
+        }
+        ecc_report_free(&report);
+    }
+
+    // files are found from the scanned metadata, the image doesn't need
+    // to mount
+    salvage_t s;
+    if (salvage_scan(&s, image, block_size, block_count) != 0) {
+        fprintf(stderr, "[!] Failed to scan image\n");
+        salvage_free(&s);
+        if (jsonl) {
+            jsonl_free(&json);
+        }
+        free(image);
+        return 1;
+    }
+
+    struct hash_jobs jobs = {0};
+    salvage_walk(&s, collect_file, &jobs);
+    parallel_for(jobs.count, HASH_GRAIN, hash_range, &jobs);
+    print_manifest(&jobs);
+
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    free(jobs.jobs);
+    hashset_free_all(hashsets, hashset_count);
+    salvage_free(&s);
+    free(image);
+    return 0;
+}
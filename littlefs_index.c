@@ -0,0 +1,237 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "image.h"
+#include "merkle.h"
+#include "jsonl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// Runs of changed blocks, reported as ranges
+struct diff_runs {
+    lfs_block_t first;
+    lfs_block_t last;
+    bool open;
+    unsigned long blocks;
+    unsigned long runs;
+};
+
+// Loads the sidecar of an image if it is still current, otherwise hashes
+// the image and writes a new one
+int get_index(merkle_t *m, const char *image_path, bool rebuild) {
+    // every partition of a dump gets its own index
+    char view[1024];
+    char sidecar[1100];
+    image_view_name(image_path, image_offset, view, sizeof(view));
+    merkle_sidecar_path(view, sidecar, sizeof(sidecar));
+
+    if (!rebuild && merkle_load(m, sidecar, image_path,
+            block_size, block_count) == 0) {
+        if (!jsonl) {
+            printf("Index of %s: reused %s\n", image_path, sidecar);
+        }
+    } else {
+        // stamped before reading, a write during the read makes the
+        // sidecar stale rather than wrong
+        merkle_t stamp;
+        memset(&stamp, 0, sizeof(stamp));
+        int err = merkle_stamp(&stamp, image_path);
+        if (err) {
+            fprintf(stderr, "[!] Failed to open image file: %s\n", image_path);
+            return err;
+        }
+
+        uint8_t *image;
+        image_digest_t digest;
+        size_t image_size = (size_t)block_size * block_count;
+        err = image_load_at(&image, image_path, image_offset, image_size,
+                DIGEST_NONE, &digest);
+        if (err) {
+            fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                    (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+            return err;
+        }
+
+        err = merkle_build(m, image, block_size, block_count);
+        free(image);
+        if (err) {
+            fprintf(stderr, "[!] Out of memory\n");
+            return err;
+        }
+        m->file_size = stamp.file_size;
+        m->mtime_sec = stamp.mtime_sec;
+        m->mtime_nsec = stamp.mtime_nsec;
+
+        if (merkle_save(m, sidecar) != 0) {
+            fprintf(stderr, "[!] Failed to write %s\n", sidecar);
+        } else if (!jsonl) {
+            printf("Index of %s: built, saved to %s\n", image_path, sidecar);
+        }
+    }
+
+    if (jsonl) {
+        jsonl_begin(&json, "index");
+        jsonl_str(&json, "image", image_path);
+        jsonl_uint(&json, "blocks", m->block_count);
+        jsonl_uint(&json, "levels", m->levels);
+        // as a string, JSON numbers don't survive 64 bits
+        char root[17];
+        snprintf(root, sizeof(root), "%016llx",
+                (unsigned long long)merkle_root(m));
+        jsonl_str(&json, "root", root);
+        jsonl_end(&json);
+    } else {
+        printf("  %lu blocks, %d levels, root %016llx\n",
+                (unsigned long)m->block_count, m->levels,
+                (unsigned long long)merkle_root(m));
+    }
+    return 0;
+}
+
+static void flush_run(struct diff_runs *runs) {
+    if (!runs->open) {
+        return;
+    }
+    runs->open = false;
+    runs->runs += 1;
+
+    if (jsonl) {
+        jsonl_begin(&json, "changed");
+        jsonl_uint(&json, "first", runs->first);
+        jsonl_uint(&json, "last", runs->last);
+        jsonl_uint(&json, "count", runs->last - runs->first + 1);
+        jsonl_end(&json);
+    } else if (runs->first == runs->last) {
+        printf("  block %lu\n", (unsigned long)runs->first);
+    } else {
+        printf("  blocks %lu-%lu (%lu blocks)\n", (unsigned long)runs->first,
+                (unsigned long)runs->last,
+                (unsigned long)(runs->last - runs->first + 1));
+    }
+}
+
+// changed blocks arrive in order, so runs can be closed as they end
+static void changed_block(void *data, lfs_block_t block) {
+    struct diff_runs *runs = data;
+    if (runs->open && block == runs->last + 1) {
+        runs->last = block;
+    } else {
+        flush_run(runs);
+        runs->first = block;
+        runs->last = block;
+        runs->open = true;
+    }
+    runs->blocks += 1;
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool rebuild = false;
+    const char *other_path = NULL;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--rebuild") == 0) {
+            rebuild = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--diff") == 0 && i + 1 < argc) {
+            other_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--diff OTHER_IMAGE] [--rebuild] [--offset N] [--format text|jsonl]\n", argv[0]);
+        return 1;
+    }
+
+    const char *image_path = argv[1];
+    if (argc >= 3) {
+        block_size = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        block_count = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        read_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        prog_size = atoi(argv[5]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        return 1;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        return 1;
+    }
+
+    int ret = 0;
+    merkle_t a, b;
+    if (get_index(&a, image_path, rebuild) != 0) {
+        ret = 1;
+        goto done;
+    }
+
+    if (other_path) {
+        if (get_index(&b, other_path, rebuild) != 0) {
+            merkle_free(&a);
+            ret = 1;
+            goto done;
+        }
+
+        if (!jsonl) {
+            printf("\nChanged blocks:\n");
+        }
+        struct diff_runs runs = {0};
+        long compared = merkle_diff(&a, &b, changed_block, &runs);
+        flush_run(&runs);
+
+        if (compared < 0) {
+            fprintf(stderr, "[!] Cannot diff images with different block sizes\n");
+            ret = 1;
+        } else {
+            fprintf(text_out, "\n%lu blocks changed in %lu runs, "
+                    "%ld of %lu index nodes compared\n",
+                    runs.blocks, runs.runs, compared,
+                    (unsigned long)a.node_count);
+        }
+        merkle_free(&b);
+    }
+    merkle_free(&a);
+
+done:
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    return ret;
+}
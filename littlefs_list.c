@@ -1,8 +1,15 @@
 #include "lfs.h"
+#include "salvage.h"
+#include "ecc.h"
+#include "image.h"
+#include "timeline.h"
+#include "jsonl.h"
+#include "nand.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 
 #define CACHE_SIZE 512
 #define LOOKAHEAD_SIZE 16
@@ -13,8 +20,24 @@ int block_count = 16;
 int read_size = 16;
 int prog_size = 16;
 
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// with --nand, the image is a raw dump with spare bytes after every page
+nand_t nand;
+nand_t *flash = NULL;
+
 int user_read(const struct lfs_config *c, lfs_block_t block,
               lfs_off_t off, void *buffer, lfs_size_t size) {
+    if (flash) {
+        nand_read(flash, (uint64_t)block * c->block_size + off, buffer, size);
+        return 0;
+    }
     memcpy(buffer, &image[block * c->block_size + off], size);
     return 0;
 }
@@ -37,21 +60,36 @@ void traverse_directory(lfs_t *lfs, const char *path) {
     lfs_dir_t dir;
 
     if (lfs_dir_open(lfs, &dir, path) < 0) {
-        printf("[!] Failed to open directory: %s\n", path);
+        fprintf(text_out, "[!] Failed to open directory: %s\n", path);
         return;
     }
-    
-    printf("DIR: %s\n", path);
+
+    if (jsonl) {
+        jsonl_begin(&json, "dir");
+        jsonl_str(&json, "path", path);
+        jsonl_end(&json);
+    } else {
+        printf("DIR: %s\n", path);
+    }
     while (lfs_dir_read(lfs, &dir, &info) > 0) {
         if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0)
             continue;
 
         char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, info.name);
+        // the root is "/", don't double the separator below it
+        snprintf(full_path, sizeof(full_path), "%s/%s",
+                (strcmp(path, "/") == 0) ? "" : path, info.name);
 
 
         if (info.type == LFS_TYPE_REG) {
-            printf("   FILE: %s\n", full_path);
+            if (jsonl) {
+                jsonl_begin(&json, "file");
+                jsonl_str(&json, "path", full_path);
+                jsonl_uint(&json, "size", info.size);
+                jsonl_end(&json);
+            } else {
+                printf("   FILE: %s\n", full_path);
+            }
         } else if (info.type == LFS_TYPE_DIR) {
             traverse_directory(lfs, full_path);
         }
@@ -60,9 +98,138 @@ void traverse_directory(lfs_t *lfs, const char *path) {
     lfs_dir_close(lfs, &dir);
 }
 
+void print_salvaged_entry(void *data, const salvage_info_t *info) {
+    if (jsonl) {
+        jsonl_begin(&json, (info->type == LFS_TYPE_DIR) ? "dir" : "file");
+        jsonl_str(&json, "path", info->path);
+        jsonl_uint(&json, "mdir", info->mdir);
+        jsonl_bool(&json, "salvaged", true);
+        jsonl_bool(&json, "detached", info->detached);
+        jsonl_end(&json);
+    } else if (info->type == LFS_TYPE_DIR) {
+        printf("DIR: %s\n", info->path);
+    } else {
+        printf("   FILE: %s\n", info->path);
+    }
+}
+
+void print_timeline_event(void *data, const timeline_event_t *event) {
+    if (jsonl) {
+        timeline_json_event(event, &json);
+    } else {
+        timeline_print_event(event, stdout);
+    }
+}
+
+// Lists the spare bytes of every page that has any. A block whose first
+// page has a non-erased first spare byte carries a bad block marker.
+void print_oob(void) {
+    static const char digits[] = "0123456789abcdef";
+    size_t per_block = block_size / flash->page_size;
+    char *hex = malloc(2*flash->spare_size + 1);
+    if (!hex) {
+        fprintf(stderr, "[!] Out of memory, spare bytes not listed\n");
+        return;
+    }
+
+    if (!jsonl) {
+        printf("Spare Bytes (%zu+%zu):\n", flash->page_size, flash->spare_size);
+    }
+    unsigned long programmed = 0;
+    unsigned long bad = 0;
+    for (size_t page = 0; page < flash->pages; page++) {
+        if (nand_oob_erased(flash, page)) {
+            continue;
+        }
+        const uint8_t *oob = nand_oob(flash, page);
+        for (size_t i = 0; i < flash->spare_size; i++) {
+            hex[2*i] = digits[oob[i] >> 4];
+            hex[2*i + 1] = digits[oob[i] & 0xf];
+        }
+        hex[2*flash->spare_size] = '\0';
+
+        bool marker = (page % per_block == 0) && oob[0] != 0xff;
+        programmed += 1;
+        bad += marker;
+        if (jsonl) {
+            jsonl_begin(&json, "oob");
+            jsonl_uint(&json, "page", page);
+            jsonl_uint(&json, "block", page / per_block);
+            jsonl_str(&json, "spare", hex);
+            jsonl_bool(&json, "bad", marker);
+            jsonl_end(&json);
+        } else {
+            printf("  Page %zu (block %zu): %s%s\n", page, page / per_block,
+                    hex, marker ? " [bad block marker]" : "");
+        }
+    }
+    fprintf(text_out, "  %lu of %zu pages with spare bytes, %lu bad block markers\n\n",
+            programmed, flash->pages, bad);
+    free(hex);
+}
+
 int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool salvage = false;
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    uint32_t rewind = 0;
+    lfs_block_t mdir = LFS_BLOCK_NULL;
+    bool timeline = false;
+    const char *nand_spec = NULL;
+    bool oob = false;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--salvage") == 0) {
+            salvage = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--mdir") == 0 && i + 1 < argc) {
+            mdir = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--timeline") == 0) {
+            timeline = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--nand") == 0 && i + 1 < argc) {
+            nand_spec = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--oob") == 0) {
+            oob = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--salvage] [--ecc] [--rewind N] [--mdir B] [--timeline] [--nand PAGE+SPARE [--oob]] [--format text|jsonl] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
 
         return 1;
     }
@@ -86,16 +253,88 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    FILE *f = fopen(image_path, "rb");
-    if (!f) {
-        fprintf(stderr, "[!] Failed to open image file: %s\n", image_path);
+    // the scans below read the image as one run of blocks, only a mount
+    // can go through the spare areas
+    size_t page_size = 0;
+    size_t spare_size = 0;
+    if (nand_spec) {
+        if (nand_parse(nand_spec, &page_size, &spare_size) != 0 ||
+                block_size % page_size != 0) {
+            fprintf(stderr, "[!] Invalid NAND geometry: %s (PAGE+SPARE, block size a multiple of PAGE)\n", nand_spec);
+            return 1;
+        }
+        if (salvage || ecc || timeline || rewind) {
+            fprintf(stderr, "[!] --nand can't be used with --salvage, --ecc, --timeline or --rewind\n");
+            return 1;
+        }
+    }
+
+    size_t image_size = (size_t)block_size * block_count;
+    if (nand_spec) {
+        image_size = nand_raw_size(image_size, page_size, spare_size);
+    }
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
         return 1;
     }
 
-    size_t image_size = block_size * block_count;
-    image = malloc(image_size);
-    fread(image, 1, image_size, f);
-    fclose(f);
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        free(image);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
+
+    if (nand_spec) {
+        nand_init(&nand, image, image_size, page_size, spare_size);
+        flash = &nand;
+        if (oob) {
+            print_oob();
+        }
+    }
+
+    if (ecc) {
+        ecc_report_t report;
+        if (ecc_correct_image(image, block_size, block_count, &report) == 0) {
+            ecc_print_report(&report, block_size, text_out);
+            fprintf(text_out, "\n");
+        }
+        ecc_report_free(&report);
+    }
+
+    if (timeline) {
+        salvage_t s;
+        if (salvage_scan(&s, image, block_size, block_count) == 0) {
+            if (!jsonl) {
+                printf("Timeline:\n");
+            }
+            timeline_replay(&s, mdir, print_timeline_event, NULL);
+            if (!jsonl) {
+                printf("\n");
+            }
+        }
+        salvage_free(&s);
+    }
+
+    if (rewind) {
+        timeline_cuts_t cuts;
+        if (timeline_rewind(image, block_size, block_count, rewind, mdir,
+                &cuts) == 0) {
+            timeline_print_cuts(&cuts, rewind, text_out);
+            fprintf(text_out, "\n");
+        }
+        timeline_cuts_free(&cuts);
+    }
 
     struct lfs_config cfg = {
         .read  = user_read,
@@ -115,13 +354,34 @@ int main(int argc, char **argv) {
     lfs_t lfs;
     if (lfs_mount(&lfs, &cfg) != 0) {
         fprintf(stderr, "[!] Failed to mount filesystem\n");
+        if (!salvage) {
+            if (jsonl) {
+                jsonl_free(&json);
+            }
+            free(image);
+            return 1;
+        }
+
+        salvage_t s;
+        if (salvage_scan(&s, image, block_size, block_count) == 0) {
+            salvage_print_summary(&s, text_out);
+            fprintf(text_out, "\n");
+            salvage_walk(&s, print_salvaged_entry, NULL);
+        }
+        salvage_free(&s);
+        if (jsonl) {
+            jsonl_free(&json);
+        }
         free(image);
-        return 1;
+        return 0;
     }
 
     traverse_directory(&lfs, "/");
 
     lfs_unmount(&lfs);
+    if (jsonl) {
+        jsonl_free(&json);
+    }
     free(image);
     return 0;
 }
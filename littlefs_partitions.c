@@ -0,0 +1,166 @@
+#include "lfs.h"
+#include "partition.h"
+#include "image.h"
+#include "jsonl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+// flash partitions start on erase sectors, 4 KiB on SPI NOR, but small
+// littlefs blocks are common enough to look closer
+#define DEFAULT_ALIGN 512
+
+uint8_t *image = NULL;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+void print_partition(const partition_t *parts, size_t i) {
+    const partition_t *p = &parts[i];
+    uint64_t extent = partition_extent(p);
+
+    if (jsonl) {
+        jsonl_begin(&json, "partition");
+        jsonl_uint(&json, "offset", p->offset);
+        jsonl_uint(&json, "version", p->version);
+        jsonl_uint(&json, "block_size", p->block_size);
+        jsonl_uint(&json, "block_count", p->block_count);
+        jsonl_uint(&json, "size", extent);
+        jsonl_uint(&json, "name_max", p->name_max);
+        jsonl_uint(&json, "file_max", p->file_max);
+        jsonl_uint(&json, "attr_max", p->attr_max);
+        jsonl_uint(&json, "revision", p->revision);
+        jsonl_uint(&json, "superblocks", p->superblocks);
+        jsonl_bool(&json, "truncated", p->truncated);
+        if (p->inside >= 0) {
+            jsonl_uint(&json, "inside", parts[p->inside].offset);
+        } else {
+            jsonl_null(&json, "inside");
+        }
+        jsonl_end(&json);
+        return;
+    }
+
+    printf("Partition at 0x%08llx:\n", (unsigned long long)p->offset);
+    printf("  littlefs v%lu.%lu, block size %lu, block count %lu\n",
+            (unsigned long)(p->version >> 16),
+            (unsigned long)(p->version & 0xffff),
+            (unsigned long)p->block_size, (unsigned long)p->block_count);
+    printf("  Extent: 0x%08llx-0x%08llx (%llu bytes)\n",
+            (unsigned long long)p->offset,
+            (unsigned long long)(p->offset + extent),
+            (unsigned long long)extent);
+    printf("  Superblock in block%s (revision %lu)\n",
+            (p->superblocks == 2) ? "s 0 and 1" : " 0 or 1 only",
+            (unsigned long)p->revision);
+    printf("  Name max: %lu, file max: %lu, attr max: %lu\n",
+            (unsigned long)p->name_max, (unsigned long)p->file_max,
+            (unsigned long)p->attr_max);
+    if (p->truncated) {
+        printf("  [!] Runs past the end of the dump, the rest reads as erased\n");
+    }
+    if (p->inside >= 0) {
+        printf("  [!] Lies inside the partition at 0x%08llx, likely an image stored as a file\n",
+                (unsigned long long)parts[p->inside].offset);
+    }
+    printf("  Analyze with: --offset 0x%llx --block-size %lu --block-count %lu\n\n",
+            (unsigned long long)p->offset, (unsigned long)p->block_size,
+            (unsigned long)p->block_count);
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    size_t align = DEFAULT_ALIGN;
+    int image_hash = DIGEST_NONE;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--align") == 0 && i + 1 < argc) {
+            align = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <dump_file> [--align N] [--format text|jsonl] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+    if (align == 0) {
+        fprintf(stderr, "[!] Invalid alignment.\n");
+        return 1;
+    }
+
+    // the geometry is what we're looking for, so the whole dump is read
+    const char *image_path = argv[1];
+    struct stat st;
+    if (stat(image_path, &st) != 0) {
+        fprintf(stderr, "[!] Failed to open image file: %s\n", image_path);
+        return 1;
+    }
+    size_t image_size = st.st_size;
+    image_digest_t digest;
+    int err = image_load(&image, image_path, image_size, image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+        return 1;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        free(image);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
+
+    fprintf(text_out, "Scanning %s (%llu bytes) for littlefs superblocks every %lu bytes\n\n",
+            image_path, (unsigned long long)image_size, (unsigned long)align);
+
+    partition_t *parts;
+    size_t count;
+    if (partition_scan(image, image_size, align, &parts, &count) != 0) {
+        fprintf(stderr, "[!] Out of memory\n");
+        if (jsonl) {
+            jsonl_free(&json);
+        }
+        free(image);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        print_partition(parts, i);
+    }
+    fprintf(text_out, "Found %lu littlefs partition%s\n",
+            (unsigned long)count, (count == 1) ? "" : "s");
+
+    free(parts);
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    free(image);
+    return 0;
+}
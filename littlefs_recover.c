@@ -1,11 +1,23 @@
 #include "lfs.h"
 #include "lfs_util.h"
+#include "salvage.h"
+#include "ecc.h"
+#include "image.h"
+#include "slack.h"
+#include "hexdump.h"
+#include "jsonl.h"
+#include "archive.h"
+#include "store.h"
+#include "blockcache.h"
+#include "carve.h"
+#include "classify.h"
+#include "fuzzy.h"
+#include "hashset.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
-#include <ctype.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -14,11 +26,83 @@
 
 uint8_t *image = NULL;
 bool *block_usage = NULL;
+hexdump_t hex;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// with --archive, everything recovered goes into one tar instead of
+// a file per block under recovered_blocks
+const char *archive_path = NULL;
+archive_t archive;
+
+// with --store, everything recovered goes into a content-addressed store
+// shared with other runs, each distinct content kept once
+const char *store_root = NULL;
+store_t store;
+
+// with --cache, what the scans learn about each block is kept in
+// <image_file>.lfscache and reused by the next run
+blockcache_t block_cache;
+blockcache_t *cache = NULL;
+
+// content class of every block, so orphans can be triaged by what they
+// hold rather than read one by one
+uint8_t *block_class = NULL;
+float *block_entropy = NULL;
+float *block_printable = NULL;
+
+// with --carve, orphaned blocks and slack are searched for known file
+// formats. Runs of adjacent orphaned blocks are joined into one copy so
+// an object can span them.
+struct carve_segment {
+    size_t pos;             // in the joined copy
+    size_t offset;          // in the image
+    size_t size;
+};
+
+struct carve_input {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+    struct carve_segment *segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    carve_region_t *regions;
+    size_t region_count;
+    size_t region_capacity;
+    carve_object_t *objects;
+    size_t object_count;
+    size_t object_capacity;
+    bool nomem;
+};
+
+bool carve = false;
+struct carve_input carve_in;
+
+// with --cluster, orphans and carved objects that are near copies of each
+// other are grouped, and only the first of each group is shown in full
+#define CLUSTER_SIMILARITY 50
+bool cluster = false;
+uint32_t *orphan_rep = NULL;        // per block, first orphan of its group
+uint32_t *orphan_group = NULL;      // per block, size of the group it leads
+
+// with --known-good and --known-bad, blocks and carved objects are looked
+// up in hash sets, and what is known good is left out of recovery
+hashset_t *hashsets = NULL;
+size_t hashset_count = 0;
+int *block_known = NULL;            // per block, matching set or HASHSET_NONE
+
 int block_size = 4096;
 int block_count = 16;
 int read_size = 16;
 int prog_size = 16;
 
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
 int user_read(const struct lfs_config *c, lfs_block_t block,
               lfs_off_t off, void *buffer, lfs_size_t size) {
     if (block < block_count) {
@@ -58,7 +142,9 @@ void traverse_directory(lfs_t *lfs, const char *path) {
         if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0) continue;
 
         char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, info.name);
+        // the root is "/", don't double the separator below it
+        snprintf(full_path, sizeof(full_path), "%s/%s",
+                (strcmp(path, "/") == 0) ? "" : path, info.name);
 
         if (info.type == LFS_TYPE_REG) {
             lfs_file_t file;
@@ -75,49 +161,694 @@ void traverse_directory(lfs_t *lfs, const char *path) {
     lfs_dir_close(lfs, &dir);
 }
 
-void dump_block_to_file(int block_index, const uint8_t *block_data, int block_size) {
-    char filename[64];
-    snprintf(filename, sizeof(filename), "recovered_blocks/block_%d.bin", block_index);
-
+bool write_data_to_file(const char *filename, const uint8_t *data, int size) {
     FILE *f = fopen(filename, "wb");
-    if (f) {
-        fwrite(block_data, 1, block_size, f);
-        fclose(f);
+    if (!f) {
+        fprintf(stderr, "[!] Failed to write %s\n", filename);
+        return false;
+    }
+
+    fwrite(data, 1, size, f);
+    fclose(f);
+    return true;
+}
+
+// Saves data under name, filename gets where it went. Data that is a
+// range of the image at src_off, not -1, can be copied from the file.
+bool save_copy(const char *name, const uint8_t *data, size_t size,
+        int64_t src_off, char *filename, size_t len) {
+    if (store_root) {
+        if (store_put(&store, name, data, size, filename, len) != 0) {
+            fprintf(stderr, "[!] Failed to store %s in %s\n", name, store_root);
+            return false;
+        }
+        return true;
+    }
+    if (!archive_path) {
+        snprintf(filename, len, "recovered_blocks/%s", name);
+        return write_data_to_file(filename, data, size);
+    }
+
+    snprintf(filename, len, "%s:%s", archive_path, name);
+    if (archive_add(&archive, name, data, size, src_off) != 0) {
+        fprintf(stderr, "[!] Failed to add %s to %s\n", name, archive_path);
+        return false;
+    }
+    return true;
+}
+
+// Everything but carved objects points into the image
+bool save_data(const char *name, const uint8_t *data, int size,
+        char *filename, size_t len) {
+    return save_copy(name, data, size, data - image, filename, len);
+}
+
+bool dump_block_to_file(int block_index, const uint8_t *block_data, int block_size,
+        char *filename, size_t len) {
+    char name[32];
+    snprintf(name, sizeof(name), "block_%d.bin", block_index);
+
+    if (!save_data(name, block_data, block_size, filename, len)) {
+        return false;
+    }
+    if (!jsonl) {
         printf("\nSaved block %d to %s\n", block_index, filename);
+    }
+    return true;
+}
+
+void print_content(const uint8_t *data, int size) {
+    if (hexdump_printable(data, size)) {
+        printf("ASCII content:\n");
+        fwrite(data, 1, size, stdout);
+        printf("\n");
     } else {
-        fprintf(stderr, "[!] Failed to write %s\n", filename);
+        printf("Hex dump (first 64 bytes):\n");
+        hexdump_lines(&hex, data, (size < 64) ? size : 64, 0);
+        hexdump_flush(&hex);
     }
 }
 
 void dump_block_to_terminal(int block_index, const uint8_t *block_data, int block_size) {
+    char filename[512];
+
+    if (jsonl) {
+        bool saved = dump_block_to_file(block_index, block_data, block_size,
+                filename, sizeof(filename));
+        jsonl_begin(&json, "orphan");
+        jsonl_uint(&json, "block", block_index);
+        jsonl_uint(&json, "offset", (uint64_t)block_index * block_size);
+        jsonl_uint(&json, "size", block_size);
+        jsonl_bool(&json, "text", hexdump_printable(block_data, block_size));
+        if (block_class) {
+            jsonl_str(&json, "class", classify_name(block_class[block_index]));
+            jsonl_real(&json, "entropy", block_entropy[block_index]);
+            jsonl_real(&json, "printable", block_printable[block_index]);
+        }
+        if (orphan_rep) {
+            jsonl_uint(&json, "cluster", orphan_rep[block_index]);
+        }
+        if (block_known && block_known[block_index] != HASHSET_NONE) {
+            jsonl_str(&json, "known", hashset_kind_name(
+                    hashsets[block_known[block_index]].kind));
+        }
+        jsonl_str(&json, "saved", saved ? filename : NULL);
+        jsonl_end(&json);
+        return;
+    }
+
+    if (orphan_rep && orphan_rep[block_index] != (uint32_t)block_index) {
+        printf("\nOrphaned block %d: similar to block %lu\n", block_index,
+                (unsigned long)orphan_rep[block_index]);
+        dump_block_to_file(block_index, block_data, block_size,
+                filename, sizeof(filename));
+        return;
+    }
+
     printf("\nOrphaned block %d:\n", block_index);
+    if (block_class) {
+        printf("Class: %s (entropy %.2f bits/byte, %.0f%% printable)\n",
+                classify_name(block_class[block_index]),
+                block_entropy[block_index],
+                100 * block_printable[block_index]);
+    }
+    if (orphan_rep && orphan_group[block_index] > 1) {
+        printf("Similar blocks: %lu more\n",
+                (unsigned long)orphan_group[block_index] - 1);
+    }
+    if (block_known && block_known[block_index] != HASHSET_NONE) {
+        printf("Known %s: listed in %s\n",
+                hashset_kind_name(hashsets[block_known[block_index]].kind),
+                hashsets[block_known[block_index]].path);
+    }
+    print_content(block_data, block_size);
+    dump_block_to_file(block_index, block_data, block_size,
+            filename, sizeof(filename));
+}
+
+static void *grow(void *list, size_t *capacity, size_t need, size_t size) {
+    if (need <= *capacity) {
+        return list;
+    }
+    size_t ncapacity = *capacity ? *capacity : 64;
+    while (ncapacity < need) {
+        ncapacity *= 2;
+    }
+    void *nlist = realloc(list, ncapacity * size);
+    if (nlist) {
+        *capacity = ncapacity;
+    }
+    return nlist;
+}
+
+// Appends a range of the image to the carving input, as a region of its
+// own or continuing the last one
+void carve_append(struct carve_input *in, size_t offset, size_t size,
+        bool join) {
+    if (in->nomem || size == 0) {
+        return;
+    }
+
+    uint8_t *ndata = grow(in->data, &in->capacity, in->size + size, 1);
+    struct carve_segment *nsegments = grow(in->segments,
+            &in->segment_capacity, in->segment_count + 1,
+            sizeof(struct carve_segment));
+    if (ndata) {
+        in->data = ndata;
+    }
+    if (nsegments) {
+        in->segments = nsegments;
+    }
+    if (!ndata || !nsegments) {
+        in->nomem = true;
+        return;
+    }
 
-    bool printable = true;
-    for (int i = 0; i < block_size; i++) {
-        if (!isprint(block_data[i]) && block_data[i] != '\n' && block_data[i] != '\r') {
-            printable = false;
+    if (!join || in->region_count == 0) {
+        carve_region_t *nregions = grow(in->regions, &in->region_capacity,
+                in->region_count + 1, sizeof(carve_region_t));
+        if (!nregions) {
+            in->nomem = true;
+            return;
+        }
+        in->regions = nregions;
+        in->regions[in->region_count++] = (carve_region_t){in->size, 0};
+    }
+
+    memcpy(&in->data[in->size], &image[offset], size);
+    in->segments[in->segment_count++] = (struct carve_segment){
+        in->size, offset, size,
+    };
+    in->regions[in->region_count-1].size += size;
+    in->size += size;
+}
+
+// Bytes of CTZ pointers at the start of a block that lead to the blocks
+// right before it, 0 if the block doesn't continue the one before
+lfs_off_t carve_skip(lfs_block_t block) {
+    const uint8_t *data = &image[(size_t)block * block_size];
+    lfs_off_t off = 0;
+    for (int k = 0; k < 32 && off + 4 <= (lfs_off_t)block_size; k++) {
+        uint32_t ptr;
+        memcpy(&ptr, &data[off], sizeof(ptr));
+        if (block < ((lfs_block_t)1 << k) ||
+                lfs_fromle32(ptr) != block - ((lfs_block_t)1 << k)) {
             break;
         }
+        off += 4;
     }
+    return off;
+}
 
-    if (printable) {
-        printf("ASCII content:\n");
-        fwrite(block_data, 1, block_size, stdout);
-        printf("\n");
-    } else {
-        printf("Hex dump (first 64 bytes):\n");
-        for (int i = 0; i < 64 && i < block_size; i++) {
-            printf("%02X ", block_data[i]);
+// Where a position in the joined copy came from
+const struct carve_segment *carve_source(const struct carve_input *in,
+        size_t pos) {
+    size_t lo = 0, hi = in->segment_count;
+    while (lo + 1 < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (in->segments[mid].pos <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return &in->segments[lo];
+}
+
+// Where in the image a carved object starts
+size_t carved_offset(const struct carve_input *in,
+        const carve_object_t *object) {
+    const struct carve_segment *first = carve_source(in, object->offset);
+    return first->offset + (object->offset - first->pos);
+}
+
+// Objects are kept until carving is done, so they can be clustered
+void collect_carved(void *data, const carve_object_t *object) {
+    struct carve_input *in = data;
+    carve_object_t *nobjects = grow(in->objects, &in->object_capacity,
+            in->object_count + 1, sizeof(carve_object_t));
+    if (!nobjects) {
+        in->nomem = true;
+        return;
+    }
+    in->objects = nobjects;
+    in->objects[in->object_count++] = *object;
+}
+
+// rep is the first object of a group of near copies this one belongs to,
+// known the hash set it is listed in
+void dump_carved(const struct carve_input *in, const carve_object_t *object,
+        const carve_object_t *rep, const hashset_t *known) {
+    const struct carve_segment *first = carve_source(in, object->offset);
+    const struct carve_segment *last = carve_source(in,
+            object->offset + object->size - 1);
+    size_t offset = carved_offset(in, object);
+    size_t end = last->offset + (object->offset + object->size - 1 - last->pos);
+    lfs_block_t block = offset / block_size;
+    lfs_block_t last_block = end / block_size;
+
+    char name[64];
+    char filename[512];
+    snprintf(name, sizeof(name), "carved_%08lx.%s",
+            (unsigned long)offset, object->ext);
+    // an object within one segment is still a plain range of the image
+    bool saved = save_copy(name, &in->data[object->offset], object->size,
+            (first == last) ? (int64_t)offset : -1, filename, sizeof(filename));
+
+    if (jsonl) {
+        jsonl_begin(&json, "carved");
+        jsonl_str(&json, "type", object->type);
+        jsonl_uint(&json, "block", block);
+        jsonl_uint(&json, "off", offset % block_size);
+        jsonl_uint(&json, "offset", offset);
+        jsonl_uint(&json, "size", object->size);
+        jsonl_uint(&json, "last_block", last_block);
+        jsonl_bool(&json, "complete", object->complete);
+        if (rep) {
+            jsonl_uint(&json, "cluster", carved_offset(in, rep));
+        }
+        if (known) {
+            jsonl_str(&json, "known", hashset_kind_name(known->kind));
+        }
+        jsonl_str(&json, "saved", saved ? filename : NULL);
+        jsonl_end(&json);
+        return;
+    }
+
+    printf("\nCarved %s in block %lu at +0x%04lx (%lu bytes",
+            object->type, (unsigned long)block,
+            (unsigned long)(offset % block_size), (unsigned long)object->size);
+    if (last_block != block) {
+        printf(", through block %lu", (unsigned long)last_block);
+    }
+    printf("%s)\n", object->complete ? "" : ", truncated");
+    if (rep && rep != object) {
+        printf("Similar to carved_%08lx.%s\n",
+                (unsigned long)carved_offset(in, rep), rep->ext);
+    }
+    if (known) {
+        printf("Known %s: listed in %s\n", hashset_kind_name(known->kind),
+                known->path);
+    }
+    if (saved) {
+        printf("Saved carved object to %s\n", filename);
+    }
+}
+
+void dump_slack_to_terminal(void *data, const slack_range_t *range) {
+    char name[64];
+    char filename[512];
+    if (carve) {
+        carve_append(&carve_in,
+                (size_t)range->block * block_size + range->off,
+                range->size, false);
+    }
+
+    snprintf(name, sizeof(name), "slack_%lu_%04lx.bin",
+            (unsigned long)range->block, (unsigned long)range->off);
+
+    if (jsonl) {
+        bool saved = save_data(name, range->data, range->size,
+                filename, sizeof(filename));
+        jsonl_begin(&json, "slack");
+        jsonl_str(&json, "kind",
+                (range->kind == SLACK_METADATA) ? "metadata" : "file");
+        jsonl_uint(&json, "block", range->block);
+        jsonl_uint(&json, "off", range->off);
+        jsonl_uint(&json, "offset",
+                (uint64_t)range->block * block_size + range->off);
+        jsonl_uint(&json, "size", range->size);
+        jsonl_str(&json, "owner", range->owner);
+        jsonl_bool(&json, "text", hexdump_printable(range->data, range->size));
+        jsonl_str(&json, "saved", saved ? filename : NULL);
+        jsonl_end(&json);
+        return;
+    }
+
+    printf("\n%s slack in block %lu at +0x%04lx (%lu bytes, owner %s):\n",
+            (range->kind == SLACK_METADATA) ? "Metadata" : "File",
+            (unsigned long)range->block, (unsigned long)range->off,
+            (unsigned long)range->size, range->owner);
+    print_content(range->data, range->size);
+
+    if (save_data(name, range->data, range->size, filename, sizeof(filename))) {
+        printf("\nSaved slack to %s\n", filename);
+    }
+}
+
+// Whether a block is still erased, the cache may already know
+bool block_blank(int i) {
+    blockcache_facts_t *facts = cache ? &cache->facts[i] : NULL;
+    if (facts && (facts->flags & BLOCKCACHE_BLANK)) {
+        return facts->flags & BLOCKCACHE_ERASED;
+    }
+
+    bool blank = true;
+    for (int j = 0; j < block_size; j++) {
+        if (image[i * block_size + j] != 0xFF) {
+            blank = false;
+            break;
+        }
+    }
+
+    if (facts) {
+        facts->flags |= BLOCKCACHE_BLANK | (blank ? BLOCKCACHE_ERASED : 0);
+    }
+    return blank;
+}
+
+// Whether a block is recovered: nothing references it, it isn't erased,
+// and no hash set knows it as good
+bool block_orphaned(int i) {
+    return !block_usage[i] && !block_blank(i) && !(block_known &&
+            block_known[i] != HASHSET_NONE &&
+            hashsets[block_known[i]].kind == HASHSET_GOOD);
+}
+
+// Looks every programmed block up in the hash sets
+int match_blocks(void) {
+    hashset_range_t *ranges = malloc(block_count * sizeof(hashset_range_t));
+    block_known = malloc(block_count * sizeof(int));
+    if (!ranges || !block_known) {
+        free(ranges);
+        free(block_known);
+        block_known = NULL;
+        return LFS_ERR_NOMEM;
+    }
+
+    for (int i = 0; i < block_count; i++) {
+        ranges[i] = (hashset_range_t){
+            block_blank(i) ? NULL : &image[i * block_size], block_size
+        };
+    }
+    hashset_match(hashsets, hashset_count, ranges, block_count, block_known);
+    free(ranges);
+    return 0;
+}
+
+// Known bad blocks one by one, known good ones only counted
+void print_known_blocks(void) {
+    lfs_size_t good = 0;
+    lfs_size_t dropped = 0;
+    lfs_size_t bad = 0;
+    if (!jsonl) {
+        printf("\nHash Set Matches:\n");
+    }
+    for (int i = 0; i < block_count; i++) {
+        if (block_known[i] == HASHSET_NONE) {
+            continue;
+        }
+        const hashset_t *set = &hashsets[block_known[i]];
+        if (jsonl) {
+            jsonl_begin(&json, "known");
+            jsonl_str(&json, "kind", hashset_kind_name(set->kind));
+            jsonl_uint(&json, "block", i);
+            jsonl_bool(&json, "used", block_usage[i]);
+            jsonl_str(&json, "set", set->path);
+            jsonl_end(&json);
+        }
+
+        if (set->kind == HASHSET_GOOD) {
+            good += 1;
+            dropped += !block_usage[i];
+            continue;
+        }
+        bad += 1;
+        if (!jsonl) {
+            printf("  Block %d (%s): known bad, listed in %s\n", i,
+                    block_usage[i] ? "in use" : "orphaned", set->path);
         }
-        printf("...\n");
     }
 
-    dump_block_to_file(block_index, block_data, block_size);
+    fprintf(text_out, "%s%lu blocks known bad, %lu known good", jsonl ? "" : "  ",
+            (unsigned long)bad, (unsigned long)good);
+    fprintf(text_out, " (%lu orphaned ones left out)\n", (unsigned long)dropped);
+}
+
+// Groups the orphaned blocks that are near copies of each other, the
+// first block of a group stands for the rest
+int cluster_orphans(void) {
+    uint32_t *orphans = malloc(block_count * sizeof(uint32_t));
+    fuzzy_range_t *ranges = malloc(block_count * sizeof(fuzzy_range_t));
+    fuzzy_sig_t *sigs = malloc(block_count * sizeof(fuzzy_sig_t));
+    size_t *rep = malloc(block_count * sizeof(size_t));
+    orphan_rep = malloc(block_count * sizeof(uint32_t));
+    orphan_group = calloc(block_count, sizeof(uint32_t));
+    int err = LFS_ERR_NOMEM;
+    if (!orphans || !ranges || !sigs || !rep || !orphan_rep ||
+            !orphan_group) {
+        goto cleanup;
+    }
+
+    size_t n = 0;
+    for (int i = 0; i < block_count; i++) {
+        orphan_rep[i] = i;
+        if (block_orphaned(i)) {
+            orphans[n] = i;
+            ranges[n] = (fuzzy_range_t){&image[i * block_size], block_size};
+            n++;
+        }
+    }
+
+    // with no orphans every block stands for itself
+    err = 0;
+    if (n == 0) {
+        goto cleanup;
+    }
+
+    fuzzy_hash_ranges(ranges, n, sigs);
+    err = fuzzy_cluster(sigs, n, CLUSTER_SIMILARITY, rep);
+    if (!err) {
+        for (size_t j = 0; j < n; j++) {
+            orphan_rep[orphans[j]] = orphans[rep[j]];
+            orphan_group[orphans[rep[j]]] += 1;
+        }
+    }
+
+cleanup:
+    free(orphans);
+    free(ranges);
+    free(sigs);
+    free(rep);
+    if (err) {
+        free(orphan_rep);
+        free(orphan_group);
+        orphan_rep = NULL;
+        orphan_group = NULL;
+    }
+    return err;
+}
+
+// One line per group of similar orphans, its first block and the members
+void print_orphan_clusters(void) {
+    if (jsonl) {
+        for (int i = 0; i < block_count; i++) {
+            if (orphan_group[i] > 1) {
+                jsonl_begin(&json, "cluster");
+                jsonl_str(&json, "kind", "orphan");
+                jsonl_uint(&json, "block", i);
+                jsonl_uint(&json, "count", orphan_group[i]);
+                jsonl_end(&json);
+            }
+        }
+        return;
+    }
+
+    // members are chained in block order, so each group is listed in
+    // one pass over the image
+    uint32_t *next = malloc(block_count * sizeof(uint32_t));
+    uint32_t *tail = malloc(block_count * sizeof(uint32_t));
+    if (!next || !tail) {
+        free(next);
+        free(tail);
+        return;
+    }
+    for (int i = 0; i < block_count; i++) {
+        next[i] = UINT32_MAX;
+        tail[i] = i;
+        uint32_t r = orphan_rep[i];
+        if (r != (uint32_t)i) {
+            next[tail[r]] = i;
+            tail[r] = i;
+        }
+    }
+
+    printf("\nOrphan Clusters:\n");
+    lfs_size_t groups = 0;
+    for (int i = 0; i < block_count; i++) {
+        if (orphan_group[i] < 2) {
+            continue;
+        }
+        groups += 1;
+        printf("  block %d: %lu blocks (", i, (unsigned long)orphan_group[i]);
+        // runs of adjacent members are shown as ranges
+        uint32_t b = i;
+        while (b != UINT32_MAX) {
+            uint32_t e = b;
+            while (next[e] == e + 1) {
+                e = next[e];
+            }
+            printf((b == (uint32_t)i) ? "%lu" : " %lu", (unsigned long)b);
+            if (e != b) {
+                printf("-%lu", (unsigned long)e);
+            }
+            b = next[e];
+        }
+        printf(")\n");
+    }
+    if (!groups) {
+        printf("  No similar orphaned blocks\n");
+    }
+    free(next);
+    free(tail);
+}
+
+// Reports every carved object, near copies point to the first of theirs
+void print_carved(const struct carve_input *in) {
+    size_t *rep = NULL;
+    if (cluster && in->object_count) {
+        fuzzy_range_t *ranges = malloc(
+                in->object_count * sizeof(fuzzy_range_t));
+        fuzzy_sig_t *sigs = malloc(in->object_count * sizeof(fuzzy_sig_t));
+        rep = malloc(in->object_count * sizeof(size_t));
+        if (ranges && sigs && rep) {
+            for (size_t i = 0; i < in->object_count; i++) {
+                ranges[i] = (fuzzy_range_t){
+                    &in->data[in->objects[i].offset], in->objects[i].size
+                };
+            }
+            fuzzy_hash_ranges(ranges, in->object_count, sigs);
+            if (fuzzy_cluster(sigs, in->object_count, CLUSTER_SIMILARITY,
+                    rep) != 0) {
+                free(rep);
+                rep = NULL;
+            }
+        } else {
+            free(rep);
+            rep = NULL;
+        }
+        if (!rep) {
+            fprintf(stderr, "[!] Out of memory, carved objects not clustered\n");
+        }
+        free(ranges);
+        free(sigs);
+    }
+
+    int *known = NULL;
+    if (hashset_count && in->object_count) {
+        hashset_range_t *ranges = malloc(
+                in->object_count * sizeof(hashset_range_t));
+        known = malloc(in->object_count * sizeof(int));
+        if (ranges && known) {
+            for (size_t i = 0; i < in->object_count; i++) {
+                ranges[i] = (hashset_range_t){
+                    &in->data[in->objects[i].offset], in->objects[i].size
+                };
+            }
+            hashset_match(hashsets, hashset_count, ranges, in->object_count,
+                    known);
+        } else {
+            fprintf(stderr, "[!] Out of memory, carved objects not matched\n");
+            free(known);
+            known = NULL;
+        }
+        free(ranges);
+    }
+
+    for (size_t i = 0; i < in->object_count; i++) {
+        const hashset_t *set = (known && known[i] != HASHSET_NONE) ?
+                &hashsets[known[i]] : NULL;
+        if (set && set->kind == HASHSET_GOOD) {
+            continue;
+        }
+        dump_carved(in, &in->objects[i],
+                rep ? &in->objects[rep[i]] : NULL, set);
+    }
+    free(known);
+    free(rep);
 }
 
 int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool salvage = false;
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    bool slack = false;
+    bool use_cache = false;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--salvage") == 0) {
+            salvage = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--slack") == 0) {
+            slack = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--carve") == 0) {
+            carve = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cluster") == 0) {
+            cluster = true;
+            continue;
+        }
+        if ((strcmp(argv[i], "--known-good") == 0 ||
+                strcmp(argv[i], "--known-bad") == 0) && i + 1 < argc) {
+            int kind = (strcmp(argv[i], "--known-good") == 0) ?
+                    HASHSET_GOOD : HASHSET_BAD;
+            int err = hashset_append(&hashsets, &hashset_count, argv[++i],
+                    kind);
+            if (err) {
+                fprintf(stderr, "[!] Failed to load hash set %s: %s\n",
+                        argv[i], hashset_error(err));
+                hashset_free_all(hashsets, hashset_count);
+                return 1;
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--archive") == 0 && i + 1 < argc) {
+            archive_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_root = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--salvage] [--ecc] [--slack] [--carve] [--cluster] [--known-good FILE] [--known-bad FILE] [--archive FILE] [--store DIR] [--cache] [--format text|jsonl] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+    if (archive_path && store_root) {
+        fprintf(stderr, "[!] --archive and --store can't be used together\n");
         return 1;
     }
 
@@ -135,17 +866,97 @@ int main(int argc, char **argv) {
         prog_size = atoi(argv[5]);
     }
 
-    FILE *f = fopen(image_path, "rb");
-    if (!f) {
-        fprintf(stderr, "[!] Failed to open image file: %s\n", image_path);
+    size_t image_size = (size_t)block_size * block_count;
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
         return 1;
     }
 
-    image = malloc(block_size * block_count);
-    fread(image, 1, block_size * block_count, f);
-    fclose(f);
+    // archive members are copied from the file itself
+    FILE *f = archive_path ? fopen(image_path, "rb") : NULL;
 
     block_usage = calloc(block_count, sizeof(bool));
+    text_out = jsonl ? stderr : stdout;
+    if (!hexdump_init(&hex, stdout, true) ||
+            (jsonl && !jsonl_init(&json, stdout))) {
+        fprintf(stderr, "[!] Out of memory\n");
+        if (f) {
+            fclose(f);
+        }
+        free(image);
+        free(block_usage);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
+
+    if (ecc) {
+        ecc_report_t report;
+        int err = ecc_correct_image(image, block_size, block_count, &report);
+        if (err == 0) {
+            ecc_print_report(&report, block_size, text_out);
+            fprintf(text_out, "\n");
+        } else {
+            fprintf(stderr, "[!] Bit error correction failed (%d), the image may be partly corrected\n", err);
+        }
+        // the corrected bytes only exist in memory now
+        if ((report.count || err) && f) {
+            fclose(f);
+            f = NULL;
+        }
+        ecc_report_free(&report);
+    }
+
+    // opened after any corrections, the cache is keyed by content
+    if (use_cache) {
+        char view[1024];
+        image_view_name(image_path, image_offset, view, sizeof(view));
+        if (blockcache_open(&block_cache, view, image,
+                block_size, block_count) == 0) {
+            cache = &block_cache;
+            blockcache_print_summary(cache, text_out);
+            fprintf(text_out, "\n");
+        } else {
+            fprintf(stderr, "[!] Out of memory, running without the cache\n");
+        }
+    }
+
+    if (store_root) {
+        // keyed like the cache, by what was recovered from
+        char view[1024];
+        image_view_name(image_path, image_offset, view, sizeof(view));
+        if (store_open(&store, store_root, view, image, image_size,
+                "recover") != 0) {
+            fprintf(stderr, "[!] Failed to open store: %s\n", store_root);
+            if (f) {
+                fclose(f);
+            }
+            free(image);
+            free(block_usage);
+            return 1;
+        }
+    } else if (archive_path) {
+        if (archive_open(&archive, archive_path, f ? fileno(f) : -1,
+                image_offset) != 0) {
+            fprintf(stderr, "[!] Failed to create archive: %s\n", archive_path);
+            if (f) {
+                fclose(f);
+            }
+            free(image);
+            free(block_usage);
+            return 1;
+        }
+    } else {
+        mkdir("recovered_blocks", 0755);
+    }
 
     struct lfs_config cfg = {
         .read  = user_read,
@@ -162,40 +973,180 @@ int main(int argc, char **argv) {
         .block_cycles = -1
     };
 
-    mkdir("recovered_blocks", 0755);
-
+    // the blocks a mount reads only change with the image, a cache that
+    // saw this exact image already knows them
     lfs_t lfs;
-    if (lfs_mount(&lfs, &cfg) == 0) {
+    if (cache && cache->usage) {
+        for (int i = 0; i < block_count; i++) {
+            block_usage[i] = cache->usage[i];
+        }
+        fprintf(text_out, "Blocks in use taken from the cache, image unchanged\n");
+    } else if (lfs_mount(&lfs, &cfg) == 0) {
         traverse_directory(&lfs, "/");
         lfs_unmount(&lfs);
+        if (cache && blockcache_put_usage(cache, block_usage) != 0) {
+            fprintf(stderr, "[!] Out of memory, block usage not cached\n");
+        }
     } else {
         fprintf(stderr, "[!] Failed to mount image.\n");
+        if (salvage) {
+            // mark what the rebuilt tree still references so only
+            // genuinely orphaned blocks are dumped
+            salvage_t s;
+            if (salvage_scan_cached(&s, image, block_size, block_count,
+                    cache) == 0) {
+                salvage_print_summary(&s, text_out);
+                salvage_mark_used(&s, block_usage);
+            }
+            salvage_free(&s);
+        }
     }
 
-    printf("\nThe files in the filesystem use the following blocks:\n");
-    for (int i = 0; i < block_count; i++) {
-        if (block_usage[i]) {
-            printf("%d ", i);
+    if (jsonl) {
+        for (int i = 0; i < block_count; i++) {
+            if (block_usage[i]) {
+                jsonl_begin(&json, "block");
+                jsonl_uint(&json, "block", i);
+                jsonl_bool(&json, "used", true);
+                jsonl_end(&json);
+            }
+        }
+    } else {
+        printf("\nThe files in the filesystem use the following blocks:\n");
+        for (int i = 0; i < block_count; i++) {
+            if (block_usage[i]) {
+                printf("%d ", i);
+            }
         }
+        printf("\n");
+
+        printf("\nOrphaned Block Scan:\n");
+    }
+    block_class = malloc(block_count);
+    block_entropy = malloc(block_count * sizeof(float));
+    block_printable = malloc(block_count * sizeof(float));
+    if (block_class && block_entropy && block_printable) {
+        classify_image(image, block_size, block_count, cache,
+                block_class, block_entropy, block_printable);
+    } else {
+        fprintf(stderr, "[!] Out of memory, blocks are not classified\n");
+        free(block_class);
+        block_class = NULL;
     }
-    printf("\n");
 
-    printf("\nOrphaned Block Scan:\n");
+    if (hashset_count && match_blocks() != 0) {
+        fprintf(stderr, "[!] Out of memory, blocks are not matched\n");
+    }
+    if (cluster && cluster_orphans() != 0) {
+        fprintf(stderr, "[!] Out of memory, orphans are not clustered\n");
+    }
+
+    bool joined = false;
     for (int i = 0; i < block_count; i++) {
-        if (block_usage[i]) continue;
+        if (!block_orphaned(i)) {
+            joined = false;
+            continue;
+        }
 
-        bool blank = true;
-        for (int j = 0; j < block_size; j++) {
-            if (image[i * block_size + j] != 0xFF) {
-                blank = false;
-                break;
+        dump_block_to_terminal(i, &image[i * block_size], block_size);
+        if (carve) {
+            // a deleted file's blocks are usually allocated in order, its
+            // CTZ pointers are left out of the joined copy
+            lfs_off_t skip = joined ? carve_skip(i) : 0;
+            carve_append(&carve_in, (size_t)i * block_size + skip,
+                    block_size - skip, joined);
+            joined = true;
+        }
+    }
+
+    if (orphan_rep) {
+        print_orphan_clusters();
+    }
+    if (block_known) {
+        print_known_blocks();
+    }
+
+    if (block_class) {
+        if (jsonl) {
+            lfs_size_t totals[CLASSIFY_COUNT] = {0};
+            for (int i = 0; i < block_count; i++) {
+                totals[block_class[i]]++;
+            }
+            jsonl_begin(&json, "classes");
+            for (int c = 0; c < CLASSIFY_COUNT; c++) {
+                jsonl_uint(&json, classify_name(c), totals[c]);
             }
+            jsonl_end(&json);
+        } else {
+            printf("\n");
+            classify_print_heatmap(block_class, block_count, stdout);
         }
-        if (!blank) {
-            dump_block_to_terminal(i, &image[i * block_size], block_size);
+    }
+
+    if (slack) {
+        if (!jsonl) {
+            printf("\nSlack Space Scan:\n");
+        }
+        salvage_t s;
+        if (salvage_scan_cached(&s, image, block_size, block_count,
+                cache) == 0) {
+            slack_scan(&s, dump_slack_to_terminal, NULL);
+        }
+        salvage_free(&s);
+    }
+
+    if (carve) {
+        if (!jsonl) {
+            printf("\nCarved Objects:\n");
+        }
+        if (carve_in.nomem || carve_scan(carve_in.data, carve_in.regions,
+                carve_in.region_count, collect_carved, &carve_in) != 0 ||
+                carve_in.nomem) {
+            fprintf(stderr, "[!] Out of memory, carving skipped\n");
+        } else {
+            print_carved(&carve_in);
+        }
+        free(carve_in.data);
+        free(carve_in.objects);
+        free(carve_in.segments);
+        free(carve_in.regions);
+    }
+
+    if (archive_path) {
+        if (archive_close(&archive) != 0) {
+            fprintf(stderr, "[!] Failed to write archive: %s\n", archive_path);
+        } else {
+            fprintf(text_out, "\nRecovered data archived to %s\n", archive_path);
         }
     }
+    if (store_root) {
+        fprintf(text_out, "\n");
+        store_print_summary(&store, text_out);
+        if (store_close(&store) != 0) {
+            fprintf(stderr, "[!] Failed to write %s\n", store.refs_path);
+        }
+    }
+    if (f) {
+        fclose(f);
+    }
+    if (cache) {
+        if (blockcache_save(cache) != 0) {
+            fprintf(stderr, "[!] Failed to write %s\n", cache->path);
+        }
+        blockcache_free(cache);
+    }
 
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    hexdump_free(&hex);
+    free(orphan_rep);
+    free(orphan_group);
+    free(block_known);
+    hashset_free_all(hashsets, hashset_count);
+    free(block_class);
+    free(block_entropy);
+    free(block_printable);
     free(image);
     free(block_usage);
     return 0;
@@ -0,0 +1,809 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "parallel.h"
+#include "ecc.h"
+#include "image.h"
+#include "search.h"
+#include "trigram.h"
+#include "jsonl.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define SEARCH_GRAIN 64
+#define SEAM_GRAIN 4
+#define SEAM_REGEX_WINDOW 256
+#define HIT_TEXT 64
+#define MAX_PATH_LEN 1024
+#define NO_OWNER 0xffffffff
+
+uint8_t *image = NULL;
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+enum owner_kind {
+    OWNER_NONE = 0,
+    OWNER_FILE,             // a block of a file's CTZ skip-list
+    OWNER_METADATA,         // a metadata log
+};
+
+// What each block holds, so a hit can be traced back to a file
+struct block_owner {
+    uint8_t kind;
+    uint32_t owner;         // file index, or directory path index
+    lfs_off_t skip;         // CTZ pointer bytes before the data
+    lfs_size_t len;         // file data in the block, the rest is slack
+    lfs_off_t pos;          // file offset of the block's first data byte
+    lfs_off_t log_end;      // metadata, end of the last valid commit
+};
+
+struct file {
+    char *path;
+    lfs_size_t size;
+    lfs_block_t *blocks;    // CTZ blocks in file order
+    lfs_off_t count;
+};
+
+// Inline file data inside a metadata block
+struct inline_range {
+    size_t start;           // image offset
+    lfs_size_t size;
+    uint32_t file;
+};
+
+struct owners {
+    struct block_owner *blocks;
+    struct file *files;
+    size_t file_count;
+    size_t file_capacity;
+    struct inline_range *inlines;
+    size_t inline_count;
+    size_t inline_capacity;
+    char **dirs;            // salvage_dir_paths, per metadata block
+};
+
+enum hit_kind {
+    HIT_FILE,
+    HIT_METADATA,
+    HIT_SLACK,
+    HIT_ORPHAN,
+};
+
+static const char *hit_names[] = {"file", "metadata", "slack", "orphan"};
+
+struct hit {
+    int pattern;
+    size_t offset;          // image offset of the first byte
+    size_t len;
+    int kind;
+    const char *path;       // NULL for orphans
+    lfs_off_t file_off;     // HIT_FILE
+    uint8_t text[HIT_TEXT]; // the match, a seam match isn't contiguous
+    size_t text_len;
+};
+
+struct hits {
+    struct hit *list;
+    size_t count;
+    size_t capacity;
+    pthread_mutex_t lock;
+};
+
+struct owners owners;
+struct hits hits = {.lock = PTHREAD_MUTEX_INITIALIZER};
+search_t search;
+
+static int record_block(void *data, lfs_block_t block, lfs_off_t index) {
+    struct file *f = data;
+    f->blocks[index] = block;
+    return 0;
+}
+
+static void collect_file(void *data, const salvage_info_t *info) {
+    struct owners *o = data;
+    const ondisk_entry_t *e = info->entry;
+    if (!e || info->type != LFS_TYPE_REG) {
+        return;
+    }
+
+    if (o->file_count == o->file_capacity) {
+        size_t capacity = o->file_capacity ? 2*o->file_capacity : 64;
+        struct file *nfiles = realloc(o->files, capacity * sizeof(struct file));
+        if (!nfiles) {
+            fprintf(stderr, "[!] Out of memory, skipping %s\n", info->path);
+            return;
+        }
+        o->files = nfiles;
+        o->file_capacity = capacity;
+    }
+
+    struct file *f = &o->files[o->file_count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(info->path);
+    if (!f->path) {
+        return;
+    }
+    uint32_t id = o->file_count++;
+
+    lfs_block_t head;
+    if (ondisk_entry_ctz(e, &head, &f->size) && f->size) {
+        lfs_off_t last = f->size - 1;
+        f->count = ondisk_ctz_index(block_size, &last) + 1;
+        f->blocks = malloc(f->count * sizeof(lfs_block_t));
+        if (!f->blocks || ondisk_ctz_walk(image, block_size, block_count,
+                head, f->size, record_block, f) != 0) {
+            fprintf(stderr, "[!] Corrupt CTZ chain, hits in %s are reported "
+                    "as orphaned\n", f->path);
+            free(f->blocks);
+            f->blocks = NULL;
+            f->count = 0;
+            return;
+        }
+
+        lfs_off_t pos = 0;
+        for (lfs_off_t i = 0; i < f->count; i++) {
+            struct block_owner *b = &o->blocks[f->blocks[i]];
+            // a corrupt chain may run into metadata, keep the stronger claim
+            if (b->kind == OWNER_METADATA) {
+                continue;
+            }
+            b->kind = OWNER_FILE;
+            b->owner = id;
+            b->skip = ondisk_ctz_skip(i);
+            b->pos = pos;
+            b->len = lfs_min(block_size - b->skip, f->size - pos);
+            pos += b->len;
+        }
+    } else if (e->struct_type == LFS_TYPE_INLINESTRUCT && e->struct_size) {
+        f->size = e->struct_size;
+        if (o->inline_count == o->inline_capacity) {
+            size_t capacity = o->inline_capacity ? 2*o->inline_capacity : 64;
+            struct inline_range *ninlines = realloc(o->inlines,
+                    capacity * sizeof(struct inline_range));
+            if (!ninlines) {
+                return;
+            }
+            o->inlines = ninlines;
+            o->inline_capacity = capacity;
+        }
+        o->inlines[o->inline_count++] = (struct inline_range){
+            e->struct_data - image, e->struct_size, id,
+        };
+    }
+}
+
+static int compare_inline(const void *a, const void *b) {
+    const struct inline_range *ra = a;
+    const struct inline_range *rb = b;
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+int build_owners(struct owners *o, salvage_t *s) {
+    memset(o, 0, sizeof(*o));
+    o->blocks = calloc(block_count, sizeof(struct block_owner));
+    o->dirs = salvage_dir_paths(s);
+    if (!o->blocks || !o->dirs) {
+        return LFS_ERR_NOMEM;
+    }
+
+    for (lfs_block_t i = 0; i < (lfs_block_t)block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state != SALVAGE_NONE) {
+            o->blocks[i].kind = OWNER_METADATA;
+            o->blocks[i].owner = i;
+            o->blocks[i].log_end = b->off;
+        }
+    }
+
+    salvage_walk(s, collect_file, o);
+    if (o->inline_count) {
+        qsort(o->inlines, o->inline_count, sizeof(struct inline_range),
+                compare_inline);
+    }
+    return 0;
+}
+
+void free_owners(struct owners *o, salvage_t *s) {
+    for (size_t i = 0; i < o->file_count; i++) {
+        free(o->files[i].path);
+        free(o->files[i].blocks);
+    }
+    free(o->files);
+    free(o->inlines);
+    free(o->blocks);
+    salvage_free_paths(s, o->dirs);
+}
+
+static const struct inline_range *find_inline(size_t offset) {
+    size_t lo = 0, hi = owners.inline_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (owners.inlines[mid].start <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    const struct inline_range *r = &owners.inlines[lo - 1];
+    return (offset < r->start + r->size) ? r : NULL;
+}
+
+// Where in the filesystem an image offset is
+static void classify(struct hit *h) {
+    lfs_block_t block = h->offset / block_size;
+    lfs_off_t in = h->offset % block_size;
+    const struct block_owner *b = &owners.blocks[block];
+
+    h->path = NULL;
+    h->kind = HIT_ORPHAN;
+    if (b->kind == OWNER_FILE) {
+        h->path = owners.files[b->owner].path;
+        if (in < b->skip) {
+            h->kind = HIT_METADATA;
+        } else if (in < b->skip + b->len) {
+            h->kind = HIT_FILE;
+            h->file_off = b->pos + (in - b->skip);
+        } else {
+            h->kind = HIT_SLACK;
+        }
+    } else if (b->kind == OWNER_METADATA) {
+        const struct inline_range *r = find_inline(h->offset);
+        if (r) {
+            h->kind = HIT_FILE;
+            h->path = owners.files[r->file].path;
+            h->file_off = h->offset - r->start;
+            return;
+        }
+        h->path = owners.dirs[b->owner];
+        h->kind = (in < b->log_end) ? HIT_METADATA : HIT_SLACK;
+    }
+}
+
+static void add_hit(struct hit *h) {
+    pthread_mutex_lock(&hits.lock);
+    if (hits.count == hits.capacity) {
+        size_t capacity = hits.capacity ? 2*hits.capacity : 256;
+        struct hit *nlist = realloc(hits.list, capacity * sizeof(struct hit));
+        if (!nlist) {
+            pthread_mutex_unlock(&hits.lock);
+            fprintf(stderr, "[!] Out of memory, dropping a hit\n");
+            return;
+        }
+        hits.list = nlist;
+        hits.capacity = capacity;
+    }
+    hits.list[hits.count++] = *h;
+    pthread_mutex_unlock(&hits.lock);
+}
+
+static void found_in_image(void *data, int pattern, size_t start, size_t len) {
+    (void)data;
+    lfs_block_t block = start / block_size;
+    lfs_block_t last = (start + len - 1) / block_size;
+    const struct block_owner *b = &owners.blocks[block];
+    lfs_off_t in = start % block_size;
+
+    // the next block of a file isn't the next block of the image, the
+    // seam scan finds those matches
+    if (last != block && b->kind == OWNER_FILE &&
+            b->skip + b->len == (lfs_size_t)block_size &&
+            in >= b->skip) {
+        return;
+    }
+
+    struct hit h = {.pattern = pattern, .offset = start, .len = len};
+    h.text_len = lfs_min(len, HIT_TEXT);
+    memcpy(h.text, &image[start], h.text_len);
+    classify(&h);
+    add_hit(&h);
+}
+
+static void scan_range(void *data, size_t begin, size_t end) {
+    (void)data;
+    size_t size = (size_t)block_size * block_count;
+    search_scan(&search, image, size, begin * block_size, end * block_size,
+            found_in_image, NULL);
+}
+
+// A run of candidate blocks from the trigram index
+struct piece {
+    lfs_block_t begin;
+    lfs_block_t end;
+    bool first;             // the block before isn't scanned
+};
+
+static void scan_pieces(void *data, size_t begin, size_t end) {
+    const struct piece *pieces = data;
+    size_t size = (size_t)block_size * block_count;
+    for (size_t i = begin; i < end; i++) {
+        size_t start = (size_t)pieces[i].begin * block_size;
+        // a regex match may start in printable text before the candidate
+        if (pieces[i].first) {
+            start = search_rewind(&search, image, start);
+        }
+        search_scan(&search, image, size, start,
+                (size_t)pieces[i].end * block_size, found_in_image, NULL);
+    }
+}
+
+// Blocks a match may start in according to the trigram index, NULL if
+// some pattern has no literal long enough to narrow anything down
+uint8_t *narrow_blocks(const trigram_t *index, const ecc_report_t *fixed) {
+    uint8_t *candidates = calloc(block_count, 1);
+    if (!candidates) {
+        return NULL;
+    }
+
+    for (int p = 0; p < search.count; p++) {
+        const search_pattern_t *pattern = &search.patterns[p];
+        if (trigram_narrow(index, pattern->bytes, pattern->len,
+                candidates) != 0) {
+            free(candidates);
+            return NULL;
+        }
+    }
+
+    // the index is of the image as acquired, corrected bits aren't in it
+    for (size_t i = 0; fixed && i < fixed->count; i++) {
+        candidates[fixed->fixes[i].block] = 1;
+    }
+    return candidates;
+}
+
+// Scans only the candidate blocks, in runs of at most SEARCH_GRAIN
+lfs_size_t scan_candidates(const uint8_t *candidates) {
+    size_t count = 0, capacity = 0;
+    struct piece *pieces = NULL;
+    lfs_size_t scanned = 0;
+
+    for (lfs_block_t b = 0; b < (lfs_block_t)block_count;) {
+        if (!candidates[b]) {
+            b++;
+            continue;
+        }
+
+        bool first = true;
+        while (b < (lfs_block_t)block_count && candidates[b]) {
+            lfs_block_t end = b;
+            while (end < (lfs_block_t)block_count && candidates[end] &&
+                    end - b < SEARCH_GRAIN) {
+                end++;
+            }
+            if (count == capacity) {
+                capacity = capacity ? 2*capacity : 64;
+                struct piece *npieces = realloc(pieces,
+                        capacity * sizeof(struct piece));
+                if (!npieces) {
+                    // scanning everything is always right
+                    free(pieces);
+                    parallel_for(block_count, SEARCH_GRAIN, scan_range, NULL);
+                    return block_count;
+                }
+                pieces = npieces;
+            }
+            pieces[count++] = (struct piece){b, end, first};
+            scanned += end - b;
+            first = false;
+            b = end;
+        }
+    }
+
+    parallel_for(count, 1, scan_pieces, pieces);
+    free(pieces);
+    return scanned;
+}
+
+// The end of one data block of a file and the start of the next, joined
+struct seam {
+    uint8_t *buf;
+    size_t split;           // where the second block starts in buf
+    size_t first_off;       // image offset of buf[0]
+    size_t second_off;      // image offset of buf[split]
+};
+
+static void found_in_seam(void *data, int pattern, size_t start, size_t len) {
+    struct seam *seam = data;
+    if (start >= seam->split || start + len <= seam->split) {
+        return;
+    }
+
+    struct hit h = {.pattern = pattern, .offset = seam->first_off + start,
+            .len = len};
+    h.text_len = lfs_min(len, HIT_TEXT);
+    memcpy(h.text, &seam->buf[start], h.text_len);
+    classify(&h);
+    add_hit(&h);
+}
+
+static void seam_range(void *data, size_t begin, size_t end) {
+    size_t window = *(size_t *)data;
+    uint8_t *buf = malloc(2*window);
+    if (!buf) {
+        return;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        const struct file *f = &owners.files[i];
+        for (lfs_off_t k = 0; k + 1 < f->count; k++) {
+            const struct block_owner *a = &owners.blocks[f->blocks[k]];
+            const struct block_owner *b = &owners.blocks[f->blocks[k+1]];
+            if (a->kind != OWNER_FILE || b->kind != OWNER_FILE) {
+                continue;
+            }
+
+            size_t alen = lfs_min(window, a->len);
+            size_t blen = lfs_min(window, b->len);
+            size_t aoff = (size_t)f->blocks[k] * block_size +
+                    a->skip + a->len - alen;
+            size_t boff = (size_t)f->blocks[k+1] * block_size + b->skip;
+            memcpy(buf, &image[aoff], alen);
+            memcpy(&buf[alen], &image[boff], blen);
+
+            struct seam seam = {buf, alen, aoff, boff};
+            search_scan(&search, buf, alen + blen, 0, alen,
+                    found_in_seam, &seam);
+        }
+    }
+    free(buf);
+}
+
+static int compare_hit(const void *a, const void *b) {
+    const struct hit *ha = a;
+    const struct hit *hb = b;
+    if (ha->offset != hb->offset) {
+        return (ha->offset < hb->offset) ? -1 : 1;
+    }
+    if (ha->pattern != hb->pattern) {
+        return ha->pattern - hb->pattern;
+    }
+    return (ha->len > hb->len) - (ha->len < hb->len);
+}
+
+// Runs scanned back from a candidate may overlap the run before
+static void unique_hits(void) {
+    size_t n = 0;
+    for (size_t i = 0; i < hits.count; i++) {
+        if (n && compare_hit(&hits.list[n-1], &hits.list[i]) == 0) {
+            continue;
+        }
+        hits.list[n++] = hits.list[i];
+    }
+    hits.count = n;
+}
+
+static void print_text(const uint8_t *text, size_t len, bool more) {
+    printf("\"");
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] >= 0x20 && text[i] < 0x7f && text[i] != '"' &&
+                text[i] != '\\') {
+            putchar(text[i]);
+        } else {
+            printf("\\x%02x", text[i]);
+        }
+    }
+    printf("\"%s", more ? "..." : "");
+}
+
+void print_hits(void) {
+    unsigned long per_kind[HIT_ORPHAN + 1] = {0};
+    unsigned long *per_pattern = calloc(search.count, sizeof(unsigned long));
+
+    if (!jsonl) {
+        printf("Search results:\n");
+    }
+
+    for (size_t i = 0; i < hits.count; i++) {
+        const struct hit *h = &hits.list[i];
+        lfs_block_t block = h->offset / block_size;
+        lfs_off_t in = h->offset % block_size;
+        per_kind[h->kind] += 1;
+        if (per_pattern) {
+            per_pattern[h->pattern] += 1;
+        }
+
+        if (jsonl) {
+            jsonl_begin(&json, "hit");
+            jsonl_str(&json, "pattern", search.patterns[h->pattern].name);
+            jsonl_uint(&json, "block", block);
+            jsonl_uint(&json, "off", in);
+            jsonl_uint(&json, "offset", h->offset);
+            jsonl_uint(&json, "size", h->len);
+            jsonl_str(&json, "kind", hit_names[h->kind]);
+            jsonl_str(&json, "path", h->path);
+            if (h->kind == HIT_FILE) {
+                jsonl_uint(&json, "file_offset", h->file_off);
+            }
+            jsonl_strn(&json, "match", h->text, h->text_len);
+            jsonl_end(&json);
+            continue;
+        }
+
+        printf("  block %lu +%lu  ", (unsigned long)block, (unsigned long)in);
+        if (h->kind == HIT_FILE) {
+            printf("%s +%lu  ", h->path, (unsigned long)h->file_off);
+        } else if (h->kind == HIT_ORPHAN) {
+            printf("orphan  ");
+        } else {
+            printf("%s of %s  ", hit_names[h->kind],
+                    h->path ? h->path : "(unreachable)");
+        }
+        print_text(h->text, h->text_len, h->len > h->text_len);
+        printf("\n");
+    }
+
+    if (!hits.count && !jsonl) {
+        printf("  no matches\n");
+    }
+
+    fprintf(text_out, "\n%lu hits: %lu in files, %lu in metadata, "
+            "%lu in slack, %lu in orphaned blocks\n",
+            (unsigned long)hits.count, per_kind[HIT_FILE],
+            per_kind[HIT_METADATA], per_kind[HIT_SLACK], per_kind[HIT_ORPHAN]);
+    for (int p = 0; per_pattern && p < search.count; p++) {
+        fprintf(text_out, "  %-30s %lu\n", search.patterns[p].name,
+                per_pattern[p]);
+    }
+    free(per_pattern);
+}
+
+static int parse_hex(const char *hex, uint8_t *out, size_t *len) {
+    size_t n = strlen(hex);
+    if (n == 0 || n % 2) {
+        return LFS_ERR_INVAL;
+    }
+    for (size_t i = 0; i < n/2; i++) {
+        unsigned v;
+        if (sscanf(&hex[2*i], "%2x", &v) != 1) {
+            return LFS_ERR_INVAL;
+        }
+        out[i] = v;
+    }
+    *len = n/2;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool ecc = false;
+    bool icase = false;
+    bool use_index = false;
+    bool rebuild = false;
+    int image_hash = DIGEST_NONE;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ignore-case") == 0) {
+            icase = true;
+        }
+    }
+    search_init(&search, icase);
+
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        int err = 0;
+        if (strcmp(argv[i], "--ignore-case") == 0) {
+            continue;
+        }
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--index") == 0) {
+            use_index = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--rebuild-index") == 0) {
+            use_index = true;
+            rebuild = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc) {
+            const char *text = argv[++i];
+            err = search_add_literal(&search, text,
+                    (const uint8_t *)text, strlen(text));
+        } else if (strcmp(argv[i], "--hex") == 0 && i + 1 < argc) {
+            const char *hex = argv[++i];
+            uint8_t *bytes = malloc(strlen(hex)/2 + 1);
+            size_t len;
+            err = !bytes ? LFS_ERR_NOMEM : parse_hex(hex, bytes, &len);
+            if (!err) {
+                err = search_add_literal(&search, hex, bytes, len);
+            }
+            free(bytes);
+        } else if (strcmp(argv[i], "--regex") == 0 && i + 1 < argc) {
+            err = search_add_regex(&search, argv[++i]);
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        } else if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                search_free(&search);
+                return 1;
+            }
+            continue;
+        } else {
+            argv[nargs++] = argv[i];
+            continue;
+        }
+
+        if (err < 0) {
+            fprintf(stderr, "[!] Invalid pattern: %s\n", argv[i]);
+            search_free(&search);
+            return 1;
+        }
+    }
+    argc = nargs;
+
+    if (argc < 4 || search.count == 0) {
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] --pattern TEXT|--hex BYTES|--regex EXPR ... [--ignore-case] [--index] [--rebuild-index] [--ecc] [--format text|jsonl] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        search_free(&search);
+        return 1;
+    }
+
+    const char *image_path = argv[1];
+    if (argc >= 3) {
+        block_size = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        block_count = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        read_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        prog_size = atoi(argv[5]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        search_free(&search);
+        return 1;
+    }
+
+    if (search_compile(&search) != 0) {
+        fprintf(stderr, "[!] Out of memory\n");
+        search_free(&search);
+        return 1;
+    }
+
+    size_t image_size = (size_t)block_size * block_count;
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+        search_free(&search);
+        return 1;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+    if (jsonl && !jsonl_init(&json, stdout)) {
+        fprintf(stderr, "[!] Out of memory\n");
+        search_free(&search);
+        free(image);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
+
+    // the index is of the image file, built before any correction
+    trigram_t index;
+    bool indexed = false;
+    if (use_index) {
+        // every partition of a dump gets its own index
+        char view[MAX_PATH_LEN];
+        char sidecar[MAX_PATH_LEN + 16];
+        image_view_name(image_path, image_offset, view, sizeof(view));
+        trigram_sidecar_path(view, sidecar, sizeof(sidecar));
+        if (!rebuild && trigram_open(&index, sidecar, image_path,
+                block_size, block_count) == 0) {
+            indexed = true;
+            fprintf(text_out, "Trigram index: reusing %s\n", sidecar);
+        } else if (trigram_build(sidecar, image_path, image,
+                    block_size, block_count) == 0 &&
+                trigram_open(&index, sidecar, image_path,
+                    block_size, block_count) == 0) {
+            indexed = true;
+            fprintf(text_out, "Trigram index: built %s\n", sidecar);
+        } else {
+            fprintf(stderr, "[!] Failed to build %s, scanning every block\n",
+                    sidecar);
+        }
+    }
+
+    ecc_report_t report = {0};
+    if (ecc) {
+        int err = ecc_correct_image(image, block_size, block_count, &report);
+        if (err == 0) {
+            ecc_print_report(&report, block_size, text_out);
+            fprintf(text_out, "\n");
+        } else if (indexed) {
+            // blocks that changed aren't all known, the index can't be
+            // trusted to narrow
+            fprintf(stderr, "[!] Bit error correction failed (%d), scanning every block\n", err);
+            trigram_close(&index);
+            indexed = false;
+        }
+    }
+
+    // hits are traced to files through the scanned metadata, the image
+    // doesn't need to mount
+    salvage_t s;
+    int ret = 0;
+    if (salvage_scan(&s, image, block_size, block_count) != 0 ||
+            build_owners(&owners, &s) != 0) {
+        fprintf(stderr, "[!] Failed to scan image\n");
+        ret = 1;
+        goto done;
+    }
+
+    uint8_t *candidates = indexed ? narrow_blocks(&index, &report) : NULL;
+    if (candidates) {
+        lfs_size_t scanned = scan_candidates(candidates);
+        fprintf(text_out, "Trigram index: %lu of %lu blocks scanned\n\n",
+                (unsigned long)scanned, (unsigned long)block_count);
+        free(candidates);
+    } else {
+        if (indexed) {
+            fprintf(text_out, "Trigram index: a pattern has no literal of 3 "
+                    "bytes or more, scanning every block\n\n");
+        }
+        parallel_for(block_count, SEARCH_GRAIN, scan_range, NULL);
+    }
+
+    // literal matches only need their own length across a seam, a regex
+    // gets a generous window
+    size_t window = search.max_len ? search.max_len - 1 : 0;
+    if (search.regexes) {
+        window = lfs_max(window, SEAM_REGEX_WINDOW);
+    }
+    if (window) {
+        parallel_for(owners.file_count, SEAM_GRAIN, seam_range, &window);
+    }
+
+    if (hits.count) {
+        qsort(hits.list, hits.count, sizeof(struct hit), compare_hit);
+        unique_hits();
+    }
+    print_hits();
+
+done:
+    if (indexed) {
+        trigram_close(&index);
+    }
+    ecc_report_free(&report);
+    if (jsonl) {
+        jsonl_free(&json);
+    }
+    free(hits.list);
+    free_owners(&owners, &s);
+    salvage_free(&s);
+    search_free(&search);
+    free(image);
+    return ret;
+}
@@ -1,5 +1,13 @@
 #include "lfs.h"
 #include "lfs_util.h"
+#include "salvage.h"
+#include "ecc.h"
+#include "image.h"
+#include "timeline.h"
+#include "hexdump.h"
+#include "jsonl.h"
+#include "blockmap.h"
+#include "blockcache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -14,9 +22,22 @@ int block_size = 4096;
 int block_count = 16;
 int read_size = 16; 
 int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
 int dump_size = 8;
 bool *block_usage = NULL;
-typedef uint32_t lfs_tag_t;
+hexdump_t hex;
+
+// with --format jsonl, records go to stdout and everything else to stderr
+bool jsonl = false;
+jsonl_t json;
+FILE *text_out = NULL;
+
+// with --cache, what the scans learn about each block is kept in
+// <image_file>.lfscache and reused by the next run
+blockcache_t block_cache;
+blockcache_t *cache = NULL;
 
 int user_read(const struct lfs_config *c, lfs_block_t block,
               lfs_off_t off, void *buffer, lfs_size_t size) {
@@ -68,104 +89,457 @@ void print_block_usage(int block_count) {
 }
 
 
-void decode_block_header(uint8_t *block_data) {
-    lfs_tag_t tag = *(lfs_tag_t *)block_data;
-    uint8_t type = tag & 0x3F;
+const char *describe_stop(int stop) {
+    switch (stop) {
+        case ONDISK_STOP_INVALID:
+            return "torn commit";
+        case ONDISK_STOP_OVERFLOW:
+            return "tag runs past the end of the block";
+        case ONDISK_STOP_BADCRC:
+            return "bad crc";
+        default:
+            return "erased";
+    }
+}
+
+// Prints the part of a tag's payload that means something on its own
+void print_tag_detail(const ondisk_tag_t *t) {
+    uint16_t type = ondisk_tag_type3(t->tag);
+
+    switch (ondisk_tag_type1(t->tag)) {
+        case LFS_TYPE_NAME:
+            printf("  \"");
+            for (lfs_size_t i = 0; i < t->size && i < 32; i++) {
+                uint8_t c = t->data[i];
+                putchar((c >= 0x20 && c < 0x7f) ? c : '.');
+            }
+            printf("%s\"", (t->size > 32) ? "..." : "");
+            break;
 
-    switch (type) {
-        case 0x01:
-            printf("File entry");
+        case LFS_TYPE_STRUCT:
+            if (type == LFS_TYPE_DIRSTRUCT && t->size >= 8) {
+                printf("  pair {%lu, %lu}",
+                        (unsigned long)ondisk_le32(&t->data[0]),
+                        (unsigned long)ondisk_le32(&t->data[4]));
+            } else if (type == LFS_TYPE_CTZSTRUCT && t->size >= 8) {
+                printf("  head %lu, size %lu",
+                        (unsigned long)ondisk_le32(&t->data[0]),
+                        (unsigned long)ondisk_le32(&t->data[4]));
+            }
             break;
-        case 0x02:
-            printf("Directory entry");
+
+        case LFS_TYPE_TAIL:
+            if (t->size >= 8) {
+                printf("  pair {%lu, %lu}",
+                        (unsigned long)ondisk_le32(&t->data[0]),
+                        (unsigned long)ondisk_le32(&t->data[4]));
+            }
             break;
-        case 0x05:
-        case 0x06:
-            printf("Superblock");
+
+        case LFS_TYPE_CRC:
+            if (type == LFS_TYPE_FCRC && t->size >= 8) {
+                printf("  next %lu bytes, crc 0x%08lX",
+                        (unsigned long)ondisk_le32(&t->data[0]),
+                        (unsigned long)ondisk_le32(&t->data[4]));
+            } else if (t->size >= 4) {
+                printf("  crc 0x%08lX",
+                        (unsigned long)ondisk_le32(&t->data[0]));
+            }
             break;
-        default:
-            printf("Unknown type");
+
+        case LFS_TYPE_GLOBALS:
+            if (t->size >= 12) {
+                printf("  tag 0x%08lX, pair {%lu, %lu}",
+                        (unsigned long)ondisk_le32(&t->data[0]),
+                        (unsigned long)ondisk_le32(&t->data[4]),
+                        (unsigned long)ondisk_le32(&t->data[8]));
+            }
             break;
     }
 }
 
+// Walks the whole commit log with the same rules as lfs_dir_fetchmatch
+void decode_block_log(const uint8_t *block_data, int block_size) {
+    ondisk_cursor_t cur;
+    ondisk_commit_t commit;
+    ondisk_cursor_init(&cur, block_data, block_size);
+
+    if (!ondisk_next_commit(&cur, &commit)) {
+        bool is_blank = true;
+        for (int j = 0; j < 16; j++) {
+            if (block_data[j] != 0xFF) {
+                is_blank = false;
+                break;
+            }
+        }
+        printf("%s\n", is_blank ? "Erased" : "Data");
+        return;
+    }
+
+    printf("Metadata (revision %lu)\n", (unsigned long)cur.rev);
+    do {
+        printf("    Commit %lu at +0x%04lx:\n", (unsigned long)commit.index,
+                (unsigned long)commit.start);
+
+        ondisk_tagiter_t it;
+        ondisk_tag_t t;
+        ondisk_tagiter_init(&it, block_data, &commit);
+        while (ondisk_tagiter_next(&it, &t)) {
+            printf("      +0x%04lx  0x%08lX  %-12s  id %-4u",
+                    (unsigned long)t.off, (unsigned long)t.tag,
+                    ondisk_tag_typename(t.tag), ondisk_tag_id(t.tag));
+            if (ondisk_tag_isdelete(t.tag)) {
+                printf("  size -   ");
+            } else {
+                printf("  size %-4lu", (unsigned long)ondisk_tag_size(t.tag));
+            }
+            print_tag_detail(&t);
+            printf("\n");
+        }
+    } while (ondisk_next_commit(&cur, &commit));
+
+    printf("    Log ends at +0x%04lx (%s)\n", (unsigned long)cur.stop_off,
+            describe_stop(cur.stop));
+}
+
 
 void dump_blocks(int block_size, int block_count) {
     printf("\nDumping first %d blocks:\n", block_count);
 
     for (int i = 0; i < block_count; i++) {
         printf("  Block %d: ", i);
-        for (int j = 0; j < 16; j++) {
-            printf("%02X ", image[i * block_size + j]);
-        }
+        hexdump_bytes(&hex, &image[i * block_size], 16);
+        hexdump_flush(&hex);
         printf("  -->  ");
-        decode_block_header(&image[i * block_size]);
-        
-        printf("...\n");
+        decode_block_log(&image[i * block_size], block_size);
     }
     printf("\n");
 }
 
+// One "block" record per block, plus a "tag" record per tag of the first
+// tag_blocks blocks, mirroring the text dump
+void json_blocks(int block_size, int block_count, int tag_blocks) {
+    for (int i = 0; i < block_count; i++) {
+        const uint8_t *block_data = &image[i * block_size];
+        ondisk_cursor_t cur;
+        ondisk_commit_t commit;
+        ondisk_cursor_init(&cur, block_data, block_size);
+        bool metadata = ondisk_next_commit(&cur, &commit);
+
+        if (metadata && i < tag_blocks) {
+            do {
+                ondisk_tagiter_t it;
+                ondisk_tag_t t;
+                ondisk_tagiter_init(&it, block_data, &commit);
+                while (ondisk_tagiter_next(&it, &t)) {
+                    jsonl_begin(&json, "tag");
+                    jsonl_uint(&json, "block", i);
+                    jsonl_uint(&json, "commit", commit.index);
+                    jsonl_uint(&json, "off", t.off);
+                    jsonl_uint(&json, "tag", t.tag);
+                    jsonl_str(&json, "type", ondisk_tag_typename(t.tag));
+                    jsonl_uint(&json, "id", ondisk_tag_id(t.tag));
+                    if (ondisk_tag_isdelete(t.tag)) {
+                        jsonl_null(&json, "size");
+                    } else {
+                        jsonl_uint(&json, "size", ondisk_tag_size(t.tag));
+                    }
+                    jsonl_end(&json);
+                }
+            } while (ondisk_next_commit(&cur, &commit));
+        } else if (metadata) {
+            while (ondisk_next_commit(&cur, &commit)) {
+            }
+        }
 
-void traverse_directory(lfs_t *lfs, const char *path) {
+        jsonl_begin(&json, "block");
+        jsonl_uint(&json, "block", i);
+        jsonl_bool(&json, "used", block_usage[i]);
+        if (metadata) {
+            jsonl_str(&json, "kind", "metadata");
+            jsonl_uint(&json, "revision", cur.rev);
+            jsonl_uint(&json, "commits", cur.commits);
+            jsonl_uint(&json, "log_end", cur.stop_off);
+            jsonl_str(&json, "stop", describe_stop(cur.stop));
+        } else {
+            jsonl_str(&json, "kind", block_usage[i] ? "data" : "erased");
+        }
+        jsonl_end(&json);
+    }
+}
+
+void hexdump_range(uint64_t off, uint64_t len) {
+    printf("\nHex dump of bytes 0x%08llx-0x%08llx:\n",
+            (unsigned long long)off, (unsigned long long)(off + len - 1));
+    hexdump_lines(&hex, &image[off], len, off);
+    hexdump_flush(&hex);
+}
+
+void hexdump_blocks(int first, int last, int block_size) {
+    printf("\nHex dump of blocks %d-%d:\n", first, last);
+    for (int i = first; i <= last; i++) {
+        printf("Block %d:\n", i);
+        hexdump_lines(&hex, &image[(size_t)i * block_size], block_size,
+                (size_t)i * block_size);
+        hexdump_flush(&hex);
+    }
+}
+
+
+// One line of the mounted tree, as walked or replayed from the cache
+void print_tree_entry(int kind, const char *path, lfs_size_t size) {
+    if (kind == BLOCKCACHE_DIR_OPEN) {
+        if (jsonl) {
+            jsonl_begin(&json, "dir");
+            jsonl_str(&json, "path", path);
+            jsonl_end(&json);
+        } else {
+            printf("Directory: %s\n", path);
+        }
+    } else if (kind == BLOCKCACHE_FILE) {
+        if (jsonl) {
+            jsonl_begin(&json, "file");
+            jsonl_str(&json, "path", path);
+            jsonl_uint(&json, "size", size);
+            jsonl_end(&json);
+        } else {
+            printf("  FILE: %s (Size: %lu)\n", path, (unsigned long)size);
+        }
+    } else if (!jsonl) {
+        printf("  DIR: %s\n", path);
+    }
+}
+
+// Recorded in the cache's listing as it is printed, so a rerun on the
+// same image can print it without mounting
+bool listing_lost = false;
+
+void walk_tree_entry(int kind, const char *path, lfs_size_t size) {
+    if (cache && !listing_lost &&
+            blockcache_put_entry(cache, kind, size, path) != 0) {
+        fprintf(stderr, "[!] Out of memory, listing not cached\n");
+        listing_lost = true;
+    }
+    print_tree_entry(kind, path, size);
+}
+
+// Returns 0, or an error if some directory could not be opened
+int traverse_directory(lfs_t *lfs, const char *path) {
     struct lfs_info info;
     lfs_dir_t dir;
 
-    if (lfs_dir_open(lfs, &dir, path) < 0) {
-        printf("[!] Failed to open directory: %s\n", path);
-        return;
+    int err = lfs_dir_open(lfs, &dir, path);
+    if (err < 0) {
+        fprintf(text_out, "[!] Failed to open directory: %s\n", path);
+        return err;
     }
 
-    printf("Directory: %s\n", path);
+    walk_tree_entry(BLOCKCACHE_DIR_OPEN, path, 0);
 
+    err = 0;
     while (lfs_dir_read(lfs, &dir, &info) > 0) {
         if (strcmp(info.name, ".") == 0 || strcmp(info.name, "..") == 0)
             continue;
 
         char full_path[512];
-        snprintf(full_path, sizeof(full_path), "%s/%s", path, info.name);
+        // the root is "/", don't double the separator below it
+        snprintf(full_path, sizeof(full_path), "%s/%s",
+                (strcmp(path, "/") == 0) ? "" : path, info.name);
 
         if (info.type == LFS_TYPE_REG) {
-            printf("  FILE: %s (Size: %lu)\n", full_path, (unsigned long)info.size);
+            walk_tree_entry(BLOCKCACHE_FILE, full_path, info.size);
         } else if (info.type == LFS_TYPE_DIR) {
-            printf("  DIR: %s\n", full_path);
-            traverse_directory(lfs, full_path);
+            walk_tree_entry(BLOCKCACHE_SUBDIR, full_path, 0);
+            int res = traverse_directory(lfs, full_path);
+            err = err ? err : res;
         }
     }
     lfs_dir_close(lfs, &dir);
-}
-
-// Utility to read 32-bit little-endian values safely
-uint32_t read_le32(const uint8_t *ptr) {
-    return ((uint32_t)ptr[0]) |
-           ((uint32_t)ptr[1] << 8) |
-           ((uint32_t)ptr[2] << 16) |
-           ((uint32_t)ptr[3] << 24);
+    return err;
 }
 
 void print_superblock_info(uint8_t *image, int block_size) {
-    printf("Superblock information:\n");
 
+    // the superblock entry lives in the root pair, the newer half wins
+    int found = -1;
+    uint32_t found_rev = 0;
+    const uint8_t *sb = NULL;
     for (int block = 0; block <= 1; block++) {
-        const uint8_t *block_data = image + block * block_size;
-        uint32_t raw_tag = read_le32(block_data);
-        uint8_t tag_type = raw_tag & 0x3F;
+        ondisk_mdir_t mdir;
+        ondisk_cursor_t cur;
+        ondisk_mdir_init(&mdir);
+        ondisk_mdir_load(&mdir, &cur, image + block * block_size, block_size);
+
+        for (uint16_t id = 0; id < mdir.count; id++) {
+            const ondisk_entry_t *e = &mdir.entries[id];
+            if (e->type == LFS_TYPE_SUPERBLOCK &&
+                    e->struct_type == LFS_TYPE_INLINESTRUCT &&
+                    e->struct_size >= 24 &&
+                    (found < 0 || (int32_t)(cur.rev - found_rev) > 0)) {
+                found = block;
+                found_rev = cur.rev;
+                sb = e->struct_data;
+            }
+        }
+        ondisk_mdir_free(&mdir);
+    }
 
-        if (tag_type == 0x05 || tag_type == 0x06) {
-            printf("  Superblock tag detected in block %d\n", block);
-            printf("  Raw tag: 0x%08X\n", raw_tag);
-            printf("  Tag type: 0x%02X (Superblock)\n", tag_type);
-            return;
+    if (jsonl) {
+        jsonl_begin(&json, "superblock");
+        jsonl_bool(&json, "found", found >= 0);
+        if (found >= 0) {
+            jsonl_uint(&json, "block", found);
+            jsonl_uint(&json, "revision", found_rev);
+            jsonl_uint(&json, "version", ondisk_le32(&sb[0]));
+            jsonl_uint(&json, "block_size", ondisk_le32(&sb[4]));
+            jsonl_uint(&json, "block_count", ondisk_le32(&sb[8]));
+            jsonl_uint(&json, "name_max", ondisk_le32(&sb[12]));
+            jsonl_uint(&json, "file_max", ondisk_le32(&sb[16]));
+            jsonl_uint(&json, "attr_max", ondisk_le32(&sb[20]));
         }
+        jsonl_end(&json);
+        return;
     }
 
-    printf("  [!] No valid superblock tag found in block 0 or 1.\n");
+    printf("Superblock information:\n");
+    if (found < 0) {
+        printf("  [!] No valid superblock tag found in block 0 or 1.\n");
+        return;
+    }
+
+    uint32_t version = ondisk_le32(&sb[0]);
+    printf("  Superblock found in block %d (revision %lu)\n",
+            found, (unsigned long)found_rev);
+    printf("  Version: %lu.%lu\n", (unsigned long)(version >> 16),
+            (unsigned long)(version & 0xffff));
+    printf("  Block size: %lu\n", (unsigned long)ondisk_le32(&sb[4]));
+    printf("  Block count: %lu\n", (unsigned long)ondisk_le32(&sb[8]));
+    printf("  Name max: %lu\n", (unsigned long)ondisk_le32(&sb[12]));
+    printf("  File max: %lu\n", (unsigned long)ondisk_le32(&sb[16]));
+    printf("  Attr max: %lu\n", (unsigned long)ondisk_le32(&sb[20]));
 }
 
 
+void print_salvaged_entry(void *data, const salvage_info_t *info) {
+    lfs_block_t head;
+    lfs_size_t size = 0;
+    if (info->type == LFS_TYPE_REG &&
+            !ondisk_entry_ctz(info->entry, &head, &size) &&
+            info->entry->struct_type == LFS_TYPE_INLINESTRUCT) {
+        size = info->entry->struct_size;
+    }
+
+    if (jsonl) {
+        jsonl_begin(&json, (info->type == LFS_TYPE_DIR) ? "dir" : "file");
+        jsonl_str(&json, "path", info->path);
+        if (info->type == LFS_TYPE_REG) {
+            jsonl_uint(&json, "size", size);
+        }
+        jsonl_uint(&json, "mdir", info->mdir);
+        jsonl_bool(&json, "salvaged", true);
+        jsonl_bool(&json, "detached", info->detached);
+        jsonl_end(&json);
+    } else if (info->type == LFS_TYPE_REG) {
+        printf("  FILE: %s (Size: %lu, mdir %lu)\n", info->path,
+                (unsigned long)size, (unsigned long)info->mdir);
+    } else if (info->entry) {
+        printf("  DIR: %s\n", info->path);
+    } else {
+        printf("Directory: %s\n", info->path);
+    }
+}
+
+void print_timeline_event(void *data, const timeline_event_t *event) {
+    if (jsonl) {
+        timeline_json_event(event, &json);
+    } else {
+        timeline_print_event(event, stdout);
+    }
+}
+
 int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool salvage = false;
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    uint32_t rewind = 0;
+    bool use_cache = false;
+    lfs_block_t mdir = LFS_BLOCK_NULL;
+    bool timeline = false;
+    int hex_first = -1;
+    int hex_last = -1;
+    uint64_t hex_off = 0;
+    uint64_t hex_len = 0;
+    const char *export_path = NULL;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--salvage") == 0) {
+            salvage = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--mdir") == 0 && i + 1 < argc) {
+            mdir = strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--timeline") == 0) {
+            timeline = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--hexdump") == 0 && i + 1 < argc) {
+            // a single block or an inclusive range, e.g. 2-5, or a byte
+            // range of the image, e.g. 0x1f80+256
+            char *end;
+            hex_first = strtol(argv[++i], &end, 0);
+            hex_last = (*end == '-') ? strtol(end + 1, NULL, 0) : hex_first;
+            if (*end == '+') {
+                hex_off = strtoull(argv[i], NULL, 0);
+                hex_len = strtoull(end + 1, NULL, 0);
+                hex_first = -1;
+                if (hex_len == 0) {
+                    fprintf(stderr, "[!] Invalid hexdump byte range.\n");
+                    return 1;
+                }
+            }
+            continue;
+        }
+        if (strcmp(argv[i], "--cache") == 0) {
+            use_cache = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            export_path = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            jsonl = (strcmp(argv[++i], "jsonl") == 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
     if (argc < 4) {
-        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [dump_blocks]\n", argv[0]);
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [dump_blocks] [--salvage] [--ecc] [--rewind N] [--mdir B] [--timeline] [--hexdump FIRST[-LAST]|OFFSET+LENGTH] [--format text|jsonl] [--export FILE] [--cache] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
         return 1;
     }
 
@@ -197,25 +571,52 @@ int main(int argc, char **argv) {
     }
 
 
+    if (hex_first >= 0 && (hex_last < hex_first || hex_last >= block_count)) {
+        fprintf(stderr, "[!] Invalid hexdump block range.\n");
+        return 1;
+    }
+    uint64_t fs_size = (uint64_t)block_size * block_count;
+    if (hex_len && hex_off >= fs_size) {
+        fprintf(stderr, "[!] Invalid hexdump byte range.\n");
+        return 1;
+    }
+    if (hex_len > fs_size - hex_off) {
+        hex_len = fs_size - hex_off;
+    }
+
+    text_out = jsonl ? stderr : stdout;
+
     if (dump_size > block_count) {
-        printf("[!] The filesystem has only %d blocks, but %d were requested for dump.\n", block_count, dump_size);
-        printf("    Proceeding to dump %d blocks instead.\n", block_count);
+        fprintf(text_out, "[!] The filesystem has only %d blocks, but %d were requested for dump.\n", block_count, dump_size);
+        fprintf(text_out, "    Proceeding to dump %d blocks instead.\n", block_count);
         dump_size = block_count;
     }
 
-    FILE *f = fopen(image_path, "rb");
-    if (!f) {
-        fprintf(stderr, "[!] Failed to open image file: %s\n", image_path);
+    size_t image_size = (size_t)block_size * block_count;
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
         return 1;
     }
 
-    size_t image_size = block_size * block_count;
-    image = malloc(image_size);
-    fread(image, 1, image_size, f);
-    fclose(f);
-
     block_usage = malloc(sizeof(bool) * block_count);
     memset(block_usage, 0, sizeof(bool) * block_count);
+    if (!hexdump_init(&hex, stdout, true) ||
+            (jsonl && !jsonl_init(&json, stdout))) {
+        fprintf(stderr, "[!] Out of memory\n");
+        free(image);
+        free(block_usage);
+        return 1;
+    }
+
+    if (jsonl) {
+        image_json_digest(&digest, image_path, &json);
+    } else {
+        image_print_digest(&digest, image_path, stdout);
+    }
 
     struct lfs_config cfg = {
         .read  = user_read,
@@ -232,32 +633,161 @@ int main(int argc, char **argv) {
         .block_cycles = -1
     };
 
-    printf("\n");
-    print_superblock_info(image, block_size);
+    if (ecc) {
+        ecc_report_t report;
+        if (ecc_correct_image(image, block_size, block_count, &report) == 0) {
+            ecc_print_report(&report, block_size, text_out);
+            fprintf(text_out, "\n");
+        }
+        ecc_report_free(&report);
+    }
 
-    printf("\n");
-    printf("Filesystem configuration:\n");
-    printf("  Block size: %d\n", cfg.block_size);
-    printf("  Block count: %d\n", cfg.block_count);
-    printf("  Read size: %d\n", cfg.read_size);
-    printf("  Prog size: %d\n", cfg.prog_size);
-    printf("\n");
+    if (timeline) {
+        salvage_t s;
+        if (salvage_scan(&s, image, block_size, block_count) == 0) {
+            if (!jsonl) {
+                printf("Timeline:\n");
+            }
+            timeline_replay(&s, mdir, print_timeline_event, NULL);
+            if (!jsonl) {
+                printf("\n");
+            }
+        }
+        salvage_free(&s);
+    }
+
+    if (rewind) {
+        timeline_cuts_t cuts;
+        if (timeline_rewind(image, block_size, block_count, rewind, mdir,
+                &cuts) == 0) {
+            timeline_print_cuts(&cuts, rewind, text_out);
+            fprintf(text_out, "\n");
+        }
+        timeline_cuts_free(&cuts);
+    }
+
+    // opened on the image as it will be analyzed, after any corrections
+    // or rewinding, since the cache is keyed by content
+    if (use_cache) {
+        char view[1024];
+        image_view_name(image_path, image_offset, view, sizeof(view));
+        if (blockcache_open(&block_cache, view, image,
+                block_size, block_count) == 0) {
+            cache = &block_cache;
+            blockcache_print_summary(cache, text_out);
+            fprintf(text_out, "\n");
+        } else {
+            fprintf(stderr, "[!] Out of memory, running without the cache\n");
+        }
+    }
+
+    if (jsonl) {
+        print_superblock_info(image, block_size);
+
+        jsonl_begin(&json, "config");
+        jsonl_uint(&json, "block_size", cfg.block_size);
+        jsonl_uint(&json, "block_count", cfg.block_count);
+        jsonl_uint(&json, "read_size", cfg.read_size);
+        jsonl_uint(&json, "prog_size", cfg.prog_size);
+        jsonl_end(&json);
+    } else {
+        printf("\n");
+        print_superblock_info(image, block_size);
+
+        printf("\n");
+        printf("Filesystem configuration:\n");
+        printf("  Block size: %d\n", cfg.block_size);
+        printf("  Block count: %d\n", cfg.block_count);
+        printf("  Read size: %d\n", cfg.read_size);
+        printf("  Prog size: %d\n", cfg.prog_size);
+        printf("\n");
+    }
 
+    // a cache that saw this exact image already holds the listing
     lfs_t lfs;
-    if (lfs_mount(&lfs, &cfg) != 0) {
+    if (cache && cache->listing_known) {
+        fprintf(text_out, "Listing taken from the cache, image unchanged\n");
+        for (size_t i = 0; i < cache->listing_count; i++) {
+            const blockcache_entry_t *e = &cache->listing[i];
+            print_tree_entry(e->kind, e->path, e->size);
+        }
+    } else if (lfs_mount(&lfs, &cfg) == 0) {
+        // a listing with holes would hide the failures on a rerun
+        err = traverse_directory(&lfs, "/");
+        if (cache && !err && !listing_lost) {
+            blockcache_listing_done(cache);
+        } else if (cache) {
+            blockcache_drop_listing(cache);
+        }
+        lfs_unmount(&lfs);
+    } else {
         fprintf(stderr, "[!] Failed to mount filesystem\n");
-        free(image);
-        free(block_usage);
-        return 1;
-    }
+        if (!salvage) {
+            if (jsonl) {
+                jsonl_free(&json);
+            }
+            blockcache_free(&block_cache);
+            hexdump_free(&hex);
+            free(image);
+            free(block_usage);
+            return 1;
+        }
 
-    traverse_directory(&lfs, "/");
+        salvage_t s;
+        if (salvage_scan_cached(&s, image, block_size, block_count,
+                cache) == 0) {
+            salvage_print_summary(&s, text_out);
+            fprintf(text_out, "\n");
+            salvage_walk(&s, print_salvaged_entry, NULL);
+        }
+        salvage_free(&s);
+    }
 
     mark_used_blocks(block_size, block_count);
-    print_block_usage(block_count);
-    dump_blocks(block_size, dump_size);
 
-    lfs_unmount(&lfs);
+    if (export_path) {
+        salvage_t s;
+        blockmap_t m;
+        int err = salvage_scan_cached(&s, image, block_size, block_count,
+                cache);
+        if (!err) {
+            err = blockmap_build(&m, &s);
+            if (!err) {
+                err = blockmap_export(&m, export_path);
+                blockmap_free(&m);
+            }
+        }
+        salvage_free(&s);
+
+        if (err) {
+            fprintf(stderr, "[!] Failed to export block table to %s (%d)\n",
+                    export_path, err);
+        } else {
+            fprintf(text_out, "Exported block table to %s\n", export_path);
+        }
+    }
+    if (jsonl) {
+        json_blocks(block_size, block_count, dump_size);
+        jsonl_free(&json);
+    } else {
+        print_block_usage(block_count);
+        dump_blocks(block_size, dump_size);
+        if (hex_first >= 0) {
+            hexdump_blocks(hex_first, hex_last, block_size);
+        }
+        if (hex_len) {
+            hexdump_range(hex_off, hex_len);
+        }
+    }
+
+    if (cache) {
+        if (blockcache_save(cache) != 0) {
+            fprintf(stderr, "[!] Failed to write %s\n", cache->path);
+        }
+        blockcache_free(cache);
+    }
+
+    hexdump_free(&hex);
     free(image);
     free(block_usage);
     return 0;
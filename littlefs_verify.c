@@ -0,0 +1,466 @@
+#include "lfs.h"
+#include "lfs_util.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "parallel.h"
+#include "ecc.h"
+#include "image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define CTZ_GRAIN 16
+
+uint8_t *image = NULL;
+int block_size = 4096;
+int block_count = 16;
+int read_size = 16;
+int prog_size = 16;
+
+// with --offset, the filesystem starts this many bytes into the image file
+uint64_t image_offset = 0;
+
+struct verify_counts {
+    unsigned long checked;
+    unsigned long bad_crc;
+    unsigned long torn;
+    unsigned long dangling_dir;
+    unsigned long dangling_ctz;
+    unsigned long ctz_chains;
+    unsigned long tail_cycles;
+};
+
+// One CTZ chain to check, filled in by the tree walk
+struct ctz_job {
+    char path[256];
+    lfs_block_t mdir;
+    lfs_block_t head;
+    lfs_size_t size;
+    size_t struct_off;      // absolute offset of the CTZSTRUCT attribute
+
+    lfs_block_t prev;
+    int err;
+    size_t err_off;
+    lfs_block_t err_block;
+};
+
+struct ctz_check {
+    struct ctz_job *job;
+    salvage_t *s;
+};
+
+struct ctz_jobs {
+    struct ctz_job *jobs;
+    size_t count;
+    size_t capacity;
+    salvage_t *s;
+};
+
+static size_t image_off(const uint8_t *p) {
+    return (size_t)(p - image);
+}
+
+static bool is_erased(const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void report(lfs_block_t block, lfs_off_t off, const char *what) {
+    size_t abs = (size_t)block * block_size + off;
+    printf("  [0x%08lx] block %lu +0x%04lx: %s\n", (unsigned long)abs,
+            (unsigned long)block, (unsigned long)off, what);
+}
+
+// Active blocks are checked in full. A pair half that holds no valid log,
+// or an older half, still says why its log ended, and a block outside
+// every file whose log ended on a bad or broken commit was metadata once.
+// Erased blocks and file data are left alone.
+static bool verify_block_wanted(const salvage_block_t *b, const bool *usage,
+        lfs_block_t i) {
+    if (b->state != SALVAGE_NONE || b->referenced) {
+        return true;
+    }
+    return !usage[i] && (b->stop == ONDISK_STOP_BADCRC ||
+            b->stop == ONDISK_STOP_INVALID);
+}
+
+void verify_commits(salvage_t *s, struct verify_counts *counts) {
+    printf("Metadata commits:\n");
+
+    bool *usage = calloc(block_count, sizeof(bool));
+    if (!usage) {
+        return;
+    }
+    salvage_mark_used(s, usage);
+
+    for (lfs_block_t i = 0; i < (lfs_block_t)block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (!verify_block_wanted(b, usage, i)) {
+            continue;
+        }
+        const uint8_t *data = &image[(size_t)i * block_size];
+
+        // the unused half of a fresh pair is simply erased, caches
+        // written before erased blocks had a stop say NONE
+        if (b->state == SALVAGE_NONE && (b->stop == ONDISK_STOP_ERASED ||
+                b->stop == ONDISK_STOP_NONE) && is_erased(data, block_size)) {
+            continue;
+        }
+
+        counts->checked += 1;
+        const char *half = (b->state == SALVAGE_STALE) ? " (stale half)"
+                : (b->state == SALVAGE_NONE && !b->referenced)
+                ? " (unreferenced)" : "";
+        char what[128];
+
+        switch (b->stop) {
+            case ONDISK_STOP_BADCRC:
+                counts->bad_crc += 1;
+                snprintf(what, sizeof(what), "%s%s", (b->commits == 0)
+                        ? "bad CRC in first commit, block unreadable"
+                        : "bad CRC, later commits discarded", half);
+                report(i, b->stop_off, what);
+                break;
+
+            case ONDISK_STOP_INVALID:
+            case ONDISK_STOP_OVERFLOW:
+                // stale halves are expected to carry old, interrupted logs
+                if (b->state == SALVAGE_STALE) {
+                    break;
+                }
+                counts->torn += 1;
+                snprintf(what, sizeof(what), "%s%s", (b->commits == 0)
+                        ? "torn first commit, block unreadable"
+                        : "torn commit, no terminating CRC", half);
+                report(i, b->off, what);
+                break;
+
+            case ONDISK_STOP_ERASED:
+                // anything programmed past the end of the log is a commit
+                // that never got as far as its first tag
+                if (b->state != SALVAGE_STALE && !is_erased(
+                        &data[b->stop_off], block_size - b->stop_off)) {
+                    counts->torn += 1;
+                    snprintf(what, sizeof(what), "%s%s",
+                            (b->commits == 0)
+                            ? "no valid commit, block unreadable"
+                            : "torn commit, data past end of log", half);
+                    report(i, b->stop_off, what);
+                }
+                break;
+
+            default:
+                counts->torn += 1;
+                snprintf(what, sizeof(what),
+                        "inconsistent create/delete ids%s", half);
+                report(i, b->off, what);
+                break;
+        }
+    }
+
+    free(usage);
+}
+
+void verify_dirstructs(salvage_t *s, struct verify_counts *counts) {
+    printf("Directory pointers:\n");
+
+    for (lfs_block_t i = 0; i < (lfs_block_t)block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state != SALVAGE_ACTIVE) {
+            continue;
+        }
+
+        for (uint16_t id = 0; id < b->mdir.count; id++) {
+            const ondisk_entry_t *e = &b->mdir.entries[id];
+            lfs_block_t pair[2];
+            if (!ondisk_entry_dirpair(e, pair) ||
+                    salvage_resolve(s, pair) != LFS_BLOCK_NULL) {
+                continue;
+            }
+
+            char what[320];
+            snprintf(what, sizeof(what),
+                    "DIRSTRUCT of \"%.*s\" -> {%lu, %lu} has no valid log",
+                    (int)lfs_min(e->name_len, 255), e->name,
+                    (unsigned long)pair[0], (unsigned long)pair[1]);
+            size_t abs = image_off(e->struct_data);
+            report(abs / block_size, abs % block_size, what);
+            counts->dangling_dir += 1;
+        }
+    }
+}
+
+static void collect_ctz(void *data, const salvage_info_t *info) {
+    struct ctz_jobs *jobs = data;
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (!info->entry || !ondisk_entry_ctz(info->entry, &head, &size)) {
+        return;
+    }
+
+    if (jobs->count == jobs->capacity) {
+        size_t capacity = jobs->capacity ? 2*jobs->capacity : 64;
+        struct ctz_job *njobs = realloc(jobs->jobs,
+                capacity * sizeof(struct ctz_job));
+        if (!njobs) {
+            return;
+        }
+        jobs->jobs = njobs;
+        jobs->capacity = capacity;
+    }
+
+    struct ctz_job *job = &jobs->jobs[jobs->count++];
+    memset(job, 0, sizeof(*job));
+    snprintf(job->path, sizeof(job->path), "%s", info->path);
+    job->mdir = info->mdir;
+    job->head = head;
+    job->size = size;
+    job->struct_off = image_off(info->entry->struct_data);
+    job->prev = LFS_BLOCK_NULL;
+}
+
+static int check_ctz_block(void *data, lfs_block_t block, lfs_off_t index) {
+    struct ctz_check *check = data;
+    struct ctz_job *job = check->job;
+    const salvage_block_t *b = &check->s->blocks[block];
+
+    if (b->state == SALVAGE_ACTIVE ||
+            (b->state == SALVAGE_STALE && b->partner != LFS_BLOCK_NULL)) {
+        job->err_block = block;
+        job->err = 1;
+    } else if (index > 0 &&
+            is_erased(&image[(size_t)block * block_size], block_size)) {
+        // only the first block can legitimately hold nothing but 0xFF,
+        // every later one starts with skip-list pointers
+        job->err_block = block;
+        job->err = 2;
+    }
+
+    if (job->err) {
+        job->err_off = (job->prev == LFS_BLOCK_NULL) ? job->struct_off
+                : (size_t)job->prev * block_size;
+        return LFS_ERR_CORRUPT;
+    }
+
+    job->prev = block;
+    return 0;
+}
+
+static void check_ctz_range(void *data, size_t begin, size_t end) {
+    struct ctz_jobs *jobs = data;
+
+    for (size_t i = begin; i < end; i++) {
+        struct ctz_job *job = &jobs->jobs[i];
+        struct ctz_check check = {job, jobs->s};
+
+        int err = ondisk_ctz_walk(image, block_size, block_count,
+                job->head, job->size, check_ctz_block, &check);
+        if (err && !job->err) {
+            // pointer out of range, either the head or the one we just read
+            job->err = 3;
+            job->err_off = (job->prev == LFS_BLOCK_NULL) ? job->struct_off
+                    : (size_t)job->prev * block_size;
+        }
+    }
+}
+
+void verify_ctz(salvage_t *s, struct verify_counts *counts) {
+    printf("File CTZ chains:\n");
+
+    struct ctz_jobs jobs = {.s = s};
+    salvage_walk(s, collect_ctz, &jobs);
+    parallel_for(jobs.count, CTZ_GRAIN, check_ctz_range, &jobs);
+
+    static const char *reasons[] = {
+        NULL,
+        "points into a metadata block",
+        "points at an erased block",
+        "points past the end of the image",
+    };
+
+    for (size_t i = 0; i < jobs.count; i++) {
+        const struct ctz_job *job = &jobs.jobs[i];
+        counts->ctz_chains += 1;
+        if (!job->err) {
+            continue;
+        }
+
+        char what[384];
+        snprintf(what, sizeof(what), "CTZ pointer of %s %s", job->path,
+                reasons[job->err]);
+        report(job->err_off / block_size, job->err_off % block_size, what);
+        counts->dangling_ctz += 1;
+    }
+
+    free(jobs.jobs);
+}
+
+void verify_tail_list(salvage_t *s, struct verify_counts *counts) {
+    printf("Tail list:\n");
+
+    if (s->root == LFS_BLOCK_NULL) {
+        printf("  [!] Root pair {0, 1} has no valid log, tail list not checked\n");
+        return;
+    }
+
+    bool *seen = calloc(block_count, sizeof(bool));
+    if (!seen) {
+        return;
+    }
+
+    lfs_block_t block = s->root;
+    while (true) {
+        seen[block] = true;
+        const salvage_block_t *b = &s->blocks[block];
+        if (!b->mdir.has_tail || b->mdir.tail[0] == LFS_BLOCK_NULL) {
+            break;
+        }
+
+        lfs_block_t next = salvage_resolve(s, b->mdir.tail);
+        char what[128];
+        if (next == LFS_BLOCK_NULL) {
+            snprintf(what, sizeof(what), "tail -> {%lu, %lu} has no valid log",
+                    (unsigned long)b->mdir.tail[0],
+                    (unsigned long)b->mdir.tail[1]);
+            report(block, 0, what);
+            counts->dangling_dir += 1;
+            break;
+        }
+        if (seen[next]) {
+            snprintf(what, sizeof(what), "tail -> block %lu closes a cycle",
+                    (unsigned long)next);
+            report(block, 0, what);
+            counts->tail_cycles += 1;
+            break;
+        }
+
+        block = next;
+    }
+
+    free(seen);
+}
+
+void verify_gstate(salvage_t *s) {
+    const lfs_gstate_t *g = &s->gstate;
+
+    printf("\nGlobal state:\n");
+    if (ondisk_tag_type1(g->tag)) {
+        printf("  Pending move: id %u in {%lu, %lu}\n",
+                ondisk_tag_id(g->tag),
+                (unsigned long)g->pair[0], (unsigned long)g->pair[1]);
+    } else {
+        printf("  Pending move: none\n");
+    }
+    printf("  Pending orphans: %u\n", ondisk_tag_size(g->tag) & 0x1ff);
+    if (ondisk_tag_size(g->tag) >> 9) {
+        printf("  Superblock needs rewrite\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    // optional flags may appear anywhere, positional arguments keep their order
+    bool ecc = false;
+    int image_hash = DIGEST_NONE;
+    int nargs = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--ecc") == 0) {
+            ecc = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--offset") == 0 && i + 1 < argc) {
+            image_offset = strtoull(argv[++i], NULL, 0);
+            continue;
+        }
+        if (strcmp(argv[i], "--image-hash") == 0 && i + 1 < argc) {
+            image_hash = digest_parse(argv[++i]);
+            if (image_hash == DIGEST_NONE) {
+                fprintf(stderr, "[!] Unknown image hash: %s (md5, sha1 or sha256)\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        argv[nargs++] = argv[i];
+    }
+    argc = nargs;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <image_file> [block_size] [block_count] [read_size] [prog_size] [--ecc] [--offset N] [--image-hash md5|sha1|sha256]\n", argv[0]);
+        return 1;
+    }
+
+    const char *image_path = argv[1];
+    if (argc >= 3) {
+        block_size = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        block_count = atoi(argv[3]);
+    }
+    if (argc >= 5) {
+        read_size = atoi(argv[4]);
+    }
+    if (argc >= 6) {
+        prog_size = atoi(argv[5]);
+    }
+
+    if (block_size <= 0 || block_count <= 0) {
+        fprintf(stderr, "[!] Invalid block size or block count.\n");
+        return 1;
+    }
+
+    size_t image_size = (size_t)block_size * block_count;
+    image_digest_t digest;
+    int err = image_load_at(&image, image_path, image_offset, image_size,
+            image_hash, &digest);
+    if (err) {
+        fprintf(stderr, "[!] Failed to %s image file: %s\n",
+                (err == LFS_ERR_NOMEM) ? "load" : "open", image_path);
+        return 1;
+    }
+    image_print_digest(&digest, image_path, stdout);
+
+    if (ecc) {
+        ecc_report_t report;
+        if (ecc_correct_image(image, block_size, block_count, &report) == 0) {
+            ecc_print_report(&report, block_size, stdout);
+            printf("\n");
+        }
+        ecc_report_free(&report);
+    }
+
+    // a single parallel pass over the image walks every commit log, the
+    // checks below only touch the results and the CTZ pointer words
+    salvage_t s;
+    if (salvage_scan(&s, image, block_size, block_count) != 0) {
+        fprintf(stderr, "[!] Out of memory while scanning image\n");
+        salvage_free(&s);
+        free(image);
+        return 1;
+    }
+
+    struct verify_counts counts = {0};
+    verify_commits(&s, &counts);
+    verify_tail_list(&s, &counts);
+    verify_dirstructs(&s, &counts);
+    verify_ctz(&s, &counts);
+    verify_gstate(&s);
+
+    printf("\nIntegrity summary:\n");
+    printf("  Metadata blocks checked: %lu\n", counts.checked);
+    printf("  CTZ chains checked: %lu\n", counts.ctz_chains);
+    printf("  Bad CRCs: %lu\n", counts.bad_crc);
+    printf("  Torn commits: %lu\n", counts.torn);
+    printf("  Dangling directory pointers: %lu\n", counts.dangling_dir);
+    printf("  Dangling CTZ pointers: %lu\n", counts.dangling_ctz);
+    printf("  Tail list cycles: %lu\n", counts.tail_cycles);
+
+    salvage_free(&s);
+    free(image);
+    return 0;
+}
@@ -1,5 +1,5 @@
 import argparse
-from fs_analyzer import list_files, print_structures, recover_deleted
+from fs_analyzer import list_files, print_structures, recover_deleted, verify_image, extract_files, hash_files, find_partitions, index_image, diff_images, search_image
 
 # Create a command line interface
 def main():
@@ -12,19 +12,80 @@ def main():
     parser.add_argument("--list", action="store_true", help="List files and directories")
     parser.add_argument("--struct", action="store_true", help="Print filesystem structures")
     parser.add_argument("--dump-blocks", type=int, default=None, help="Specify number of blocks to dump in --struct mode (default: 8, specify fewer if filesystem is smaller)")
+    parser.add_argument("--hexdump", default=None, help="In --struct mode, also print a full hex/ASCII dump of a block, an inclusive block range, e.g. 2-5, or a byte range, e.g. 0x1f80+256")
+    parser.add_argument("--export", default=None, help="In --struct mode, also write the per-block table (state, owner, role, entropy, revision, hash) to this file in columnar binary form")
+    parser.add_argument("--cache", action="store_true", help="In --struct and --recover mode, keep what is learned about each block in <image_file>.lfscache, keyed by block content, so later runs only analyze blocks that changed")
     parser.add_argument("--recover", action="store_true", help="Attempt to recover deleted files")
+    parser.add_argument("--slack", action="store_true", help="In --recover mode, also extract residual data after the live end of every referenced block")
+    parser.add_argument("--carve", action="store_true", help="In --recover mode, also carve JPEG, PNG, ELF, gzip, SQLite, JSON and protobuf objects out of orphaned blocks and slack space")
+    parser.add_argument("--cluster", action="store_true", help="In --recover mode, group orphaned blocks and carved objects that are near copies of each other and show one of each group")
+    parser.add_argument("--known-good", action="append", default=None, metavar="LIST", help="In --recover and --hash mode, a list of MD5, SHA-1 or SHA-256 digests of known good blocks or files, left out of recovery, may be repeated")
+    parser.add_argument("--known-bad", action="append", default=None, metavar="LIST", help="In --recover and --hash mode, a list of digests of known bad blocks or files to report, may be repeated")
+    parser.add_argument("--archive", default=None, help="In --recover mode, write every recovered block and slack range into this tar file instead of one file each under recovered_blocks")
+    parser.add_argument("--store", default=None, metavar="DIR", help="In --recover and --extract mode, put everything recovered or extracted into a content-addressed store in DIR shared between runs, keeping each distinct content once and a list of what each image contained")
+    parser.add_argument("--extract", nargs="?", const="extracted", default=None, metavar="DIR", help="Copy every file out of the image into DIR (default: extracted), recreating the directory tree")
+    parser.add_argument("--include", action="append", default=None, metavar="GLOB", help="In --extract mode, only extract files matching this pattern, may be repeated")
+    parser.add_argument("--exclude", action="append", default=None, metavar="GLOB", help="In --extract mode, skip files and directories matching this pattern, may be repeated")
+    parser.add_argument("--hash", action="store_true", help="Print a manifest with the path, size and SHA-256 digest of every file, without extracting anything")
+    parser.add_argument("--index", action="store_true", help="Hash every block into a Merkle tree kept in <image_file>.lfsidx, reused while the image is unchanged")
+    parser.add_argument("--diff", default=None, metavar="OTHER_IMAGE", help="List the blocks that differ between the image and OTHER_IMAGE using their block indexes")
+    parser.add_argument("--fs-diff", default=None, metavar="OTHER_IMAGE", help="List the files and directories added, deleted, renamed, grown, truncated or rewritten between the image and OTHER_IMAGE")
+    parser.add_argument("--search", action="append", default=None, metavar="TEXT", help="Search the raw image for this text and report which file, metadata log, slack space or orphaned block each match is in, may be repeated")
+    parser.add_argument("--search-hex", action="append", default=None, metavar="BYTES", help="Like --search, for a byte string given in hex, e.g. ffd8ffe0")
+    parser.add_argument("--search-regex", action="append", default=None, metavar="EXPR", help="Like --search, for a POSIX extended regular expression matched against runs of printable text")
+    parser.add_argument("--ignore-case", action="store_true", help="In --search mode, match ASCII letters regardless of case")
+    parser.add_argument("--search-index", action="store_true", help="In --search mode, narrow the search down to candidate blocks with a trigram index kept in <image_file>.lfsgram, built on first use and reused while the image is unchanged")
+    parser.add_argument("--rebuild-index", action="store_true", help="In --index and --diff mode, ignore existing .lfsidx files and rebuild them, in --search-index mode the .lfsgram file")
+    parser.add_argument("--verify", action="store_true", help="Check every metadata commit and CTZ chain for corruption")
+    parser.add_argument("--salvage", action="store_true", help="If the image fails to mount, rebuild the tree from a scan of every metadata block")
+    parser.add_argument("--ecc", action="store_true", help="Correct single-bit errors in metadata commits before analysis, and report every bit fixed")
+    parser.add_argument("--nand", default=None, metavar="PAGE+SPARE", help="In --list and --extract mode, the image is a raw NAND dump with SPARE bytes of OOB data after every PAGE bytes of data, e.g. 2048+64, read in place without a de-interleaved copy")
+    parser.add_argument("--oob", action="store_true", help="In --list mode with --nand, also print the spare bytes of every page that has any, and flag bad block markers")
+    parser.add_argument("--find-partitions", action="store_true", help="Scan a full-flash dump for littlefs superblocks and report the offset, block size and block count of every littlefs partition in it")
+    parser.add_argument("--align", type=lambda x: int(x, 0), default=None, help="In --find-partitions mode, check every offset that is a multiple of this many bytes (default: 512)")
+    parser.add_argument("--offset", type=lambda x: int(x, 0), default=None, help="Analyze the littlefs partition starting this many bytes into the image file, e.g. 0x290000 as reported by --find-partitions")
+    parser.add_argument("--image-hash", choices=["md5", "sha1", "sha256"], default=None, help="Also compute this acquisition hash of the whole image file while it is loaded, and report it with the results")
+    parser.add_argument("--format", choices=["text", "jsonl"], default="text", help="Output format of --list, --struct and --recover, jsonl emits one JSON record per file, directory, block or orphan")
+    parser.add_argument("--timeline", action="store_true", help="Replay every metadata commit and print when each file or directory was created, deleted, renamed or changed")
+    parser.add_argument("--rewind", type=int, default=None, help="Analyze the filesystem as it was this many commits ago in every metadata pair")
+    parser.add_argument("--mdir", type=int, default=None, help="Limit --rewind and --timeline to the metadata pair containing this block")
 
 
     args = parser.parse_args()
+    flags = {"salvage": args.salvage, "ecc": args.ecc}
+    history = {"timeline": args.timeline, "rewind": args.rewind, "mdir": args.mdir}
+    output = {"format": "jsonl"} if args.format == "jsonl" else {}
+    acquisition = {"image_hash": args.image_hash, "offset": args.offset}
+
+    if args.find_partitions:
+        find_partitions(args.image, align=args.align, **output, image_hash=args.image_hash)
 
     if args.list:
-        list_files(args.image, args.block_size, args.block_count, args.read_size, args.prog_size)
+        list_files(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, nand=args.nand, oob=args.oob, **flags, **history, **output, **acquisition)
 
     if args.struct:
-        print_structures(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, args.dump_blocks)
+        print_structures(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, args.dump_blocks, hexdump=args.hexdump, export=args.export, cache=args.cache, **flags, **history, **output, **acquisition)
 
     if args.recover:
-        recover_deleted(args.image, args.block_size, args.block_count, args.read_size, args.prog_size)
+        recover_deleted(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, slack=args.slack, carve=args.carve, cluster=args.cluster, known_good=args.known_good, known_bad=args.known_bad, archive=args.archive, store=args.store, cache=args.cache, **flags, **output, **acquisition)
+
+    if args.verify:
+        verify_image(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, ecc=args.ecc, **acquisition)
+
+    if args.hash:
+        hash_files(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, ecc=args.ecc, known_good=args.known_good, known_bad=args.known_bad, **output, **acquisition)
+
+    if args.index or args.diff:
+        index_image(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, diff=args.diff, rebuild=args.rebuild_index, offset=args.offset, **output)
+
+    if args.fs_diff:
+        diff_images(args.image, args.fs_diff, args.block_size, args.block_count, args.read_size, args.prog_size, ecc=args.ecc, **output, **acquisition)
+
+    if args.search or args.search_hex or args.search_regex:
+        search_image(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, pattern=args.search, hex=args.search_hex, regex=args.search_regex, ignore_case=args.ignore_case, index=args.search_index, rebuild_index=args.search_index and args.rebuild_index, ecc=args.ecc, **output, **acquisition)
+
+    if args.extract:
+        extract_files(args.image, args.block_size, args.block_count, args.read_size, args.prog_size, out=args.extract, include=args.include, exclude=args.exclude, store=args.store, nand=args.nand, ecc=args.ecc, **acquisition)
 
 
 if __name__ == "__main__":
@@ -0,0 +1,238 @@
+/*
+ * Per-block Merkle hash index of an image
+ */
+#include "merkle.h"
+#include "lfs_util.h"
+#include "hash64.h"
+#include "parallel.h"
+#include "sidecar.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MERKLE_GRAIN 64
+#define MERKLE_HEADER 48
+
+struct merkle_job {
+    merkle_t *m;
+    const uint8_t *image;
+};
+
+static void merkle_hash_range(void *data, size_t begin, size_t end) {
+    struct merkle_job *job = data;
+    merkle_t *m = job->m;
+
+    for (size_t i = begin; i < end; i++) {
+        m->nodes[i] = hash64(&job->image[i * m->block_size],
+                m->block_size, 0);
+    }
+}
+
+// Lays out the levels for m->block_count leaves and allocates them
+static int merkle_alloc(merkle_t *m) {
+    size_t len = m->block_count ? m->block_count : 1;
+    size_t off = 0;
+    m->levels = 0;
+    while (true) {
+        m->level_off[m->levels] = off;
+        m->level_len[m->levels] = len;
+        m->levels += 1;
+        off += len;
+        if (len == 1) {
+            break;
+        }
+        len = (len + 1) / 2;
+    }
+
+    m->node_count = off;
+    m->nodes = calloc(m->node_count, sizeof(uint64_t));
+    return m->nodes ? 0 : LFS_ERR_NOMEM;
+}
+
+int merkle_build(merkle_t *m, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count) {
+    memset(m, 0, sizeof(*m));
+    m->block_size = block_size;
+    m->block_count = block_count;
+
+    int err = merkle_alloc(m);
+    if (err) {
+        return err;
+    }
+
+    struct merkle_job job = {m, image};
+    parallel_for(block_count, MERKLE_GRAIN, merkle_hash_range, &job);
+
+    // the upper levels are a fraction of the leaves, not worth threads
+    for (int l = 1; l < m->levels; l++) {
+        const uint64_t *below = &m->nodes[m->level_off[l-1]];
+        uint64_t *level = &m->nodes[m->level_off[l]];
+        size_t below_len = m->level_len[l-1];
+
+        for (size_t i = 0; i < m->level_len[l]; i++) {
+            uint8_t pair[16];
+            size_t n = (2*i + 1 < below_len) ? 2 : 1;
+            for (size_t j = 0; j < n; j++) {
+                uint64_t h = below[2*i + j];
+                for (int k = 0; k < 8; k++) {
+                    pair[8*j + k] = h >> (8*k);
+                }
+            }
+            level[i] = hash64(pair, 8*n, l);
+        }
+    }
+
+    return 0;
+}
+
+void merkle_free(merkle_t *m) {
+    free(m->nodes);
+    memset(m, 0, sizeof(*m));
+}
+
+void merkle_sidecar_path(const char *image_path, char *out, size_t len) {
+    snprintf(out, len, "%s.lfsidx", image_path);
+}
+
+int merkle_stamp(merkle_t *m, const char *image_path) {
+    sidecar_stamp_t stamp;
+    if (sidecar_stamp(&stamp, image_path) != 0) {
+        return LFS_ERR_IO;
+    }
+    m->file_size = stamp.file_size;
+    m->mtime_sec = stamp.mtime_sec;
+    m->mtime_nsec = stamp.mtime_nsec;
+    return 0;
+}
+
+int merkle_load(merkle_t *m, const char *sidecar, const char *image_path,
+        lfs_size_t block_size, lfs_size_t block_count) {
+    memset(m, 0, sizeof(*m));
+
+    merkle_t now;
+    memset(&now, 0, sizeof(now));
+    int err = merkle_stamp(&now, image_path);
+    if (err) {
+        return err;
+    }
+
+    FILE *f = fopen(sidecar, "rb");
+    if (!f) {
+        return LFS_ERR_NOENT;
+    }
+
+    uint8_t header[MERKLE_HEADER];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header) ||
+            memcmp(header, "LFSIDX1\0", 8) != 0 ||
+            sidecar_get32(&header[8]) != 1 ||
+            sidecar_get32(&header[12]) != block_size ||
+            sidecar_get64(&header[16]) != block_count ||
+            sidecar_get64(&header[24]) != now.file_size ||
+            (int64_t)sidecar_get64(&header[32]) != now.mtime_sec ||
+            (int64_t)sidecar_get64(&header[40]) != now.mtime_nsec) {
+        fclose(f);
+        return LFS_ERR_NOENT;
+    }
+
+    m->block_size = block_size;
+    m->block_count = block_count;
+    m->file_size = now.file_size;
+    m->mtime_sec = now.mtime_sec;
+    m->mtime_nsec = now.mtime_nsec;
+    err = merkle_alloc(m);
+    if (err) {
+        fclose(f);
+        return err;
+    }
+
+    uint8_t buf[8];
+    for (size_t i = 0; i < m->node_count; i++) {
+        if (fread(buf, 1, 8, f) != 8) {
+            fclose(f);
+            merkle_free(m);
+            return LFS_ERR_NOENT;
+        }
+        m->nodes[i] = sidecar_get64(buf);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+int merkle_save(const merkle_t *m, const char *sidecar) {
+    sidecar_file_t out;
+    if (sidecar_create(&out, sidecar) != 0) {
+        return LFS_ERR_IO;
+    }
+
+    uint8_t header[MERKLE_HEADER];
+    memcpy(&header[0], "LFSIDX1\0", 8);
+    sidecar_put32(&header[8], 1);
+    sidecar_put32(&header[12], m->block_size);
+    sidecar_put64(&header[16], m->block_count);
+    sidecar_put64(&header[24], m->file_size);
+    sidecar_put64(&header[32], m->mtime_sec);
+    sidecar_put64(&header[40], m->mtime_nsec);
+    fwrite(header, 1, sizeof(header), out.f);
+
+    uint8_t buf[8];
+    for (size_t i = 0; i < m->node_count; i++) {
+        sidecar_put64(buf, m->nodes[i]);
+        fwrite(buf, 1, 8, out.f);
+    }
+
+    return sidecar_commit(&out);
+}
+
+struct merkle_walk {
+    const merkle_t *a;
+    const merkle_t *b;
+    merkle_diff_cb cb;
+    void *data;
+    long compared;
+};
+
+static void merkle_descend(struct merkle_walk *w, int level, size_t i) {
+    w->compared += 1;
+    if (w->a->nodes[w->a->level_off[level] + i] ==
+            w->b->nodes[w->b->level_off[level] + i]) {
+        return;
+    }
+
+    if (level == 0) {
+        w->cb(w->data, i);
+        return;
+    }
+
+    merkle_descend(w, level - 1, 2*i);
+    if (2*i + 1 < w->a->level_len[level - 1]) {
+        merkle_descend(w, level - 1, 2*i + 1);
+    }
+}
+
+long merkle_diff(const merkle_t *a, const merkle_t *b,
+        merkle_diff_cb cb, void *data) {
+    if (a->block_size != b->block_size) {
+        return LFS_ERR_INVAL;
+    }
+
+    struct merkle_walk w = {a, b, cb, data, 0};
+    if (a->block_count == b->block_count) {
+        merkle_descend(&w, a->levels - 1, 0);
+        return w.compared;
+    }
+
+    // different shapes, the trees don't line up so compare the leaves
+    lfs_size_t common = lfs_min(a->block_count, b->block_count);
+    for (lfs_block_t i = 0; i < common; i++) {
+        w.compared += 1;
+        if (a->nodes[i] != b->nodes[i]) {
+            cb(data, i);
+        }
+    }
+    for (lfs_block_t i = common;
+            i < lfs_max(a->block_count, b->block_count); i++) {
+        cb(data, i);
+    }
+    return w.compared;
+}
@@ -0,0 +1,75 @@
+/*
+ * Per-block Merkle hash index of an image
+ *
+ * Leaves are the hash64 of each block, the same value as the hash column
+ * of the --export table, and every level above hashes pairs of the one
+ * below, an odd node out is hashed alone. Two images of the same
+ * geometry are diffed by descending only where the hashes differ.
+ *
+ * The index can be kept in a sidecar file next to the image, all
+ * integers little-endian:
+ *
+ *   8 bytes  magic "LFSIDX1\0"
+ *   4 bytes  format version, currently 1
+ *   4 bytes  block size
+ *   8 bytes  block count
+ *   8 bytes  image file size
+ *   8 bytes  image mtime, seconds
+ *   8 bytes  image mtime, nanoseconds
+ *   8 bytes  per node, level by level from the leaves up to the root
+ *
+ * A sidecar is only reused while the image's size and mtime match.
+ */
+#ifndef MERKLE_H
+#define MERKLE_H
+
+#include "lfs.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define MERKLE_MAX_LEVELS 64
+
+typedef struct merkle {
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+
+    uint64_t *nodes;
+    size_t node_count;
+    int levels;
+    size_t level_off[MERKLE_MAX_LEVELS];
+    size_t level_len[MERKLE_MAX_LEVELS];
+} merkle_t;
+
+// Hashes every block in parallel and builds the levels above
+int merkle_build(merkle_t *m, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count);
+void merkle_free(merkle_t *m);
+
+static inline uint64_t merkle_root(const merkle_t *m) {
+    return m->nodes[m->level_off[m->levels - 1]];
+}
+
+// Sidecar path for an image, the image path with ".lfsidx" appended
+void merkle_sidecar_path(const char *image_path, char *out, size_t len);
+
+// Records the image file's size and mtime, to be saved with the index
+int merkle_stamp(merkle_t *m, const char *image_path);
+
+// Loads a sidecar if it matches the image file and the geometry,
+// LFS_ERR_NOENT if there is none or it is stale
+int merkle_load(merkle_t *m, const char *sidecar, const char *image_path,
+        lfs_size_t block_size, lfs_size_t block_count);
+int merkle_save(const merkle_t *m, const char *sidecar);
+
+// Calls cb for every block whose hash differs, in block order. Blocks
+// past the end of the shorter image count as changed. Returns the number
+// of nodes compared, or a negative error if the block sizes differ.
+typedef void (*merkle_diff_cb)(void *data, lfs_block_t block);
+long merkle_diff(const merkle_t *a, const merkle_t *b,
+        merkle_diff_cb cb, void *data);
+
+#endif
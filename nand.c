@@ -0,0 +1,70 @@
+/*
+ * Raw NAND dumps with interleaved spare areas
+ */
+#include "nand.h"
+#include <stdlib.h>
+#include <string.h>
+
+int nand_parse(const char *spec, size_t *page_size, size_t *spare_size) {
+    char *end;
+    unsigned long page = strtoul(spec, &end, 0);
+    if (end == spec || *end != '+') {
+        return LFS_ERR_INVAL;
+    }
+    const char *rest = end + 1;
+    unsigned long spare = strtoul(rest, &end, 0);
+    if (end == rest || *end != '\0' || page == 0) {
+        return LFS_ERR_INVAL;
+    }
+
+    *page_size = page;
+    *spare_size = spare;
+    return 0;
+}
+
+size_t nand_raw_size(size_t data_size, size_t page_size, size_t spare_size) {
+    size_t pages = (data_size + page_size - 1) / page_size;
+    return pages * (page_size + spare_size);
+}
+
+void nand_init(nand_t *n, const uint8_t *raw, size_t raw_size,
+        size_t page_size, size_t spare_size) {
+    n->raw = raw;
+    n->page_size = page_size;
+    n->spare_size = spare_size;
+    n->pages = raw_size / (page_size + spare_size);
+}
+
+void nand_read(const nand_t *n, uint64_t off, void *buffer, size_t size) {
+    uint8_t *out = buffer;
+    size_t stride = n->page_size + n->spare_size;
+
+    // littlefs reads rarely cross a page, that is a single copy
+    size_t page = off / n->page_size;
+    size_t in = off % n->page_size;
+    while (size) {
+        size_t chunk = n->page_size - in;
+        if (chunk > size) {
+            chunk = size;
+        }
+        if (page < n->pages) {
+            memcpy(out, &n->raw[page * stride + in], chunk);
+        } else {
+            memset(out, 0xff, chunk);
+        }
+        out += chunk;
+        size -= chunk;
+        page += 1;
+        in = 0;
+    }
+}
+
+bool nand_oob_erased(const nand_t *n, size_t page) {
+    const uint8_t *oob = nand_oob(n, page);
+    for (size_t i = 0; i < n->spare_size; i++) {
+        if (oob[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
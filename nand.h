@@ -0,0 +1,47 @@
+/*
+ * Raw NAND dumps with interleaved spare areas
+ *
+ * A chip-off dump of a NAND flash holds each page followed by its spare
+ * (OOB) bytes, e.g. 2048 bytes of data then 64 of spare, where the
+ * controller keeps ECC, bad block markers and wear-leveling tags. The
+ * filesystem only ever saw the data bytes. Reads of the filesystem's
+ * address space are served straight from the dump, page by page, so the
+ * dump is never rewritten into a de-interleaved copy, and the spare bytes
+ * of every page stay available for analysis.
+ */
+#ifndef NAND_H
+#define NAND_H
+
+#include "lfs.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct nand {
+    const uint8_t *raw;     // the dump as read
+    size_t page_size;       // data bytes per page
+    size_t spare_size;      // spare bytes after each page
+    size_t pages;           // whole pages in the dump
+} nand_t;
+
+// Parses a geometry such as "2048+64", returns 0 or LFS_ERR_INVAL
+int nand_parse(const char *spec, size_t *page_size, size_t *spare_size);
+
+// Bytes of dump that hold data_size bytes of page data
+size_t nand_raw_size(size_t data_size, size_t page_size, size_t spare_size);
+
+void nand_init(nand_t *n, const uint8_t *raw, size_t raw_size,
+        size_t page_size, size_t spare_size);
+
+// Copies size bytes at off in the page data, skipping spare areas, into
+// buffer. Anything past the last page reads as erased.
+void nand_read(const nand_t *n, uint64_t off, void *buffer, size_t size);
+
+static inline const uint8_t *nand_oob(const nand_t *n, size_t page) {
+    return &n->raw[page * (n->page_size + n->spare_size) + n->page_size];
+}
+
+// True if the page's spare bytes were never programmed
+bool nand_oob_erased(const nand_t *n, size_t page);
+
+#endif
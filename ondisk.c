@@ -0,0 +1,351 @@
+/*
+ * Zero-copy helpers for reading littlefs on-disk structures
+ */
+#include "ondisk.h"
+#include <stdlib.h>
+#include <string.h>
+
+void ondisk_cursor_init(ondisk_cursor_t *cur,
+        const uint8_t *block, lfs_size_t block_size) {
+    memset(cur, 0, sizeof(*cur));
+    cur->block = block;
+    cur->block_size = block_size;
+    cur->rev = ondisk_le32(block);
+    cur->off = sizeof(uint32_t);
+    cur->ptag = 0xffffffff;
+}
+
+bool ondisk_next_commit(ondisk_cursor_t *cur, ondisk_commit_t *commit) {
+    if (cur->stop != ONDISK_STOP_NONE) {
+        return false;
+    }
+
+    const uint8_t *block = cur->block;
+    lfs_off_t start = cur->off;
+    lfs_off_t off = start;
+    lfs_tag_t ptag = cur->ptag;
+
+    // the revision count is part of the first commit's crc
+    uint32_t crc = 0xffffffff;
+    if (cur->commits == 0) {
+        crc = lfs_crc(crc, block, sizeof(uint32_t));
+    }
+
+    while (true) {
+        if (off + sizeof(lfs_tag_t) > cur->block_size) {
+            // a log padded out to the very end of the block is complete
+            cur->stop = (off == start) ? ONDISK_STOP_ERASED
+                                       : ONDISK_STOP_OVERFLOW;
+            cur->stop_off = off;
+            return false;
+        }
+
+        crc = lfs_crc(crc, &block[off], sizeof(lfs_tag_t));
+        lfs_tag_t tag = ondisk_be32(&block[off]) ^ ptag;
+
+        if (!ondisk_tag_isvalid(tag)) {
+            // only a clean end of log if we are between commits
+            cur->stop = (off == start) ? ONDISK_STOP_ERASED
+                                       : ONDISK_STOP_INVALID;
+            cur->stop_off = off;
+            return false;
+        }
+
+        lfs_size_t dsize = ondisk_tag_dsize(tag);
+        if (off + dsize > cur->block_size) {
+            cur->stop = ONDISK_STOP_OVERFLOW;
+            cur->stop_off = off;
+            return false;
+        }
+
+        ptag = tag;
+
+        if (ondisk_tag_type2(tag) == LFS_TYPE_CCRC) {
+            if (dsize < 2*sizeof(uint32_t) ||
+                    ondisk_le32(&block[off + sizeof(tag)]) != crc) {
+                cur->stop = ONDISK_STOP_BADCRC;
+                cur->stop_off = off;
+                return false;
+            }
+
+            // the next commit's valid bit is inverted by the crc tag
+            ptag ^= (lfs_tag_t)(ondisk_tag_chunk(tag) & 1U) << 31;
+
+            commit->start = start;
+            commit->end = off + dsize;
+            commit->ptag = cur->ptag;
+            commit->index = cur->commits;
+            commit->crc = crc;
+
+            cur->off = commit->end;
+            cur->ptag = ptag;
+            cur->commits += 1;
+            return true;
+        }
+
+        crc = lfs_crc(crc, &block[off + sizeof(tag)], dsize - sizeof(tag));
+        off += dsize;
+    }
+}
+
+void ondisk_tagiter_init(ondisk_tagiter_t *it,
+        const uint8_t *block, const ondisk_commit_t *commit) {
+    it->block = block;
+    it->off = commit->start;
+    it->end = commit->end;
+    it->ptag = commit->ptag;
+}
+
+bool ondisk_tagiter_next(ondisk_tagiter_t *it, ondisk_tag_t *tag) {
+    if (it->off >= it->end) {
+        return false;
+    }
+
+    lfs_tag_t t = ondisk_be32(&it->block[it->off]) ^ it->ptag;
+    tag->tag = t;
+    tag->off = it->off;
+    tag->data = &it->block[it->off + sizeof(t)];
+    tag->size = ondisk_tag_dsize(t) - sizeof(t);
+
+    it->ptag = t;
+    it->off += ondisk_tag_dsize(t);
+    return true;
+}
+
+// Indexed by type3, sparse, unnamed slots fall back to the type1 family
+static const char *const ondisk_type3_names[0x800] = {
+    [LFS_TYPE_REG]              = "reg",
+    [LFS_TYPE_DIR]              = "dir",
+    [LFS_TYPE_SUPERBLOCK]       = "superblock",
+    [LFS_TYPE_DIRSTRUCT]        = "dirstruct",
+    [LFS_TYPE_INLINESTRUCT]     = "inlinestruct",
+    [LFS_TYPE_CTZSTRUCT]        = "ctzstruct",
+    [LFS_TYPE_CREATE]           = "create",
+    [LFS_TYPE_DELETE]           = "delete",
+    [LFS_TYPE_CCRC]             = "ccrc",
+    [LFS_TYPE_CCRC + 1]         = "ccrc",
+    [LFS_TYPE_FCRC]             = "fcrc",
+    [LFS_TYPE_SOFTTAIL]         = "softtail",
+    [LFS_TYPE_HARDTAIL]         = "hardtail",
+    [LFS_TYPE_MOVESTATE]        = "movestate",
+};
+
+static const char *const ondisk_type1_names[8] = {
+    "name", "from", "struct", "userattr",
+    "splice", "crc", "tail", "globals",
+};
+
+const char *ondisk_tag_typename(lfs_tag_t tag) {
+    const char *name = ondisk_type3_names[ondisk_tag_type3(tag)];
+    return name ? name : ondisk_type1_names[ondisk_tag_type1(tag) >> 8];
+}
+
+void ondisk_mdir_init(ondisk_mdir_t *mdir) {
+    memset(mdir, 0, sizeof(*mdir));
+    mdir->tail[0] = LFS_BLOCK_NULL;
+    mdir->tail[1] = LFS_BLOCK_NULL;
+}
+
+void ondisk_mdir_free(ondisk_mdir_t *mdir) {
+    free(mdir->entries);
+    ondisk_mdir_init(mdir);
+}
+
+static int ondisk_mdir_reserve(ondisk_mdir_t *mdir, uint32_t count) {
+    if (count <= mdir->capacity) {
+        return 0;
+    }
+
+    uint32_t capacity = mdir->capacity ? mdir->capacity : 8;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    // ids are 10 bits on disk
+    capacity = lfs_min(capacity, 0x400);
+    if (count > capacity) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    ondisk_entry_t *entries = realloc(mdir->entries,
+            capacity * sizeof(ondisk_entry_t));
+    if (!entries) {
+        return LFS_ERR_NOMEM;
+    }
+
+    mdir->entries = entries;
+    mdir->capacity = capacity;
+    return 0;
+}
+
+static int ondisk_mdir_grow(ondisk_mdir_t *mdir, uint16_t id) {
+    if (id < mdir->count) {
+        return 0;
+    }
+
+    int err = ondisk_mdir_reserve(mdir, id + 1);
+    if (err) {
+        return err;
+    }
+
+    memset(&mdir->entries[mdir->count], 0,
+            (id + 1 - mdir->count) * sizeof(ondisk_entry_t));
+    mdir->count = id + 1;
+    return 0;
+}
+
+int ondisk_mdir_apply(ondisk_mdir_t *mdir, const ondisk_tag_t *tag) {
+    lfs_tag_t t = tag->tag;
+    uint16_t id = ondisk_tag_id(t);
+    int err;
+
+    switch (ondisk_tag_type1(t)) {
+        case LFS_TYPE_NAME:
+            err = ondisk_mdir_grow(mdir, id);
+            if (err) {
+                return err;
+            }
+            mdir->entries[id].type = ondisk_tag_type3(t);
+            mdir->entries[id].name = tag->data;
+            mdir->entries[id].name_len = ondisk_tag_size(t);
+            break;
+
+        case LFS_TYPE_STRUCT:
+            err = ondisk_mdir_grow(mdir, id);
+            if (err) {
+                return err;
+            }
+            mdir->entries[id].struct_type = ondisk_tag_type3(t);
+            mdir->entries[id].struct_data = tag->data;
+            mdir->entries[id].struct_size = ondisk_tag_size(t);
+            break;
+
+        case LFS_TYPE_SPLICE:
+            if (ondisk_tag_type3(t) == LFS_TYPE_CREATE) {
+                if (id > mdir->count) {
+                    return LFS_ERR_CORRUPT;
+                }
+                err = ondisk_mdir_reserve(mdir, mdir->count + 1);
+                if (err) {
+                    return err;
+                }
+                memmove(&mdir->entries[id + 1], &mdir->entries[id],
+                        (mdir->count - id) * sizeof(ondisk_entry_t));
+                memset(&mdir->entries[id], 0, sizeof(ondisk_entry_t));
+                mdir->count += 1;
+            } else if (ondisk_tag_type3(t) == LFS_TYPE_DELETE) {
+                if (id >= mdir->count) {
+                    return LFS_ERR_CORRUPT;
+                }
+                memmove(&mdir->entries[id], &mdir->entries[id + 1],
+                        (mdir->count - id - 1) * sizeof(ondisk_entry_t));
+                mdir->count -= 1;
+            }
+            break;
+
+        case LFS_TYPE_TAIL:
+            if (tag->size < 8) {
+                return LFS_ERR_CORRUPT;
+            }
+            mdir->tail[0] = ondisk_le32(&tag->data[0]);
+            mdir->tail[1] = ondisk_le32(&tag->data[4]);
+            mdir->has_tail = true;
+            mdir->split = ondisk_tag_chunk(t) & 1;
+            break;
+
+        case LFS_TYPE_GLOBALS:
+            if (tag->size >= sizeof(lfs_gstate_t)) {
+                mdir->gdelta.tag ^= ondisk_le32(&tag->data[0]);
+                mdir->gdelta.pair[0] ^= ondisk_le32(&tag->data[4]);
+                mdir->gdelta.pair[1] ^= ondisk_le32(&tag->data[8]);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+int ondisk_mdir_load(ondisk_mdir_t *mdir, ondisk_cursor_t *cur,
+        const uint8_t *block, lfs_size_t block_size) {
+    ondisk_cursor_init(cur, block, block_size);
+
+    ondisk_commit_t commit;
+    while (ondisk_next_commit(cur, &commit)) {
+        ondisk_tagiter_t it;
+        ondisk_tag_t tag;
+        ondisk_tagiter_init(&it, block, &commit);
+        while (ondisk_tagiter_next(&it, &tag)) {
+            int err = ondisk_mdir_apply(mdir, &tag);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return cur->commits;
+}
+
+bool ondisk_entry_dirpair(const ondisk_entry_t *e, lfs_block_t pair[2]) {
+    if (e->struct_type != LFS_TYPE_DIRSTRUCT || e->struct_size < 8) {
+        return false;
+    }
+    pair[0] = ondisk_le32(&e->struct_data[0]);
+    pair[1] = ondisk_le32(&e->struct_data[4]);
+    return true;
+}
+
+bool ondisk_entry_ctz(const ondisk_entry_t *e,
+        lfs_block_t *head, lfs_size_t *size) {
+    if (e->struct_type != LFS_TYPE_CTZSTRUCT || e->struct_size < 8) {
+        return false;
+    }
+    *head = ondisk_le32(&e->struct_data[0]);
+    *size = ondisk_le32(&e->struct_data[4]);
+    return true;
+}
+
+// Same arithmetic as lfs_ctz_index in lfs.c
+lfs_off_t ondisk_ctz_index(lfs_size_t block_size, lfs_off_t *off) {
+    lfs_off_t size = *off;
+    lfs_off_t b = block_size - 2*4;
+    lfs_off_t i = size / b;
+    if (i == 0) {
+        return 0;
+    }
+
+    i = (size - 4*(lfs_popc(i-1)+2)) / b;
+    *off = size - b*i - 4*lfs_popc(i);
+    return i;
+}
+
+int ondisk_ctz_walk(const uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, lfs_block_t head, lfs_size_t size,
+        ondisk_ctz_cb cb, void *data) {
+    if (size == 0) {
+        return 0;
+    }
+
+    lfs_off_t last = size - 1;
+    lfs_off_t index = ondisk_ctz_index(block_size, &last);
+
+    while (true) {
+        if (head >= block_count) {
+            return LFS_ERR_CORRUPT;
+        }
+
+        int err = cb(data, head, index);
+        if (err) {
+            return err;
+        }
+
+        if (index == 0) {
+            return 0;
+        }
+
+        // the first pointer of every block links to its predecessor
+        head = ondisk_le32(&image[(size_t)head * block_size]);
+        index -= 1;
+    }
+}
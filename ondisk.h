@@ -0,0 +1,187 @@
+/*
+ * Zero-copy helpers for reading littlefs on-disk structures straight out of
+ * an in-memory image, without going through lfs_mount.
+ *
+ * These follow the same rules as lfs_dir_fetchmatch in lfs.c, but expose
+ * every commit and tag to the caller instead of silently falling back.
+ */
+#ifndef ONDISK_H
+#define ONDISK_H
+
+#include "lfs.h"
+#include "lfs_util.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint32_t lfs_tag_t;
+
+// Same sentinels as lfs.c, which keeps them private
+#define LFS_BLOCK_NULL ((lfs_block_t)-1)
+#define LFS_BLOCK_INLINE ((lfs_block_t)-2)
+
+// Tag field accessors, mirroring the static helpers in lfs.c
+#define ONDISK_MKTAG(type, id, size) \
+    (((lfs_tag_t)(type) << 20) | ((lfs_tag_t)(id) << 10) | (lfs_tag_t)(size))
+
+static inline bool ondisk_tag_isvalid(lfs_tag_t tag) {
+    return !(tag & 0x80000000);
+}
+
+static inline bool ondisk_tag_isdelete(lfs_tag_t tag) {
+    return ((int32_t)(tag << 22) >> 22) == -1;
+}
+
+static inline uint16_t ondisk_tag_type1(lfs_tag_t tag) {
+    return (tag & 0x70000000) >> 20;
+}
+
+static inline uint16_t ondisk_tag_type2(lfs_tag_t tag) {
+    return (tag & 0x78000000) >> 20;
+}
+
+static inline uint16_t ondisk_tag_type3(lfs_tag_t tag) {
+    return (tag & 0x7ff00000) >> 20;
+}
+
+static inline uint8_t ondisk_tag_chunk(lfs_tag_t tag) {
+    return (tag & 0x0ff00000) >> 20;
+}
+
+static inline int8_t ondisk_tag_splice(lfs_tag_t tag) {
+    return (int8_t)ondisk_tag_chunk(tag);
+}
+
+static inline uint16_t ondisk_tag_id(lfs_tag_t tag) {
+    return (tag & 0x000ffc00) >> 10;
+}
+
+static inline lfs_size_t ondisk_tag_size(lfs_tag_t tag) {
+    return tag & 0x000003ff;
+}
+
+static inline lfs_size_t ondisk_tag_dsize(lfs_tag_t tag) {
+    return sizeof(tag) + ondisk_tag_size(tag + ondisk_tag_isdelete(tag));
+}
+
+static inline uint32_t ondisk_le32(const uint8_t *p) {
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t ondisk_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | ((uint32_t)p[3]);
+}
+
+// Why a commit log stopped where it did
+enum ondisk_stop {
+    ONDISK_STOP_NONE = 0,   // still walking
+    ONDISK_STOP_ERASED,     // next tag is unprogrammed, log ends cleanly
+    ONDISK_STOP_INVALID,    // next tag has the valid bit set mid-commit
+    ONDISK_STOP_OVERFLOW,   // tag size runs past the end of the block
+    ONDISK_STOP_BADCRC,     // commit crc does not match
+};
+
+// Cursor over the commits of a single metadata block
+typedef struct ondisk_cursor {
+    const uint8_t *block;
+    lfs_size_t block_size;
+    uint32_t rev;
+
+    lfs_off_t off;          // start of the next commit
+    lfs_tag_t ptag;         // xor state carried into the next commit
+    uint32_t commits;       // valid commits consumed so far
+
+    int stop;               // enum ondisk_stop once the log ends
+    lfs_off_t stop_off;     // offset of the offending tag
+} ondisk_cursor_t;
+
+// One valid commit, [start, end) includes its trailing crc tag
+typedef struct ondisk_commit {
+    lfs_off_t start;
+    lfs_off_t end;
+    lfs_tag_t ptag;
+    uint32_t index;
+    uint32_t crc;
+} ondisk_commit_t;
+
+// Iterator over the tags of one commit
+typedef struct ondisk_tagiter {
+    const uint8_t *block;
+    lfs_off_t off;
+    lfs_off_t end;
+    lfs_tag_t ptag;
+} ondisk_tagiter_t;
+
+typedef struct ondisk_tag {
+    lfs_tag_t tag;
+    lfs_off_t off;          // offset of the tag word in the block
+    const uint8_t *data;    // points into the image, size bytes long
+    lfs_size_t size;
+} ondisk_tag_t;
+
+void ondisk_cursor_init(ondisk_cursor_t *cur,
+        const uint8_t *block, lfs_size_t block_size);
+bool ondisk_next_commit(ondisk_cursor_t *cur, ondisk_commit_t *commit);
+
+void ondisk_tagiter_init(ondisk_tagiter_t *it,
+        const uint8_t *block, const ondisk_commit_t *commit);
+bool ondisk_tagiter_next(ondisk_tagiter_t *it, ondisk_tag_t *tag);
+
+// Short name of a tag's type, e.g. "ctzstruct", types littlefs doesn't
+// define fall back to the name of their type1 family
+const char *ondisk_tag_typename(lfs_tag_t tag);
+
+// Directory entries as they stand after replaying a set of commits
+typedef struct ondisk_entry {
+    uint16_t type;          // LFS_TYPE_REG, LFS_TYPE_DIR, LFS_TYPE_SUPERBLOCK
+    const uint8_t *name;
+    lfs_size_t name_len;
+    uint16_t struct_type;   // LFS_TYPE_DIRSTRUCT, CTZSTRUCT or INLINESTRUCT
+    const uint8_t *struct_data;
+    lfs_size_t struct_size;
+} ondisk_entry_t;
+
+typedef struct ondisk_mdir {
+    ondisk_entry_t *entries;
+    uint16_t count;
+    uint16_t capacity;
+
+    lfs_block_t tail[2];
+    bool has_tail;
+    bool split;
+
+    lfs_gstate_t gdelta;    // xor of every MOVESTATE seen
+} ondisk_mdir_t;
+
+void ondisk_mdir_init(ondisk_mdir_t *mdir);
+void ondisk_mdir_free(ondisk_mdir_t *mdir);
+int ondisk_mdir_apply(ondisk_mdir_t *mdir, const ondisk_tag_t *tag);
+
+// Replays every valid commit of a block, returns the number of commits,
+// the cursor is left at the end of the log for inspection
+int ondisk_mdir_load(ondisk_mdir_t *mdir, ondisk_cursor_t *cur,
+        const uint8_t *block, lfs_size_t block_size);
+
+// Decoded struct attributes, false if the entry does not carry that kind
+bool ondisk_entry_dirpair(const ondisk_entry_t *e, lfs_block_t pair[2]);
+bool ondisk_entry_ctz(const ondisk_entry_t *e,
+        lfs_block_t *head, lfs_size_t *size);
+
+// Walks a CTZ skip-list from its head back to the first block, calling cb
+// with each block and its index in the file. Stops early on a nonzero
+// return from cb, or returns LFS_ERR_CORRUPT on an out of range pointer.
+typedef int (*ondisk_ctz_cb)(void *data, lfs_block_t block, lfs_off_t index);
+
+lfs_off_t ondisk_ctz_index(lfs_size_t block_size, lfs_off_t *off);
+int ondisk_ctz_walk(const uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, lfs_block_t head, lfs_size_t size,
+        ondisk_ctz_cb cb, void *data);
+
+// Bytes of skip-list pointers at the start of a CTZ block, file data
+// follows them
+static inline lfs_off_t ondisk_ctz_skip(lfs_off_t index) {
+    return index ? 4*(lfs_ctz(index) + 1) : 0;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * Minimal pthread work splitter for scans over every block of an image
+ */
+#include "parallel.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct parallel_job {
+    size_t count;
+    size_t grain;
+    size_t next;
+    parallel_fn fn;
+    void *data;
+};
+
+int parallel_threads(void) {
+    const char *env = getenv("LFS_THREADS");
+    if (env && atoi(env) > 0) {
+        return atoi(env);
+    }
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+static void *parallel_worker(void *arg) {
+    struct parallel_job *job = arg;
+
+    while (true) {
+        size_t begin = __atomic_fetch_add(&job->next, job->grain,
+                __ATOMIC_RELAXED);
+        if (begin >= job->count) {
+            break;
+        }
+
+        size_t end = begin + job->grain;
+        if (end > job->count) {
+            end = job->count;
+        }
+        job->fn(job->data, begin, end);
+    }
+
+    return NULL;
+}
+
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void *data) {
+    if (count == 0) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    struct parallel_job job = {count, grain, 0, fn, data};
+
+    size_t nthreads = parallel_threads();
+    size_t chunks = (count + grain - 1) / grain;
+    if (nthreads > chunks) {
+        nthreads = chunks;
+    }
+
+    pthread_t *threads = malloc(nthreads * sizeof(pthread_t));
+    size_t started = 0;
+    if (threads) {
+        // the calling thread acts as worker 0
+        for (size_t i = 1; i < nthreads; i++) {
+            if (pthread_create(&threads[started], NULL,
+                    parallel_worker, &job) != 0) {
+                break;
+            }
+            started++;
+        }
+    }
+
+    parallel_worker(&job);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
@@ -0,0 +1,20 @@
+/*
+ * Minimal pthread work splitter for scans over every block of an image
+ */
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+// Called with a half-open range [begin, end) of work items
+typedef void (*parallel_fn)(void *data, size_t begin, size_t end);
+
+// Number of worker threads, from LFS_THREADS or the online cpu count
+int parallel_threads(void);
+
+// Runs fn over [0, count) in chunks of grain items across the worker
+// threads and waits for all of them to finish. Falls back to running
+// inline if threads can't be created.
+void parallel_for(size_t count, size_t grain, parallel_fn fn, void *data);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Finding littlefs partitions in full-flash dumps
+ */
+#include "partition.h"
+#include "ondisk.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+
+// offsets per work item of the magic scan, each check is a few loads
+#define PARTITION_GRAIN 65536
+
+// bytes a superblock needs before its log can be replayed: revision,
+// name tag, name, struct tag, struct
+#define PARTITION_HEADER 44
+
+struct partition_candidate {
+    uint64_t offset;
+    bool valid;
+    uint32_t rev;
+    uint8_t sb[24];         // inline struct as of the last commit
+};
+
+struct partition_job {
+    const uint8_t *image;
+    size_t size;
+    size_t align;
+    uint8_t *hits;
+    struct partition_candidate *cands;
+};
+
+// The first tag of a commit is stored xored with 0xffffffff, big-endian
+static bool partition_magic(const uint8_t *p) {
+    if (memcmp(&p[8], "littlefs", 8) != 0) {
+        return false;
+    }
+    lfs_tag_t tag = ondisk_be32(&p[4]) ^ 0xffffffff;
+    return ondisk_tag_isvalid(tag) &&
+            ondisk_tag_type3(tag) == LFS_TYPE_SUPERBLOCK &&
+            ondisk_tag_size(tag) == 8;
+}
+
+static void partition_find(void *data, size_t begin, size_t end) {
+    struct partition_job *job = data;
+    for (size_t i = begin; i < end; i++) {
+        job->hits[i] = partition_magic(&job->image[i * job->align]);
+    }
+}
+
+// Replays the candidate's log with the block size it claims, a real
+// superblock has at least one commit whose crc checks out
+static void partition_check(const struct partition_job *job,
+        struct partition_candidate *c) {
+    const uint8_t *p = &job->image[c->offset];
+    lfs_tag_t tag = ondisk_be32(&p[4]) ^ 0xffffffff;
+    lfs_tag_t next = ondisk_be32(&p[16]) ^ tag;
+    if (!ondisk_tag_isvalid(next) ||
+            ondisk_tag_type3(next) != LFS_TYPE_INLINESTRUCT ||
+            ondisk_tag_size(next) < 24) {
+        return;
+    }
+
+    lfs_size_t block_size = ondisk_le32(&p[24]);
+    if (block_size < 128 || block_size > job->size - c->offset) {
+        return;
+    }
+
+    ondisk_mdir_t mdir;
+    ondisk_cursor_t cur;
+    ondisk_mdir_init(&mdir);
+    if (ondisk_mdir_load(&mdir, &cur, p, block_size) > 0) {
+        for (uint16_t id = 0; id < mdir.count; id++) {
+            const ondisk_entry_t *e = &mdir.entries[id];
+            if (e->type == LFS_TYPE_SUPERBLOCK &&
+                    e->struct_type == LFS_TYPE_INLINESTRUCT &&
+                    e->struct_size >= 24 &&
+                    ondisk_le32(&e->struct_data[4]) == block_size &&
+                    ondisk_le32(&e->struct_data[8]) > 0) {
+                memcpy(c->sb, e->struct_data, sizeof(c->sb));
+                c->rev = cur.rev;
+                c->valid = true;
+                break;
+            }
+        }
+    }
+    ondisk_mdir_free(&mdir);
+}
+
+static void partition_check_range(void *data, size_t begin, size_t end) {
+    struct partition_job *job = data;
+    for (size_t i = begin; i < end; i++) {
+        partition_check(job, &job->cands[i]);
+    }
+}
+
+// True if the block before candidate i is the partition's block 0: a
+// metadata log, or a superblock too damaged to check out
+static bool partition_follows_block0(const struct partition_job *job,
+        size_t i, lfs_size_t block_size) {
+    uint64_t off = job->cands[i].offset;
+    if (off < block_size) {
+        return false;
+    }
+    off -= block_size;
+    for (size_t j = i; j-- > 0 && job->cands[j].offset >= off; ) {
+        if (job->cands[j].offset == off) {
+            return true;
+        }
+    }
+
+    ondisk_mdir_t mdir;
+    ondisk_cursor_t cur;
+    ondisk_mdir_init(&mdir);
+    int commits = ondisk_mdir_load(&mdir, &cur, &job->image[off],
+            block_size);
+    ondisk_mdir_free(&mdir);
+    return commits > 0;
+}
+
+static int partition_cmp(const void *a, const void *b) {
+    const partition_t *pa = a;
+    const partition_t *pb = b;
+    return (pa->offset > pb->offset) - (pa->offset < pb->offset);
+}
+
+int partition_scan(const uint8_t *image, size_t size, size_t align,
+        partition_t **parts, size_t *count) {
+    *parts = NULL;
+    *count = 0;
+    if (size < PARTITION_HEADER) {
+        return 0;
+    }
+
+    size_t offsets = (size - PARTITION_HEADER) / align + 1;
+    struct partition_job job = {image, size, align, NULL, NULL};
+    job.hits = malloc(offsets);
+    if (!job.hits) {
+        return LFS_ERR_NOMEM;
+    }
+    parallel_for(offsets, PARTITION_GRAIN, partition_find, &job);
+
+    size_t cand_count = 0;
+    for (size_t i = 0; i < offsets; i++) {
+        cand_count += job.hits[i];
+    }
+    job.cands = calloc(cand_count ? cand_count : 1,
+            sizeof(struct partition_candidate));
+    partition_t *out = malloc((cand_count ? cand_count : 1) *
+            sizeof(partition_t));
+    if (!job.cands || !out) {
+        free(job.hits);
+        free(job.cands);
+        free(out);
+        return LFS_ERR_NOMEM;
+    }
+    for (size_t i = 0, j = 0; i < offsets; i++) {
+        if (job.hits[i]) {
+            job.cands[j++].offset = (uint64_t)i * align;
+        }
+    }
+    free(job.hits);
+    parallel_for(cand_count, 1, partition_check_range, &job);
+
+    // candidates are in offset order, a partition's block 1 follows its
+    // block 0 with the same block size
+    size_t n = 0;
+    for (size_t i = 0; i < cand_count; i++) {
+        struct partition_candidate *c = &job.cands[i];
+        if (!c->valid) {
+            continue;
+        }
+
+        lfs_size_t block_size = ondisk_le32(&c->sb[4]);
+        struct partition_candidate *pair = NULL;
+        for (size_t j = i + 1; j < cand_count &&
+                job.cands[j].offset <= c->offset + block_size; j++) {
+            if (job.cands[j].valid &&
+                    job.cands[j].offset == c->offset + block_size &&
+                    ondisk_le32(&job.cands[j].sb[4]) == block_size) {
+                pair = &job.cands[j];
+                break;
+            }
+        }
+
+        partition_t *p = &out[n++];
+        const struct partition_candidate *newer = c;
+        p->offset = c->offset;
+        p->superblocks = 1;
+        if (pair) {
+            pair->valid = false;
+            p->superblocks = 2;
+            if ((int32_t)(pair->rev - c->rev) > 0) {
+                newer = pair;
+            }
+        } else if (partition_follows_block0(&job, i, block_size)) {
+            p->offset = c->offset - block_size;
+        }
+
+        p->version = ondisk_le32(&newer->sb[0]);
+        p->block_size = block_size;
+        p->block_count = ondisk_le32(&newer->sb[8]);
+        p->name_max = ondisk_le32(&newer->sb[12]);
+        p->file_max = ondisk_le32(&newer->sb[16]);
+        p->attr_max = ondisk_le32(&newer->sb[20]);
+        p->revision = newer->rev;
+    }
+    free(job.cands);
+
+    // a littlefs image kept as a file shows up inside its host partition
+    qsort(out, n, sizeof(partition_t), partition_cmp);
+    for (size_t i = 0; i < n; i++) {
+        out[i].truncated = out[i].offset + partition_extent(&out[i]) > size;
+        out[i].inside = -1;
+        for (size_t j = 0; j < i; j++) {
+            if (out[i].offset < out[j].offset + partition_extent(&out[j])) {
+                out[i].inside = j;
+                break;
+            }
+        }
+    }
+
+    *parts = out;
+    *count = n;
+    return 0;
+}
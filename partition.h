@@ -0,0 +1,50 @@
+/*
+ * Finding littlefs partitions in full-flash dumps
+ *
+ * A dump of a whole SPI flash holds a bootloader, firmware slots and
+ * other partitions, with littlefs somewhere among them. Every littlefs
+ * superblock starts the same way: a revision count, a superblock tag
+ * and the name "littlefs" at byte 8, followed by an inline struct with
+ * the version, block size and block count. Every aligned offset is
+ * checked for that, in parallel, and each hit is confirmed by replaying
+ * its metadata log with the block size it claims.
+ *
+ * Blocks 0 and 1 of a partition both hold the superblock, so two
+ * agreeing superblocks a block apart mark a partition's start. A lone
+ * one is block 0 unless the block before it is a metadata log as well,
+ * or a superblock that no longer checks out, which makes it block 1.
+ * The newer of the two superblocks gives the geometry, and with it the
+ * partition's extent.
+ */
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "lfs.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef struct partition {
+    uint64_t offset;        // of block 0 in the dump
+    uint32_t version;       // on-disk version, major in the top 16 bits
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+    lfs_size_t name_max;
+    lfs_size_t file_max;
+    lfs_size_t attr_max;
+    uint32_t revision;      // of the newer superblock
+    int superblocks;        // 1 or 2 found
+    bool truncated;         // extends past the end of the dump
+    int inside;             // index of a partition this one lies in, or -1
+} partition_t;
+
+// Scans every offset that is a multiple of align. Returns 0 or
+// LFS_ERR_NOMEM, *parts is in offset order and is freed by the caller.
+int partition_scan(const uint8_t *image, size_t size, size_t align,
+        partition_t **parts, size_t *count);
+
+static inline uint64_t partition_extent(const partition_t *p) {
+    return (uint64_t)p->block_size * p->block_count;
+}
+
+#endif
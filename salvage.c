@@ -0,0 +1,681 @@
+/*
+ * Salvage scan for images that fail to mount
+ */
+#include "salvage.h"
+#include "blockcache.h"
+#include "parallel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SALVAGE_GRAIN 64
+
+static void salvage_scan_range(void *data, size_t begin, size_t end) {
+    salvage_t *s = data;
+
+    for (size_t i = begin; i < end; i++) {
+        const uint8_t *block = &s->image[i * s->block_size];
+        salvage_block_t *b = &s->blocks[i];
+
+        ondisk_mdir_init(&b->mdir);
+        b->partner = LFS_BLOCK_NULL;
+
+        // logs are always parsed, their entries point into the image
+        blockcache_facts_t *facts = s->cache ? &s->cache->facts[i] : NULL;
+        if (facts && (facts->flags & BLOCKCACHE_SCANNED) &&
+                !(facts->flags & BLOCKCACHE_LOG)) {
+            b->stop = facts->stop;
+            b->stop_off = facts->stop_off;
+            continue;
+        }
+
+        // an erased revision followed by an erased tag is never a log,
+        // it ends where a parse would, at its first tag
+        if (ondisk_le32(&block[0]) == 0xffffffff &&
+                ondisk_le32(&block[4]) == 0xffffffff) {
+            b->stop = ONDISK_STOP_ERASED;
+            b->stop_off = 0;
+            if (facts) {
+                facts->flags |= BLOCKCACHE_SCANNED;
+                facts->stop = ONDISK_STOP_ERASED;
+                facts->stop_off = 0;
+            }
+            continue;
+        }
+
+        ondisk_cursor_t cur;
+        ondisk_mdir_load(&b->mdir, &cur, block, s->block_size);
+        b->stop = cur.stop;
+        b->stop_off = cur.stop_off;
+        if (facts) {
+            facts->flags |= BLOCKCACHE_SCANNED |
+                    ((cur.commits > 0) ? BLOCKCACHE_LOG : 0);
+            facts->stop = cur.stop;
+            facts->stop_off = cur.stop_off;
+        }
+        if (cur.commits == 0) {
+            ondisk_mdir_free(&b->mdir);
+            continue;
+        }
+
+        b->state = SALVAGE_ACTIVE;
+        b->rev = cur.rev;
+        b->commits = cur.commits;
+        b->off = cur.off;
+    }
+}
+
+lfs_block_t salvage_resolve(const salvage_t *s, const lfs_block_t pair[2]) {
+    lfs_block_t best = LFS_BLOCK_NULL;
+
+    for (int i = 0; i < 2; i++) {
+        if (pair[i] >= s->block_count ||
+                s->blocks[pair[i]].state == SALVAGE_NONE) {
+            continue;
+        }
+        if (best == LFS_BLOCK_NULL ||
+                lfs_scmp(s->blocks[pair[i]].rev, s->blocks[best].rev) > 0) {
+            best = pair[i];
+        }
+    }
+
+    return best;
+}
+
+static void salvage_link(salvage_t *s, const lfs_block_t pair[2]) {
+    for (int i = 0; i < 2; i++) {
+        if (pair[i] < s->block_count) {
+            s->blocks[pair[i]].referenced = true;
+        }
+    }
+
+    lfs_block_t winner = salvage_resolve(s, pair);
+    if (winner == LFS_BLOCK_NULL) {
+        return;
+    }
+
+    lfs_block_t other = (winner == pair[0]) ? pair[1] : pair[0];
+    s->blocks[winner].partner = other;
+    if (other < s->block_count && other != winner) {
+        s->blocks[other].partner = winner;
+        if (s->blocks[other].state != SALVAGE_NONE) {
+            s->blocks[other].state = SALVAGE_STALE;
+        }
+    }
+}
+
+// Links every pair referenced by candidate blocks, or only by the trusted
+// ones if given
+static void salvage_link_all(salvage_t *s, const bool *trusted) {
+    static const lfs_block_t root[2] = {0, 1};
+    if (s->block_count >= 2) {
+        salvage_link(s, root);
+    }
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_NONE || (trusted && !trusted[i])) {
+            continue;
+        }
+
+        for (uint16_t id = 0; id < b->mdir.count; id++) {
+            lfs_block_t pair[2];
+            if (ondisk_entry_dirpair(&b->mdir.entries[id], pair)) {
+                salvage_link(s, pair);
+            }
+        }
+        if (b->mdir.has_tail) {
+            salvage_link(s, b->mdir.tail);
+        }
+    }
+}
+
+struct salvage_key {
+    lfs_block_t lo, hi;
+    lfs_block_t block;
+    bool referenced;
+    uint32_t rev;
+};
+
+static int salvage_key_cmp(const void *a, const void *b) {
+    const struct salvage_key *ka = a;
+    const struct salvage_key *kb = b;
+    if (ka->lo != kb->lo) {
+        return (ka->lo < kb->lo) ? -1 : 1;
+    }
+    if (ka->hi != kb->hi) {
+        return (ka->hi < kb->hi) ? -1 : 1;
+    }
+    // referenced blocks first, then newest revision first
+    if (ka->referenced != kb->referenced) {
+        return ka->referenced ? -1 : 1;
+    }
+    int d = lfs_scmp(kb->rev, ka->rev);
+    return (d > 0) - (d < 0);
+}
+
+static int salvage_add_key(struct salvage_key **keys, size_t *count,
+        size_t *capacity, const lfs_block_t pair[2],
+        lfs_block_t block, const salvage_block_t *b) {
+    if (*count == *capacity) {
+        size_t ncapacity = *capacity ? 2 * *capacity : 64;
+        struct salvage_key *nkeys = realloc(*keys,
+                ncapacity * sizeof(struct salvage_key));
+        if (!nkeys) {
+            return LFS_ERR_NOMEM;
+        }
+        *keys = nkeys;
+        *capacity = ncapacity;
+    }
+
+    struct salvage_key *k = &(*keys)[(*count)++];
+    k->lo = lfs_min(pair[0], pair[1]);
+    k->hi = lfs_max(pair[0], pair[1]);
+    k->block = block;
+    k->referenced = b->referenced;
+    k->rev = b->rev;
+    return 0;
+}
+
+// Pairs aren't linked on disk, so two unreferenced blocks pointing at the
+// same child or tail are taken to be old and new halves of one pair
+static int salvage_dedupe(salvage_t *s) {
+    struct salvage_key *keys = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    int err = 0;
+
+    for (lfs_block_t i = 0; i < s->block_count && !err; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state != SALVAGE_ACTIVE) {
+            continue;
+        }
+
+        for (uint16_t id = 0; id < b->mdir.count && !err; id++) {
+            lfs_block_t pair[2];
+            if (ondisk_entry_dirpair(&b->mdir.entries[id], pair)) {
+                err = salvage_add_key(&keys, &count, &capacity, pair, i, b);
+            }
+        }
+        if (b->mdir.has_tail && !err) {
+            err = salvage_add_key(&keys, &count, &capacity,
+                    b->mdir.tail, i, b);
+        }
+    }
+
+    if (!err && count) {
+        qsort(keys, count, sizeof(struct salvage_key), salvage_key_cmp);
+        for (size_t i = 1; i < count; i++) {
+            if (keys[i].lo == keys[i-1].lo && keys[i].hi == keys[i-1].hi &&
+                    keys[i].block != keys[i-1].block &&
+                    !s->blocks[keys[i].block].referenced) {
+                s->blocks[keys[i].block].state = SALVAGE_STALE;
+                // carry the winner forward so ties chain correctly
+                keys[i] = keys[i-1];
+            }
+        }
+    }
+
+    free(keys);
+    return err;
+}
+
+static bool salvage_share_entry(const ondisk_mdir_t *a,
+        const ondisk_mdir_t *b) {
+    for (uint16_t i = 0; i < a->count; i++) {
+        const ondisk_entry_t *ea = &a->entries[i];
+        if (ea->type != LFS_TYPE_REG && ea->type != LFS_TYPE_DIR) {
+            continue;
+        }
+        for (uint16_t j = 0; j < b->count; j++) {
+            const ondisk_entry_t *eb = &b->entries[j];
+            if (eb->type == ea->type && eb->name_len == ea->name_len &&
+                    memcmp(eb->name, ea->name, ea->name_len) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+struct salvage_orphan {
+    uint32_t rev;
+    lfs_block_t block;
+};
+
+static int salvage_orphan_cmp(const void *a, const void *b) {
+    const struct salvage_orphan *oa = a;
+    const struct salvage_orphan *ob = b;
+    if (oa->rev != ob->rev) {
+        return (oa->rev < ob->rev) ? -1 : 1;
+    }
+    return (oa->block > ob->block) - (oa->block < ob->block);
+}
+
+// With their parent lost, nothing names the two halves of a detached
+// pair. A compaction moves the log to the other half with the next
+// revision, so an orphan whose revision is one below another's, and that
+// holds an entry of the same name, is taken as the older half.
+static int salvage_pair_orphans(salvage_t *s) {
+    struct salvage_orphan *orphans = malloc(
+            (s->block_count ? s->block_count : 1) *
+            sizeof(struct salvage_orphan));
+    if (!orphans) {
+        return LFS_ERR_NOMEM;
+    }
+
+    size_t count = 0;
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_ACTIVE && !b->referenced &&
+                b->partner == LFS_BLOCK_NULL) {
+            orphans[count].rev = b->rev;
+            orphans[count].block = i;
+            count += 1;
+        }
+    }
+    qsort(orphans, count, sizeof(struct salvage_orphan), salvage_orphan_cmp);
+
+    for (size_t i = 0; i < count; i++) {
+        salvage_block_t *older = &s->blocks[orphans[i].block];
+        if (older->partner != LFS_BLOCK_NULL) {
+            continue;
+        }
+
+        // first orphan with the next revision, which wraps to 0
+        uint32_t next = orphans[i].rev + 1;
+        size_t lo = 0;
+        size_t hi = count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (orphans[mid].rev < next) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        for (size_t k = lo; k < count && orphans[k].rev == next; k++) {
+            salvage_block_t *newer = &s->blocks[orphans[k].block];
+            if (newer->partner != LFS_BLOCK_NULL ||
+                    !salvage_share_entry(&older->mdir, &newer->mdir)) {
+                continue;
+            }
+
+            older->state = SALVAGE_STALE;
+            older->partner = orphans[k].block;
+            newer->partner = orphans[i].block;
+            break;
+        }
+    }
+
+    free(orphans);
+    return 0;
+}
+
+int salvage_scan(salvage_t *s, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count) {
+    return salvage_scan_cached(s, image, block_size, block_count, NULL);
+}
+
+int salvage_scan_cached(salvage_t *s, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count,
+        struct blockcache *cache) {
+    memset(s, 0, sizeof(*s));
+    s->image = image;
+    s->block_size = block_size;
+    s->block_count = block_count;
+    s->root = LFS_BLOCK_NULL;
+    s->cache = cache;
+
+    s->blocks = calloc(block_count, sizeof(salvage_block_t));
+    if (!s->blocks) {
+        return LFS_ERR_NOMEM;
+    }
+
+    parallel_for(block_count, SALVAGE_GRAIN, salvage_scan_range, s);
+
+    // first pass links pairs named anywhere, the second only trusts
+    // references from blocks that survived the first pass, so stale logs
+    // naming since-relocated pairs don't knock out live ones
+    salvage_link_all(s, NULL);
+
+    bool *trusted = calloc(block_count, sizeof(bool));
+    if (!trusted) {
+        return LFS_ERR_NOMEM;
+    }
+
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        salvage_block_t *b = &s->blocks[i];
+        trusted[i] = (b->state == SALVAGE_ACTIVE);
+        if (b->state != SALVAGE_NONE) {
+            b->state = SALVAGE_ACTIVE;
+        }
+        b->referenced = false;
+        b->partner = LFS_BLOCK_NULL;
+    }
+
+    salvage_link_all(s, trusted);
+    free(trusted);
+
+    int err = salvage_dedupe(s);
+    if (!err) {
+        err = salvage_pair_orphans(s);
+    }
+    if (err) {
+        return err;
+    }
+
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_NONE) {
+            continue;
+        }
+
+        s->candidates += 1;
+        if (b->state == SALVAGE_ACTIVE) {
+            s->active += 1;
+            s->gstate.tag ^= b->mdir.gdelta.tag;
+            s->gstate.pair[0] ^= b->mdir.gdelta.pair[0];
+            s->gstate.pair[1] ^= b->mdir.gdelta.pair[1];
+        }
+    }
+
+    if (block_count >= 2) {
+        s->root = salvage_resolve(s, (lfs_block_t[2]){0, 1});
+    }
+
+    return 0;
+}
+
+void salvage_free(salvage_t *s) {
+    if (s->blocks) {
+        for (lfs_block_t i = 0; i < s->block_count; i++) {
+            ondisk_mdir_free(&s->blocks[i].mdir);
+        }
+    }
+    free(s->blocks);
+    s->blocks = NULL;
+}
+
+struct salvage_walker {
+    salvage_t *s;
+    salvage_cb cb;
+    void *data;
+    bool detached;
+    char path[1024];
+};
+
+static void salvage_walk_dir(struct salvage_walker *w,
+        lfs_block_t block, size_t len) {
+    salvage_t *s = w->s;
+
+    while (block != LFS_BLOCK_NULL && !s->blocks[block].visited) {
+        salvage_block_t *b = &s->blocks[block];
+        b->visited = true;
+
+        for (uint16_t id = 0; id < b->mdir.count; id++) {
+            const ondisk_entry_t *e = &b->mdir.entries[id];
+            if (e->type != LFS_TYPE_REG && e->type != LFS_TYPE_DIR) {
+                continue;
+            }
+
+            size_t nlen = snprintf(&w->path[len], sizeof(w->path) - len,
+                    "%s%.*s", (len > 1) ? "/" : "",
+                    (int)lfs_min(e->name_len, LFS_NAME_MAX), e->name);
+            nlen = lfs_min(len + nlen, sizeof(w->path) - 1);
+
+            salvage_info_t info = {
+                .path = w->path,
+                .type = e->type,
+                .entry = e,
+                .mdir = block,
+                .detached = w->detached,
+            };
+            w->cb(w->data, &info);
+
+            lfs_block_t pair[2];
+            if (e->type == LFS_TYPE_DIR && ondisk_entry_dirpair(e, pair)) {
+                salvage_walk_dir(w, salvage_resolve(s, pair), nlen);
+            }
+            w->path[len] = '\0';
+        }
+
+        if (!b->mdir.has_tail || !b->mdir.split) {
+            break;
+        }
+        block = salvage_resolve(s, b->mdir.tail);
+    }
+}
+
+static void salvage_walk_root(struct salvage_walker *w, lfs_block_t block) {
+    size_t len = strlen(w->path);
+    salvage_info_t info = {
+        .path = w->path,
+        .type = LFS_TYPE_DIR,
+        .entry = NULL,
+        .mdir = block,
+        .detached = w->detached,
+    };
+    w->cb(w->data, &info);
+    salvage_walk_dir(w, block, len);
+}
+
+void salvage_walk(salvage_t *s, salvage_cb cb, void *data) {
+    struct salvage_walker w = {.s = s, .cb = cb, .data = data};
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        s->blocks[i].visited = false;
+    }
+
+    if (s->root != LFS_BLOCK_NULL) {
+        strcpy(w.path, "/");
+        salvage_walk_root(&w, s->root);
+    }
+
+    // anything still unvisited is detached, start from blocks nothing
+    // else points at, then pick up whatever is left over (cycles)
+    bool *has_parent = calloc(s->block_count, sizeof(bool));
+    if (!has_parent) {
+        return;
+    }
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state != SALVAGE_ACTIVE || b->visited) {
+            continue;
+        }
+
+        for (uint16_t id = 0; id < b->mdir.count; id++) {
+            lfs_block_t pair[2];
+            if (ondisk_entry_dirpair(&b->mdir.entries[id], pair)) {
+                lfs_block_t child = salvage_resolve(s, pair);
+                if (child != LFS_BLOCK_NULL && child != i) {
+                    has_parent[child] = true;
+                }
+            }
+        }
+        if (b->mdir.has_tail && b->mdir.split) {
+            lfs_block_t next = salvage_resolve(s, b->mdir.tail);
+            if (next != LFS_BLOCK_NULL && next != i) {
+                has_parent[next] = true;
+            }
+        }
+    }
+
+    w.detached = true;
+    bool announced = false;
+    for (int pass = 0; pass < 2; pass++) {
+        for (lfs_block_t i = 0; i < s->block_count; i++) {
+            const salvage_block_t *b = &s->blocks[i];
+            if (b->state != SALVAGE_ACTIVE || b->visited ||
+                    (pass == 0 && has_parent[i])) {
+                continue;
+            }
+
+            if (!announced) {
+                strcpy(w.path, "/lost+found");
+                salvage_info_t info = {
+                    .path = w.path,
+                    .type = LFS_TYPE_DIR,
+                    .mdir = LFS_BLOCK_NULL,
+                    .detached = true,
+                };
+                cb(data, &info);
+                announced = true;
+            }
+
+            snprintf(w.path, sizeof(w.path), "/lost+found/mdir_%"PRIu32, i);
+            salvage_walk_root(&w, i);
+        }
+    }
+
+    free(has_parent);
+}
+
+struct salvage_paths {
+    salvage_t *s;
+    char **paths;
+};
+
+static void salvage_set_path(struct salvage_paths *p, lfs_block_t block,
+        const char *path, size_t len) {
+    if (block >= p->s->block_count || p->paths[block]) {
+        return;
+    }
+
+    p->paths[block] = malloc(len + 1);
+    if (p->paths[block]) {
+        memcpy(p->paths[block], path, len);
+        p->paths[block][len] = '\0';
+    }
+}
+
+static void salvage_collect_path(void *data, const salvage_info_t *info) {
+    struct salvage_paths *p = data;
+
+    if (!info->entry) {
+        // synthesized directory, owns its own first block
+        salvage_set_path(p, info->mdir, info->path, strlen(info->path));
+        return;
+    }
+
+    // the mdir holding an entry belongs to the entry's parent directory
+    const char *slash = strrchr(info->path, '/');
+    size_t len = (slash && slash != info->path)
+            ? (size_t)(slash - info->path) : 1;
+    salvage_set_path(p, info->mdir, info->path, len);
+
+    lfs_block_t pair[2];
+    if (ondisk_entry_dirpair(info->entry, pair)) {
+        salvage_set_path(p, salvage_resolve(p->s, pair),
+                info->path, strlen(info->path));
+    }
+}
+
+char **salvage_dir_paths(salvage_t *s) {
+    struct salvage_paths p = {s, calloc(s->block_count, sizeof(char *))};
+    if (!p.paths) {
+        return NULL;
+    }
+
+    salvage_walk(s, salvage_collect_path, &p);
+
+    // the older half of a pair belongs to the same directory
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_ACTIVE && b->partner < s->block_count &&
+                p.paths[i]) {
+            salvage_set_path(&p, b->partner, p.paths[i], strlen(p.paths[i]));
+        }
+    }
+
+    return p.paths;
+}
+
+void salvage_free_paths(const salvage_t *s, char **paths) {
+    if (!paths) {
+        return;
+    }
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+struct salvage_marker {
+    salvage_t *s;
+    bool *usage;
+};
+
+static int salvage_mark_ctz(void *data, lfs_block_t block, lfs_off_t index) {
+    (void)index;
+    bool *usage = data;
+    usage[block] = true;
+    return 0;
+}
+
+static void salvage_mark_entry(void *data, const salvage_info_t *info) {
+    struct salvage_marker *m = data;
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (info->entry && ondisk_entry_ctz(info->entry, &head, &size)) {
+        ondisk_ctz_walk(m->s->image, m->s->block_size, m->s->block_count,
+                head, size, salvage_mark_ctz, m->usage);
+    }
+}
+
+void salvage_mark_used(salvage_t *s, bool *usage) {
+    struct salvage_marker m = {s, usage};
+    salvage_walk(s, salvage_mark_entry, &m);
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        if (b->state == SALVAGE_ACTIVE) {
+            usage[i] = true;
+            if (b->partner < s->block_count) {
+                usage[b->partner] = true;
+            }
+        }
+    }
+}
+
+void salvage_print_summary(const salvage_t *s, FILE *out) {
+    fprintf(out, "Salvage scan:\n");
+    fprintf(out, "  Metadata candidates: %"PRIu32" (%"PRIu32" active, "
+            "%"PRIu32" stale)\n",
+            s->candidates, s->active, s->candidates - s->active);
+
+    if (s->root == LFS_BLOCK_NULL) {
+        fprintf(out, "  Root pair {0, 1}: lost\n");
+        return;
+    }
+
+    fprintf(out, "  Root pair {0, 1}: block %"PRIu32" (rev %"PRIu32")\n",
+            s->root, s->blocks[s->root].rev);
+
+    // rebuild the threaded tail list starting from the root
+    fprintf(out, "  Tail chain: %"PRIu32, s->root);
+    lfs_block_t block = s->root;
+    for (lfs_size_t steps = 0; ; steps++) {
+        const salvage_block_t *b = &s->blocks[block];
+        if (!b->mdir.has_tail || b->mdir.tail[0] == LFS_BLOCK_NULL) {
+            fprintf(out, " (end)\n");
+            break;
+        }
+
+        lfs_block_t next = salvage_resolve(s, b->mdir.tail);
+        if (next == LFS_BLOCK_NULL) {
+            fprintf(out, " -> {%"PRIu32", %"PRIu32"} (broken)\n",
+                    b->mdir.tail[0], b->mdir.tail[1]);
+            break;
+        }
+        if (steps >= s->active || next == s->root) {
+            fprintf(out, " -> %"PRIu32" (cycle)\n", next);
+            break;
+        }
+
+        fprintf(out, " %s %"PRIu32, b->mdir.split ? "=>" : "->", next);
+        block = next;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * Salvage scan for images that fail to mount
+ *
+ * Every block is checked in parallel for a valid metadata log, the
+ * highest-revision half of each pair is kept, and the directory tree is
+ * rebuilt from DIRSTRUCT and tail tags alone. Nothing here depends on the
+ * superblock in blocks 0/1 being intact; directories that can't be reached
+ * from the root are reported as detached subtrees under /lost+found.
+ */
+#ifndef SALVAGE_H
+#define SALVAGE_H
+
+#include "lfs.h"
+#include "ondisk.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+enum salvage_state {
+    SALVAGE_NONE = 0,       // no valid metadata log in this block
+    SALVAGE_ACTIVE,         // newest half of its pair, used for the tree
+    SALVAGE_STALE,          // superseded by a newer revision
+};
+
+typedef struct salvage_block {
+    int state;
+    uint32_t rev;
+    uint32_t commits;
+    lfs_off_t off;          // end of the last valid commit
+    int stop;               // enum ondisk_stop, why the log ended
+    lfs_off_t stop_off;
+    ondisk_mdir_t mdir;
+
+    lfs_block_t partner;    // other half of the pair, LFS_BLOCK_NULL if unknown
+    bool referenced;        // named by a DIRSTRUCT, tail or the root pair
+    bool visited;
+} salvage_block_t;
+
+typedef struct salvage {
+    const uint8_t *image;
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+
+    salvage_block_t *blocks;
+    lfs_size_t candidates;
+    lfs_size_t active;
+    lfs_block_t root;       // active block of pair {0,1}, LFS_BLOCK_NULL if lost
+    lfs_gstate_t gstate;
+
+    struct blockcache *cache;   // optional, see salvage_scan_cached
+} salvage_t;
+
+typedef struct salvage_info {
+    const char *path;
+    uint16_t type;                  // LFS_TYPE_REG or LFS_TYPE_DIR
+    const ondisk_entry_t *entry;    // NULL for synthesized directories
+    lfs_block_t mdir;               // metadata block holding the entry
+    bool detached;
+} salvage_info_t;
+
+typedef void (*salvage_cb)(void *data, const salvage_info_t *info);
+
+int salvage_scan(salvage_t *s, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count);
+
+// Same, but blocks the cache knows hold no metadata log are not parsed
+// again, and what the scan learns about the others is added to it. The
+// cache may be NULL, and must outlive the scan.
+int salvage_scan_cached(salvage_t *s, const uint8_t *image,
+        lfs_size_t block_size, lfs_size_t block_count,
+        struct blockcache *cache);
+void salvage_free(salvage_t *s);
+
+// Returns the active block of a pair, or LFS_BLOCK_NULL
+lfs_block_t salvage_resolve(const salvage_t *s, const lfs_block_t pair[2]);
+
+// Visits the rebuilt tree depth-first, directories before their contents
+void salvage_walk(salvage_t *s, salvage_cb cb, void *data);
+
+// Path of the directory each metadata block belongs to, NULL where the
+// block isn't reachable. Free with salvage_free_paths.
+char **salvage_dir_paths(salvage_t *s);
+void salvage_free_paths(const salvage_t *s, char **paths);
+
+// Marks every metadata block and every CTZ block reachable from the tree
+void salvage_mark_used(salvage_t *s, bool *usage);
+
+void salvage_print_summary(const salvage_t *s, FILE *out);
+
+#endif
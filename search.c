@@ -0,0 +1,419 @@
+/*
+ * Multi-pattern search over raw image bytes
+ */
+#include "search.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static bool search_printable(uint8_t c) {
+    return (c >= 0x20 && c < 0x7f) || c == '\t';
+}
+
+static uint8_t search_fold(const search_t *s, uint8_t c) {
+    return (s->icase && c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+void search_init(search_t *s, bool icase) {
+    memset(s, 0, sizeof(*s));
+    s->icase = icase;
+}
+
+void search_free(search_t *s) {
+    for (int i = 0; i < s->count; i++) {
+        free(s->patterns[i].name);
+        free(s->patterns[i].bytes);
+        if (s->patterns[i].regex) {
+            regfree(&s->patterns[i].re);
+        }
+    }
+    free(s->patterns);
+    free(s->next);
+    free(s->fail);
+    free(s->out);
+    free(s->link);
+    free(s->depth);
+    memset(s, 0, sizeof(*s));
+}
+
+static search_pattern_t *search_push(search_t *s, const char *name) {
+    if (s->count == s->capacity) {
+        int capacity = s->capacity ? 2*s->capacity : 8;
+        search_pattern_t *npatterns = realloc(s->patterns,
+                capacity * sizeof(search_pattern_t));
+        if (!npatterns) {
+            return NULL;
+        }
+        s->patterns = npatterns;
+        s->capacity = capacity;
+    }
+
+    search_pattern_t *p = &s->patterns[s->count];
+    memset(p, 0, sizeof(*p));
+    p->name = strdup(name);
+    return p->name ? p : NULL;
+}
+
+int search_add_literal(search_t *s, const char *name,
+        const uint8_t *bytes, size_t len) {
+    if (len == 0) {
+        return LFS_ERR_INVAL;
+    }
+
+    search_pattern_t *p = search_push(s, name);
+    if (!p) {
+        return LFS_ERR_NOMEM;
+    }
+    p->bytes = malloc(len);
+    if (!p->bytes) {
+        free(p->name);
+        return LFS_ERR_NOMEM;
+    }
+    memcpy(p->bytes, bytes, len);
+    p->len = len;
+    return s->count++;
+}
+
+// The longest run of plain characters every match of a regex has to
+// contain, as far as a simple reading of the expression can tell. Any
+// alternation gives up, groups and bracket expressions break runs.
+static size_t search_regex_literal(const char *expr, uint8_t *out) {
+    if (strchr(expr, '|')) {
+        return 0;
+    }
+
+    size_t best = 0;
+    size_t run = 0;
+    size_t start = 0;       // of the run in out, past the best so far
+    for (size_t i = 0; expr[i];) {
+        int c = (uint8_t)expr[i];
+        size_t next = i + 1;
+        bool literal = true;
+
+        if (c == '\\' && expr[i+1]) {
+            // escaped letters and digits are classes or back-references
+            c = (uint8_t)expr[i+1];
+            literal = !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                    (c >= '0' && c <= '9'));
+            next = i + 2;
+        } else if (c == '[') {
+            next = i + 1;
+            if (expr[next] == '^') {
+                next++;
+            }
+            if (expr[next] == ']') {
+                next++;
+            }
+            while (expr[next] && expr[next] != ']') {
+                next++;
+            }
+            next += (expr[next] == ']');
+            literal = false;
+        } else if (c == '(') {
+            int depth = 1;
+            while (expr[next] && depth) {
+                if (expr[next] == '\\' && expr[next+1]) {
+                    next++;
+                } else if (expr[next] == '(') {
+                    depth++;
+                } else if (expr[next] == ')') {
+                    depth--;
+                }
+                next++;
+            }
+            literal = false;
+        } else if (c == '{') {
+            while (expr[next] && expr[next] != '}') {
+                next++;
+            }
+            next += (expr[next] == '}');
+            literal = false;
+        } else if (strchr(".^$*+?)]}", c)) {
+            literal = false;
+        }
+
+        // a quantifier that allows zero copies makes the character optional
+        char q = expr[next];
+        if (literal && (q == '*' || q == '?' || q == '{')) {
+            literal = false;
+        }
+
+        if (literal) {
+            out[start + run++] = c;
+        }
+        if (!literal || q == '+') {
+            if (run > best) {
+                memmove(out, &out[start], run);
+                best = run;
+            }
+            start = best;
+            run = 0;
+        }
+        i = next;
+    }
+    if (run > best) {
+        memmove(out, &out[start], run);
+        best = run;
+    }
+    return best;
+}
+
+int search_add_regex(search_t *s, const char *expr) {
+    search_pattern_t *p = search_push(s, expr);
+    if (!p) {
+        return LFS_ERR_NOMEM;
+    }
+    if (regcomp(&p->re, expr,
+            REG_EXTENDED | (s->icase ? REG_ICASE : 0)) != 0) {
+        free(p->name);
+        return LFS_ERR_INVAL;
+    }
+    p->regex = true;
+    s->regexes += 1;
+
+    p->bytes = malloc(strlen(expr) + 1);
+    if (p->bytes) {
+        p->len = search_regex_literal(expr, p->bytes);
+    }
+    return s->count++;
+}
+
+int search_compile(search_t *s) {
+    size_t bound = 1;
+    for (int i = 0; i < s->count; i++) {
+        bound += s->patterns[i].len;
+    }
+
+    s->next = calloc(bound, sizeof(*s->next));
+    s->fail = calloc(bound, sizeof(int32_t));
+    s->out = malloc(bound * sizeof(int32_t));
+    s->link = malloc(bound * sizeof(int32_t));
+    s->depth = calloc(bound, sizeof(uint32_t));
+    int32_t *queue = malloc(bound * sizeof(int32_t));
+    if (!s->next || !s->fail || !s->out || !s->link || !s->depth || !queue) {
+        free(queue);
+        return LFS_ERR_NOMEM;
+    }
+    for (size_t i = 0; i < bound; i++) {
+        s->out[i] = -1;
+        s->link[i] = -1;
+    }
+
+    // the trie first, no state points back at the root so 0 means no
+    // child yet
+    s->states = 1;
+    s->max_len = 0;
+    for (int i = 0; i < s->count; i++) {
+        const search_pattern_t *p = &s->patterns[i];
+        if (p->regex) {
+            continue;
+        }
+
+        int32_t state = 0;
+        for (size_t j = 0; j < p->len; j++) {
+            uint8_t c = search_fold(s, p->bytes[j]);
+            if (!s->next[state][c]) {
+                s->depth[s->states] = j + 1;
+                s->next[state][c] = s->states++;
+            }
+            state = s->next[state][c];
+        }
+        // a repeated pattern is reported under its first number
+        if (s->out[state] < 0) {
+            s->out[state] = i;
+        }
+        if (p->len > s->max_len) {
+            s->max_len = p->len;
+        }
+    }
+
+    // then breadth first, every missing edge is filled in from the fail
+    // state so scanning never has to follow fail links
+    size_t head = 0, tail = 0;
+    for (int c = 0; c < 256; c++) {
+        if (s->next[0][c]) {
+            queue[tail++] = s->next[0][c];
+        }
+    }
+    while (head < tail) {
+        int32_t u = queue[head++];
+        int32_t f = s->fail[u];
+        s->link[u] = (s->out[f] >= 0) ? f : s->link[f];
+
+        for (int c = 0; c < 256; c++) {
+            int32_t v = s->next[u][c];
+            if (v) {
+                s->fail[v] = s->next[f][c];
+                queue[tail++] = v;
+            } else {
+                s->next[u][c] = s->next[f][c];
+            }
+        }
+    }
+    free(queue);
+
+    s->first_count = 0;
+    for (int c = 0; c < 256; c++) {
+        s->first[c] = (s->next[0][search_fold(s, c)] != 0);
+        if (s->first[c]) {
+            if (s->first_count < SEARCH_MAX_FIRST) {
+                s->first_bytes[s->first_count] = c;
+            }
+            s->first_count += 1;
+        }
+    }
+    if (s->first_count > SEARCH_MAX_FIRST) {
+        s->first_count = 0;
+    }
+    return 0;
+}
+
+// Next position in [i, limit) that can start a literal match
+static size_t search_skip(const search_t *s, const uint8_t *data,
+        size_t i, size_t limit) {
+#ifdef __SSE2__
+    if (s->first_count) {
+        __m128i want[SEARCH_MAX_FIRST];
+        for (int k = 0; k < s->first_count; k++) {
+            want[k] = _mm_set1_epi8((char)s->first_bytes[k]);
+        }
+        while (i + 16 <= limit) {
+            __m128i x = _mm_loadu_si128((const __m128i *)&data[i]);
+            __m128i hit = _mm_cmpeq_epi8(x, want[0]);
+            for (int k = 1; k < s->first_count; k++) {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(x, want[k]));
+            }
+            int mask = _mm_movemask_epi8(hit);
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+            i += 16;
+        }
+    }
+#else
+    // libc's memchr is vectorized where the compiler isn't told to be
+    if (s->first_count == 1) {
+        const uint8_t *p = memchr(&data[i], s->first_bytes[0], limit - i);
+        return p ? (size_t)(p - data) : limit;
+    }
+#endif
+
+    while (i < limit && !s->first[data[i]]) {
+        i++;
+    }
+    return i;
+}
+
+static void search_literals(const search_t *s, const uint8_t *data,
+        size_t size, size_t begin, size_t end, search_cb cb, void *cbdata) {
+    size_t limit = end + s->max_len - 1;
+    if (limit > size) {
+        limit = size;
+    }
+    int32_t state = 0;
+
+    for (size_t i = begin; i < limit; i++) {
+        if (state == 0) {
+            // nothing in flight, a match would have to start here
+            if (i >= end) {
+                break;
+            }
+            i = search_skip(s, data, i, end);
+            if (i >= end) {
+                break;
+            }
+        }
+
+        state = s->next[state][search_fold(s, data[i])];
+        int32_t t = (s->out[state] >= 0) ? state : s->link[state];
+        for (; t > 0; t = s->link[t]) {
+            size_t start = i + 1 - s->depth[t];
+            if (start < end) {
+                cb(cbdata, s->out[t], start, s->depth[t]);
+            }
+        }
+    }
+}
+
+static void search_regexes(const search_t *s, const uint8_t *data,
+        size_t size, size_t begin, size_t end, search_cb cb, void *cbdata) {
+    // a run already under way belongs to whoever scans the bytes before
+    size_t i = begin;
+    if (i > 0 && search_printable(data[i-1])) {
+        while (i < end && search_printable(data[i])) {
+            i++;
+        }
+    }
+
+    char *buf = NULL;
+    size_t capacity = 0;
+    while (i < end) {
+        if (!search_printable(data[i])) {
+            i++;
+            continue;
+        }
+
+        size_t start = i;
+        while (i < size && search_printable(data[i])) {
+            i++;
+        }
+        size_t n = i - start;
+        if (n + 1 > capacity) {
+            char *nbuf = realloc(buf, n + 1);
+            if (!nbuf) {
+                break;
+            }
+            buf = nbuf;
+            capacity = n + 1;
+        }
+        memcpy(buf, &data[start], n);
+        buf[n] = '\0';
+
+        for (int p = 0; p < s->count; p++) {
+            if (!s->patterns[p].regex) {
+                continue;
+            }
+
+            size_t off = 0;
+            int flags = 0;
+            regmatch_t m;
+            while (off <= n && regexec(&s->patterns[p].re, &buf[off],
+                    1, &m, flags) == 0) {
+                size_t mstart = off + m.rm_so;
+                size_t mlen = m.rm_eo - m.rm_so;
+                cb(cbdata, p, start + mstart, mlen);
+                off = mstart + (mlen ? mlen : 1);
+                flags = REG_NOTBOL;
+            }
+        }
+    }
+    free(buf);
+}
+
+size_t search_rewind(const search_t *s, const uint8_t *data, size_t begin) {
+    if (!s->regexes) {
+        return begin;
+    }
+    while (begin > 0 && search_printable(data[begin-1])) {
+        begin--;
+    }
+    return begin;
+}
+
+void search_scan(const search_t *s, const uint8_t *data, size_t size,
+        size_t begin, size_t end, search_cb cb, void *cbdata) {
+    if (end > size) {
+        end = size;
+    }
+    if (begin >= end) {
+        return;
+    }
+    if (s->states > 1) {
+        search_literals(s, data, size, begin, end, cb, cbdata);
+    }
+    if (s->regexes) {
+        search_regexes(s, data, size, begin, end, cb, cbdata);
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Multi-pattern search over raw image bytes
+ *
+ * Literal patterns are matched together in one pass by an Aho-Corasick
+ * automaton, compiled into a full transition table so every byte costs
+ * one lookup. While the automaton is at its root, bytes that can't start
+ * any pattern are skipped with a vectorized scan for the possible first
+ * bytes. Regular expressions (POSIX extended) are run over the runs of
+ * printable text, the same text strings(1) would extract.
+ */
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "lfs.h"
+#include <regex.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SEARCH_MAX_FIRST 4
+
+typedef struct search_pattern {
+    char *name;             // as given, for reporting
+    uint8_t *bytes;         // a literal, for a regex the longest literal
+    size_t len;             // every match contains, if any
+    bool regex;
+    regex_t re;
+} search_pattern_t;
+
+typedef struct search {
+    bool icase;             // ASCII case-insensitive
+    search_pattern_t *patterns;
+    int count;
+    int capacity;
+    int regexes;
+
+    // automaton over the literal patterns, state 0 is the root
+    int32_t (*next)[256];
+    int32_t *fail;
+    int32_t *out;           // pattern ending at this state, or -1
+    int32_t *link;          // next state on the fail chain with an output
+    uint32_t *depth;
+    size_t states;
+    size_t max_len;         // longest literal pattern
+
+    // bytes that can start a literal pattern, for skipping at the root
+    bool first[256];
+    uint8_t first_bytes[SEARCH_MAX_FIRST];
+    int first_count;        // 0 if there are too many for the fast path
+} search_t;
+
+// A match of pattern at [start, start+len) of the scanned buffer
+typedef void (*search_cb)(void *data, int pattern, size_t start, size_t len);
+
+void search_init(search_t *s, bool icase);
+void search_free(search_t *s);
+
+// Patterns are numbered in the order they are added. Returns the number,
+// LFS_ERR_INVAL for an empty literal or a regex that doesn't compile, or
+// LFS_ERR_NOMEM.
+int search_add_literal(search_t *s, const char *name,
+        const uint8_t *bytes, size_t len);
+int search_add_regex(search_t *s, const char *expr);
+
+// Builds the automaton, call once after every pattern is added
+int search_compile(search_t *s);
+
+// Where a scan has to begin to find every regex match overlapping begin,
+// the start of the printable run begin is in. Returns begin if there are
+// no regexes.
+size_t search_rewind(const search_t *s, const uint8_t *data, size_t begin);
+
+// Reports every match starting in [begin, end) of data, a match may run
+// past end up to size, so adjacent ranges can be scanned independently
+// without losing the matches that cross between them. Thread-safe.
+void search_scan(const search_t *s, const uint8_t *data, size_t size,
+        size_t begin, size_t end, search_cb cb, void *cbdata);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ * SHA-256 for hash manifests
+ */
+#include "sha256.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+typedef void (*sha256_blocks_fn)(uint32_t state[8],
+        const uint8_t *data, size_t blocks);
+
+static inline uint32_t sha256_rotr(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+static inline uint32_t sha256_be32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void sha256_blocks_generic(uint32_t state[8],
+        const uint8_t *data, size_t blocks) {
+    for (; blocks; blocks--, data += 64) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = sha256_be32(&data[4*i]);
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = sha256_rotr(w[i-15], 7) ^
+                    sha256_rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+            uint32_t s1 = sha256_rotr(w[i-2], 17) ^
+                    sha256_rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+            w[i] = w[i-16] + s0 + w[i-7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t s1 = sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^
+                    sha256_rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+            uint32_t s0 = sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^
+                    sha256_rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+// Four rounds on the SHA extensions, msg holds the schedule words
+#define SHA256_ROUNDS4(msg, i) do { \
+        __m128i m = _mm_add_epi32(msg, \
+                _mm_loadu_si128((const __m128i *)&sha256_k[i])); \
+        state1 = _mm_sha256rnds2_epu32(state1, state0, m); \
+        m = _mm_shuffle_epi32(m, 0x0E); \
+        state0 = _mm_sha256rnds2_epu32(state0, state1, m); \
+    } while (0)
+
+// Next four schedule words, m0 is the oldest
+#define SHA256_SCHEDULE4(m0, m1, m2, m3) do { \
+        m0 = _mm_sha256msg1_epu32(m0, m1); \
+        m0 = _mm_add_epi32(m0, _mm_alignr_epi8(m3, m2, 4)); \
+        m0 = _mm_sha256msg2_epu32(m0, m3); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8],
+        const uint8_t *data, size_t blocks) {
+    const __m128i bswap = _mm_set_epi64x(
+            0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // the instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    for (; blocks; blocks--, data += 64) {
+        __m128i save0 = state0;
+        __m128i save1 = state1;
+
+        __m128i m0 = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)&data[0]), bswap);
+        __m128i m1 = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)&data[16]), bswap);
+        __m128i m2 = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)&data[32]), bswap);
+        __m128i m3 = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)&data[48]), bswap);
+
+        SHA256_ROUNDS4(m0, 0);
+        SHA256_ROUNDS4(m1, 4);
+        SHA256_ROUNDS4(m2, 8);
+        SHA256_ROUNDS4(m3, 12);
+        for (int i = 16; i < 64; i += 16) {
+            SHA256_SCHEDULE4(m0, m1, m2, m3);
+            SHA256_ROUNDS4(m0, i);
+            SHA256_SCHEDULE4(m1, m2, m3, m0);
+            SHA256_ROUNDS4(m1, i + 4);
+            SHA256_SCHEDULE4(m2, m3, m0, m1);
+            SHA256_ROUNDS4(m2, i + 8);
+            SHA256_SCHEDULE4(m3, m0, m1, m2);
+            SHA256_ROUNDS4(m3, i + 12);
+        }
+
+        state0 = _mm_add_epi32(state0, save0);
+        state1 = _mm_add_epi32(state1, save1);
+    }
+
+    // and back to ABCD EFGH
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static bool sha256_cpu_has_shani(void) {
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_SSE4_1)) {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        return false;
+    }
+    return (b >> 29) & 1;
+}
+#endif
+
+static sha256_blocks_fn sha256_pick(void) {
+#ifdef SHA256_X86
+    if (sha256_cpu_has_shani()) {
+        return sha256_blocks_shani;
+    }
+#endif
+    return sha256_blocks_generic;
+}
+
+// resolved on first use, racing threads all store the same pointer
+static sha256_blocks_fn sha256_blocks_impl = NULL;
+
+static void sha256_blocks(uint32_t state[8],
+        const uint8_t *data, size_t blocks) {
+    sha256_blocks_fn fn = __atomic_load_n(&sha256_blocks_impl,
+            __ATOMIC_RELAXED);
+    if (!fn) {
+        fn = sha256_pick();
+        __atomic_store_n(&sha256_blocks_impl, fn, __ATOMIC_RELAXED);
+    }
+    fn(state, data, blocks);
+}
+
+bool sha256_accelerated(void) {
+    return sha256_pick() != sha256_blocks_generic;
+}
+
+void sha256_init(sha256_t *ctx) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+    ctx->buf_len = 0;
+}
+
+void sha256_update(sha256_t *ctx, const void *data, size_t size) {
+    const uint8_t *p = data;
+    ctx->length += size;
+
+    if (ctx->buf_len) {
+        size_t n = 64 - ctx->buf_len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(&ctx->buf[ctx->buf_len], p, n);
+        ctx->buf_len += n;
+        p += n;
+        size -= n;
+        if (ctx->buf_len < 64) {
+            return;
+        }
+        sha256_blocks(ctx->state, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+
+    // whole blocks straight from the caller's buffer
+    if (size >= 64) {
+        sha256_blocks(ctx->state, p, size / 64);
+        p += size & ~(size_t)63;
+        size &= 63;
+    }
+
+    memcpy(ctx->buf, p, size);
+    ctx->buf_len = size;
+}
+
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]) {
+    uint64_t bits = ctx->length * 8;
+
+    ctx->buf[ctx->buf_len++] = 0x80;
+    if (ctx->buf_len > 56) {
+        memset(&ctx->buf[ctx->buf_len], 0, 64 - ctx->buf_len);
+        sha256_blocks(ctx->state, ctx->buf, 1);
+        ctx->buf_len = 0;
+    }
+    memset(&ctx->buf[ctx->buf_len], 0, 56 - ctx->buf_len);
+    for (int i = 0; i < 8; i++) {
+        ctx->buf[56 + i] = bits >> (56 - 8*i);
+    }
+    sha256_blocks(ctx->state, ctx->buf, 1);
+
+    for (int i = 0; i < 8; i++) {
+        digest[4*i+0] = ctx->state[i] >> 24;
+        digest[4*i+1] = ctx->state[i] >> 16;
+        digest[4*i+2] = ctx->state[i] >> 8;
+        digest[4*i+3] = ctx->state[i];
+    }
+}
+
+void sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char *out) {
+    static const char digits[16] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        out[2*i] = digits[digest[i] >> 4];
+        out[2*i+1] = digits[digest[i] & 0xf];
+    }
+    out[2*SHA256_DIGEST_SIZE] = '\0';
+}
@@ -0,0 +1,34 @@
+/*
+ * SHA-256 for hash manifests
+ *
+ * On x86 CPUs with the SHA extensions the compression function runs on
+ * them, picked once at runtime, otherwise a portable version is used.
+ * Both give the same digests.
+ */
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct sha256 {
+    uint32_t state[8];
+    uint64_t length;        // bytes hashed so far
+    uint8_t buf[64];
+    size_t buf_len;
+} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+void sha256_update(sha256_t *ctx, const void *data, size_t size);
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// Lowercase hex, out must hold 2*SHA256_DIGEST_SIZE+1 bytes
+void sha256_hex(const uint8_t digest[SHA256_DIGEST_SIZE], char *out);
+
+// True if the hardware path is in use
+bool sha256_accelerated(void);
+
+#endif
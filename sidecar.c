@@ -0,0 +1,75 @@
+/*
+ * Files kept next to an image: indexes, caches, converted hash sets
+ */
+#include "sidecar.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+int sidecar_stamp(sidecar_stamp_t *s, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return LFS_ERR_NOENT;
+    }
+    s->file_size = st.st_size;
+    s->mtime_sec = st.st_mtim.tv_sec;
+    s->mtime_nsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+void sidecar_put_stamp(uint8_t *p, const sidecar_stamp_t *s) {
+    sidecar_put64(&p[0], s->file_size);
+    sidecar_put64(&p[8], s->mtime_sec);
+    sidecar_put64(&p[16], s->mtime_nsec);
+}
+
+void sidecar_get_stamp(const uint8_t *p, sidecar_stamp_t *s) {
+    s->file_size = sidecar_get64(&p[0]);
+    s->mtime_sec = (int64_t)sidecar_get64(&p[8]);
+    s->mtime_nsec = (int64_t)sidecar_get64(&p[16]);
+}
+
+bool sidecar_stamp_equal(const sidecar_stamp_t *a, const sidecar_stamp_t *b) {
+    return a->file_size == b->file_size && a->mtime_sec == b->mtime_sec &&
+            a->mtime_nsec == b->mtime_nsec;
+}
+
+int sidecar_create(sidecar_file_t *s, const char *path) {
+    s->path = path;
+    snprintf(s->tmp, sizeof(s->tmp), "%s.tmp", path);
+    s->f = fopen(s->tmp, "wb");
+    return s->f ? 0 : LFS_ERR_IO;
+}
+
+// The rename itself only survives power loss once the directory is synced
+static void sidecar_sync_dir(const char *path) {
+    char dir[sizeof(((sidecar_file_t *)0)->tmp)];
+    snprintf(dir, sizeof(dir), "%s", path);
+    int fd = open(dirname(dir), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+int sidecar_commit(sidecar_file_t *s) {
+    // without the fsync the rename can reach the disk before the data
+    // does, and a power loss leaves a renamed file full of zeros
+    int err = (ferror(s->f) || fflush(s->f) != 0 ||
+            fsync(fileno(s->f)) != 0) ? LFS_ERR_IO : 0;
+    if (fclose(s->f) != 0) {
+        err = LFS_ERR_IO;
+    }
+    s->f = NULL;
+    if (!err && rename(s->tmp, s->path) != 0) {
+        err = LFS_ERR_IO;
+    }
+    if (err) {
+        remove(s->tmp);
+    } else {
+        sidecar_sync_dir(s->path);
+    }
+    return err;
+}
@@ -0,0 +1,79 @@
+/*
+ * Files kept next to an image: indexes, caches, converted hash sets
+ *
+ * All of them store integers little-endian. The ones built from a file
+ * record its size and mtime (a stamp), and are only reused while both
+ * still match. They are written under a temporary name, flushed to disk
+ * and renamed over the old file, so a crash or power loss leaves the old
+ * file or the new one, never a partly written one.
+ */
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include "lfs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SIDECAR_STAMP 24    // bytes of a stamp as stored
+
+typedef struct sidecar_stamp {
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} sidecar_stamp_t;
+
+typedef struct sidecar_file {
+    FILE *f;
+    const char *path;
+    char tmp[1100];
+} sidecar_file_t;
+
+static inline void sidecar_put16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static inline void sidecar_put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = v >> (8*i);
+    }
+}
+
+static inline void sidecar_put64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = v >> (8*i);
+    }
+}
+
+static inline uint16_t sidecar_get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t sidecar_get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t sidecar_get64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8*i);
+    }
+    return v;
+}
+
+// Size and mtime of the file at path, LFS_ERR_NOENT if it can't be stat'd
+int sidecar_stamp(sidecar_stamp_t *s, const char *path);
+void sidecar_put_stamp(uint8_t *p, const sidecar_stamp_t *s);
+void sidecar_get_stamp(const uint8_t *p, sidecar_stamp_t *s);
+bool sidecar_stamp_equal(const sidecar_stamp_t *a, const sidecar_stamp_t *b);
+
+// Opens <path>.tmp for writing, s->f takes the contents
+int sidecar_create(sidecar_file_t *s, const char *path);
+
+// Flushes and syncs the temporary file and renames it over path. On any
+// error the temporary file is removed and path is left as it was.
+int sidecar_commit(sidecar_file_t *s);
+
+#endif
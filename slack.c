@@ -0,0 +1,100 @@
+/*
+ * Slack space extraction
+ */
+#include "slack.h"
+#include "ondisk.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct slack_files {
+    salvage_t *s;
+    char **owners;          // file owning each CTZ tail block
+    lfs_off_t *live;        // live extent of file tail blocks, 0 if none
+    bool failed;
+};
+
+static void slack_collect(void *data, const salvage_info_t *info) {
+    struct slack_files *f = data;
+    salvage_t *s = f->s;
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (!info->entry || !ondisk_entry_ctz(info->entry, &head, &size) ||
+            size == 0 || head >= s->block_count || f->live[head]) {
+        return;
+    }
+
+    // the head is the last block, live up to the final byte
+    lfs_off_t last = size - 1;
+    ondisk_ctz_index(s->block_size, &last);
+    f->live[head] = last + 1;
+    f->owners[head] = strdup(info->path);
+    if (!f->owners[head]) {
+        f->failed = true;
+    }
+}
+
+static void slack_emit(salvage_t *s, lfs_block_t block, lfs_off_t live,
+        int kind, const char *owner, slack_cb cb, void *data) {
+    const uint8_t *bdata = &s->image[(size_t)block * s->block_size];
+    lfs_off_t off = live;
+
+    while (off < s->block_size) {
+        while (off < s->block_size && bdata[off] == 0xFF) {
+            off++;
+        }
+        lfs_off_t start = off;
+        while (off < s->block_size && bdata[off] != 0xFF) {
+            off++;
+        }
+
+        if (off > start) {
+            slack_range_t range = {
+                .block = block,
+                .off = start,
+                .size = off - start,
+                .kind = kind,
+                .owner = owner ? owner : "?",
+                .data = &bdata[start],
+            };
+            cb(data, &range);
+        }
+    }
+}
+
+int slack_scan(salvage_t *s, slack_cb cb, void *data) {
+    struct slack_files f = {.s = s};
+    f.owners = calloc(s->block_count, sizeof(char *));
+    f.live = calloc(s->block_count, sizeof(lfs_off_t));
+    char **dirs = salvage_dir_paths(s);
+    if (!f.owners || !f.live || !dirs) {
+        free(f.owners);
+        free(f.live);
+        salvage_free_paths(s, dirs);
+        return LFS_ERR_NOMEM;
+    }
+
+    salvage_walk(s, slack_collect, &f);
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        const salvage_block_t *b = &s->blocks[i];
+        // the unused half of a pair has no live extent at all
+        bool metadata = b->state == SALVAGE_ACTIVE ||
+                (b->state == SALVAGE_STALE && b->partner != LFS_BLOCK_NULL) ||
+                (b->state == SALVAGE_NONE && b->referenced);
+
+        if (metadata) {
+            slack_emit(s, i, b->off, SLACK_METADATA, dirs[i], cb, data);
+        } else if (f.live[i]) {
+            slack_emit(s, i, f.live[i], SLACK_FILE, f.owners[i], cb, data);
+        }
+    }
+
+    for (lfs_block_t i = 0; i < s->block_count; i++) {
+        free(f.owners[i]);
+    }
+    free(f.owners);
+    free(f.live);
+    salvage_free_paths(s, dirs);
+    return f.failed ? LFS_ERR_NOMEM : 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * Slack space extraction
+ *
+ * The live extent of every referenced block is computed from the rebuilt
+ * tree: metadata blocks are live up to the end of their last valid commit,
+ * and the final block of each CTZ file is live up to the file's size.
+ * Anything after that which isn't erased is residual data.
+ */
+#ifndef SLACK_H
+#define SLACK_H
+
+#include "lfs.h"
+#include "salvage.h"
+
+enum slack_kind {
+    SLACK_METADATA,         // after the last valid commit of an mdir
+    SLACK_FILE,             // past the end of a file in its last CTZ block
+};
+
+typedef struct slack_range {
+    lfs_block_t block;
+    lfs_off_t off;
+    lfs_size_t size;
+    int kind;
+    const char *owner;      // directory or file path, "?" if unreachable
+    const uint8_t *data;    // points into the image
+} slack_range_t;
+
+typedef void (*slack_cb)(void *data, const slack_range_t *range);
+
+// Calls cb for every non-erased slack range, in block order
+int slack_scan(salvage_t *s, slack_cb cb, void *data);
+
+#endif
@@ -0,0 +1,253 @@
+/*
+ * Content-addressed store for recovered data
+ */
+#include "store.h"
+#include "hash64.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static int store_mkdir(const char *path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return LFS_ERR_IO;
+    }
+    return 0;
+}
+
+static void store_object_path(const store_t *s,
+        const uint8_t digest[SHA256_DIGEST_SIZE], char *path, size_t len) {
+    char hex[2*SHA256_DIGEST_SIZE + 1];
+    sha256_hex(digest, hex);
+    snprintf(path, len, "%s/objects/%.2s/%s", s->root, hex, hex + 2);
+}
+
+static int store_ref(store_t *s, const char *name,
+        const uint8_t digest[SHA256_DIGEST_SIZE], uint64_t size,
+        bool written) {
+    char *copy = strdup(name);
+    if (!copy) {
+        return LFS_ERR_NOMEM;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    if (s->ref_count == s->ref_capacity) {
+        size_t capacity = s->ref_capacity ? 2*s->ref_capacity : 256;
+        store_ref_t *refs = realloc(s->refs, capacity * sizeof(store_ref_t));
+        if (!refs) {
+            pthread_mutex_unlock(&s->lock);
+            free(copy);
+            return LFS_ERR_NOMEM;
+        }
+        s->refs = refs;
+        s->ref_capacity = capacity;
+    }
+
+    store_ref_t *r = &s->refs[s->ref_count++];
+    memcpy(r->digest, digest, SHA256_DIGEST_SIZE);
+    r->size = size;
+    r->name = copy;
+    if (written) {
+        s->written += 1;
+        s->written_bytes += size;
+    } else {
+        s->present += 1;
+        s->present_bytes += size;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+// Moves a finished temporary object into place, unless it is already
+// there, and references it
+static int store_link(store_t *s, const char *tmp, const char *name,
+        const uint8_t digest[SHA256_DIGEST_SIZE], uint64_t size,
+        char *path, size_t len) {
+    store_object_path(s, digest, path, len);
+
+    // the fan-out directory is the part of the path before the name
+    char dir[1200];
+    snprintf(dir, sizeof(dir), "%s", path);
+    *strrchr(dir, '/') = '\0';
+
+    bool written = true;
+    if (store_mkdir(dir) != 0) {
+        unlink(tmp);
+        return LFS_ERR_IO;
+    }
+    if (link(tmp, path) != 0) {
+        if (errno != EEXIST) {
+            unlink(tmp);
+            return LFS_ERR_IO;
+        }
+        written = false;
+    }
+    unlink(tmp);
+    return store_ref(s, name, digest, size, written);
+}
+
+int store_open(store_t *s, const char *root, const char *image_path,
+        const uint8_t *image, size_t image_size, const char *tool) {
+    memset(s, 0, sizeof(*s));
+    snprintf(s->root, sizeof(s->root), "%s", root);
+
+    char dir[1100];
+    int err = store_mkdir(s->root);
+    const char *const subdirs[] = {"objects", "refs", "tmp"};
+    for (int i = 0; !err && i < 3; i++) {
+        snprintf(dir, sizeof(dir), "%s/%s", s->root, subdirs[i]);
+        err = store_mkdir(dir);
+    }
+    if (err) {
+        return err;
+    }
+
+    snprintf(s->refs_path, sizeof(s->refs_path), "%s/refs/%016llx.%s.refs",
+            s->root, (unsigned long long)hash64(image, image_size, 0), tool);
+    snprintf(s->header, sizeof(s->header), "# image %s %llu %s\n",
+            image_path, (unsigned long long)image_size, tool);
+    pthread_mutex_init(&s->lock, NULL);
+    return 0;
+}
+
+int store_close(store_t *s) {
+    // written aside and renamed, readers see the old list or the new one
+    char tmp[1300];
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+    snprintf(tmp, sizeof(tmp), "%s.%s.%ld.tmp", s->refs_path, host,
+            (long)getpid());
+
+    int err = 0;
+    FILE *f = fopen(tmp, "w");
+    if (!f) {
+        err = LFS_ERR_IO;
+    } else {
+        fputs(s->header, f);
+        for (size_t i = 0; i < s->ref_count; i++) {
+            char hex[2*SHA256_DIGEST_SIZE + 1];
+            sha256_hex(s->refs[i].digest, hex);
+            fprintf(f, "%s  %llu  %s\n", hex,
+                    (unsigned long long)s->refs[i].size, s->refs[i].name);
+        }
+        err = ferror(f) ? LFS_ERR_IO : 0;
+        if (fclose(f) != 0) {
+            err = LFS_ERR_IO;
+        }
+        if (!err && rename(tmp, s->refs_path) != 0) {
+            err = LFS_ERR_IO;
+        }
+        if (err) {
+            remove(tmp);
+        }
+    }
+
+    for (size_t i = 0; i < s->ref_count; i++) {
+        free(s->refs[i].name);
+    }
+    free(s->refs);
+    s->refs = NULL;
+    s->ref_count = 0;
+    pthread_mutex_destroy(&s->lock);
+    return err;
+}
+
+int store_begin(store_t *s, store_writer_t *w) {
+    memset(w, 0, sizeof(*w));
+    w->store = s;
+    sha256_init(&w->ctx);
+
+    // unique across threads, processes and hosts sharing the store
+    char host[64] = "";
+    gethostname(host, sizeof(host) - 1);
+    uint64_t seq = __atomic_fetch_add(&s->sequence, 1, __ATOMIC_RELAXED);
+    snprintf(w->tmp, sizeof(w->tmp), "%s/tmp/%s.%ld.%llu", s->root, host,
+            (long)getpid(), (unsigned long long)seq);
+
+    w->fd = open(w->tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (w->fd < 0) {
+        w->err = LFS_ERR_IO;
+    }
+    return w->err;
+}
+
+int store_write(store_writer_t *w, const void *data, size_t size) {
+    if (w->err) {
+        return w->err;
+    }
+
+    sha256_update(&w->ctx, data, size);
+    w->size += size;
+    const uint8_t *p = data;
+    while (size) {
+        ssize_t n = write(w->fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            w->err = LFS_ERR_IO;
+            return w->err;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+void store_abort(store_writer_t *w) {
+    if (w->fd >= 0) {
+        close(w->fd);
+        unlink(w->tmp);
+        w->fd = -1;
+    }
+}
+
+int store_commit(store_writer_t *w, const char *name, char *path, size_t len) {
+    if (w->err) {
+        store_abort(w);
+        return w->err;
+    }
+
+    int fd = w->fd;
+    w->fd = -1;
+    if (close(fd) != 0) {
+        unlink(w->tmp);
+        return LFS_ERR_IO;
+    }
+
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&w->ctx, digest);
+    return store_link(w->store, w->tmp, name, digest, w->size, path, len);
+}
+
+int store_put(store_t *s, const char *name, const void *data, size_t size,
+        char *path, size_t len) {
+    // the common case on a fleet is content the store already has, that
+    // costs a hash and a stat
+    sha256_t ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, size);
+    sha256_final(&ctx, digest);
+
+    store_object_path(s, digest, path, len);
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        return store_ref(s, name, digest, size, false);
+    }
+
+    store_writer_t w;
+    store_begin(s, &w);
+    store_write(&w, data, size);
+    return store_commit(&w, name, path, len);
+}
+
+void store_print_summary(const store_t *s, FILE *out) {
+    fprintf(out, "Store %s: %lu objects written (%llu bytes), "
+            "%lu already stored (%llu bytes)\n", s->root,
+            s->written, (unsigned long long)s->written_bytes,
+            s->present, (unsigned long long)s->present_bytes);
+}
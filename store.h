@@ -0,0 +1,89 @@
+/*
+ * Content-addressed store for recovered data
+ *
+ * Across many images of the same kind of device, the same orphaned
+ * blocks and files turn up over and over. A store keeps one copy of each
+ * distinct content, named by its SHA-256, and a reference list per image
+ * saying which names it found under which hash:
+ *
+ *   <root>/objects/<first 2 hex digits>/<other 62 hex digits>
+ *   <root>/refs/<image key>.<tool>.refs
+ *   <root>/tmp/                                 objects being written
+ *
+ * The image key is the XXH64 of the image as loaded, so rerunning a tool
+ * on the same image replaces its list. A reference list is text:
+ *
+ *   # image <path> <size> <tool>
+ *   <sha256>  <size>  <name>
+ *
+ * Any number of processes, and threads within them, may write to one
+ * store at once. An object is written under a private name in tmp and
+ * hard-linked into place, which fails if another writer got there
+ * first, so an object is never seen half written and never written
+ * over. Reference lists are written aside and renamed the same way.
+ */
+#ifndef STORE_H
+#define STORE_H
+
+#include "lfs.h"
+#include "sha256.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef struct store_ref {
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    uint64_t size;
+    char *name;
+} store_ref_t;
+
+typedef struct store {
+    char root[1024];
+    char refs_path[1200];
+    char header[1300];
+
+    pthread_mutex_t lock;   // refs and counters, writers may be threads
+    store_ref_t *refs;
+    size_t ref_count;
+    size_t ref_capacity;
+    uint64_t sequence;      // private names of objects being written
+
+    unsigned long written;
+    unsigned long present;
+    uint64_t written_bytes;
+    uint64_t present_bytes;
+} store_t;
+
+// An object written in pieces, hashed as it goes
+typedef struct store_writer {
+    store_t *store;
+    char tmp[1200];
+    int fd;
+    sha256_t ctx;
+    uint64_t size;
+    int err;
+} store_writer_t;
+
+// Creates the store's directories as needed
+int store_open(store_t *s, const char *root, const char *image_path,
+        const uint8_t *image, size_t image_size, const char *tool);
+
+// Writes the reference list and releases the store
+int store_close(store_t *s);
+
+// Stores data under name, path gets the object's path. Content the
+// store already has is only referenced, never written again.
+int store_put(store_t *s, const char *name, const void *data, size_t size,
+        char *path, size_t len);
+
+int store_begin(store_t *s, store_writer_t *w);
+int store_write(store_writer_t *w, const void *data, size_t size);
+// Finishes an object begun with store_begin, or discards it on error
+int store_commit(store_writer_t *w, const char *name, char *path, size_t len);
+void store_abort(store_writer_t *w);
+
+void store_print_summary(const store_t *s, FILE *out);
+
+#endif
@@ -0,0 +1,42 @@
+import tempfile
+import unittest
+
+from tools import BLOCK_COUNT, BLOCK_SIZE, rename_entry, run, scratch_image, write_image
+
+def listing(out):
+    return [line for line in out.splitlines()
+            if line.startswith(("Directory:", "  FILE:", "  DIR:"))]
+
+class CacheTest(unittest.TestCase):
+    def test_struct_listing_from_cache(self):
+        # an unchanged image lists its tree from the cache, a changed
+        # block means mounting again
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp)
+            args = ("littlefs_struct", path, BLOCK_SIZE, BLOCK_COUNT, "--cache")
+            first = run(*args, check=True).stdout
+            second = run(*args, check=True).stdout
+            self.assertNotIn("Listing taken from the cache", first)
+            self.assertIn("Listing taken from the cache", second)
+            self.assertEqual(listing(second), listing(first))
+            self.assertIn("  FILE: /nested/file3.txt (Size: 52)", listing(second))
+
+            for block in (0, 1):
+                rename_entry(data, block, b"file1.txt", b"file9.txt")
+            write_image(path, data)
+            third = run(*args, check=True).stdout
+            self.assertNotIn("Listing taken from the cache", third)
+            self.assertIn("  FILE: /file9.txt (Size: 40)", listing(third))
+
+    def test_recover_usage_from_cache(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            path, _ = scratch_image(tmp, "test2.img")
+            args = ("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, "--cache")
+            first = run(*args, check=True).stdout
+            second = run(*args, check=True).stdout
+            self.assertIn("Blocks in use taken from the cache", second)
+            self.assertEqual(second.split("use the following blocks:")[1],
+                    first.split("use the following blocks:")[1])
+
+if __name__ == "__main__":
+    unittest.main()
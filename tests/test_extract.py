@@ -0,0 +1,44 @@
+import os
+import tempfile
+import unittest
+
+from tools import BLOCK_COUNT, BLOCK_SIZE, rename_entry, run, scratch_image, write_image
+
+def tree(root):
+    found = set()
+    for dirpath, dirnames, filenames in os.walk(root):
+        for name in dirnames + filenames:
+            found.add(os.path.relpath(os.path.join(dirpath, name), root))
+    return found
+
+class ExtractTest(unittest.TestCase):
+    def test_extract_tree(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            path, _ = scratch_image(tmp)
+            out = os.path.join(tmp, "out")
+            run("littlefs_extract", path, BLOCK_SIZE, BLOCK_COUNT, "--out", out, check=True)
+            self.assertEqual(tree(out), {"file1.txt", "file2.txt", "nested", "nested/file3.txt"})
+            self.assertEqual(os.path.getsize(os.path.join(out, "nested", "file3.txt")), 52)
+
+    def test_hostile_names_stay_inside(self):
+        # names with a separator, "..", and a name cut short by NUL bytes,
+        # in both halves of the root pair
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp)
+            for block in (0, 1):
+                rename_entry(data, block, b"nested", b"../zzz")
+                rename_entry(data, block, b"file1.txt", b"..")
+            write_image(path, data)
+
+            work = os.path.join(tmp, "work")
+            out = os.path.join(work, "out")
+            os.makedirs(work)
+            result = run("littlefs_extract", path, BLOCK_SIZE, BLOCK_COUNT, "--out", out)
+
+            self.assertEqual(tree(tmp) - {"test.img"}, {"work", "work/out", "work/out/file2.txt"})
+            self.assertIn('unsafe name in /: "../zzz"', result.stderr)
+            self.assertIn('unsafe name in /: ".."', result.stderr)
+            self.assertIn("Skipped 2 entries", result.stderr)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,111 @@
+import gzip
+import os
+import random
+import struct
+import tarfile
+import tempfile
+import unittest
+
+from tools import BLOCK_COUNT, BLOCK_SIZE, run, scratch_image, write_image
+
+def members(path):
+    with tarfile.open(path) as tar:
+        return {m.name: tar.extractfile(m).read() for m in tar.getmembers()}
+
+class RecoverTest(unittest.TestCase):
+    def test_archive_with_offset(self):
+        # the partition sits behind 64 KiB of other data in the dump, the
+        # archive copies members straight from the file and has to skip it
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp, "test2.img")
+            offset = 0x10000
+            dump = os.path.join(tmp, "dump.bin")
+            with open(dump, "wb") as f:
+                f.write(b"\x5a" * offset + data)
+
+            archive = os.path.join(tmp, "out.tar")
+            run("littlefs_recover", dump, BLOCK_SIZE, BLOCK_COUNT,
+                "--offset", hex(offset), "--archive", archive, check=True)
+            saved = members(archive)
+
+            self.assertIn("block_5.bin", saved)
+            for name, content in saved.items():
+                block = int(name[len("block_"):-len(".bin")])
+                self.assertEqual(content, data[block * BLOCK_SIZE:(block + 1) * BLOCK_SIZE], name)
+
+            plain = os.path.join(tmp, "plain.tar")
+            run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT,
+                "--archive", plain, check=True)
+            self.assertEqual(members(plain), saved)
+
+    def test_partly_written_text_block(self):
+        # block 5 of test2.img is a short deleted text file followed by
+        # erased bytes, its class and printable share the same bytes
+        with tempfile.TemporaryDirectory() as tmp:
+            path, _ = scratch_image(tmp, "test2.img")
+            out = run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, check=True).stdout
+            self.assertIn("Class: text (", out)
+            self.assertIn("100% printable", out)
+            self.assertIn("T text: 1", out)
+
+    def test_entropy_of_random_tail(self):
+        # an erased block with random bytes at its end, entropy is taken
+        # over the same programmed bytes as the class
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp, "test2.img")
+            rng = random.Random(45)
+            tail = bytes(rng.getrandbits(8) for _ in range(1024)).replace(b"\xff", b"\x00")
+            data[7 * BLOCK_SIZE - len(tail):7 * BLOCK_SIZE] = tail
+            write_image(path, data)
+
+            out = run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, check=True).stdout
+            line = out.split("Orphaned block 6:\n")[1].splitlines()[0]
+            self.assertTrue(line.startswith("Class: compressed (entropy "), line)
+            entropy = float(line.split("entropy ")[1].split(" ")[0])
+            self.assertGreater(entropy, 7.5)
+
+    def test_carve_gzip_ends_with_stream(self):
+        # a deleted gzip in unused blocks 6 and 7 of test2.img, with more
+        # orphaned data right after it, is carved to its exact length
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp, "test2.img")
+            rng = random.Random(44)
+            text = "".join("%016x\n" % rng.getrandbits(64) for _ in range(550)).encode()
+            gz = gzip.compress(text, mtime=0)
+            self.assertTrue(BLOCK_SIZE < len(gz) < 2 * BLOCK_SIZE - 64)
+            start = 6 * BLOCK_SIZE
+            data[start:start + len(gz)] = gz
+            data[start + len(gz):9 * BLOCK_SIZE] = b"\x5a" * (9 * BLOCK_SIZE - start - len(gz))
+            write_image(path, data)
+
+            out = run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, "--carve", cwd=tmp, check=True).stdout
+            self.assertIn("Carved gzip in block 6 at +0x0000 (%d bytes, through block 7)" % len(gz), out)
+            with open(os.path.join(tmp, "recovered_blocks", "carved_00006000.gz"), "rb") as f:
+                self.assertEqual(gzip.decompress(f.read()), text)
+
+            # cut short by the end of the orphaned run, it is truncated
+            data[start + len(gz) - 100:9 * BLOCK_SIZE] = b"\xff" * (9 * BLOCK_SIZE - start - len(gz) + 100)
+            data[7 * BLOCK_SIZE:8 * BLOCK_SIZE] = b"\xff" * BLOCK_SIZE
+            write_image(path, data)
+            out = run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, "--carve", cwd=tmp, check=True).stdout
+            self.assertIn("Carved gzip in block 6 at +0x0000 (4096 bytes, truncated)", out)
+
+    def test_carve_padding_inside_elf(self):
+        # an ELF that runs past its orphaned blocks, with zero padding and
+        # then bytes that parse as protobuf fields inside it
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp, "test2.img")
+            elf = bytearray(b"\x7fELF\x02\x01\x01" + b"\x00" * 57)
+            struct.pack_into("<QQ", elf, 32, 64, 0x10000)
+            struct.pack_into("<HHHHHH", elf, 52, 64, 56, 1, 64, 4, 3)
+            elf += b"\x00" * (0x800 - len(elf)) + b"\x08\x01\x10\x02\x18\x03\x20\x04" * 4
+            start = 6 * BLOCK_SIZE
+            data[start:start + len(elf)] = elf
+            write_image(path, data)
+
+            out = run("littlefs_recover", path, BLOCK_SIZE, BLOCK_COUNT, "--carve", cwd=tmp, check=True).stdout
+            self.assertIn("Carved elf in block 6 at +0x0000 (4096 bytes, truncated)", out)
+            self.assertNotIn("Carved protobuf", out)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,29 @@
+import os
+import tempfile
+import unittest
+
+from tools import ROOT, BLOCK_COUNT, BLOCK_SIZE, erase_block, run, scratch_image, write_image
+
+class SalvageTest(unittest.TestCase):
+    def test_detached_pair_listed_once(self):
+        # with the root pair gone, /nested is only reachable as an orphan
+        # and both halves of its pair {4, 5} hold a valid log
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp)
+            erase_block(data, 0)
+            erase_block(data, 1)
+            write_image(path, data)
+
+            out = run("littlefs_list", path, BLOCK_SIZE, BLOCK_COUNT, "--salvage").stdout
+            self.assertIn("2 (1 active, 1 stale)", out)
+            self.assertEqual(out.count("file3.txt"), 1)
+            self.assertIn("/lost+found/mdir_4/file3.txt", out)
+            self.assertNotIn("mdir_5", out)
+
+    def test_intact_image_unchanged(self):
+        out = run("littlefs_list", os.path.join(ROOT, "test.img"), BLOCK_SIZE, BLOCK_COUNT, "--salvage").stdout
+        self.assertIn("/nested/file3.txt", out)
+        self.assertNotIn("lost+found", out)
+
+if __name__ == "__main__":
+    unittest.main()
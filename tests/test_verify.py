@@ -0,0 +1,49 @@
+import tempfile
+import unittest
+
+from tools import BLOCK_COUNT, BLOCK_SIZE, erase_block, run, scratch_image, write_image
+
+def summary(out, name):
+    for line in out.splitlines():
+        if line.strip().startswith(name + ":"):
+            return int(line.split(":")[1])
+    raise LookupError(name)
+
+class VerifyTest(unittest.TestCase):
+    def test_clean_image(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            path, _ = scratch_image(tmp)
+            out = run("littlefs_verify", path, BLOCK_SIZE, BLOCK_COUNT).stdout
+            self.assertEqual(summary(out, "Bad CRCs"), 0)
+            self.assertEqual(summary(out, "Torn commits"), 0)
+
+    def test_directory_with_one_half_erased(self):
+        # a directory made after format has only ever written one half of
+        # its pair, the other is still erased and is not a torn commit
+        for block in (4, 5):
+            with tempfile.TemporaryDirectory() as tmp:
+                path, data = scratch_image(tmp)
+                erase_block(data, block)
+                write_image(path, data)
+
+                out = run("littlefs_verify", path, BLOCK_SIZE, BLOCK_COUNT).stdout
+                self.assertEqual(summary(out, "Bad CRCs"), 0, block)
+                self.assertEqual(summary(out, "Torn commits"), 0, block)
+
+    def test_bad_crc_in_both_root_halves(self):
+        # one flipped bit in each superblock leaves neither half with a
+        # valid commit, both must still be reported
+        with tempfile.TemporaryDirectory() as tmp:
+            path, data = scratch_image(tmp)
+            for block in (0, 1):
+                data[block * BLOCK_SIZE + 20] ^= 0x01
+            write_image(path, data)
+
+            out = run("littlefs_verify", path, BLOCK_SIZE, BLOCK_COUNT).stdout
+            self.assertEqual(summary(out, "Bad CRCs"), 2)
+            self.assertIn("block 0 +", out)
+            self.assertIn("block 1 +", out)
+            self.assertIn("bad CRC in first commit", out)
+
+if __name__ == "__main__":
+    unittest.main()
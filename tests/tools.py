@@ -0,0 +1,87 @@
+# Builds the C tools for the tests from the compile lines in the README,
+# so the tests always use the same sources and flags as a user would
+import os
+import shlex
+import struct
+import subprocess
+import tempfile
+import zlib
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BLOCK_SIZE = 4096
+BLOCK_COUNT = 16
+
+_build_dir = tempfile.TemporaryDirectory(prefix="littlefs_tests_")
+_built = {}
+
+def compile_line(tool):
+    with open(os.path.join(ROOT, "README.md"), encoding="utf-8") as f:
+        for line in f:
+            if line.startswith(f"gcc {tool}.c "):
+                return shlex.split(line.strip())
+    raise LookupError(f"no compile line for {tool} in README.md")
+
+def build(tool):
+    if tool not in _built:
+        args = compile_line(tool)
+        out = os.path.join(_build_dir.name, tool)
+        args[args.index("-o") + 1] = out
+        subprocess.run(args, cwd=ROOT, check=True)
+        _built[tool] = out
+    return _built[tool]
+
+# Tools that write next to where they run (recovered_blocks/) do so in
+# the scratch directory, never in the checkout
+def run(tool, *args, check=False, cwd=None):
+    return subprocess.run([build(tool)] + [str(a) for a in args],
+                          capture_output=True, text=True, check=check,
+                          cwd=cwd or _build_dir.name)
+
+# Copies a fixture image into a scratch directory so it can be damaged
+def scratch_image(tmp, name="test.img"):
+    with open(os.path.join(ROOT, name), "rb") as f:
+        data = bytearray(f.read())
+    path = os.path.join(tmp, name)
+    with open(path, "wb") as f:
+        f.write(data)
+    return path, data
+
+def write_image(path, data):
+    with open(path, "wb") as f:
+        f.write(data)
+
+def erase_block(data, block):
+    data[block * BLOCK_SIZE:(block + 1) * BLOCK_SIZE] = b"\xff" * BLOCK_SIZE
+
+def lfs_crc(crc, data):
+    return ~zlib.crc32(bytes(data), ~crc & 0xffffffff) & 0xffffffff
+
+# Renames an entry in place in a metadata block's log and fixes up the crc
+# of every commit it appears in, the new name is padded or cut to the
+# length of the old one
+def rename_entry(data, block, old, new):
+    base = block * BLOCK_SIZE
+    new = new.ljust(len(old), b"\0")[:len(old)]
+    off = 4
+    start = 0
+    ptag = 0xffffffff
+    renamed = False
+    while off + 4 <= BLOCK_SIZE:
+        tag = struct.unpack(">I", data[base + off:base + off + 4])[0] ^ ptag
+        if tag & 0x80000000:
+            break
+        size = tag & 0x3ff
+        dsize = 4 + (0 if size == 0x3ff else size)
+        ptag = tag
+        kind = (tag >> 20) & 0x7ff
+        if kind >> 8 == 0 and data[base + off + 4:base + off + dsize] == old:
+            data[base + off + 4:base + off + dsize] = new
+            renamed = True
+        if kind & 0x700 == 0x500 and kind != 0x5ff:
+            if renamed:
+                crc = lfs_crc(0xffffffff, data[base + start:base + off + 4])
+                data[base + off + 4:base + off + 8] = struct.pack("<I", crc)
+            ptag ^= (kind & 1) << 31
+            start = off + dsize
+        off += dsize
+    return renamed
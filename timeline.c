@@ -0,0 +1,474 @@
+/*
+ * Point-in-time views of a littlefs image
+ */
+#include "timeline.h"
+#include <stdlib.h>
+#include <string.h>
+
+// ids are 10 bits on disk, so a power of two above twice that never fills
+#define TIMELINE_HASH_SIZE 2048
+
+// Oldest first: the stale half's log, then the active half's
+typedef struct timeline_history {
+    lfs_block_t blocks[2];
+    uint32_t commits[2];
+    int count;
+    uint32_t total;
+} timeline_history_t;
+
+static bool timeline_history(const salvage_t *s, lfs_block_t block,
+        timeline_history_t *h) {
+    const salvage_block_t *b = &s->blocks[block];
+    if (b->state != SALVAGE_ACTIVE) {
+        return false;
+    }
+
+    h->count = 0;
+    h->total = 0;
+    if (b->partner < s->block_count &&
+            s->blocks[b->partner].state == SALVAGE_STALE) {
+        h->blocks[h->count] = b->partner;
+        h->commits[h->count] = s->blocks[b->partner].commits;
+        h->total += h->commits[h->count];
+        h->count++;
+    }
+    h->blocks[h->count] = block;
+    h->commits[h->count] = b->commits;
+    h->total += h->commits[h->count];
+    h->count++;
+    return true;
+}
+
+static bool timeline_selected(const salvage_t *s, lfs_block_t block,
+        lfs_block_t only) {
+    return only == LFS_BLOCK_NULL || block == only ||
+            s->blocks[block].partner == only;
+}
+
+static int timeline_add_cut(timeline_cuts_t *cuts, const timeline_cut_t *cut) {
+    if (cuts->count == cuts->capacity) {
+        size_t capacity = cuts->capacity ? 2*cuts->capacity : 16;
+        timeline_cut_t *ncuts = realloc(cuts->cuts,
+                capacity * sizeof(timeline_cut_t));
+        if (!ncuts) {
+            return LFS_ERR_NOMEM;
+        }
+        cuts->cuts = ncuts;
+        cuts->capacity = capacity;
+    }
+
+    cuts->cuts[cuts->count++] = *cut;
+    return 0;
+}
+
+// Offset just past the first `kept` commits, 0 erases the whole block
+static lfs_off_t timeline_commit_end(const uint8_t *block,
+        lfs_size_t block_size, uint32_t kept) {
+    if (kept == 0) {
+        return 0;
+    }
+
+    ondisk_cursor_t cur;
+    ondisk_commit_t commit;
+    ondisk_cursor_init(&cur, block, block_size);
+    while (cur.commits < kept && ondisk_next_commit(&cur, &commit)) {
+    }
+    return cur.off;
+}
+
+int timeline_rewind(uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, uint32_t rewind, lfs_block_t only,
+        timeline_cuts_t *cuts) {
+    memset(cuts, 0, sizeof(*cuts));
+    if (rewind == 0) {
+        return 0;
+    }
+
+    salvage_t s;
+    int err = salvage_scan(&s, image, block_size, block_count);
+    if (err) {
+        salvage_free(&s);
+        return err;
+    }
+
+    // work out every cut before touching the image, blanking one block
+    // must not change how its partner was classified
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        timeline_history_t h;
+        if (!timeline_selected(&s, i, only) || !timeline_history(&s, i, &h)) {
+            continue;
+        }
+
+        // peel commits off the newest end of the history, there's no clock
+        // shared between pairs, so the commit that created a pair is kept
+        // rather than leaving its parent pointing at nothing
+        uint32_t left = lfs_min(rewind, h.total - 1);
+        for (int j = h.count - 1; j >= 0 && left > 0; j--) {
+            uint32_t drop = lfs_min(left, h.commits[j]);
+            left -= drop;
+
+            timeline_cut_t cut = {
+                .block = h.blocks[j],
+                .commits = h.commits[j],
+                .kept = h.commits[j] - drop,
+            };
+            cut.off = timeline_commit_end(
+                    &image[(size_t)cut.block * block_size],
+                    block_size, cut.kept);
+
+            err = timeline_add_cut(cuts, &cut);
+            if (err) {
+                goto cleanup;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < cuts->count; i++) {
+        const timeline_cut_t *cut = &cuts->cuts[i];
+        memset(&image[(size_t)cut->block * block_size + cut->off], 0xFF,
+                block_size - cut->off);
+    }
+
+cleanup:
+    salvage_free(&s);
+    return err;
+}
+
+void timeline_cuts_free(timeline_cuts_t *cuts) {
+    free(cuts->cuts);
+    memset(cuts, 0, sizeof(*cuts));
+}
+
+void timeline_print_cuts(const timeline_cuts_t *cuts, uint32_t rewind,
+        FILE *out) {
+    fprintf(out, "Rewound %lu commits:\n", (unsigned long)rewind);
+    for (size_t i = 0; i < cuts->count; i++) {
+        const timeline_cut_t *cut = &cuts->cuts[i];
+        fprintf(out, "  block %lu: kept %lu of %lu commits, "
+                "erased from +0x%04lx\n",
+                (unsigned long)cut->block, (unsigned long)cut->kept,
+                (unsigned long)cut->commits, (unsigned long)cut->off);
+    }
+    fprintf(out, "  Blocks rewound: %lu\n", (unsigned long)cuts->count);
+}
+
+static bool timeline_listed(const ondisk_entry_t *e) {
+    return e->name && (e->type == LFS_TYPE_REG || e->type == LFS_TYPE_DIR);
+}
+
+static uint32_t timeline_hash(const uint8_t *name, lfs_size_t len) {
+    // FNV-1a
+    uint32_t h = 0x811c9dc5;
+    for (lfs_size_t i = 0; i < len; i++) {
+        h = (h ^ name[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static bool timeline_same_name(const ondisk_entry_t *a,
+        const ondisk_entry_t *b) {
+    return a->name_len == b->name_len &&
+            (a->name == b->name ||
+             memcmp(a->name, b->name, a->name_len) == 0);
+}
+
+static bool timeline_same_struct(const ondisk_entry_t *a,
+        const ondisk_entry_t *b) {
+    return a->type == b->type &&
+            a->struct_type == b->struct_type &&
+            a->struct_size == b->struct_size &&
+            (a->struct_data == b->struct_data ||
+             memcmp(a->struct_data, b->struct_data, a->struct_size) == 0);
+}
+
+typedef struct timeline_state {
+    salvage_t *s;
+    timeline_cb cb;
+    void *data;
+    const char *dir;
+
+    // entries as of the previous commit, name data still points into the image
+    ondisk_entry_t *prev;
+    uint32_t prev_count;
+    uint16_t hash[TIMELINE_HASH_SIZE];  // index+1 into prev, 0 is empty
+    bool *matched;
+} timeline_state_t;
+
+static int timeline_find(const timeline_state_t *t, const ondisk_entry_t *e) {
+    uint32_t i = timeline_hash(e->name, e->name_len) & (TIMELINE_HASH_SIZE-1);
+    while (t->hash[i]) {
+        const ondisk_entry_t *p = &t->prev[t->hash[i] - 1];
+        if (timeline_same_name(p, e)) {
+            return t->hash[i] - 1;
+        }
+        i = (i + 1) & (TIMELINE_HASH_SIZE-1);
+    }
+    return -1;
+}
+
+static void timeline_index(timeline_state_t *t) {
+    memset(t->hash, 0, sizeof(t->hash));
+    for (uint32_t j = 0; j < t->prev_count; j++) {
+        const ondisk_entry_t *p = &t->prev[j];
+        if (!timeline_listed(p)) {
+            continue;
+        }
+        uint32_t i = timeline_hash(p->name, p->name_len)
+                & (TIMELINE_HASH_SIZE-1);
+        while (t->hash[i]) {
+            i = (i + 1) & (TIMELINE_HASH_SIZE-1);
+        }
+        t->hash[i] = j + 1;
+    }
+}
+
+static void timeline_emit(timeline_state_t *t, timeline_event_t *event,
+        int kind, const ondisk_entry_t *entry, const ondisk_entry_t *before) {
+    event->kind = kind;
+    event->entry = entry;
+    event->before = before;
+    t->cb(t->data, event);
+}
+
+// Compares the entries after one commit with those before it
+static void timeline_diff(timeline_state_t *t, const ondisk_mdir_t *mdir,
+        timeline_event_t *event) {
+    memset(t->matched, 0, t->prev_count * sizeof(bool));
+
+    // entries missing from the old state are created, unless a deleted
+    // entry with the same struct shows up in this commit too
+    for (uint32_t i = 0; i < mdir->count; i++) {
+        const ondisk_entry_t *e = &mdir->entries[i];
+        if (!timeline_listed(e)) {
+            continue;
+        }
+
+        int j = timeline_find(t, e);
+        if (j >= 0) {
+            t->matched[j] = true;
+            if (!timeline_same_struct(&t->prev[j], e)) {
+                timeline_emit(t, event, TIMELINE_CHANGED, e, &t->prev[j]);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < mdir->count; i++) {
+        const ondisk_entry_t *e = &mdir->entries[i];
+        if (!timeline_listed(e) || timeline_find(t, e) >= 0) {
+            continue;
+        }
+
+        const ondisk_entry_t *before = NULL;
+        for (uint32_t j = 0; j < t->prev_count; j++) {
+            if (!t->matched[j] && timeline_listed(&t->prev[j]) &&
+                    e->struct_size > 0 &&
+                    timeline_same_struct(&t->prev[j], e)) {
+                t->matched[j] = true;
+                before = &t->prev[j];
+                break;
+            }
+        }
+
+        timeline_emit(t, event, before ? TIMELINE_RENAMED : TIMELINE_CREATED,
+                e, before);
+    }
+
+    for (uint32_t j = 0; j < t->prev_count; j++) {
+        if (!t->matched[j] && timeline_listed(&t->prev[j])) {
+            timeline_emit(t, event, TIMELINE_DELETED, NULL, &t->prev[j]);
+        }
+    }
+}
+
+static int timeline_snapshot(timeline_state_t *t, const ondisk_mdir_t *mdir) {
+    if (mdir->count > t->prev_count) {
+        ondisk_entry_t *prev = realloc(t->prev,
+                mdir->count * sizeof(ondisk_entry_t));
+        bool *matched = realloc(t->matched, mdir->count * sizeof(bool));
+        if (prev) {
+            t->prev = prev;
+        }
+        if (matched) {
+            t->matched = matched;
+        }
+        if (!prev || !matched) {
+            return LFS_ERR_NOMEM;
+        }
+    }
+
+    memcpy(t->prev, mdir->entries, mdir->count * sizeof(ondisk_entry_t));
+    t->prev_count = mdir->count;
+    timeline_index(t);
+    return 0;
+}
+
+static int timeline_replay_pair(timeline_state_t *t,
+        const timeline_history_t *h) {
+    salvage_t *s = t->s;
+    uint32_t index = 0;
+    int err = 0;
+
+    t->prev_count = 0;
+    timeline_index(t);
+
+    for (int k = 0; k < h->count && !err; k++) {
+        const uint8_t *block = &s->image[(size_t)h->blocks[k] * s->block_size];
+
+        // a compaction rewrites the whole state, start the new half from
+        // scratch but keep diffing against the old half's final state
+        ondisk_mdir_t mdir;
+        ondisk_mdir_init(&mdir);
+
+        ondisk_cursor_t cur;
+        ondisk_commit_t commit;
+        ondisk_cursor_init(&cur, block, s->block_size);
+        while (!err && ondisk_next_commit(&cur, &commit)) {
+            ondisk_tagiter_t it;
+            ondisk_tag_t tag;
+            ondisk_tagiter_init(&it, block, &commit);
+            while (!err && ondisk_tagiter_next(&it, &tag)) {
+                err = ondisk_mdir_apply(&mdir, &tag);
+            }
+            if (err) {
+                break;
+            }
+
+            timeline_event_t event = {
+                .block = h->blocks[k],
+                .commit = commit.index,
+                .rewind = h->total - index,
+                .dir = t->dir,
+            };
+            timeline_diff(t, &mdir, &event);
+            err = timeline_snapshot(t, &mdir);
+            index++;
+        }
+
+        ondisk_mdir_free(&mdir);
+    }
+
+    // a corrupt commit just ends this pair's history early
+    return (err == LFS_ERR_NOMEM) ? err : 0;
+}
+
+int timeline_replay(salvage_t *s, lfs_block_t only,
+        timeline_cb cb, void *data) {
+    timeline_state_t *t = calloc(1, sizeof(timeline_state_t));
+    char **dirs = salvage_dir_paths(s);
+    if (!t || !dirs) {
+        free(t);
+        salvage_free_paths(s, dirs);
+        return LFS_ERR_NOMEM;
+    }
+
+    t->s = s;
+    t->cb = cb;
+    t->data = data;
+
+    int err = 0;
+    for (lfs_block_t i = 0; i < s->block_count && !err; i++) {
+        timeline_history_t h;
+        if (!timeline_selected(s, i, only) || !timeline_history(s, i, &h)) {
+            continue;
+        }
+
+        t->dir = dirs[i];
+        err = timeline_replay_pair(t, &h);
+    }
+
+    free(t->prev);
+    free(t->matched);
+    free(t);
+    salvage_free_paths(s, dirs);
+    return err;
+}
+
+static void timeline_print_struct(const ondisk_entry_t *e, FILE *out) {
+    lfs_block_t pair[2];
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (ondisk_entry_ctz(e, &head, &size)) {
+        fprintf(out, " (CTZ head %lu, %lu bytes)",
+                (unsigned long)head, (unsigned long)size);
+    } else if (ondisk_entry_dirpair(e, pair)) {
+        fprintf(out, " (pair %lu, %lu)",
+                (unsigned long)pair[0], (unsigned long)pair[1]);
+    } else if (e->struct_type == LFS_TYPE_INLINESTRUCT) {
+        fprintf(out, " (inline, %lu bytes)", (unsigned long)e->struct_size);
+    }
+}
+
+static const char *const timeline_kinds[] = {
+    [TIMELINE_CREATED] = "created",
+    [TIMELINE_DELETED] = "deleted",
+    [TIMELINE_CHANGED] = "changed",
+    [TIMELINE_RENAMED] = "renamed",
+};
+
+void timeline_print_event(const timeline_event_t *event, FILE *out) {
+    const ondisk_entry_t *e = event->entry ? event->entry : event->before;
+    const char *dir = event->dir ? event->dir : "?";
+    const char *sep = (strcmp(dir, "/") == 0) ? "" : "/";
+
+    fprintf(out, "  [rewind %lu] block %lu commit %lu: %s %s %s%s%.*s",
+            (unsigned long)event->rewind, (unsigned long)event->block,
+            (unsigned long)event->commit, timeline_kinds[event->kind],
+            (e->type == LFS_TYPE_DIR) ? "DIR" : "FILE",
+            dir, sep, (int)e->name_len, (const char *)e->name);
+    if (event->kind == TIMELINE_RENAMED) {
+        fprintf(out, " (was %.*s)", (int)event->before->name_len,
+                (const char *)event->before->name);
+    }
+    if (event->kind == TIMELINE_CHANGED) {
+        timeline_print_struct(event->before, out);
+        fprintf(out, " ->");
+    }
+    timeline_print_struct(e, out);
+    fprintf(out, "\n");
+}
+
+static void timeline_json_struct(jsonl_t *j, const char *prefix,
+        const ondisk_entry_t *e) {
+    char key[32];
+    lfs_block_t pair[2];
+    lfs_block_t head;
+    lfs_size_t size;
+
+    if (ondisk_entry_ctz(e, &head, &size)) {
+        snprintf(key, sizeof(key), "%shead", prefix);
+        jsonl_uint(j, key, head);
+        snprintf(key, sizeof(key), "%ssize", prefix);
+        jsonl_uint(j, key, size);
+    } else if (ondisk_entry_dirpair(e, pair)) {
+        snprintf(key, sizeof(key), "%spair0", prefix);
+        jsonl_uint(j, key, pair[0]);
+        snprintf(key, sizeof(key), "%spair1", prefix);
+        jsonl_uint(j, key, pair[1]);
+    } else if (e->struct_type == LFS_TYPE_INLINESTRUCT) {
+        snprintf(key, sizeof(key), "%ssize", prefix);
+        jsonl_uint(j, key, e->struct_size);
+    }
+}
+
+void timeline_json_event(const timeline_event_t *event, jsonl_t *j) {
+    const ondisk_entry_t *e = event->entry ? event->entry : event->before;
+
+    jsonl_begin(j, "event");
+    jsonl_str(j, "kind", timeline_kinds[event->kind]);
+    jsonl_str(j, "type", (e->type == LFS_TYPE_DIR) ? "dir" : "file");
+    jsonl_str(j, "dir", event->dir);
+    jsonl_strn(j, "name", e->name, e->name_len);
+    jsonl_uint(j, "block", event->block);
+    jsonl_uint(j, "commit", event->commit);
+    jsonl_uint(j, "rewind", event->rewind);
+    timeline_json_struct(j, "", e);
+    if (event->kind == TIMELINE_RENAMED) {
+        jsonl_strn(j, "old_name", event->before->name,
+                event->before->name_len);
+    }
+    if (event->kind == TIMELINE_CHANGED) {
+        timeline_json_struct(j, "old_", event->before);
+    }
+    jsonl_end(j);
+}
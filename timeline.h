@@ -0,0 +1,76 @@
+/*
+ * Point-in-time views of a littlefs image
+ *
+ * Every metadata pair carries its own history: the stale half holds the
+ * log from before the last compaction and the active half the commits
+ * since. Rewinding blanks the newest commits of that history in the
+ * in-memory image, so lfs_mount and every later pass see the filesystem as
+ * it was. Replaying walks the same history forward one commit at a time,
+ * diffing only the entries each commit touched, to build a timeline of
+ * creations and deletions without remounting for every state.
+ */
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "lfs.h"
+#include "ondisk.h"
+#include "salvage.h"
+#include "jsonl.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct timeline_cut {
+    lfs_block_t block;
+    uint32_t commits;       // commits in the block's log
+    uint32_t kept;          // commits still visible after rewinding
+    lfs_off_t off;          // everything from here on now reads as erased
+} timeline_cut_t;
+
+typedef struct timeline_cuts {
+    timeline_cut_t *cuts;
+    size_t count;
+    size_t capacity;
+} timeline_cuts_t;
+
+enum timeline_kind {
+    TIMELINE_CREATED,
+    TIMELINE_DELETED,
+    TIMELINE_CHANGED,       // same name, different struct (size, blocks)
+    TIMELINE_RENAMED,       // same struct under a new name in one commit
+};
+
+typedef struct timeline_event {
+    int kind;
+    lfs_block_t block;              // block holding the commit
+    uint32_t commit;                // index of the commit in that block
+    uint32_t rewind;                // --rewind showing the state just before
+    const char *dir;                // owning directory, NULL if unknown
+    const ondisk_entry_t *entry;    // entry after the commit, NULL if deleted
+    const ondisk_entry_t *before;   // entry before the commit, NULL if created
+} timeline_event_t;
+
+typedef void (*timeline_cb)(void *data, const timeline_event_t *event);
+
+// Hides the newest `rewind` commits of every pair's history, or only of the
+// pair containing `only` unless it is LFS_BLOCK_NULL. A pair's first commit
+// is always kept. Returns 0 or a negative LFS_ERR code, cuts must be freed
+// with timeline_cuts_free.
+int timeline_rewind(uint8_t *image, lfs_size_t block_size,
+        lfs_size_t block_count, uint32_t rewind, lfs_block_t only,
+        timeline_cuts_t *cuts);
+void timeline_cuts_free(timeline_cuts_t *cuts);
+void timeline_print_cuts(const timeline_cuts_t *cuts, uint32_t rewind,
+        FILE *out);
+
+// Replays every pair's history oldest commit first, reporting each entry
+// a commit creates, deletes, renames or changes. `only` works as above.
+int timeline_replay(salvage_t *s, lfs_block_t only,
+        timeline_cb cb, void *data);
+
+// Writes one line describing an event
+void timeline_print_event(const timeline_event_t *event, FILE *out);
+// Writes an event as an "event" record
+void timeline_json_event(const timeline_event_t *event, jsonl_t *j);
+
+#endif
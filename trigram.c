@@ -0,0 +1,497 @@
+/*
+ * Block-level trigram index of an image
+ */
+#include "trigram.h"
+#include "lfs_util.h"
+#include "parallel.h"
+#include "sidecar.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define TRIGRAM_BUCKETS (1u << TRIGRAM_BITS)
+#define TRIGRAM_HEADER 64
+#define TRIGRAM_GRAIN 16
+#define TRIGRAM_BUCKET_GRAIN 4096
+// bucket lists of one segment of blocks are gathered at a time
+#define TRIGRAM_ARENA (16u << 20)
+// a query only intersects the rarest few of a literal's trigrams
+#define TRIGRAM_QUERY_MAX 8
+
+struct trigram_list {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+    lfs_block_t last;
+};
+
+struct trigram_job {
+    const uint8_t *image;
+    size_t image_size;
+    lfs_size_t block_size;
+    lfs_size_t limit;       // more distinct buckets than this is dense
+    lfs_block_t first;      // first block of the segment
+
+    uint32_t *buckets;      // limit per block of the segment
+    uint32_t *lens;         // per block of the segment, 0 if dense
+    uint8_t *dense;         // per block of the image
+    uint32_t *counts;       // per bucket
+    uint32_t *cursor;       // per bucket, next free posting
+    uint32_t *starts;       // per bucket, first posting
+    lfs_block_t *postings;
+    struct trigram_list *lists;
+    bool nomem;
+};
+
+static uint8_t trigram_fold(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static uint32_t trigram_bucket(const uint8_t *p) {
+    uint32_t t = ((uint32_t)trigram_fold(p[0]) << 16) |
+            ((uint32_t)trigram_fold(p[1]) << 8) | trigram_fold(p[2]);
+    return (t * 0x9e3779b1) >> (32 - TRIGRAM_BITS);
+}
+
+void trigram_sidecar_path(const char *image_path, char *out, size_t len) {
+    snprintf(out, len, "%s.lfsgram", image_path);
+}
+
+// Distinct buckets of the trigrams starting in each block, a trigram at
+// the end of a block runs on into the next one
+static void trigram_collect_range(void *data, size_t begin, size_t end) {
+    struct trigram_job *job = data;
+    uint64_t *seen = calloc(TRIGRAM_BUCKETS / 64, sizeof(uint64_t));
+    if (!seen) {
+        job->nomem = true;
+        return;
+    }
+
+    for (size_t i = begin; i < end; i++) {
+        lfs_block_t block = job->first + i;
+        uint32_t *buckets = &job->buckets[i * job->limit];
+        size_t start = (size_t)block * job->block_size;
+        size_t stop = start + job->block_size;
+        if (stop + 2 > job->image_size) {
+            stop = (job->image_size >= 2) ? job->image_size - 2 : 0;
+        }
+
+        uint32_t n = 0;
+        for (size_t off = start; off < stop; off++) {
+            uint32_t b = trigram_bucket(&job->image[off]);
+            uint64_t bit = (uint64_t)1 << (b % 64);
+            if (seen[b / 64] & bit) {
+                continue;
+            }
+            seen[b / 64] |= bit;
+            if (n == job->limit) {
+                n += 1;
+                break;
+            }
+            buckets[n++] = b;
+        }
+
+        if (n > job->limit) {
+            job->dense[block] = 1;
+            job->lens[i] = 0;
+            memset(seen, 0, TRIGRAM_BUCKETS / 8);
+            continue;
+        }
+
+        job->lens[i] = n;
+        for (uint32_t j = 0; j < n; j++) {
+            seen[buckets[j] / 64] = 0;
+            __atomic_fetch_add(&job->counts[buckets[j]], 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    free(seen);
+}
+
+static void trigram_post_range(void *data, size_t begin, size_t end) {
+    struct trigram_job *job = data;
+    for (size_t i = begin; i < end; i++) {
+        const uint32_t *buckets = &job->buckets[i * job->limit];
+        for (uint32_t j = 0; j < job->lens[i]; j++) {
+            uint32_t k = __atomic_fetch_add(&job->cursor[buckets[j]], 1,
+                    __ATOMIC_RELAXED);
+            job->postings[k] = job->first + i;
+        }
+    }
+}
+
+static int trigram_block_cmp(const void *a, const void *b) {
+    lfs_block_t ba = *(const lfs_block_t *)a;
+    lfs_block_t bb = *(const lfs_block_t *)b;
+    return (ba > bb) - (ba < bb);
+}
+
+// Sorts each bucket's postings of the segment and appends them to its list
+static void trigram_append_range(void *data, size_t begin, size_t end) {
+    struct trigram_job *job = data;
+    for (size_t k = begin; k < end; k++) {
+        uint32_t count = job->counts[k];
+        if (!count) {
+            continue;
+        }
+        job->counts[k] = 0;
+
+        // blocks are posted a range at a time, usually already in order
+        lfs_block_t *p = &job->postings[job->starts[k]];
+        for (uint32_t j = 1; j < count; j++) {
+            if (p[j] < p[j-1]) {
+                qsort(p, count, sizeof(lfs_block_t), trigram_block_cmp);
+                break;
+            }
+        }
+
+        struct trigram_list *l = &job->lists[k];
+        if (l->len + 5*count > l->capacity) {
+            size_t capacity = l->capacity ? 2*l->capacity : 64;
+            while (capacity < l->len + 5*count) {
+                capacity *= 2;
+            }
+            uint8_t *ndata = realloc(l->data, capacity);
+            if (!ndata) {
+                job->nomem = true;
+                return;
+            }
+            l->data = ndata;
+            l->capacity = capacity;
+        }
+
+        for (uint32_t j = 0; j < count; j++) {
+            uint32_t delta = p[j] - l->last;
+            l->last = p[j];
+            do {
+                l->data[l->len++] = (delta & 0x7f) | ((delta > 0x7f) ? 0x80 : 0);
+                delta >>= 7;
+            } while (delta);
+        }
+    }
+}
+
+static int trigram_write(const char *sidecar, const sidecar_stamp_t *stamp,
+        const struct trigram_job *job, lfs_size_t block_count) {
+    sidecar_file_t out;
+    if (sidecar_create(&out, sidecar) != 0) {
+        return LFS_ERR_IO;
+    }
+    FILE *f = out.f;
+
+    uint64_t dense_count = 0;
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        dense_count += job->dense[i];
+    }
+
+    uint8_t header[TRIGRAM_HEADER];
+    memcpy(&header[0], "LFSTRI1\0", 8);
+    sidecar_put32(&header[8], 1);
+    sidecar_put32(&header[12], job->block_size);
+    sidecar_put64(&header[16], block_count);
+    sidecar_put_stamp(&header[24], stamp);
+    sidecar_put32(&header[48], TRIGRAM_BITS);
+    sidecar_put32(&header[52], 0);
+    sidecar_put64(&header[56], dense_count);
+    fwrite(header, 1, sizeof(header), f);
+
+    uint8_t buf[8];
+    for (lfs_block_t i = 0; i < block_count; i++) {
+        if (job->dense[i]) {
+            sidecar_put32(buf, i);
+            fwrite(buf, 1, 4, f);
+        }
+    }
+
+    uint64_t off = 0;
+    for (uint32_t k = 0; k <= TRIGRAM_BUCKETS; k++) {
+        sidecar_put64(buf, off);
+        fwrite(buf, 1, 8, f);
+        if (k < TRIGRAM_BUCKETS) {
+            off += job->lists[k].len;
+        }
+    }
+    // most buckets are empty and have no list allocated
+    for (uint32_t k = 0; k < TRIGRAM_BUCKETS; k++) {
+        if (job->lists[k].len) {
+            fwrite(job->lists[k].data, 1, job->lists[k].len, f);
+        }
+    }
+
+    return sidecar_commit(&out);
+}
+
+int trigram_build(const char *sidecar, const char *image_path,
+        const uint8_t *image, lfs_size_t block_size, lfs_size_t block_count) {
+    sidecar_stamp_t stamp;
+    int err = sidecar_stamp(&stamp, image_path);
+    if (err) {
+        return err;
+    }
+
+    struct trigram_job job;
+    memset(&job, 0, sizeof(job));
+    job.image = image;
+    job.image_size = (size_t)block_size * block_count;
+    job.block_size = block_size;
+    // text rarely has more distinct trigrams than three quarters of its
+    // length, random data has nearly one per byte
+    job.limit = block_size / 4 * 3;
+    if (job.limit == 0) {
+        job.limit = 1;
+    }
+
+    lfs_size_t segment = TRIGRAM_ARENA / (job.limit * sizeof(uint32_t));
+    if (segment == 0) {
+        segment = 1;
+    }
+    if (segment > block_count) {
+        segment = block_count;
+    }
+
+    job.buckets = malloc((size_t)segment * job.limit * sizeof(uint32_t));
+    job.lens = malloc(segment * sizeof(uint32_t));
+    job.dense = calloc(block_count, 1);
+    job.counts = calloc(TRIGRAM_BUCKETS, sizeof(uint32_t));
+    job.cursor = malloc(TRIGRAM_BUCKETS * sizeof(uint32_t));
+    job.starts = malloc(TRIGRAM_BUCKETS * sizeof(uint32_t));
+    job.postings = malloc((size_t)segment * job.limit * sizeof(lfs_block_t));
+    job.lists = calloc(TRIGRAM_BUCKETS, sizeof(struct trigram_list));
+    if (!job.buckets || !job.lens || !job.dense || !job.counts ||
+            !job.cursor || !job.starts || !job.postings || !job.lists) {
+        err = LFS_ERR_NOMEM;
+        goto cleanup;
+    }
+
+    for (lfs_block_t first = 0; first < block_count; first += segment) {
+        lfs_size_t n = block_count - first;
+        if (n > segment) {
+            n = segment;
+        }
+        job.first = first;
+        parallel_for(n, TRIGRAM_GRAIN, trigram_collect_range, &job);
+
+        uint32_t total = 0;
+        for (uint32_t k = 0; k < TRIGRAM_BUCKETS; k++) {
+            job.starts[k] = total;
+            job.cursor[k] = total;
+            total += job.counts[k];
+        }
+        parallel_for(n, TRIGRAM_GRAIN, trigram_post_range, &job);
+        parallel_for(TRIGRAM_BUCKETS, TRIGRAM_BUCKET_GRAIN,
+                trigram_append_range, &job);
+        if (job.nomem) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+    }
+
+    err = trigram_write(sidecar, &stamp, &job, block_count);
+
+cleanup:
+    if (job.lists) {
+        for (uint32_t k = 0; k < TRIGRAM_BUCKETS; k++) {
+            free(job.lists[k].data);
+        }
+    }
+    free(job.lists);
+    free(job.postings);
+    free(job.starts);
+    free(job.cursor);
+    free(job.counts);
+    free(job.dense);
+    free(job.lens);
+    free(job.buckets);
+    return err;
+}
+
+int trigram_open(trigram_t *t, const char *sidecar, const char *image_path,
+        lfs_size_t block_size, lfs_size_t block_count) {
+    memset(t, 0, sizeof(*t));
+
+    sidecar_stamp_t now;
+    int err = sidecar_stamp(&now, image_path);
+    if (err) {
+        return err;
+    }
+
+    FILE *f = fopen(sidecar, "rb");
+    if (!f) {
+        return LFS_ERR_NOENT;
+    }
+
+    uint8_t header[TRIGRAM_HEADER];
+    sidecar_stamp_t made;
+    bool read = (fread(header, 1, sizeof(header), f) == sizeof(header));
+    sidecar_get_stamp(&header[24], &made);
+    if (!read || memcmp(header, "LFSTRI1\0", 8) != 0 ||
+            sidecar_get32(&header[8]) != 1 ||
+            sidecar_get32(&header[12]) != block_size ||
+            sidecar_get64(&header[16]) != block_count ||
+            !sidecar_stamp_equal(&made, &now) ||
+            sidecar_get32(&header[48]) != TRIGRAM_BITS ||
+            sidecar_get64(&header[56]) > block_count) {
+        fclose(f);
+        return LFS_ERR_NOENT;
+    }
+
+    t->f = f;
+    t->block_size = block_size;
+    t->block_count = block_count;
+    t->dense_count = sidecar_get64(&header[56]);
+    t->dense = malloc((t->dense_count + 1) * sizeof(lfs_block_t));
+    if (!t->dense) {
+        trigram_close(t);
+        return LFS_ERR_NOMEM;
+    }
+
+    uint8_t buf[4];
+    for (size_t i = 0; i < t->dense_count; i++) {
+        if (fread(buf, 1, 4, f) != 4 ||
+                (t->dense[i] = sidecar_get32(buf)) >= block_count) {
+            trigram_close(t);
+            return LFS_ERR_NOENT;
+        }
+    }
+
+    t->table_off = TRIGRAM_HEADER + 4*(uint64_t)t->dense_count;
+    t->lists_off = t->table_off + 8*((uint64_t)TRIGRAM_BUCKETS + 1);
+    return 0;
+}
+
+void trigram_close(trigram_t *t) {
+    if (t->f) {
+        fclose(t->f);
+    }
+    free(t->dense);
+    memset(t, 0, sizeof(*t));
+}
+
+struct trigram_query {
+    uint32_t bucket;
+    uint64_t start;
+    uint64_t len;
+};
+
+static int trigram_query_cmp(const void *a, const void *b) {
+    const struct trigram_query *qa = a;
+    const struct trigram_query *qb = b;
+    if (qa->len != qb->len) {
+        return (qa->len > qb->len) - (qa->len < qb->len);
+    }
+    return (qa->bucket > qb->bucket) - (qa->bucket < qb->bucket);
+}
+
+static void trigram_mark(uint8_t *has, lfs_block_t block) {
+    // a match starting in the block before may run on into this one
+    has[block] = 1;
+    if (block > 0) {
+        has[block-1] = 1;
+    }
+}
+
+int trigram_narrow(const trigram_t *t, const uint8_t *bytes, size_t len,
+        uint8_t *candidates) {
+    if (len < 3) {
+        return LFS_ERR_INVAL;
+    }
+    // any match of a longer literal starts with this much, and that fits
+    // in the block it starts in and the next
+    if (len > t->block_size) {
+        len = t->block_size;
+    }
+
+    size_t n = len - 2;
+    struct trigram_query *q = malloc(n * sizeof(struct trigram_query));
+    uint8_t *want = malloc(t->block_count);
+    uint8_t *has = malloc(t->block_count);
+    uint8_t *list = NULL;
+    int err = 0;
+    if (!q || !want || !has) {
+        err = LFS_ERR_NOMEM;
+        goto cleanup;
+    }
+
+    // fetch where each distinct trigram's list is, the rarest narrow the
+    // most
+    for (size_t i = 0; i < n; i++) {
+        q[i].bucket = trigram_bucket(&bytes[i]);
+    }
+    qsort(q, n, sizeof(struct trigram_query), trigram_query_cmp);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (unique && q[unique-1].bucket == q[i].bucket) {
+            continue;
+        }
+        uint8_t buf[16];
+        if (fseek(t->f, t->table_off + 8*(uint64_t)q[i].bucket, SEEK_SET) != 0 ||
+                fread(buf, 1, 16, t->f) != 16) {
+            err = LFS_ERR_IO;
+            goto cleanup;
+        }
+        q[unique].bucket = q[i].bucket;
+        q[unique].start = sidecar_get64(&buf[0]);
+        q[unique].len = sidecar_get64(&buf[8]) - q[unique].start;
+        unique += 1;
+    }
+    qsort(q, unique, sizeof(struct trigram_query), trigram_query_cmp);
+    if (unique > TRIGRAM_QUERY_MAX) {
+        unique = TRIGRAM_QUERY_MAX;
+    }
+
+    memset(want, 1, t->block_count);
+    for (size_t i = 0; i < unique; i++) {
+        memset(has, 0, t->block_count);
+        for (size_t d = 0; d < t->dense_count; d++) {
+            trigram_mark(has, t->dense[d]);
+        }
+
+        if (q[i].len) {
+            uint8_t *nlist = realloc(list, q[i].len);
+            if (!nlist) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+            list = nlist;
+            if (fseek(t->f, t->lists_off + q[i].start, SEEK_SET) != 0 ||
+                    fread(list, 1, q[i].len, t->f) != q[i].len) {
+                err = LFS_ERR_IO;
+                goto cleanup;
+            }
+        }
+
+        lfs_block_t block = 0;
+        uint32_t delta = 0;
+        int shift = 0;
+        for (uint64_t j = 0; j < q[i].len; j++) {
+            delta |= (uint32_t)(list[j] & 0x7f) << shift;
+            shift += 7;
+            if (list[j] & 0x80) {
+                continue;
+            }
+            block += delta;
+            delta = 0;
+            shift = 0;
+            if (block >= t->block_count) {
+                err = LFS_ERR_CORRUPT;
+                goto cleanup;
+            }
+            trigram_mark(has, block);
+        }
+
+        for (lfs_block_t b = 0; b < t->block_count; b++) {
+            want[b] &= has[b];
+        }
+    }
+
+    for (lfs_block_t b = 0; b < t->block_count; b++) {
+        candidates[b] |= want[b];
+    }
+
+cleanup:
+    free(list);
+    free(has);
+    free(want);
+    free(q);
+    return err;
+}
@@ -0,0 +1,70 @@
+/*
+ * Block-level trigram index of an image
+ *
+ * Every 3-byte sequence of the image, ASCII case folded, is hashed into
+ * one of 2^18 buckets, and each bucket lists the blocks a sequence
+ * starting in them hashes to. A literal can only occur where all of its
+ * trigrams do, so a search reads a handful of short lists instead of
+ * the image and only scans the blocks left over. Blocks with too many
+ * distinct trigrams to be worth listing (compressed or encrypted data)
+ * are kept apart as dense and always scanned.
+ *
+ * The index lives in a sidecar next to the image, all integers
+ * little-endian:
+ *
+ *   8 bytes  magic "LFSTRI1\0"
+ *   4 bytes  format version, currently 1
+ *   4 bytes  block size
+ *   8 bytes  block count
+ *   8 bytes  image file size
+ *   8 bytes  image mtime, seconds
+ *   8 bytes  image mtime, nanoseconds
+ *   4 bytes  bucket bits
+ *   4 bytes  reserved, 0
+ *   8 bytes  number of dense blocks
+ *   4 bytes  per dense block, ascending
+ *   8 bytes  per bucket and one more, offset of its list from the first
+ *   lists    per bucket, ascending blocks as LEB128 deltas from the last
+ *
+ * A sidecar is only reused while the image's size and mtime match.
+ */
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include "lfs.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRIGRAM_BITS 18
+
+typedef struct trigram {
+    FILE *f;
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+    lfs_block_t *dense;
+    size_t dense_count;
+    uint64_t table_off;     // file offset of the bucket table
+    uint64_t lists_off;     // file offset of the first list
+} trigram_t;
+
+// Sidecar path for an image, the image path with ".lfsgram" appended
+void trigram_sidecar_path(const char *image_path, char *out, size_t len);
+
+// Indexes every block of image in parallel and writes the sidecar
+int trigram_build(const char *sidecar, const char *image_path,
+        const uint8_t *image, lfs_size_t block_size, lfs_size_t block_count);
+
+// Returns LFS_ERR_NOENT if there is no sidecar or it is stale
+int trigram_open(trigram_t *t, const char *sidecar, const char *image_path,
+        lfs_size_t block_size, lfs_size_t block_count);
+void trigram_close(trigram_t *t);
+
+// Sets candidates[b] for every block a match of the literal may start in,
+// including matches that run on into the next block. Returns
+// LFS_ERR_INVAL for a literal shorter than a trigram, every block is a
+// candidate then.
+int trigram_narrow(const trigram_t *t, const uint8_t *bytes, size_t len,
+        uint8_t *candidates);
+
+#endif